@@ -0,0 +1,604 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+#include "vk_renderer.h"
+
+/*
+  hikari_bench
+
+  Reproducible startup, frame-throughput, mesh and texture streaming suites. Runs headless by default so it works
+  on CI machines with only a software Vulkan driver (e.g. lavapipe).
+  Every result is one JSON object per line (JSON Lines) so runs can be diffed and
+  tracked over time.
+
+    hikari_bench [--suite=all|startup|throughput|mesh|textures] [--frames=N] [--warmup=N]
+                 [--output=path] [--windowed] [--mesh-segments=N] [--textures=N] [--texture-size=N]
+*/
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions
+{
+  std::string suite       = "all";
+  uint32_t    frames      = 300;
+  uint32_t    warmup      = 30;
+  uint32_t    width       = kWidth;
+  uint32_t    height      = kHeight;
+  bool        windowed    = false;
+  std::string output;
+  std::string cache_path  = "hikari_bench_pipeline_cache.bin";
+  // Test scene size for the mesh suite: about 56 * segments^2 bytes (512 = ~15 MB).
+  // Pass --mesh-segments=4096 (~0.9 GB) for a streaming run that does not fit in caches.
+  uint32_t    mesh_segments = 512;
+  std::string mesh_path     = "hikari_bench_scene.hkm";
+  // Texture suite: BC1 textures with full mip chains, budgeted at a quarter of their total size.
+  uint32_t    texture_count = 32;
+  uint32_t    texture_size  = 1024;
+};
+
+double Milliseconds(Clock::time_point begin, Clock::time_point end)
+{
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+// Ask the kernel to drop `path` from the page cache, so the next read comes from disk. Best effort.
+void EvictFromPageCache(const std::string& path)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd >= 0)
+  {
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+  }
+}
+
+// Resident set size of this process in bytes (Linux).
+uint64_t ResidentBytes()
+{
+  std::ifstream statm("/proc/self/statm");
+  uint64_t      pages_total = 0;
+  uint64_t      pages_resident = 0;
+  statm >> pages_total >> pages_resident;
+  return pages_resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+std::string Escape(const std::string& s)
+{
+  std::string out;
+  for(const auto c : s)
+  {
+    if(c == '"' || c == '\\')
+    {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out;
+}
+
+// Builds one flat JSON object.
+class JsonLine
+{
+public:
+  JsonLine& Add(const std::string& key, const std::string& value)
+  {
+    Separator();
+    ss_ << "\"" << key << "\":\"" << Escape(value) << "\"";
+    return *this;
+  }
+  // Without this, string literals would pick the bool overload.
+  JsonLine& Add(const std::string& key, const char* value) { return Add(key, std::string(value)); }
+  JsonLine& Add(const std::string& key, double value)
+  {
+    Separator();
+    ss_ << "\"" << key << "\":" << value;
+    return *this;
+  }
+  JsonLine& Add(const std::string& key, uint64_t value)
+  {
+    Separator();
+    ss_ << "\"" << key << "\":" << value;
+    return *this;
+  }
+  JsonLine& Add(const std::string& key, uint32_t value) { return Add(key, static_cast<uint64_t>(value)); }
+  JsonLine& Add(const std::string& key, bool value)
+  {
+    Separator();
+    ss_ << "\"" << key << "\":" << (value ? "true" : "false");
+    return *this;
+  }
+
+  std::string str() const { return "{" + ss_.str() + "}"; }
+
+private:
+  void Separator()
+  {
+    if(!first_)
+    {
+      ss_ << ",";
+    }
+    first_ = false;
+  }
+
+  std::stringstream ss_;
+  bool              first_ = true;
+};
+
+class Bench
+{
+public:
+  explicit Bench(const BenchOptions& options) : options_(options)
+  {
+    if(!options_.output.empty())
+    {
+      file_.open(options_.output);
+    }
+  }
+
+  RendererConfig BaseConfig() const
+  {
+    RendererConfig config;
+    config.headless            = !options_.windowed;
+    config.width               = options_.width;
+    config.height              = options_.height;
+    config.pipeline_cache_path = options_.cache_path;
+    config.log_startup         = false; // the startup suite reports the same timings as JSON
+    return config;
+  }
+
+  /*
+    Startup suite
+    Cold: no pipeline cache on disk. Warm: the cache written by the cold run.
+  */
+  void Startup()
+  {
+    std::remove(options_.cache_path.c_str());
+    for(const auto warm : {false, true})
+    {
+      const auto config = BaseConfig();
+      const auto start  = Clock::now();
+      {
+        VkRenderer renderer(config, window_);
+        const auto constructed = Clock::now();
+        renderer.WaitForPipelines();
+        const auto ready = Clock::now();
+
+        const auto& t       = renderer.GetStartupTimings();
+        const auto  shaders = renderer.GetShaderStats();
+        Emit(JsonLine()
+               .Add("suite", "startup")
+               .Add("device", renderer.DeviceName())
+               .Add("pipeline_cache", warm ? "warm" : "cold")
+               .Add("instance_ms", t.instance_ms)
+               .Add("device_ms", t.device_ms)
+               .Add("frame_resources_ms", t.frame_resources_ms)
+               .Add("swapchain_ms", t.swapchain_ms)
+               .Add("render_targets_ms", t.render_targets_ms)
+               .Add("constructor_ms", Milliseconds(start, constructed))
+               .Add("pipelines_ms", Milliseconds(constructed, ready))
+               .Add("shader_modules", shaders.modules_created)
+               .Add("shader_requests", shaders.requests)
+               .Add("shader_load_ms", shaders.load_seconds * 1000.0)
+               .Add("time_to_first_frame_ready_ms", Milliseconds(start, ready)));
+      }
+      // The renderer saves the pipeline cache on destruction, so the next iteration starts warm.
+    }
+  }
+
+  /*
+    Throughput suite
+    Scenes of increasing draw count crossed with frames-in-flight settings, CPU-recorded
+    (with and without recording reuse) vs GPU-driven draws and, with --windowed, present modes.
+    GPU-driven draws also run with an occluder in front of the grid, so visible_objects shows
+    what occlusion culling removes.
+  */
+  void Throughput()
+  {
+    const std::vector<uint32_t> scenes           = {1, 1000, 10000, 100000};
+    const std::vector<uint32_t> frames_in_flight = {1, 2, 3};
+    std::vector<vk::PresentModeKHR> present_modes = {vk::PresentModeKHR::eFifo};
+    if(options_.windowed)
+    {
+      present_modes = {vk::PresentModeKHR::eFifo,
+                       vk::PresentModeKHR::eFifoRelaxed,
+                       vk::PresentModeKHR::eMailbox,
+                       vk::PresentModeKHR::eImmediate};
+    }
+    for(const auto object_count : scenes)
+    {
+      for(const auto fif : frames_in_flight)
+      {
+        for(const auto gpu_driven : {false, true})
+        {
+          // Recording reuse only applies to CPU-recorded draws; without it every frame re-records.
+          for(const auto reuse : {true, false})
+          {
+            if(gpu_driven && !reuse)
+            {
+              continue;
+            }
+            for(const auto occluder : {false, true})
+            {
+              if(occluder && !gpu_driven)
+              {
+                continue;
+              }
+              for(const auto present_mode : present_modes)
+              {
+                auto config                  = BaseConfig();
+                config.object_count          = object_count;
+                config.frames_in_flight      = fif;
+                config.gpu_driven            = gpu_driven;
+                config.reuse_command_buffers = reuse;
+                config.occluder              = occluder;
+                config.present_mode          = present_mode;
+                RunThroughput(config);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  /*
+    Mesh suite
+    Streams a generated scene while rendering, against a plain read() of the same file.
+    The read is the ceiling: parsing-free loading should get close to it.
+    Runs through the graphics queue and through the dedicated transfer queue (when the
+    device has one); frame times during the load show how much streaming disturbs rendering.
+  */
+  void Mesh()
+  {
+    const auto write_start = Clock::now();
+    if(!WriteTestScene(options_.mesh_path, options_.mesh_segments, 64))
+    {
+      return;
+    }
+    const auto write_ms = Milliseconds(write_start, Clock::now());
+
+    // Baseline: sequential read() in the streamer's chunk size.
+    EvictFromPageCache(options_.mesh_path);
+    uint64_t read_bytes = 0;
+    const auto read_start = Clock::now();
+    {
+      std::ifstream     ifs(options_.mesh_path, std::ios::binary);
+      std::vector<char> chunk(8 << 20);
+      while(ifs.read(chunk.data(), chunk.size()) || ifs.gcount() > 0)
+      {
+        read_bytes += static_cast<uint64_t>(ifs.gcount());
+      }
+    }
+    const auto read_seconds = Milliseconds(read_start, Clock::now()) / 1000.0;
+
+    for(const auto dedicated_transfer : {false, true})
+    {
+      EvictFromPageCache(options_.mesh_path);
+      auto config               = BaseConfig();
+      config.mesh_path          = options_.mesh_path;
+      config.dedicated_transfer = dedicated_transfer;
+      VkRenderer renderer(config, window_);
+      if(dedicated_transfer && !renderer.DedicatedTransfer())
+      {
+        break; // same as the first run
+      }
+      renderer.WaitForPipelines();
+
+      // Frames keep coming while the scene streams in: the load must not stall rendering.
+      const auto& scene  = *renderer.GetStreamedScene();
+      uint32_t    frames = 0;
+      while(!scene.ready && !scene.failed)
+      {
+        Frame(renderer, config);
+        ++frames;
+      }
+      Drain(renderer, config);
+
+      const auto& profiler = renderer.GetProfiler();
+      const auto  bytes    = static_cast<double>(scene.total_bytes);
+      Emit(JsonLine()
+             .Add("suite", "mesh")
+             .Add("device", renderer.DeviceName())
+             .Add("dedicated_transfer", renderer.DedicatedTransfer())
+             .Add("file_bytes", read_bytes)
+             .Add("upload_bytes", static_cast<uint64_t>(scene.total_bytes))
+             .Add("write_ms", write_ms)
+             .Add("read_ms", read_seconds * 1000.0)
+             .Add("read_gb_per_s", read_bytes / read_seconds / 1.0e9)
+             .Add("failed", static_cast<bool>(scene.failed))
+             .Add("load_ms", scene.seconds * 1000.0)
+             .Add("load_gb_per_s", bytes / scene.seconds / 1.0e9)
+             .Add("frames_during_load", frames)
+             .Add("frame_ms_p50", profiler.Percentile("cpu:frame", 0.50))
+             .Add("frame_ms_p99", profiler.Percentile("cpu:frame", 0.99))
+             .Add("gpu_frame_ms_p99", profiler.Percentile("gpu:frame", 0.99))
+             .Add("resident_bytes", ResidentBytes()));
+    }
+    std::remove(options_.mesh_path.c_str());
+  }
+
+  /*
+    Texture suite
+    A window of a quarter of the textures is touched at a time and slides along, so mips
+    stream in for the textures entering it while the budget (a quarter of all the mips)
+    forces the ones that left it to give their levels back. Frame times show what the
+    uploads and image rebuilds cost; resident bytes must stay near the budget.
+  */
+  void Textures()
+  {
+    std::vector<std::string> paths;
+    for(uint32_t i = 0; i < options_.texture_count; ++i)
+    {
+      paths.push_back("hikari_bench_texture_" + std::to_string(i) + ".hkt");
+      if(!WriteTestTexture(paths.back(), options_.texture_size))
+      {
+        return;
+      }
+    }
+    uint64_t texture_bytes = 0;
+    for(uint32_t w = options_.texture_size; w >= 1; w /= 2)
+    {
+      texture_bytes += TextureMipBytes(kTextureFormatBc1, w, w) * options_.texture_count;
+    }
+
+    auto config                 = BaseConfig();
+    config.texture_budget_bytes = texture_bytes / 4;
+    VkRenderer renderer(config, window_);
+    renderer.WaitForPipelines();
+
+    std::vector<TextureHandle> textures;
+    for(const auto& path : paths)
+    {
+      textures.push_back(renderer.LoadTexture(path));
+    }
+
+    const auto window = std::max<uint32_t>(options_.texture_count / 4, 1);
+    uint64_t   peak   = 0;
+    for(uint32_t i = 0; i < options_.warmup + options_.frames; ++i)
+    {
+      // One texture enters and one leaves the window every 8 frames.
+      const auto first = i / 8;
+      for(uint32_t t = 0; t < window; ++t)
+      {
+        renderer.TouchTexture(textures[(first + t) % textures.size()]);
+      }
+      Frame(renderer, config);
+      peak = std::max<uint64_t>(peak, renderer.GetTextureStats().resident_bytes);
+    }
+    Drain(renderer, config);
+
+    const auto& profiler = renderer.GetProfiler();
+    const auto  stats    = renderer.GetTextureStats();
+    Emit(JsonLine()
+           .Add("suite", "textures")
+           .Add("device", renderer.DeviceName())
+           .Add("textures", stats.textures)
+           .Add("failed", stats.failed)
+           .Add("texture_size", options_.texture_size)
+           .Add("texture_bytes", texture_bytes)
+           .Add("budget_bytes", static_cast<uint64_t>(stats.budget_bytes))
+           .Add("resident_bytes", static_cast<uint64_t>(stats.resident_bytes))
+           .Add("peak_resident_bytes", peak)
+           .Add("mips_streamed", stats.mips_streamed)
+           .Add("mips_evicted", stats.mips_evicted)
+           .Add("bytes_streamed", stats.bytes_streamed)
+           .Add("rebuilds", stats.rebuilds)
+           .Add("frames", options_.warmup + options_.frames)
+           .Add("frame_ms_p50", profiler.Percentile("cpu:frame", 0.50))
+           .Add("frame_ms_p99", profiler.Percentile("cpu:frame", 0.99))
+           .Add("gpu_textures_ms_p99", profiler.Percentile("gpu:textures", 0.99)));
+
+    for(const auto& path : paths)
+    {
+      std::remove(path.c_str());
+    }
+  }
+
+  void SetWindow(GLFWwindow* window) { window_ = window; }
+
+private:
+  void RunThroughput(const RendererConfig& config)
+  {
+    VkRenderer renderer(config, window_);
+    renderer.WaitForPipelines();
+
+    uint64_t read_back = 0;
+    renderer.SetReadbackCallback([&read_back](uint64_t, const void*, size_t) { ++read_back; });
+
+    for(uint32_t i = 0; i < options_.warmup; ++i)
+    {
+      Frame(renderer, config);
+    }
+    Drain(renderer, config);
+    renderer.ResetMeasurements();
+
+    const auto start = Clock::now();
+    for(uint32_t i = 0; i < options_.frames; ++i)
+    {
+      Frame(renderer, config);
+    }
+    Drain(renderer, config);
+    const auto seconds = Milliseconds(start, Clock::now()) / 1000.0;
+
+    const auto& profiler   = renderer.GetProfiler();
+    const auto& pipelining = renderer.GetPipeliningStats();
+    const auto  memory     = renderer.GetMemoryStats();
+    const auto  culling    = renderer.GetGpuDrivenStats();
+    const auto& reuse      = renderer.GetCommandReuseStats();
+    const auto  uniforms   = renderer.GetUniformStats();
+    Emit(JsonLine()
+           .Add("suite", "throughput")
+           .Add("device", renderer.DeviceName())
+           .Add("headless", config.headless)
+           .Add("width", config.width)
+           .Add("height", config.height)
+           .Add("objects", config.object_count)
+           .Add("occluder", config.occluder)
+           .Add("frames_in_flight", config.frames_in_flight)
+           // False when requested but unsupported by the device.
+           .Add("gpu_driven", renderer.GpuDriven())
+           .Add("async_compute", renderer.AsyncCompute())
+           .Add("visible_objects", culling.visible)
+           // Reports the mode in use after fallback, so unsupported modes show up as fifo.
+           .Add("present_mode", config.headless ? "none" : PresentModeName(renderer.GetPresentMode()))
+           .Add("frames", options_.frames)
+           .Add("fps", options_.frames / seconds)
+           .Add("frame_ms_p50", profiler.Percentile("cpu:frame", 0.50))
+           .Add("frame_ms_p95", profiler.Percentile("cpu:frame", 0.95))
+           .Add("frame_ms_p99", profiler.Percentile("cpu:frame", 0.99))
+           .Add("record_ms_p50", profiler.Percentile("cpu:record", 0.50))
+           .Add("command_reuse", config.reuse_command_buffers)
+           .Add("command_reuse_hits", reuse.hits)
+           .Add("command_reuse_misses", reuse.misses)
+           .Add("uniform_peak_bytes", uniforms.peak_bytes)
+           .Add("uniform_overflows", uniforms.overflows)
+           .Add("gpu_frame_ms_p50", profiler.Percentile("gpu:frame", 0.50))
+           .Add("gpu_frame_ms_p99", profiler.Percentile("gpu:frame", 0.99))
+           .Add("gpu_cull_ms_p50", profiler.Percentile("gpu:cull", 0.50))
+           .Add("cpu_gpu_overlap", pipelining.Overlap())
+           .Add("device_memory_reserved_bytes", static_cast<uint64_t>(memory.bytes_reserved))
+           .Add("device_memory_used_bytes", static_cast<uint64_t>(memory.bytes_used))
+           .Add("device_allocations", memory.allocation_count)
+           .Add("device_memory_blocks", memory.block_count)
+           .Add("resident_bytes", ResidentBytes()));
+  }
+
+  void Frame(VkRenderer& renderer, const RendererConfig& config)
+  {
+    renderer.Render();
+    if(config.headless)
+    {
+      renderer.PollReadbacks();
+    }
+    else
+    {
+      glfwPollEvents();
+    }
+  }
+
+  void Drain(VkRenderer& renderer, const RendererConfig& config)
+  {
+    if(config.headless)
+    {
+      renderer.PollReadbacks(true);
+    }
+  }
+
+  void Emit(const JsonLine& line)
+  {
+    std::cout << line.str() << std::endl;
+    if(file_)
+    {
+      file_ << line.str() << std::endl;
+    }
+  }
+
+  BenchOptions  options_;
+  GLFWwindow*   window_ = nullptr;
+  std::ofstream file_;
+};
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (arg.rfind("--suite=", 0) == 0)
+    {
+      options.suite = arg.substr(8);
+    }
+    else if (arg.rfind("--frames=", 0) == 0)
+    {
+      options.frames = static_cast<uint32_t>(std::stoul(arg.substr(9)));
+    }
+    else if (arg.rfind("--warmup=", 0) == 0)
+    {
+      options.warmup = static_cast<uint32_t>(std::stoul(arg.substr(9)));
+    }
+    else if (arg.rfind("--output=", 0) == 0)
+    {
+      options.output = arg.substr(9);
+    }
+    else if (arg.rfind("--mesh-segments=", 0) == 0)
+    {
+      options.mesh_segments = static_cast<uint32_t>(std::stoul(arg.substr(16)));
+    }
+    else if (arg.rfind("--textures=", 0) == 0)
+    {
+      options.texture_count = static_cast<uint32_t>(std::stoul(arg.substr(11)));
+    }
+    else if (arg.rfind("--texture-size=", 0) == 0)
+    {
+      options.texture_size = static_cast<uint32_t>(std::stoul(arg.substr(15)));
+    }
+    else if (arg == "--windowed")
+    {
+      options.windowed = true;
+    }
+    else
+    {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return -1;
+    }
+  }
+
+  Bench bench(options);
+
+  GLFWwindow* window = nullptr;
+  if (options.windowed)
+  {
+    if (!glfwInit() || !glfwVulkanSupported())
+    {
+      std::cerr << "Failed to initialize GLFW3 with Vulkan support." << std::endl;
+      return -1;
+    }
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_RESIZABLE, 0);
+    window = glfwCreateWindow(options.width, options.height, "hikari_bench", nullptr, nullptr);
+    bench.SetWindow(window);
+  }
+
+  static vk::DynamicLoader dl;
+  auto vkGetInstanceProcAddr = dl.getProcAddress<PFN_vkGetInstanceProcAddr>("vkGetInstanceProcAddr");
+  VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
+
+  if (options.suite == "all" || options.suite == "startup")
+  {
+    bench.Startup();
+  }
+  if (options.suite == "all" || options.suite == "throughput")
+  {
+    bench.Throughput();
+  }
+  if (options.suite == "all" || options.suite == "mesh")
+  {
+    bench.Mesh();
+  }
+  if (options.suite == "all" || options.suite == "textures")
+  {
+    bench.Textures();
+  }
+
+  if (window)
+  {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+  }
+  return 0;
+}
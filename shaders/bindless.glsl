@@ -0,0 +1,18 @@
+// Shader side of BindlessTable (bindless_table.h). Define BINDLESS_SET before including:
+// 1 in the main pass layout, 2 in the GPU-driven draw layout.
+//   #extension GL_GOOGLE_include_directive : require
+//   #define BINDLESS_SET 1
+//   #include "bindless.glsl"
+// Slots come from VkRenderer::TextureSlot() / TextureSamplerSlot(), e.g. through push constants
+// (mesh_textured.frag). BindlessTable::Accepts() checks the bindings below against the C++ side.
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = BINDLESS_SET, binding = 0) uniform texture2D bindless_images[];
+layout(set = BINDLESS_SET, binding = 2) uniform sampler bindless_samplers[];
+
+// Slots may differ between invocations of a draw, hence nonuniformEXT.
+vec4 SampleBindless(uint image, uint sampler_slot, vec2 uv)
+{
+  return texture(sampler2D(bindless_images[nonuniformEXT(image)], bindless_samplers[nonuniformEXT(sampler_slot)]), uv);
+}
@@ -0,0 +1,30 @@
+#version 450
+
+// .hkm vertex layout (MeshVertex in mesh_format.h).
+// MeshPipeline::kInputs in vk_renderer.h must list these; a mismatch fails the C++ build.
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec3 in_normal;
+layout(location = 2) in vec2 in_uv;
+
+layout(push_constant) uniform PushConstants
+{
+  vec4 transform; // xy: offset, z: scale
+} pc;
+
+layout(location = 0) out vec3 out_color;
+layout(location = 1) out vec2 out_uv; // read by mesh_textured.frag only
+
+// FrameUniforms in vk_renderer.h (see triangle.frag).
+layout(std140, set = 0, binding = 0) uniform Frame
+{
+  vec4 color_scale;
+  vec4 camera; // xy: pan, z: zoom
+} frame;
+
+void main()
+{
+  const vec3 position = in_position * pc.transform.z;
+  gl_Position = vec4((position.xy + pc.transform.xy - frame.camera.xy) * frame.camera.z, position.z * 0.5 + 0.5, 1.0);
+  out_color   = in_normal * 0.5 + 0.5;
+  out_uv      = in_uv;
+}
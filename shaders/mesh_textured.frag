@@ -0,0 +1,33 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// The streamed scene with a streamed texture, sampled through the bindless table (set 1 of the main pass layout).
+#define BINDLESS_SET 1
+#include "bindless.glsl"
+
+layout(location = 0) in vec3 in_color;
+layout(location = 1) in vec2 in_uv;
+layout(location = 0) out vec4 out_color;
+
+// FrameUniforms in vk_renderer.h (see triangle.frag).
+layout(std140, set = 0, binding = 0) uniform Frame
+{
+  vec4 color_scale;
+  vec4 camera;
+} frame;
+
+// MaterialSlots in vk_renderer.h, after the vertex stage's DrawItem.
+layout(push_constant) uniform PushConstants
+{
+  layout(offset = 16) uint image;
+  uint sampler_slot;
+} pc;
+
+const uint kNoBindlessSlot = 0xffffffffu;
+
+void main()
+{
+  // Until the texture's first mips are resident the slot is kNoBindlessSlot; shade like triangle.frag.
+  const vec3 color = pc.image == kNoBindlessSlot ? in_color : SampleBindless(pc.image, pc.sampler_slot, in_uv).rgb * in_color;
+  out_color = vec4(color * frame.color_scale.rgb, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 450
+
+layout(location = 0) in vec3 in_color;
+layout(location = 0) out vec4 out_color;
+
+// FrameUniforms in vk_renderer.h, bound with a dynamic offset into the renderer's uniform ring.
+layout(std140, set = 0, binding = 0) uniform Frame
+{
+  vec4 color_scale; // rgb multiplier
+  vec4 camera;      // xy: pan, z: zoom; applied by the vertex shaders
+} frame;
+
+void main()
+{
+  out_color = vec4(in_color * frame.color_scale.rgb, 1.0);
+}
@@ -0,0 +1,26 @@
+#version 450
+
+layout(push_constant) uniform PushConstants
+{
+  vec4 transform; // xy: offset, z: scale, w: depth
+} pc;
+
+layout(location = 0) out vec3 out_color;
+
+// FrameUniforms in vk_renderer.h (see triangle.frag).
+layout(std140, set = 0, binding = 0) uniform Frame
+{
+  vec4 color_scale;
+  vec4 camera; // xy: pan, z: zoom
+} frame;
+
+// Test triangle generated from gl_VertexIndex, no vertex buffer needed.
+const vec2 kPositions[3] = vec2[](vec2(0.0, -0.5), vec2(0.5, 0.5), vec2(-0.5, 0.5));
+const vec3 kColors[3]    = vec3[](vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, 1.0));
+
+void main()
+{
+  const vec2 position = kPositions[gl_VertexIndex] * pc.transform.z + pc.transform.xy;
+  gl_Position = vec4((position - frame.camera.xy) * frame.camera.z, pc.transform.w, 1.0);
+  out_color   = kColors[gl_VertexIndex];
+}
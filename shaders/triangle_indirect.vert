@@ -0,0 +1,28 @@
+#version 450
+
+// Object transforms, one per object. Read by firstInstance, which the culling pass sets to the object index.
+layout(std430, set = 1, binding = 0) readonly buffer Transforms
+{
+  vec4 transforms[]; // xy: offset, z: scale, w: depth
+};
+
+layout(location = 0) out vec3 out_color;
+
+// FrameUniforms in vk_renderer.h (see triangle.frag).
+layout(std140, set = 0, binding = 0) uniform Frame
+{
+  vec4 color_scale;
+  vec4 camera; // xy: pan, z: zoom
+} frame;
+
+// Same test triangle as triangle.vert; the index buffer supplies 0, 1, 2.
+const vec2 kPositions[3] = vec2[](vec2(0.0, -0.5), vec2(0.5, 0.5), vec2(-0.5, 0.5));
+const vec3 kColors[3]    = vec3[](vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, 1.0));
+
+void main()
+{
+  const vec4 transform = transforms[gl_InstanceIndex];
+  const vec2 position  = kPositions[gl_VertexIndex] * transform.z + transform.xy;
+  gl_Position = vec4((position - frame.camera.xy) * frame.camera.z, transform.w, 1.0);
+  out_color   = kColors[gl_VertexIndex];
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "capabilities.h"
+#include "deletion_queue.h"
+#include "spirv_reflect.h"
+
+// Bindings of the bindless table's set. Shaders index the arrays with the slots handed out below.
+constexpr uint32_t kBindlessImageBinding   = 0; // texture2D images[]
+constexpr uint32_t kBindlessBufferBinding  = 1; // buffer blocks[]
+constexpr uint32_t kBindlessSamplerBinding = 2; // sampler samplers[]
+constexpr uint32_t kNoBindlessSlot         = ~0u;
+
+struct BindlessStats
+{
+  uint32_t images          = 0; // live slots
+  uint32_t buffers         = 0;
+  uint32_t samplers        = 0;
+  uint32_t image_capacity  = 0;
+  uint32_t buffer_capacity = 0;
+  uint64_t writes          = 0; // descriptors written by Apply(), over all sets
+  uint64_t recycled        = 0; // slots handed out again after a Remove*()
+};
+
+/*
+  Bindless resource table
+
+  One descriptor set layout with large arrays of sampled images, storage buffers and samplers.
+  Resources get a slot (an array index) when added; draws address them by that index, so a
+  frame binds a single set no matter how many materials it uses.
+
+  There is one set per frame context. Add / Update / Remove only change the CPU-side table and
+  mark the slot dirty in every set; Apply() writes a context's set right after its fence wait,
+  when no pending frame reads it. The arrays are UPDATE_AFTER_BIND, so command buffers that
+  bind the set (the main pass's cached secondaries) stay valid across those writes, and
+  PARTIALLY_BOUND, so unused or freed slots need no valid descriptor.
+
+  A removed slot is recycled once the frames that could still index it have completed,
+  through the renderer's deletion queue. Render thread only.
+*/
+class BindlessTable
+{
+public:
+  // Array sizes are clamped to the device's update-after-bind limits, per type and all together.
+  BindlessTable(vk::Device                device,
+                const DeviceCapabilities& caps,
+                DeletionQueue&            deletion_queue,
+                uint32_t                  set_count,
+                uint32_t                  max_images   = 16384,
+                uint32_t                  max_buffers  = 4096,
+                uint32_t                  max_samplers = 64)
+    : device_(device), deletion_queue_(deletion_queue)
+  {
+    if(!caps.descriptor_indexing)
+    {
+      throw std::runtime_error("The bindless table needs VK_EXT_descriptor_indexing.");
+    }
+    images_.capacity   = std::min(max_images, caps.max_bindless_images);
+    buffers_.capacity  = std::min(max_buffers, caps.max_bindless_buffers);
+    samplers_.capacity = std::min(max_samplers, caps.max_bindless_samplers);
+    const uint64_t total = uint64_t(images_.capacity) + buffers_.capacity + samplers_.capacity;
+    if(total > caps.max_bindless_resources)
+    {
+      // Over the per-stage budget of all three together: shrink every array by the same factor.
+      auto shrink = [&](uint32_t capacity) {
+        return std::max(static_cast<uint32_t>(capacity * uint64_t(caps.max_bindless_resources) / total), std::min(capacity, 1u));
+      };
+      images_.capacity   = shrink(images_.capacity);
+      buffers_.capacity  = shrink(buffers_.capacity);
+      samplers_.capacity = shrink(samplers_.capacity);
+    }
+
+    const auto stages = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+    const std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {
+      vk::DescriptorSetLayoutBinding(kBindlessImageBinding, vk::DescriptorType::eSampledImage, images_.capacity, stages),
+      vk::DescriptorSetLayoutBinding(kBindlessBufferBinding, vk::DescriptorType::eStorageBuffer, buffers_.capacity, stages),
+      vk::DescriptorSetLayoutBinding(kBindlessSamplerBinding, vk::DescriptorType::eSampler, samplers_.capacity, stages)};
+    const auto flags = vk::DescriptorBindingFlagsEXT(vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind |
+                                                     vk::DescriptorBindingFlagBitsEXT::ePartiallyBound |
+                                                     vk::DescriptorBindingFlagBitsEXT::eUpdateUnusedWhilePending);
+    const std::array<vk::DescriptorBindingFlagsEXT, 3> binding_flags = {flags, flags, flags};
+    const auto flags_ci = vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT(static_cast<uint32_t>(binding_flags.size()),
+                                                                           binding_flags.data());
+    layout_ = device_.createDescriptorSetLayoutUnique(
+      vk::DescriptorSetLayoutCreateInfo(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT,
+                                        static_cast<uint32_t>(bindings.size()),
+                                        bindings.data())
+        .setPNext(&flags_ci));
+
+    const std::array<vk::DescriptorPoolSize, 3> pool_sizes = {
+      vk::DescriptorPoolSize(vk::DescriptorType::eSampledImage, images_.capacity * set_count),
+      vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, buffers_.capacity * set_count),
+      vk::DescriptorPoolSize(vk::DescriptorType::eSampler, samplers_.capacity * set_count)};
+    pool_ = device_.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT,
+                                                                            set_count,
+                                                                            static_cast<uint32_t>(pool_sizes.size()),
+                                                                            pool_sizes.data()));
+    const std::vector<vk::DescriptorSetLayout> layouts(set_count, layout_.get());
+    sets_ = device_.allocateDescriptorSets(vk::DescriptorSetAllocateInfo(pool_.get(), set_count, layouts.data()));
+    dirty_.resize(set_count);
+  }
+
+  BindlessTable(const BindlessTable&) = delete;
+  BindlessTable& operator=(const BindlessTable&) = delete;
+
+  // Returns kNoBindlessSlot when the array is full.
+  uint32_t AddImage(vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+  {
+    return Add(images_, kBindlessImageBinding, vk::DescriptorImageInfo(nullptr, view, layout));
+  }
+  // The new view reaches each set before that set's next frame; frames in flight keep the old one.
+  void UpdateImage(uint32_t slot, vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+  {
+    Update(images_, kBindlessImageBinding, slot, vk::DescriptorImageInfo(nullptr, view, layout));
+  }
+  // The slot is handed out again once `frame_count` frames have completed.
+  void RemoveImage(uint32_t slot, uint64_t frame_count) { Remove(images_, kBindlessImageBinding, slot, frame_count); }
+
+  uint32_t AddBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE)
+  {
+    return Add(buffers_, kBindlessBufferBinding, vk::DescriptorBufferInfo(buffer, offset, range));
+  }
+  void UpdateBuffer(uint32_t slot, vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE)
+  {
+    Update(buffers_, kBindlessBufferBinding, slot, vk::DescriptorBufferInfo(buffer, offset, range));
+  }
+  void RemoveBuffer(uint32_t slot, uint64_t frame_count) { Remove(buffers_, kBindlessBufferBinding, slot, frame_count); }
+
+  uint32_t AddSampler(vk::Sampler sampler)
+  {
+    return Add(samplers_, kBindlessSamplerBinding, vk::DescriptorImageInfo(sampler, nullptr, vk::ImageLayout::eUndefined));
+  }
+  void RemoveSampler(uint32_t slot, uint64_t frame_count) { Remove(samplers_, kBindlessSamplerBinding, slot, frame_count); }
+
+  /*
+    Whether the descriptors a shader declares in `set` (the set the table is bound to) are all
+    bindings of the table with matching types, e.g. bindless.glsl against the k*Binding constants.
+  */
+  bool Accepts(const std::vector<ShaderDescriptor>& descriptors, uint32_t set) const
+  {
+    for(const auto& d : descriptors)
+    {
+      if(d.set != set)
+      {
+        continue;
+      }
+      const bool match = (d.binding == kBindlessImageBinding && d.type == vk::DescriptorType::eSampledImage) ||
+                         (d.binding == kBindlessBufferBinding && d.type == vk::DescriptorType::eStorageBuffer) ||
+                         (d.binding == kBindlessSamplerBinding && d.type == vk::DescriptorType::eSampler);
+      if(!match || !d.array)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*
+    Write every slot changed since set `index` was last applied. Call once per frame, after the
+    fence wait of the context owning the set and before its submission.
+  */
+  void Apply(uint32_t index)
+  {
+    auto& dirty = dirty_[index];
+    if(dirty.empty())
+    {
+      return;
+    }
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    std::vector<vk::WriteDescriptorSet> writes;
+    writes.reserve(dirty.size());
+    for(const auto& d : dirty)
+    {
+      auto write = vk::WriteDescriptorSet(sets_[index], d.binding, d.slot, 1, vk::DescriptorType::eSampledImage);
+      switch(d.binding)
+      {
+        case kBindlessImageBinding:
+          write.setPImageInfo(&images_.entries[d.slot]);
+          break;
+        case kBindlessBufferBinding:
+          write.setDescriptorType(vk::DescriptorType::eStorageBuffer).setPBufferInfo(&buffers_.entries[d.slot]);
+          break;
+        default:
+          write.setDescriptorType(vk::DescriptorType::eSampler).setPImageInfo(&samplers_.entries[d.slot]);
+          break;
+      }
+      writes.push_back(write);
+    }
+    device_.updateDescriptorSets(writes, nullptr);
+    stats_.writes += writes.size();
+    dirty.clear();
+  }
+
+  vk::DescriptorSetLayout Layout() const { return layout_.get(); }
+  vk::DescriptorSet Set(uint32_t index) const { return sets_[index]; }
+
+  BindlessStats Stats() const
+  {
+    auto stats            = stats_;
+    stats.images          = images_.live;
+    stats.buffers         = buffers_.live;
+    stats.samplers        = samplers_.live;
+    stats.image_capacity  = images_.capacity;
+    stats.buffer_capacity = buffers_.capacity;
+    return stats;
+  }
+
+private:
+  // Slots of one binding. `entries` grows up to `capacity`; freed slots are reused first.
+  template <typename Info>
+  struct SlotArray
+  {
+    std::vector<Info>     entries;
+    std::vector<uint32_t> free;
+    uint32_t              capacity = 0;
+    uint32_t              live     = 0;
+  };
+
+  struct Dirty
+  {
+    uint32_t binding;
+    uint32_t slot;
+
+    bool operator<(const Dirty& other) const { return binding != other.binding ? binding < other.binding : slot < other.slot; }
+    bool operator==(const Dirty& other) const { return binding == other.binding && slot == other.slot; }
+  };
+
+  template <typename Info>
+  uint32_t Add(SlotArray<Info>& array, uint32_t binding, const Info& info)
+  {
+    uint32_t slot = kNoBindlessSlot;
+    if(!array.free.empty())
+    {
+      slot = array.free.back();
+      array.free.pop_back();
+      array.entries[slot] = info;
+      ++stats_.recycled;
+    }
+    else if(array.entries.size() < array.capacity)
+    {
+      slot = static_cast<uint32_t>(array.entries.size());
+      array.entries.push_back(info);
+    }
+    else
+    {
+      return kNoBindlessSlot;
+    }
+    ++array.live;
+    MarkDirty(binding, slot);
+    return slot;
+  }
+
+  template <typename Info>
+  void Update(SlotArray<Info>& array, uint32_t binding, uint32_t slot, const Info& info)
+  {
+    array.entries[slot] = info;
+    MarkDirty(binding, slot);
+  }
+
+  template <typename Info>
+  void Remove(SlotArray<Info>& array, uint32_t binding, uint32_t slot, uint64_t frame_count)
+  {
+    --array.live;
+    // Sets not yet applied must not pick up a descriptor whose resource is about to go.
+    for(auto& dirty : dirty_)
+    {
+      dirty.erase(std::remove(dirty.begin(), dirty.end(), Dirty{binding, slot}), dirty.end());
+    }
+    // The deletion queue is collected on the render thread too, so the free list needs no lock.
+    deletion_queue_.Defer(frame_count, [&array, slot] { array.free.push_back(slot); });
+  }
+
+  void MarkDirty(uint32_t binding, uint32_t slot)
+  {
+    for(auto& dirty : dirty_)
+    {
+      dirty.push_back(Dirty{binding, slot});
+    }
+  }
+
+  vk::Device                                 device_;
+  DeletionQueue&                             deletion_queue_;
+  vk::UniqueDescriptorSetLayout              layout_;
+  vk::UniqueDescriptorPool                   pool_;
+  std::vector<vk::DescriptorSet>             sets_; // one per frame context, freed with the pool
+  std::vector<std::vector<Dirty>>            dirty_; // per set
+  SlotArray<vk::DescriptorImageInfo>         images_;
+  SlotArray<vk::DescriptorBufferInfo>        buffers_;
+  SlotArray<vk::DescriptorImageInfo>         samplers_;
+  BindlessStats                              stats_;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+  Camera path for batch rendering
+
+  Keyframes of FrameUniforms::camera, one per line or separated by ';':
+    frame x y zoom      # comment
+  Frames must increase. The camera is interpolated linearly between keyframes and held
+  before the first and after the last; an empty path is the identity camera.
+*/
+class CameraPath
+{
+public:
+  using Camera = std::array<float, 4>;
+
+  bool Load(const std::string& path)
+  {
+    std::ifstream ifs(path);
+    if(!ifs)
+    {
+      std::cerr << "Failed to open camera path: " << path << std::endl;
+      return false;
+    }
+    std::stringstream text;
+    text << ifs.rdbuf();
+    if(!Parse(text.str()))
+    {
+      std::cerr << "Invalid camera path: " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Replaces the keyframes. On failure the path is left empty.
+  bool Parse(const std::string& text)
+  {
+    keys_.clear();
+    std::string line;
+    std::stringstream lines(text);
+    while(std::getline(lines, line))
+    {
+      std::stringstream entries(line.substr(0, line.find('#')));
+      std::string       entry;
+      while(std::getline(entries, entry, ';'))
+      {
+        std::stringstream fields(entry);
+        Key               key;
+        if(!(fields >> key.frame))
+        {
+          continue; // blank
+        }
+        if(!(fields >> key.camera[0] >> key.camera[1] >> key.camera[2]) || (!keys_.empty() && key.frame <= keys_.back().frame))
+        {
+          keys_.clear();
+          return false;
+        }
+        keys_.push_back(key);
+      }
+    }
+    return true;
+  }
+
+  bool Empty() const { return keys_.empty(); }
+
+  Camera Sample(uint64_t frame) const
+  {
+    if(keys_.empty())
+    {
+      return Camera{0.0f, 0.0f, 1.0f, 0.0f};
+    }
+    if(frame <= keys_.front().frame)
+    {
+      return keys_.front().camera;
+    }
+    if(frame >= keys_.back().frame)
+    {
+      return keys_.back().camera;
+    }
+    const auto next = std::upper_bound(keys_.begin(), keys_.end(), frame,
+                                       [](uint64_t f, const Key& key) { return f < key.frame; });
+    const auto& b = *next;
+    const auto& a = *(next - 1);
+    const auto  t = static_cast<float>(frame - a.frame) / static_cast<float>(b.frame - a.frame);
+    Camera camera;
+    for(size_t i = 0; i < camera.size(); ++i)
+    {
+      camera[i] = a.camera[i] + (b.camera[i] - a.camera[i]) * t;
+    }
+    return camera;
+  }
+
+private:
+  struct Key
+  {
+    uint64_t frame  = 0;
+    Camera   camera = {0.0f, 0.0f, 1.0f, 0.0f};
+  };
+
+  std::vector<Key> keys_;
+};
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+/*
+  Capability negotiation
+
+  Instead of enabling every extension the loader / driver reports, the renderer asks for
+  what it needs:
+    required: creation fails (instance) or the device is rejected (device) without them
+    optional: enabled only when available; the outcome is recorded in DeviceCapabilities
+  The rest of the renderer queries DeviceCapabilities rather than re-probing the driver.
+*/
+
+constexpr uint32_t kMinimumApiVersion = VK_API_VERSION_1_1;
+// Queue family index meaning "none"; the work falls back to the graphics queue.
+constexpr uint32_t kNoQueueFamily     = VK_QUEUE_FAMILY_IGNORED;
+
+// Descriptors sharing a stage with the bindless table in the renderer's layouts: the GPU-driven
+// transform buffer, the frame uniforms, and the color plus MSAA resolve attachments.
+constexpr uint32_t kBindlessReservedStorageBuffers = 1;
+constexpr uint32_t kBindlessReservedResources      = 4;
+
+inline bool HasExtension(const std::vector<vk::ExtensionProperties>& available, const char* name)
+{
+  return std::any_of(available.begin(), available.end(), [name](const vk::ExtensionProperties& p) {
+    return std::strcmp(p.extensionName, name) == 0;
+  });
+}
+
+inline bool HasLayer(const std::vector<vk::LayerProperties>& available, const char* name)
+{
+  return std::any_of(available.begin(), available.end(), [name](const vk::LayerProperties& p) {
+    return std::strcmp(p.layerName, name) == 0;
+  });
+}
+
+struct InstanceCapabilities
+{
+  std::vector<const char*> extensions;
+  std::vector<const char*> layers;
+  bool                     validation   = false;
+  bool                     debug_report = false;
+};
+
+/*
+  Pick instance extensions and layers.
+  `required` usually comes from glfwGetRequiredInstanceExtensions() (empty when headless).
+  Validation is best effort: a missing layer is reported, not fatal.
+*/
+inline InstanceCapabilities NegotiateInstance(const std::vector<const char*>& required, bool validation)
+{
+  InstanceCapabilities caps;
+  const auto available = vk::enumerateInstanceExtensionProperties();
+  for(const auto name : required)
+  {
+    if(!HasExtension(available, name))
+    {
+      throw std::runtime_error(std::string("Required instance extension is not available: ") + name);
+    }
+    caps.extensions.push_back(name);
+  }
+
+  if(validation)
+  {
+    const auto layers = vk::enumerateInstanceLayerProperties();
+    // The Khronos layer replaced the LunarG meta layer; accept either.
+    for(const auto name : {"VK_LAYER_KHRONOS_validation", "VK_LAYER_LUNARG_standard_validation"})
+    {
+      if(HasLayer(layers, name))
+      {
+        caps.layers.push_back(name);
+        caps.validation = true;
+        break;
+      }
+    }
+    if(!caps.validation)
+    {
+      std::cerr << "Validation requested but no validation layer is installed." << std::endl;
+    }
+    if(caps.validation && HasExtension(available, VK_EXT_DEBUG_REPORT_EXTENSION_NAME))
+    {
+      caps.extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+      caps.debug_report = true;
+    }
+  }
+  return caps;
+}
+
+/*
+  What the selected device supports, after negotiation.
+  `extensions` and `features` are exactly what gets passed to vkCreateDevice.
+*/
+struct DeviceCapabilities
+{
+  vk::PhysicalDevice           physical_device;
+  vk::PhysicalDeviceProperties properties;
+  int64_t                      score                = 0;
+  uint32_t                     graphics_queue_index = 0;
+  // Families without graphics, so their queues run beside the graphics queue. kNoQueueFamily when absent.
+  uint32_t                     compute_queue_index  = kNoQueueFamily;
+  uint32_t                     transfer_queue_index = kNoQueueFamily;
+  // Queue within transfer_queue_index: 1 when it shares the compute family, which then needs two queues.
+  uint32_t                     transfer_queue_slot  = 0;
+
+  std::vector<const char*>     extensions;
+  vk::PhysicalDeviceFeatures   features;
+
+  // Optional extensions
+  bool memory_budget          = false; // VK_EXT_memory_budget
+  bool descriptor_indexing    = false; // VK_EXT_descriptor_indexing
+  bool draw_indirect_count    = false; // VK_KHR_draw_indirect_count
+  // Optional features
+  bool pipeline_statistics    = false; // pipelineStatisticsQuery + inheritedQueries
+  bool multi_draw_indirect    = false; // multiDrawIndirect + drawIndirectFirstInstance (GPU-driven draws)
+  bool texture_compression_bc = false; // textureCompressionBC (streamed .hkt textures)
+  bool sample_rate_shading    = false; // sampleRateShading (per-sample shading with MSAA)
+
+  // Descriptor indexing features chained into vkCreateDevice, and the bindless array sizes the device allows.
+  // Only filled in when descriptor_indexing is set.
+  vk::PhysicalDeviceDescriptorIndexingFeaturesEXT descriptor_indexing_features;
+  uint32_t                     max_bindless_images   = 0;
+  uint32_t                     max_bindless_buffers  = 0;
+  uint32_t                     max_bindless_samplers = 0;
+  // Descriptors all three arrays may hold together, the per-stage limit over every set of a layout.
+  uint32_t                     max_bindless_resources = 0;
+
+  bool AsyncCompute() const { return compute_queue_index != kNoQueueFamily; }
+  bool DedicatedTransfer() const { return transfer_queue_index != kNoQueueFamily; }
+
+  // Highest sample count up to `requested` that color and depth attachments both support.
+  vk::SampleCountFlagBits MsaaSamples(uint32_t requested) const
+  {
+    const auto supported = properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+    for(const auto samples : {vk::SampleCountFlagBits::e8, vk::SampleCountFlagBits::e4, vk::SampleCountFlagBits::e2})
+    {
+      if(static_cast<uint32_t>(samples) <= requested && (supported & samples))
+      {
+        return samples;
+      }
+    }
+    return vk::SampleCountFlagBits::e1;
+  }
+
+  std::string DeviceName() const { return properties.deviceName; }
+};
+
+struct DeviceRequirements
+{
+  std::vector<const char*> extensions; // e.g. VK_KHR_swapchain when presenting
+  // Returns whether a queue family of a device can present. Null in headless mode.
+  std::function<bool(vk::PhysicalDevice, uint32_t queue_family)> can_present;
+};
+
+/*
+  Score a physical device. Negative means unusable.
+  Discrete GPUs beat integrated ones, which beat virtual and CPU implementations;
+  ties go to the larger device-local heap.
+*/
+inline int64_t ScorePhysicalDevice(vk::PhysicalDevice           device,
+                                   const DeviceRequirements&    requirements,
+                                   uint32_t*                    graphics_queue_index)
+{
+  const auto properties = device.getProperties();
+  if(properties.apiVersion < kMinimumApiVersion)
+  {
+    return -1;
+  }
+
+  const auto available = device.enumerateDeviceExtensionProperties();
+  for(const auto name : requirements.extensions)
+  {
+    if(!HasExtension(available, name))
+    {
+      return -1;
+    }
+  }
+
+  // A family that does graphics (and presents, when windowed). Graphics queues can always transfer.
+  const auto families = device.getQueueFamilyProperties();
+  bool       found    = false;
+  for(uint32_t i = 0; i < families.size() && !found; ++i)
+  {
+    if(!(families[i].queueFlags & vk::QueueFlagBits::eGraphics))
+    {
+      continue;
+    }
+    if(requirements.can_present && !requirements.can_present(device, i))
+    {
+      continue;
+    }
+    *graphics_queue_index = i;
+    found                 = true;
+  }
+  if(!found)
+  {
+    return -1;
+  }
+
+  int64_t score = 0;
+  switch(properties.deviceType)
+  {
+    case vk::PhysicalDeviceType::eDiscreteGpu:   score += 100000; break;
+    case vk::PhysicalDeviceType::eIntegratedGpu: score += 50000;  break;
+    case vk::PhysicalDeviceType::eVirtualGpu:    score += 20000;  break;
+    case vk::PhysicalDeviceType::eCpu:           score += 1000;   break;
+    default:                                                      break;
+  }
+
+  const auto memory = device.getMemoryProperties();
+  for(uint32_t i = 0; i < memory.memoryHeapCount; ++i)
+  {
+    if(memory.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+    {
+      score += static_cast<int64_t>(memory.memoryHeaps[i].size >> 20) / 1024; // GiB
+    }
+  }
+  return score;
+}
+
+/*
+  Find queue families that can run beside the graphics queue.
+  compute: a compute family without graphics (async compute).
+  transfer: prefer a transfer-only family (the copy engine), else any other non-graphics family
+  with transfer. Sharing the compute family is only allowed when it has a second queue, because
+  the two queues are used from different threads.
+*/
+inline void FindAsyncQueues(DeviceCapabilities& caps)
+{
+  const auto families = caps.physical_device.getQueueFamilyProperties();
+  auto       has      = [&families](uint32_t i, vk::QueueFlags flags) { return (families[i].queueFlags & flags) == flags; };
+
+  for(uint32_t i = 0; i < families.size(); ++i)
+  {
+    if(has(i, vk::QueueFlagBits::eCompute) && !has(i, vk::QueueFlagBits::eGraphics) && families[i].queueCount > 0)
+    {
+      caps.compute_queue_index = i;
+      break;
+    }
+  }
+
+  // Compute families can always transfer, even when they do not report it (e.g. video-only families cannot).
+  uint32_t fallback = kNoQueueFamily;
+  for(uint32_t i = 0; i < families.size(); ++i)
+  {
+    if(i == caps.graphics_queue_index || has(i, vk::QueueFlagBits::eGraphics) || families[i].queueCount == 0)
+    {
+      continue;
+    }
+    const bool transfer_only = has(i, vk::QueueFlagBits::eTransfer) && !has(i, vk::QueueFlagBits::eCompute);
+    if(transfer_only)
+    {
+      caps.transfer_queue_index = i;
+      return;
+    }
+    const bool can_transfer = has(i, vk::QueueFlagBits::eTransfer) || has(i, vk::QueueFlagBits::eCompute);
+    if(fallback == kNoQueueFamily && can_transfer && (i != caps.compute_queue_index || families[i].queueCount > 1))
+    {
+      fallback = i;
+    }
+  }
+  caps.transfer_queue_index = fallback;
+  caps.transfer_queue_slot  = (fallback != kNoQueueFamily && fallback == caps.compute_queue_index) ? 1 : 0;
+}
+
+/*
+  Pick the best physical device and negotiate its extensions and features.
+  Throws when no device meets the requirements.
+*/
+inline DeviceCapabilities SelectPhysicalDevice(vk::Instance instance, const DeviceRequirements& requirements)
+{
+  DeviceCapabilities caps;
+  caps.score = -1;
+  for(const auto device : instance.enumeratePhysicalDevices())
+  {
+    uint32_t   queue_index = 0;
+    const auto score       = ScorePhysicalDevice(device, requirements, &queue_index);
+    if(score > caps.score)
+    {
+      caps.physical_device      = device;
+      caps.score                = score;
+      caps.graphics_queue_index = queue_index;
+    }
+  }
+  if(caps.score < 0)
+  {
+    throw std::runtime_error("No Vulkan device meets the renderer's requirements.");
+  }
+  caps.properties = caps.physical_device.getProperties();
+  FindAsyncQueues(caps);
+
+  const auto available = caps.physical_device.enumerateDeviceExtensionProperties();
+  caps.extensions      = requirements.extensions;
+  // Portability implementations (e.g. MoltenVK) must have this enabled whenever it is exposed.
+  if(HasExtension(available, "VK_KHR_portability_subset"))
+  {
+    caps.extensions.push_back("VK_KHR_portability_subset");
+  }
+  if(HasExtension(available, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+  {
+    caps.extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    caps.memory_budget = true;
+  }
+  if(HasExtension(available, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+  {
+    /*
+      The bindless table needs runtime-sized, partially bound arrays that can be written after
+      they are bound (recorded secondaries stay valid) while other frames still use the set.
+      Anything less and the extension is left off.
+    */
+    const auto features = caps.physical_device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                                             vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>()
+                            .get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+    if(features.runtimeDescriptorArray && features.descriptorBindingPartiallyBound &&
+       features.descriptorBindingUpdateUnusedWhilePending && features.descriptorBindingSampledImageUpdateAfterBind &&
+       features.descriptorBindingStorageBufferUpdateAfterBind && features.shaderSampledImageArrayNonUniformIndexing)
+    {
+      caps.extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+      caps.descriptor_indexing = true;
+      caps.descriptor_indexing_features.setRuntimeDescriptorArray(VK_TRUE)
+                                       .setDescriptorBindingPartiallyBound(VK_TRUE)
+                                       .setDescriptorBindingUpdateUnusedWhilePending(VK_TRUE)
+                                       .setDescriptorBindingSampledImageUpdateAfterBind(VK_TRUE)
+                                       .setDescriptorBindingStorageBufferUpdateAfterBind(VK_TRUE)
+                                       .setShaderSampledImageArrayNonUniformIndexing(VK_TRUE)
+                                       .setShaderStorageBufferArrayNonUniformIndexing(features.shaderStorageBufferArrayNonUniformIndexing);
+
+      /*
+        Per stage and per set limits both apply; every binding is visible to all stages. They
+        count every set of a pipeline layout, so what the renderer binds next to the table
+        (kBindlessReserved*) comes off the table's share.
+      */
+      const auto limits = caps.physical_device.getProperties2<vk::PhysicalDeviceProperties2,
+                                                              vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>()
+                            .get<vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>();
+      auto share = [](uint32_t limit, uint32_t reserved) { return limit > reserved ? limit - reserved : 0; };
+      caps.max_bindless_images    = std::min(limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                             limits.maxDescriptorSetUpdateAfterBindSampledImages);
+      caps.max_bindless_buffers   = share(std::min(limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                                                   limits.maxDescriptorSetUpdateAfterBindStorageBuffers),
+                                          kBindlessReservedStorageBuffers);
+      caps.max_bindless_samplers  = std::min(limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+                                             limits.maxDescriptorSetUpdateAfterBindSamplers);
+      caps.max_bindless_resources = share(limits.maxPerStageUpdateAfterBindResources, kBindlessReservedResources);
+    }
+  }
+  if(HasExtension(available, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
+  {
+    caps.extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    caps.draw_indirect_count = true;
+  }
+
+  // Pipeline statistics around the main pass also need inheritedQueries because draws live in secondaries.
+  const auto supported     = caps.physical_device.getFeatures();
+  caps.pipeline_statistics = supported.pipelineStatisticsQuery && supported.inheritedQueries;
+  caps.features.setPipelineStatisticsQuery(caps.pipeline_statistics);
+  caps.features.setInheritedQueries(caps.pipeline_statistics);
+  // The culling pass writes one indirect command per object, indexed by firstInstance.
+  caps.multi_draw_indirect = supported.multiDrawIndirect && supported.drawIndirectFirstInstance;
+  caps.features.setMultiDrawIndirect(caps.multi_draw_indirect);
+  caps.features.setDrawIndirectFirstInstance(caps.multi_draw_indirect);
+  // BC1 / BC7 textures; RGBA8 ones stream either way.
+  caps.texture_compression_bc = supported.textureCompressionBC;
+  caps.features.setTextureCompressionBC(caps.texture_compression_bc);
+  // Only used when RendererConfig::sample_shading asks for it.
+  caps.sample_rate_shading = supported.sampleRateShading;
+  caps.features.setSampleRateShading(caps.sample_rate_shading);
+  return caps;
+}
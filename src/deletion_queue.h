@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct DeletionQueueStats
+{
+  uint64_t deferred     = 0; // Defer() calls
+  uint64_t destroyed    = 0; // entries run by Collect() / Flush()
+  uint64_t batches      = 0; // Collect() calls that destroyed anything
+  uint64_t peak_pending = 0;
+};
+
+/*
+  Deferred destruction, gated on frame completion
+
+  Objects the GPU may still be using are handed over with the number of frames that must
+  complete before they can go (normally the renderer's frame count at release time, so every
+  frame submitted so far is covered). Collect() is called once per frame after the fence wait
+  and destroys everything that became safe in one batch; nothing ever waits on the GPU here.
+  Flush() destroys the rest and is only valid once the device is idle, i.e. at shutdown.
+
+  Thread safe: pipeline workers retire pipelines while the render thread collects.
+  Destroy callbacks run outside the lock, oldest first.
+*/
+class DeletionQueue
+{
+public:
+  DeletionQueue() = default;
+  DeletionQueue(const DeletionQueue&) = delete;
+  DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+  // Anything left is destroyed here; the owner must have idled the device.
+  ~DeletionQueue() { Flush(); }
+
+  // Run `destroy` once `frame_count` frames have completed. Move-only captures are fine.
+  template <typename F>
+  void Defer(uint64_t frame_count, F&& destroy)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back(Entry{frame_count, std::make_unique<Deferred<std::decay_t<F>>>(std::forward<F>(destroy))});
+    ++stats_.deferred;
+    stats_.peak_pending = std::max<uint64_t>(stats_.peak_pending, entries_.size());
+  }
+
+  // Shorthand for a vk::Unique* handle (or anything else with reset()).
+  template <typename Handle>
+  void Release(uint64_t frame_count, Handle&& handle)
+  {
+    Defer(frame_count, [handle = std::move(handle)]() mutable { handle.reset(); });
+  }
+
+  /*
+    Destroy every entry whose frames have completed. Returns how many were destroyed.
+    Entries arrive in frame order, so this stops at the first one that is still in use.
+  */
+  size_t Collect(uint64_t completed_frames)
+  {
+    std::vector<Entry> ready;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while(!entries_.empty() && entries_.front().frame_count <= completed_frames)
+      {
+        ready.push_back(std::move(entries_.front()));
+        entries_.pop_front();
+      }
+    }
+    Run(ready);
+    return ready.size();
+  }
+
+  // Destroy everything regardless of frames. The device must be idle.
+  void Flush()
+  {
+    std::vector<Entry> all;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      all.assign(std::make_move_iterator(entries_.begin()), std::make_move_iterator(entries_.end()));
+      entries_.clear();
+    }
+    Run(all);
+  }
+
+  size_t Pending() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  DeletionQueueStats Stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+private:
+  struct DeferredBase
+  {
+    virtual ~DeferredBase() = default;
+    virtual void Destroy() = 0;
+  };
+
+  template <typename F>
+  struct Deferred : DeferredBase
+  {
+    explicit Deferred(F&& f) : fn(std::move(f)) {}
+    explicit Deferred(const F& f) : fn(f) {}
+    void Destroy() override { fn(); }
+    F fn;
+  };
+
+  struct Entry
+  {
+    uint64_t                      frame_count = 0;
+    std::unique_ptr<DeferredBase> deferred;
+  };
+
+  void Run(std::vector<Entry>& entries)
+  {
+    if(entries.empty())
+    {
+      return;
+    }
+    for(auto& entry : entries)
+    {
+      entry.deferred->Destroy();
+      entry.deferred.reset();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.destroyed += entries.size();
+    stats_.batches   += 1;
+  }
+
+  mutable std::mutex  mutex_;
+  std::deque<Entry>   entries_;
+  DeletionQueueStats  stats_;
+};
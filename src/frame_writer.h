@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vk_renderer.h"
+
+enum class ImageFileFormat
+{
+  ePpm, // binary P6, alpha dropped
+  ePng, // RGBA8, stored (uncompressed) deflate blocks
+  eRaw, // the readback buffer as is: RGBA8 rows, top first, no header
+};
+
+inline const char* ImageFileFormatName(ImageFileFormat format)
+{
+  switch(format)
+  {
+    case ImageFileFormat::ePpm: return "ppm";
+    case ImageFileFormat::ePng: return "png";
+    case ImageFileFormat::eRaw: return "raw";
+    default:                    return "unknown";
+  }
+}
+
+// Accepts the names returned by ImageFileFormatName().
+inline bool ParseImageFileFormat(const std::string& name, ImageFileFormat* format)
+{
+  for(const auto candidate : {ImageFileFormat::ePpm, ImageFileFormat::ePng, ImageFileFormat::eRaw})
+  {
+    if(name == ImageFileFormatName(candidate))
+    {
+      *format = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// CRC-32 as used by PNG chunks (reflected, polynomial 0xedb88320).
+inline uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+  static const auto table = [] {
+    std::array<uint32_t, 256> t = {};
+    for(uint32_t n = 0; n < 256; ++n)
+    {
+      uint32_t c = n;
+      for(int k = 0; k < 8; ++k)
+      {
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      t[n] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for(size_t i = 0; i < size; ++i)
+  {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+// Running Adler-32 of a zlib stream. Reduces every 5552 bytes, the most that cannot overflow.
+inline void Adler32Update(const uint8_t* data, size_t size, uint32_t* a, uint32_t* b)
+{
+  while(size > 0)
+  {
+    const auto n = std::min<size_t>(size, 5552);
+    for(size_t i = 0; i < n; ++i)
+    {
+      *a += data[i];
+      *b += *a;
+    }
+    *a %= 65521;
+    *b %= 65521;
+    data += n;
+    size -= n;
+  }
+}
+
+// Binary PPM of a tightly packed RGBA8 image.
+inline void EncodePpm(const uint8_t* rgba, uint32_t width, uint32_t height, std::vector<uint8_t>& out)
+{
+  char header[64];
+  const auto header_size = std::snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+  out.resize(header_size + size_t(width) * height * 3);
+  std::copy(header, header + header_size, out.begin());
+  auto* dst = out.data() + header_size;
+  for(size_t i = 0, count = size_t(width) * height; i < count; ++i)
+  {
+    dst[i * 3 + 0] = rgba[i * 4 + 0];
+    dst[i * 3 + 1] = rgba[i * 4 + 1];
+    dst[i * 3 + 2] = rgba[i * 4 + 2];
+  }
+}
+
+/*
+  PNG of a tightly packed RGBA8 image.
+  Rows use filter 0 and go into stored deflate blocks: no compression, so encoding costs about
+  one memcpy and the writer keeps up with the GPU; run the sequence through a PNG optimizer
+  afterwards if size matters.
+*/
+inline void EncodePng(const uint8_t* rgba, uint32_t width, uint32_t height, std::vector<uint8_t>& out)
+{
+  const size_t row_bytes = size_t(width) * 4;
+  const size_t row_runs  = (row_bytes + 1 + 65534) / 65535; // stored blocks hold at most 65535 bytes
+  out.clear();
+  out.reserve(64 + height * (row_bytes + 1 + row_runs * 5));
+
+  auto put8  = [&out](uint32_t v) { out.push_back(static_cast<uint8_t>(v)); };
+  auto put32 = [&out](uint32_t v) {
+    out.push_back(static_cast<uint8_t>(v >> 24));
+    out.push_back(static_cast<uint8_t>(v >> 16));
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+  };
+  // Chunks: length, type, data, CRC of type + data. The length is patched in once the data is known.
+  auto begin_chunk = [&](const char* type) {
+    put32(0);
+    const auto start = out.size();
+    out.insert(out.end(), type, type + 4);
+    return start;
+  };
+  auto end_chunk = [&](size_t start) {
+    const auto length = static_cast<uint32_t>(out.size() - start - 4);
+    for(int i = 0; i < 4; ++i)
+    {
+      out[start - 4 + i] = static_cast<uint8_t>(length >> (24 - 8 * i));
+    }
+    put32(Crc32(out.data() + start, out.size() - start));
+  };
+
+  static const uint8_t kSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  out.insert(out.end(), kSignature, kSignature + 8);
+
+  auto chunk = begin_chunk("IHDR");
+  put32(width);
+  put32(height);
+  put8(8); // bit depth
+  put8(6); // color type: RGBA
+  put8(0); // compression
+  put8(0); // filter method
+  put8(0); // no interlace
+  end_chunk(chunk);
+
+  chunk = begin_chunk("IDAT");
+  put8(0x78); // zlib header: deflate, 32K window, no dictionary
+  put8(0x01);
+  uint32_t adler_a = 1;
+  uint32_t adler_b = 0;
+  for(uint32_t y = 0; y < height; ++y)
+  {
+    const uint8_t* row    = rgba + y * row_bytes;
+    const uint8_t  filter = 0;
+    Adler32Update(&filter, 1, &adler_a, &adler_b);
+    Adler32Update(row, row_bytes, &adler_a, &adler_b);
+
+    // The scanline is the filter byte followed by the row; split it into stored blocks.
+    size_t offset    = 0;
+    size_t remaining = row_bytes + 1;
+    while(remaining > 0)
+    {
+      const auto n = static_cast<uint32_t>(std::min<size_t>(remaining, 65535));
+      put8(y + 1 == height && n == remaining ? 1 : 0); // BFINAL on the last block, BTYPE 00
+      put8(n & 0xff);
+      put8(n >> 8);
+      put8(~n & 0xff);
+      put8((~n >> 8) & 0xff);
+      size_t count = n;
+      if(offset == 0)
+      {
+        put8(filter);
+        --count;
+      }
+      const auto* src = row + (offset == 0 ? 0 : offset - 1);
+      out.insert(out.end(), src, src + count);
+      offset    += n;
+      remaining -= n;
+    }
+  }
+  put32((adler_b << 16) | adler_a);
+  end_chunk(chunk);
+
+  end_chunk(begin_chunk("IEND"));
+}
+
+struct FrameWriterStats
+{
+  uint64_t frames         = 0;   // files written
+  uint64_t failures       = 0;
+  uint64_t bytes          = 0;   // file bytes written
+  double   encode_seconds = 0.0; // encoding and writing, summed over the threads
+};
+
+/*
+  Image sequence writer for batch rendering
+
+  Encoder threads take headless frames off a queue as ReadbackLeases, encode them straight
+  out of the mapped readback buffer into `<prefix><number>.<ext>` (six-digit, zero padded
+  numbers) and hand the buffer back as soon as it has been read. The renderer keeps
+  recording meanwhile and only stalls when every frame context is still waiting to be written,
+  so frames in flight beyond the encoder count are what hides a slow disk.
+*/
+class FrameWriter
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  FrameWriter(std::string prefix, ImageFileFormat format, uint32_t thread_count)
+    : prefix_(std::move(prefix)), format_(format)
+  {
+    thread_count = std::max(thread_count, 1u);
+    for(uint32_t i = 0; i < thread_count; ++i)
+    {
+      threads_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  FrameWriter(const FrameWriter&) = delete;
+  FrameWriter& operator=(const FrameWriter&) = delete;
+
+  ~FrameWriter() { Finish(); }
+
+  // Queue a frame to be written as file `number`. Render thread; not after Finish().
+  void Submit(ReadbackLease lease, uint64_t number)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(Job{std::move(lease), number});
+    }
+    wake_.notify_one();
+  }
+
+  // Write everything queued, then stop the threads. Returns false if any frame failed.
+  bool Finish()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    wake_.notify_all();
+    for(auto& thread : threads_)
+    {
+      thread.join();
+    }
+    threads_.clear();
+    return Stats().failures == 0;
+  }
+
+  FrameWriterStats Stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  ImageFileFormat Format() const { return format_; }
+
+  std::string FileName(uint64_t number) const
+  {
+    char digits[32];
+    std::snprintf(digits, sizeof(digits), "%06llu", static_cast<unsigned long long>(number));
+    return prefix_ + digits + "." + ImageFileFormatName(format_);
+  }
+
+private:
+  struct Job
+  {
+    ReadbackLease lease;
+    uint64_t      number = 0;
+  };
+
+  void WorkerLoop()
+  {
+    std::vector<uint8_t> encoded; // reused across frames, so steady state does not allocate
+    for(;;)
+    {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+        if(queue_.empty())
+        {
+          return;
+        }
+        job = std::move(queue_.front());
+        queue_.pop_front();
+      }
+
+      const auto start = Clock::now();
+      const auto bytes = Write(job, encoded);
+      const auto end   = Clock::now();
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(bytes > 0)
+      {
+        ++stats_.frames;
+        stats_.bytes += bytes;
+      }
+      else
+      {
+        ++stats_.failures;
+      }
+      stats_.encode_seconds += std::chrono::duration<double>(end - start).count();
+    }
+  }
+
+  // Returns the file size, 0 on failure. Releases the lease as early as it can.
+  uint64_t Write(Job& job, std::vector<uint8_t>& encoded) const
+  {
+    const auto path = FileName(job.number);
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if(!ofs)
+    {
+      std::cerr << "Failed to write frame: " << path << std::endl;
+      return 0;
+    }
+
+    const auto&    lease = job.lease;
+    const uint8_t* data  = nullptr;
+    size_t         size  = 0;
+    switch(format_)
+    {
+      case ImageFileFormat::ePpm:
+        EncodePpm(lease.Data(), lease.Width(), lease.Height(), encoded);
+        break;
+      case ImageFileFormat::ePng:
+        EncodePng(lease.Data(), lease.Width(), lease.Height(), encoded);
+        break;
+      case ImageFileFormat::eRaw:
+        data = lease.Data();
+        size = lease.Size();
+        break;
+    }
+    if(!data)
+    {
+      // Encoded into our own buffer: the readback buffer can go back before the disk write.
+      job.lease.Release();
+      data = encoded.data();
+      size = encoded.size();
+    }
+    ofs.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    ofs.close();
+    job.lease.Release();
+    if(!ofs)
+    {
+      std::cerr << "Failed to write frame: " << path << std::endl;
+      return 0;
+    }
+    return size;
+  }
+
+  std::string                   prefix_;
+  ImageFileFormat               format_;
+  std::vector<std::thread>      threads_;
+  mutable std::mutex            mutex_;
+  std::condition_variable       wake_;
+  std::deque<Job>               queue_;
+  bool                          quit_ = false;
+  FrameWriterStats              stats_;
+};
@@ -0,0 +1,733 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "capabilities.h"
+#include "deletion_queue.h"
+#include "memory_allocator.h"
+#include "pipeline_manager.h"
+
+// Index range of one mesh in the shared index buffer. Matches MeshDraw in cull.comp.
+struct MeshDraw
+{
+  uint32_t index_count   = 0;
+  uint32_t first_index   = 0;
+  int32_t  vertex_offset = 0;
+  uint32_t padding       = 0;
+};
+
+// The culled test triangles; the index buffer only drives gl_VertexIndex, positions come from the shader.
+struct IndirectDrawPipeline
+{
+  static constexpr const char*                kVertexShader   = "triangle_indirect.vert.spv";
+  static constexpr const char*                kFragmentShader = "triangle.frag.spv";
+  static constexpr RasterState                kRaster         = RasterState().WithCullMode(vk::CullModeFlagBits::eNone);
+  static constexpr NoVertexInput              kVertex         = {};
+  static constexpr std::array<ShaderInput, 0> kInputs         = {};
+};
+
+/*
+  Static scene for the GPU-driven path, one array per attribute (SoA) so the culling pass
+  only touches the data it tests.
+*/
+struct GpuScene
+{
+  std::vector<std::array<float, 4>> transforms; // xy: offset, z: scale, w: depth (same as DrawItem)
+  std::vector<std::array<float, 4>> bounds;     // xyz: center in NDC, w: radius
+  std::vector<uint32_t>             mesh_ids;   // index into meshes
+  std::vector<MeshDraw>             meshes;
+  std::vector<uint16_t>             indices;
+};
+
+struct GpuDrivenStats
+{
+  uint32_t objects = 0;
+  uint32_t visible = 0; // survivors of the last collected frame
+};
+
+/*
+  GPU-driven draw path
+
+  Per frame:
+    RecordCull()         compute pass: frustum + occlusion test per object, writes
+                         VkDrawIndexedIndirectCommands (compacted when draw-indirect-count is available)
+    RecordDraws()        one vkCmdDrawIndexedIndirect(Count) inside the render pass
+    RecordDepthPyramid() max-reduces this frame's depth buffer into a mip chain that the
+                         next frame's occlusion test reads
+  CPU cost is a handful of commands regardless of object count.
+
+  RecordCull() may go to a command buffer for an async compute queue. Pass every queue family
+  that runs these passes as `queue_families`; with more than one, buffers and the pyramid are
+  created with concurrent sharing, so no per-frame ownership transfers are needed. The caller
+  orders the queues with semaphores (pyramid -> cull -> draws).
+
+  Occlusion uses the previous frame's depth without reprojection, so it only runs when the
+  camera is the one the pyramid was built with: the scene is static, which makes the test exact
+  then. It is off until a pyramid exists, in any frame whose camera moved (e.g. batch camera
+  paths) and when the depth buffer cannot be sampled.
+*/
+class GpuDrivenScene
+{
+public:
+  GpuDrivenScene(vk::Device                   device,
+                 DeviceAllocator&             allocator,
+                 PipelineManager&             pipelines,
+                 const DeviceCapabilities&    caps,
+                 vk::RenderPass               render_pass,
+                 vk::SampleCountFlagBits      samples,
+                 float                        min_sample_shading,
+                 vk::DescriptorSetLayout      frame_set_layout,
+                 vk::DescriptorSetLayout      bindless_layout,
+                 const std::string&           shader_dir,
+                 uint32_t                     frames_in_flight,
+                 vk::Queue                    queue,
+                 uint32_t                     queue_family_index,
+                 const std::vector<uint32_t>& queue_families,
+                 const GpuScene&              scene)
+    : device_(device), allocator_(allocator), pipelines_(pipelines), caps_(caps), queue_families_(queue_families)
+  {
+    object_count_ = static_cast<uint32_t>(scene.transforms.size());
+
+    /*
+      Descriptor set layouts / pipeline layouts
+    */
+    {
+      const auto draw_binding = vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1,
+                                                               vk::ShaderStageFlagBits::eVertex);
+      draw_set_layout_ = device_.createDescriptorSetLayoutUnique(
+        vk::DescriptorSetLayoutCreateInfo(vk::DescriptorSetLayoutCreateFlags(), 1, &draw_binding));
+      // Set 0 is the renderer's per-frame uniforms, shared with the CPU path's fragment shader; set 2 the bindless table, if any.
+      std::vector<vk::DescriptorSetLayout> draw_sets = {frame_set_layout, draw_set_layout_.get()};
+      if(bindless_layout)
+      {
+        draw_sets.push_back(bindless_layout);
+      }
+      draw_layout_ = device_.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(), static_cast<uint32_t>(draw_sets.size()), draw_sets.data()));
+
+      std::array<vk::DescriptorSetLayoutBinding, 6> cull_bindings;
+      for(uint32_t i = 0; i < 5; ++i)
+      {
+        cull_bindings[i] = vk::DescriptorSetLayoutBinding(i, vk::DescriptorType::eStorageBuffer, 1,
+                                                          vk::ShaderStageFlagBits::eCompute);
+      }
+      cull_bindings[5] = vk::DescriptorSetLayoutBinding(5, vk::DescriptorType::eCombinedImageSampler, 1,
+                                                        vk::ShaderStageFlagBits::eCompute);
+      cull_set_layout_ = device_.createDescriptorSetLayoutUnique(
+        vk::DescriptorSetLayoutCreateInfo(vk::DescriptorSetLayoutCreateFlags(),
+                                          static_cast<uint32_t>(cull_bindings.size()),
+                                          cull_bindings.data()));
+      const auto cull_push = vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullParams));
+      cull_layout_ = device_.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(), 1, &cull_set_layout_.get(), 1, &cull_push));
+
+      std::array<vk::DescriptorSetLayoutBinding, 2> pyramid_bindings;
+      pyramid_bindings[0] = vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1,
+                                                           vk::ShaderStageFlagBits::eCompute);
+      pyramid_bindings[1] = vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1,
+                                                           vk::ShaderStageFlagBits::eCompute);
+      pyramid_set_layout_ = device_.createDescriptorSetLayoutUnique(
+        vk::DescriptorSetLayoutCreateInfo(vk::DescriptorSetLayoutCreateFlags(),
+                                          static_cast<uint32_t>(pyramid_bindings.size()),
+                                          pyramid_bindings.data()));
+      const auto pyramid_push = vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(PyramidParams));
+      pyramid_layout_ = device_.createPipelineLayoutUnique(
+        vk::PipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(), 1, &pyramid_set_layout_.get(), 1, &pyramid_push));
+    }
+
+    /*
+      Pipelines, compiled in the background like every other pipeline
+    */
+    {
+      PipelineState cull;
+      cull.compute_shader = shader_dir + "/cull.comp.spv";
+      cull.layout         = cull_layout_.get();
+      cull.specialization = {{kConstantCompact, Compact() ? 1u : 0u}};
+      cull_pipeline_      = pipelines_.Request(cull);
+
+      PipelineState pyramid;
+      pyramid.compute_shader = shader_dir + "/depth_pyramid.comp.spv";
+      pyramid.layout         = pyramid_layout_.get();
+      pyramid_pipeline_      = pipelines_.Request(pyramid);
+
+      draw_pipeline_ = pipelines_.Request(GraphicsPipelineTemplate<IndirectDrawPipeline>::State(
+        shader_dir, draw_layout_.get(), render_pass, samples, min_sample_shading));
+    }
+
+    /*
+      Descriptor pool
+      Only the draw set; the cull and pyramid sets point at the depth pyramid and live in its own pool.
+    */
+    {
+      const auto size  = vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 1);
+      descriptor_pool_ = device_.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlags(), 1, 1, &size));
+    }
+
+    /*
+      Scene buffers (device local, uploaded once)
+    */
+    {
+      const auto storage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+      transforms_ = CreateBuffer(ByteSize(scene.transforms), storage, MemoryUsage::eGpuOnly);
+      bounds_     = CreateBuffer(ByteSize(scene.bounds), storage, MemoryUsage::eGpuOnly);
+      mesh_ids_   = CreateBuffer(ByteSize(scene.mesh_ids), storage, MemoryUsage::eGpuOnly);
+      meshes_     = CreateBuffer(ByteSize(scene.meshes), storage, MemoryUsage::eGpuOnly);
+      indices_    = CreateBuffer(ByteSize(scene.indices),
+                                 vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                                 MemoryUsage::eGpuOnly);
+
+      Upload(queue, queue_family_index,
+             {{&transforms_, scene.transforms.data(), ByteSize(scene.transforms)},
+              {&bounds_, scene.bounds.data(), ByteSize(scene.bounds)},
+              {&mesh_ids_, scene.mesh_ids.data(), ByteSize(scene.mesh_ids)},
+              {&meshes_, scene.meshes.data(), ByteSize(scene.meshes)},
+              {&indices_, scene.indices.data(), ByteSize(scene.indices)}});
+
+      const auto set = device_.allocateDescriptorSets(
+        vk::DescriptorSetAllocateInfo(descriptor_pool_.get(), 1, &draw_set_layout_.get()))[0];
+      draw_set_ = set;
+      const auto info = vk::DescriptorBufferInfo(transforms_.buffer.get(), 0, VK_WHOLE_SIZE);
+      device_.updateDescriptorSets(
+        vk::WriteDescriptorSet(draw_set_, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &info), nullptr);
+    }
+
+    /*
+      Per frame context: indirect commands, draw count and its readback
+    */
+    {
+      const auto command_bytes = std::max<vk::DeviceSize>(vk::DeviceSize(object_count_) * sizeof(vk::DrawIndexedIndirectCommand), 16);
+      frames_.resize(frames_in_flight);
+      for(auto& frame : frames_)
+      {
+        frame.commands = CreateBuffer(command_bytes,
+                                      vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+                                      MemoryUsage::eGpuOnly);
+        frame.count    = CreateBuffer(sizeof(uint32_t),
+                                      vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+                                        vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+                                      MemoryUsage::eGpuOnly);
+        frame.count_readback = CreateBuffer(sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst, MemoryUsage::eGpuToCpu);
+      }
+    }
+
+    const auto sampler_ci = vk::SamplerCreateInfo(vk::SamplerCreateFlags(),
+                                                  vk::Filter::eNearest,
+                                                  vk::Filter::eNearest,
+                                                  vk::SamplerMipmapMode::eNearest,
+                                                  vk::SamplerAddressMode::eClampToEdge,
+                                                  vk::SamplerAddressMode::eClampToEdge,
+                                                  vk::SamplerAddressMode::eClampToEdge,
+                                                  0.0f,
+                                                  VK_FALSE,
+                                                  1.0f,
+                                                  VK_FALSE,
+                                                  vk::CompareOp::eNever,
+                                                  0.0f,
+                                                  static_cast<float>(kMaxPyramidLevels));
+    sampler_ = device_.createSamplerUnique(sampler_ci);
+
+    stats_.objects = object_count_;
+  }
+
+  GpuDrivenScene(const GpuDrivenScene&) = delete;
+  GpuDrivenScene& operator=(const GpuDrivenScene&) = delete;
+
+  ~GpuDrivenScene()
+  {
+    for(auto& frame : frames_)
+    {
+      DestroyBuffer(frame.commands);
+      DestroyBuffer(frame.count);
+      DestroyBuffer(frame.count_readback);
+    }
+    DestroyBuffer(transforms_);
+    DestroyBuffer(bounds_);
+    DestroyBuffer(mesh_ids_);
+    DestroyBuffer(meshes_);
+    DestroyBuffer(indices_);
+    DestroyPyramid(allocator_, pyramid_);
+  }
+
+  /*
+    (Re)build the depth pyramid for a depth buffer. Call again after the depth buffer is
+    recreated (swapchain resize). `sampleable`: the depth image has eSampled usage.
+    The new pyramid comes with its own descriptor sets, so nothing a frame in flight uses is
+    rewritten: the old pyramid and its sets go to `deletion_queue` for `frame_count`, like
+    the depth buffer they were built for, and the device keeps running.
+  */
+  void SetDepthBuffer(vk::ImageView depth_view, vk::Extent2D extent, bool sampleable, DeletionQueue& deletion_queue, uint64_t frame_count)
+  {
+    if(pyramid_.image)
+    {
+      auto& allocator = allocator_;
+      deletion_queue.Defer(frame_count, [old = std::move(pyramid_), &allocator]() mutable { DestroyPyramid(allocator, old); });
+      pyramid_ = Pyramid();
+    }
+    depth_sampleable_ = sampleable;
+    pyramid_valid_    = false;
+
+    pyramid_.extent = extent;
+    pyramid_.levels = 1;
+    while(pyramid_.levels < kMaxPyramidLevels && std::max(extent.width, extent.height) >> pyramid_.levels)
+    {
+      ++pyramid_.levels;
+    }
+
+    auto image_ci = vk::ImageCreateInfo(vk::ImageCreateFlags(),
+                                        vk::ImageType::e2D,
+                                        vk::Format::eR32Sfloat,
+                                        vk::Extent3D(extent.width, extent.height, 1),
+                                        pyramid_.levels,
+                                        1,
+                                        vk::SampleCountFlagBits::e1,
+                                        vk::ImageTiling::eOptimal,
+                                        vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled);
+    SetSharing(image_ci);
+    pyramid_.image      = device_.createImageUnique(image_ci);
+    pyramid_.allocation = allocator_.AllocateForImage(pyramid_.image.get(), MemoryUsage::eGpuOnly);
+
+    auto view_ci = vk::ImageViewCreateInfo(vk::ImageViewCreateFlags(),
+                                           pyramid_.image.get(),
+                                           vk::ImageViewType::e2D,
+                                           vk::Format::eR32Sfloat,
+                                           vk::ComponentMapping(),
+                                           vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, pyramid_.levels, 0, 1));
+    pyramid_.view = device_.createImageViewUnique(view_ci);
+    for(uint32_t level = 0; level < pyramid_.levels; ++level)
+    {
+      view_ci.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1));
+      pyramid_.level_views.push_back(device_.createImageViewUnique(view_ci));
+    }
+
+    // One set per level and one cull set per frame context.
+    const auto frame_count_sets = static_cast<uint32_t>(frames_.size());
+    const std::array<vk::DescriptorPoolSize, 3> sizes = {
+      vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 5 * frame_count_sets),
+      vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, frame_count_sets + pyramid_.levels),
+      vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, pyramid_.levels)};
+    pyramid_.descriptor_pool = device_.createDescriptorPoolUnique(
+      vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlags(),
+                                   frame_count_sets + pyramid_.levels,
+                                   static_cast<uint32_t>(sizes.size()),
+                                   sizes.data()));
+    const std::vector<vk::DescriptorSetLayout> level_layouts(pyramid_.levels, pyramid_set_layout_.get());
+    pyramid_.level_sets = device_.allocateDescriptorSets(
+      vk::DescriptorSetAllocateInfo(pyramid_.descriptor_pool.get(), pyramid_.levels, level_layouts.data()));
+    const std::vector<vk::DescriptorSetLayout> cull_layouts(frame_count_sets, cull_set_layout_.get());
+    pyramid_.cull_sets = device_.allocateDescriptorSets(
+      vk::DescriptorSetAllocateInfo(pyramid_.descriptor_pool.get(), frame_count_sets, cull_layouts.data()));
+
+    // Without sampled usage the depth view must not go into a descriptor; the pyramid is never built then.
+    for(uint32_t level = 0; level < pyramid_.levels && depth_sampleable_; ++level)
+    {
+      // Level 0 reads the depth buffer, every other level the one above it.
+      const auto source = level == 0
+                          ? vk::DescriptorImageInfo(sampler_.get(), depth_view, vk::ImageLayout::eShaderReadOnlyOptimal)
+                          : vk::DescriptorImageInfo(sampler_.get(), pyramid_.level_views[level - 1].get(), vk::ImageLayout::eGeneral);
+      const auto destination = vk::DescriptorImageInfo(vk::Sampler(), pyramid_.level_views[level].get(), vk::ImageLayout::eGeneral);
+      const std::array<vk::WriteDescriptorSet, 2> writes = {
+        vk::WriteDescriptorSet(pyramid_.level_sets[level], 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &source),
+        vk::WriteDescriptorSet(pyramid_.level_sets[level], 1, 0, 1, vk::DescriptorType::eStorageImage, &destination)};
+      device_.updateDescriptorSets(writes, nullptr);
+    }
+
+    for(size_t slot = 0; slot < frames_.size(); ++slot)
+    {
+      const auto& frame    = frames_[slot];
+      const auto  cull_set = pyramid_.cull_sets[slot];
+      const std::array<vk::DescriptorBufferInfo, 5> buffers = {
+        vk::DescriptorBufferInfo(bounds_.buffer.get(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(mesh_ids_.buffer.get(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(meshes_.buffer.get(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(frame.commands.buffer.get(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(frame.count.buffer.get(), 0, VK_WHOLE_SIZE)};
+      const auto pyramid = vk::DescriptorImageInfo(sampler_.get(), pyramid_.view.get(), vk::ImageLayout::eGeneral);
+      std::array<vk::WriteDescriptorSet, 6> writes;
+      for(uint32_t i = 0; i < 5; ++i)
+      {
+        writes[i] = vk::WriteDescriptorSet(cull_set, i, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &buffers[i]);
+      }
+      writes[5] = vk::WriteDescriptorSet(cull_set, 5, 0, 1, vk::DescriptorType::eCombinedImageSampler, &pyramid);
+      device_.updateDescriptorSets(writes, nullptr);
+    }
+  }
+
+  // True once the culling and draw pipelines have compiled.
+  bool Ready() const { return pipelines_.Get(cull_pipeline_) && pipelines_.Get(draw_pipeline_); }
+
+  // Read the survivor count of the frame context that just came round again (its fence has signaled).
+  void Collect(uint32_t slot)
+  {
+    auto& frame = frames_[slot];
+    if(!frame.culled)
+    {
+      return;
+    }
+    allocator_.Invalidate(frame.count_readback.allocation);
+    std::memcpy(&stats_.visible, frame.count_readback.allocation.mapped, sizeof(uint32_t));
+    frame.culled = false;
+  }
+
+  // Record the culling pass. Must be outside a render pass. `camera` is the frame's FrameUniforms::camera.
+  void RecordCull(vk::CommandBuffer command_buffer, uint32_t slot, const std::array<float, 4>& camera)
+  {
+    auto&      frame    = frames_[slot];
+    const auto pipeline = pipelines_.Get(cull_pipeline_);
+    if(!pipeline || object_count_ == 0)
+    {
+      return;
+    }
+
+    command_buffer.fillBuffer(frame.count.buffer.get(), 0, sizeof(uint32_t), 0);
+    // Clear of the count, and the previous frame's pyramid build, before the culling reads them.
+    const auto before = vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite,
+                                          vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::DependencyFlags(),
+                                   before,
+                                   nullptr,
+                                   nullptr);
+
+    CullParams params;
+    params.object_count   = object_count_;
+    params.flags          = pyramid_valid_ && camera == pyramid_camera_ ? kFlagOcclusion : 0u;
+    params.pyramid_levels = pyramid_.levels;
+    params.pyramid_width  = static_cast<float>(pyramid_.extent.width);
+    params.pyramid_height = static_cast<float>(pyramid_.extent.height);
+    params.camera         = camera;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cull_layout_.get(), 0, pyramid_.cull_sets[slot], nullptr);
+    command_buffer.pushConstants(cull_layout_.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+    command_buffer.dispatch((object_count_ + 63) / 64, 1, 1);
+
+    const auto after = vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite,
+                                         vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eTransferRead);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eTransfer,
+                                   vk::DependencyFlags(),
+                                   after,
+                                   nullptr,
+                                   nullptr);
+
+    command_buffer.copyBuffer(frame.count.buffer.get(), frame.count_readback.buffer.get(),
+                              vk::BufferCopy(0, 0, sizeof(uint32_t)));
+    const auto host = vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eHost,
+                                   vk::DependencyFlags(),
+                                   host,
+                                   nullptr,
+                                   nullptr);
+    frame.culled = true;
+  }
+
+  // Record the draws inside the render pass (inline contents). `bindless_set` is null without a bindless layout.
+  void RecordDraws(vk::CommandBuffer command_buffer,
+                   uint32_t          slot,
+                   vk::Extent2D      extent,
+                   vk::DescriptorSet frame_set,
+                   uint32_t          frame_uniform_offset,
+                   vk::DescriptorSet bindless_set = vk::DescriptorSet())
+  {
+    auto&      frame    = frames_[slot];
+    const auto pipeline = pipelines_.Get(draw_pipeline_);
+    if(!pipeline || !frame.culled)
+    {
+      return;
+    }
+
+    const auto viewport = vk::Viewport(0.0f, 0.0f,
+                                       static_cast<float>(extent.width),
+                                       static_cast<float>(extent.height),
+                                       0.0f, 1.0f);
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    command_buffer.setViewport(0, viewport);
+    command_buffer.setScissor(0, vk::Rect2D(vk::Offset2D(0, 0), extent));
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, draw_layout_.get(), 0,
+                                      {frame_set, draw_set_}, frame_uniform_offset);
+    if(bindless_set)
+    {
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, draw_layout_.get(), 2, bindless_set, nullptr);
+    }
+    command_buffer.bindIndexBuffer(indices_.buffer.get(), 0, vk::IndexType::eUint16);
+
+    const auto stride = static_cast<uint32_t>(sizeof(vk::DrawIndexedIndirectCommand));
+    if(Compact())
+    {
+      command_buffer.drawIndexedIndirectCountKHR(frame.commands.buffer.get(), 0,
+                                                 frame.count.buffer.get(), 0,
+                                                 object_count_, stride);
+      return;
+    }
+    // Every object has a slot; culled ones draw zero instances. Split at the device's drawCount limit.
+    const auto max_draws = std::max(1u, caps_.properties.limits.maxDrawIndirectCount);
+    for(uint32_t first = 0; first < object_count_; first += max_draws)
+    {
+      const auto count = std::min(max_draws, object_count_ - first);
+      command_buffer.drawIndexedIndirect(frame.commands.buffer.get(), vk::DeviceSize(first) * stride, count, stride);
+    }
+  }
+
+  /*
+    Build the depth pyramid from the depth buffer the render pass just wrote.
+    The depth image must already be in eShaderReadOnlyOptimal and visible to compute shaders
+    (the render graph's main pass ends that way when the pyramid reads depth).
+    `camera` is the frame's FrameUniforms::camera; RecordCull() only tests against a pyramid of the same camera.
+  */
+  void RecordDepthPyramid(vk::CommandBuffer command_buffer, const std::array<float, 4>& camera)
+  {
+    const auto pipeline = pipelines_.Get(pyramid_pipeline_);
+    if(!pipeline || !depth_sampleable_)
+    {
+      return;
+    }
+
+    // The pyramid is rebuilt from scratch; the previous contents (last frame's culling input) are discarded.
+    const auto to_write = vk::ImageMemoryBarrier(vk::AccessFlagBits::eShaderRead,
+                                                 vk::AccessFlagBits::eShaderWrite,
+                                                 vk::ImageLayout::eUndefined,
+                                                 vk::ImageLayout::eGeneral,
+                                                 VK_QUEUE_FAMILY_IGNORED,
+                                                 VK_QUEUE_FAMILY_IGNORED,
+                                                 pyramid_.image.get(),
+                                                 vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, pyramid_.levels, 0, 1));
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::DependencyFlags(),
+                                   nullptr,
+                                   nullptr,
+                                   to_write);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    auto source = pyramid_.extent;
+    for(uint32_t level = 0; level < pyramid_.levels; ++level)
+    {
+      const auto destination = vk::Extent2D(std::max(1u, pyramid_.extent.width >> level),
+                                            std::max(1u, pyramid_.extent.height >> level));
+      PyramidParams params;
+      params.source_width       = static_cast<int32_t>(source.width);
+      params.source_height      = static_cast<int32_t>(source.height);
+      params.destination_width  = static_cast<int32_t>(destination.width);
+      params.destination_height = static_cast<int32_t>(destination.height);
+
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pyramid_layout_.get(), 0, pyramid_.level_sets[level], nullptr);
+      command_buffer.pushConstants(pyramid_layout_.get(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+      command_buffer.dispatch((destination.width + 7) / 8, (destination.height + 7) / 8, 1);
+
+      // The next level reads this one.
+      const auto barrier = vk::ImageMemoryBarrier(vk::AccessFlagBits::eShaderWrite,
+                                                  vk::AccessFlagBits::eShaderRead,
+                                                  vk::ImageLayout::eGeneral,
+                                                  vk::ImageLayout::eGeneral,
+                                                  VK_QUEUE_FAMILY_IGNORED,
+                                                  VK_QUEUE_FAMILY_IGNORED,
+                                                  pyramid_.image.get(),
+                                                  vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1));
+      command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                     vk::PipelineStageFlagBits::eComputeShader,
+                                     vk::DependencyFlags(),
+                                     nullptr,
+                                     nullptr,
+                                     barrier);
+      source = destination;
+    }
+    pyramid_valid_  = true;
+    pyramid_camera_ = camera;
+  }
+
+  // Compacted commands + vkCmdDrawIndexedIndirectCount, or one slot per object without the extension.
+  bool Compact() const { return caps_.draw_indirect_count && object_count_ <= caps_.properties.limits.maxDrawIndirectCount; }
+
+  const GpuDrivenStats& Stats() const { return stats_; }
+
+private:
+  static constexpr uint32_t kMaxPyramidLevels = 16;
+  static constexpr uint32_t kFlagOcclusion    = 1;
+  // Specialization constant ids in cull.comp
+  static constexpr uint32_t kConstantCompact  = 0;
+
+  // Matches the push constant blocks in cull.comp and depth_pyramid.comp.
+  struct CullParams
+  {
+    uint32_t             object_count   = 0;
+    uint32_t             flags          = 0;
+    uint32_t             pyramid_levels = 0;
+    uint32_t             padding        = 0;
+    float                pyramid_width  = 0.0f;
+    float                pyramid_height = 0.0f;
+    float                padding2[2]    = {}; // std430: the vec4 starts at 32
+    std::array<float, 4> camera         = {0.0f, 0.0f, 1.0f, 0.0f};
+  };
+
+  struct PyramidParams
+  {
+    int32_t source_width       = 0;
+    int32_t source_height      = 0;
+    int32_t destination_width  = 0;
+    int32_t destination_height = 0;
+  };
+
+  struct Buffer
+  {
+    vk::UniqueBuffer buffer;
+    Allocation       allocation;
+  };
+
+  struct FrameResources
+  {
+    Buffer            commands;
+    Buffer            count;
+    Buffer            count_readback;
+    bool              culled = false; // RecordCull() ran since the last Collect()
+  };
+
+  // The depth pyramid of one depth buffer and the descriptor sets pointing at it. Replaced as a whole on resize.
+  struct Pyramid
+  {
+    vk::UniqueImage                  image;
+    Allocation                       allocation;
+    vk::UniqueImageView              view;
+    std::vector<vk::UniqueImageView> level_views;
+    vk::UniqueDescriptorPool         descriptor_pool; // level_sets and cull_sets
+    std::vector<vk::DescriptorSet>   level_sets;
+    std::vector<vk::DescriptorSet>   cull_sets;       // by frame context
+    vk::Extent2D                     extent;
+    uint32_t                         levels = 1;
+  };
+
+  struct PendingUpload
+  {
+    Buffer*        destination;
+    const void*    data;
+    vk::DeviceSize size;
+  };
+
+  template <typename T>
+  static vk::DeviceSize ByteSize(const std::vector<T>& v)
+  {
+    return vk::DeviceSize(v.size()) * sizeof(T);
+  }
+
+  Buffer CreateBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryUsage memory_usage)
+  {
+    Buffer buffer;
+    // Zero-sized buffers are invalid; an empty scene still gets bindable descriptors.
+    auto ci = vk::BufferCreateInfo(vk::BufferCreateFlags(), std::max<vk::DeviceSize>(size, 16), usage, vk::SharingMode::eExclusive);
+    SetSharing(ci);
+    buffer.buffer     = device_.createBufferUnique(ci);
+    buffer.allocation = allocator_.AllocateForBuffer(buffer.buffer.get(), memory_usage);
+    return buffer;
+  }
+
+  // Concurrent sharing between the graphics and async compute families, when both are in use.
+  template <typename CreateInfo>
+  void SetSharing(CreateInfo& ci) const
+  {
+    if(queue_families_.size() > 1)
+    {
+      ci.setSharingMode(vk::SharingMode::eConcurrent);
+      ci.setQueueFamilyIndexCount(static_cast<uint32_t>(queue_families_.size()));
+      ci.setPQueueFamilyIndices(queue_families_.data());
+    }
+  }
+
+  void DestroyBuffer(Buffer& buffer)
+  {
+    buffer.buffer.reset();
+    if(buffer.allocation)
+    {
+      allocator_.Free(buffer.allocation);
+    }
+  }
+
+  static void DestroyPyramid(DeviceAllocator& allocator, Pyramid& pyramid)
+  {
+    pyramid.descriptor_pool.reset();
+    pyramid.level_views.clear();
+    pyramid.view.reset();
+    pyramid.image.reset();
+    if(pyramid.allocation)
+    {
+      allocator.Free(pyramid.allocation);
+    }
+  }
+
+  // Copy through host-visible staging buffers in one submission and wait for it. Startup only.
+  void Upload(vk::Queue queue, uint32_t queue_family_index, const std::vector<PendingUpload>& uploads)
+  {
+    const auto pool = device_.createCommandPoolUnique(
+      vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient, queue_family_index));
+    auto command_buffer = std::move(device_.allocateCommandBuffersUnique(
+      vk::CommandBufferAllocateInfo(pool.get(), vk::CommandBufferLevel::ePrimary, 1))[0]);
+    command_buffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+    std::vector<Buffer> staging;
+    staging.reserve(uploads.size());
+    for(const auto& upload : uploads)
+    {
+      if(upload.size == 0)
+      {
+        continue;
+      }
+      staging.push_back(CreateBuffer(upload.size, vk::BufferUsageFlagBits::eTransferSrc, MemoryUsage::eCpuToGpu));
+      auto& source = staging.back();
+      std::memcpy(source.allocation.mapped, upload.data, static_cast<size_t>(upload.size));
+      allocator_.Flush(source.allocation);
+      command_buffer->copyBuffer(source.buffer.get(), upload.destination->buffer.get(), vk::BufferCopy(0, 0, upload.size));
+    }
+    command_buffer->end();
+
+    const auto fence = device_.createFenceUnique(vk::FenceCreateInfo());
+    queue.submit(vk::SubmitInfo(0, nullptr, nullptr, 1, &command_buffer.get()), fence.get());
+    device_.waitForFences(fence.get(), VK_TRUE, UINT64_MAX);
+
+    for(auto& buffer : staging)
+    {
+      DestroyBuffer(buffer);
+    }
+  }
+
+  vk::Device                           device_;
+  DeviceAllocator&                     allocator_;
+  PipelineManager&                     pipelines_;
+  DeviceCapabilities                   caps_;
+  std::vector<uint32_t>                queue_families_;
+  uint32_t                             object_count_ = 0;
+
+  vk::UniqueDescriptorSetLayout        draw_set_layout_;
+  vk::UniquePipelineLayout             draw_layout_;
+  vk::UniqueDescriptorSetLayout        cull_set_layout_;
+  vk::UniquePipelineLayout             cull_layout_;
+  vk::UniqueDescriptorSetLayout        pyramid_set_layout_;
+  vk::UniquePipelineLayout             pyramid_layout_;
+  PipelineHandle                       cull_pipeline_    = 0;
+  PipelineHandle                       pyramid_pipeline_ = 0;
+  PipelineHandle                       draw_pipeline_    = 0;
+
+  vk::UniqueDescriptorPool             descriptor_pool_;
+  vk::DescriptorSet                    draw_set_;
+  vk::UniqueSampler                    sampler_;
+
+  Buffer                               transforms_;
+  Buffer                               bounds_;
+  Buffer                               mesh_ids_;
+  Buffer                               meshes_;
+  Buffer                               indices_;
+  std::vector<FrameResources>          frames_;
+
+  Pyramid                              pyramid_;
+  bool                                 depth_sampleable_ = false;
+  bool                                 pyramid_valid_    = false;
+  std::array<float, 4>                 pyramid_camera_   = {}; // camera of the frame the pyramid was built from
+
+  GpuDrivenStats                       stats_;
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+  Work-stealing job system
+
+  Each thread owns a deque. The owner pops from the back (LIFO, cache friendly),
+  idle threads steal from the front of other deques.
+  Thread index 0 is the thread calling ParallelFor() (the render thread); it helps
+  run jobs while it waits, so ThreadCount() == worker_count + 1.
+  Jobs get their thread index so they can use per-thread resources (e.g. command pools)
+  without locking. ParallelFor() must only be called from thread 0.
+*/
+class JobSystem
+{
+public:
+  using Function = std::function<void(uint32_t index, uint32_t thread_index)>;
+
+  explicit JobSystem(uint32_t worker_count = 0)
+  {
+    if(worker_count == 0)
+    {
+      const auto cores = std::thread::hardware_concurrency();
+      worker_count     = cores > 1 ? cores - 1 : 0;
+    }
+    queues_.reserve(worker_count + 1);
+    for(uint32_t i = 0; i < worker_count + 1; ++i)
+    {
+      queues_.push_back(std::make_unique<Queue>());
+    }
+    for(uint32_t i = 0; i < worker_count; ++i)
+    {
+      workers_.emplace_back([this, i] { WorkerLoop(i + 1); });
+    }
+  }
+
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  ~JobSystem()
+  {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex_);
+      quit_ = true;
+    }
+    wake_cv_.notify_all();
+    for(auto& worker : workers_)
+    {
+      worker.join();
+    }
+  }
+
+  uint32_t ThreadCount() const { return static_cast<uint32_t>(queues_.size()); }
+
+  // Run fn(i, thread_index) for i in [0, count) and return when all calls have finished.
+  void ParallelFor(uint32_t count, const Function& fn)
+  {
+    if(count == 0)
+    {
+      return;
+    }
+    std::atomic<uint32_t> remaining(count);
+
+    // Count the jobs before publishing them so a worker popping one never drives queued_ below zero.
+    queued_.fetch_add(count);
+    // Deal the jobs out round-robin so every thread starts with local work.
+    for(uint32_t i = 0; i < count; ++i)
+    {
+      auto& queue = *queues_[i % queues_.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(Task{&fn, i, &remaining});
+    }
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex_);
+    }
+    wake_cv_.notify_all();
+
+    while(remaining.load() > 0)
+    {
+      if(!RunOne(0))
+      {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+private:
+  struct Task
+  {
+    const Function*        fn;
+    uint32_t               index;
+    std::atomic<uint32_t>* remaining;
+  };
+
+  struct Queue
+  {
+    std::mutex       mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool PopLocal(uint32_t thread_index, Task* task)
+  {
+    auto& queue = *queues_[thread_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.tasks.empty())
+    {
+      return false;
+    }
+    *task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool Steal(uint32_t thread_index, Task* task)
+  {
+    const auto count = static_cast<uint32_t>(queues_.size());
+    for(uint32_t i = 1; i < count; ++i)
+    {
+      auto& queue = *queues_[(thread_index + i) % count];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if(!queue.tasks.empty())
+      {
+        *task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool RunOne(uint32_t thread_index)
+  {
+    Task task;
+    if(!PopLocal(thread_index, &task) && !Steal(thread_index, &task))
+    {
+      return false;
+    }
+    queued_.fetch_sub(1);
+    (*task.fn)(task.index, thread_index);
+    task.remaining->fetch_sub(1);
+    return true;
+  }
+
+  void WorkerLoop(uint32_t thread_index)
+  {
+    for(;;)
+    {
+      if(RunOne(thread_index))
+      {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(wake_mutex_);
+      wake_cv_.wait(lock, [this] { return quit_ || queued_.load() > 0; });
+      if(quit_)
+      {
+        return;
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread>            workers_;
+  std::atomic<uint32_t>               queued_{0};
+  std::mutex                          wake_mutex_;
+  std::condition_variable             wake_cv_;
+  bool                                quit_ = false;
+};
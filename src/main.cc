@@ -1,551 +1,460 @@
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
 
 #define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
 #include "vulkan.hpp"
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
-#define GLFW_INCLUDE_VULKAN
-#include <GLFW/glfw3.h>
-#include <GLFW/glfw3native.h>
+#include "camera_path.h"
+#include "frame_writer.h"
+#include "vk_renderer.h"
 
-constexpr uint32_t kWidth  = 512;
-constexpr uint32_t kHeight = 512;
 GLFWwindow* window = nullptr;
 
-static VKAPI_ATTR VkBool32 VKAPI_CALL DebugMessageCallback(VkDebugReportFlagsEXT      flags,
-                                                           VkDebugReportObjectTypeEXT objectType,
-                                                           uint64_t object, size_t location,
-                                                           int32_t     messageCode,
-                                                           const char *pLayerPrefix,
-                                                           const char *pMessage, void *pUserData)
-{
-  VkBool32 ret = VK_FALSE;
-  if (flags & VK_DEBUG_REPORT_INFORMATION_BIT_EXT ||
-    flags & VK_DEBUG_REPORT_DEBUG_BIT_EXT)
-  {
-    ret = VK_TRUE;
-  }
-  std::stringstream ss;
-  if (pLayerPrefix)
-  {
-    ss << "[" << pLayerPrefix << "] ";
-  }
-  ss << pMessage << std::endl;
-  std::cerr << ss.str().c_str() << std::endl;
-
-  return ret;
-}
-
-class VkRenderer
+int main(int argc, char *argv[])
 {
-public:
-  VkRenderer()
+  RendererConfig           config;
+  bool                     frames_in_flight_set = false;
+  uint32_t                 frame_count          = 1;
+  std::string              trace_path;
+  std::string              test_mesh_path;
+  uint32_t                 test_mesh_segments   = 512;
+  std::vector<std::string> texture_paths;
+  std::string              test_texture_path;
+  uint32_t                 test_texture_size    = 2048;
+  // Batch mode: render frames [first_frame, last_frame] along camera_path into an image sequence.
+  bool                     batch                = false;
+  uint64_t                 first_frame          = 0;
+  uint64_t                 last_frame           = 0;
+  CameraPath               camera_path;
+  std::string              output_prefix        = "frame_";
+  ImageFileFormat          output_format        = ImageFileFormat::ePng;
+  uint32_t                 encoder_threads      = 2;
+  for (int i = 1; i < argc; ++i)
   {
-    /*
-      Instance creation
-    */
+    const std::string arg = argv[i];
+    if (arg == "--headless")
     {
-      const auto appinfo = vk::ApplicationInfo(nullptr, 1, nullptr, 1, VK_API_VERSION_1_1);
-
-      // Enable all extensions
-      std::vector<const char*> extension_names;
-      auto extensions = vk::enumerateInstanceExtensionProperties();
-
-      std::cout << "Instance Extensions:" << std::endl;
-      for (auto const &ep : extensions)
-      {
-        std::cout << ep.extensionName << ":" << std::endl;
-        std::cout << "\tVersion: " << ep.specVersion << std::endl;
-        std::cout << std::endl;
-        extension_names.push_back(ep.extensionName);
-      }
-
-      uint32_t layer_count = 1;
-      const char* validationLayers[] = { "VK_LAYER_LUNARG_standard_validation" };
-
-      std::vector<const char*> layers;
-#ifdef DEBUG
-      layers.push_back("VK_LAYER_LUNARG_standard_validation");
-#endif // DEBUG
-
-      auto instance_create_info = vk::InstanceCreateInfo({},
-                                                         &appinfo,
-                                                         static_cast<uint32_t>(layers.size()),
-                                                         layers.data(),
-                                                         static_cast<uint32_t>(extensions.size()),
-                                                         extension_names.data());
-      instance_ = vk::createInstanceUnique(instance_create_info);
-      VULKAN_HPP_DEFAULT_DISPATCHER.init(instance_.get());
+      config.headless = true;
     }
-
-    /*
-      Select physical device
-    */
+    else if (arg.rfind("--frames-in-flight=", 0) == 0)
     {
-      // Use first device.
-      physical_device_ = instance_->enumeratePhysicalDevices()[0];
-      physical_device_memory_properties_ = physical_device_.getMemoryProperties();
+      config.frames_in_flight = static_cast<uint32_t>(std::stoul(arg.substr(19)));
+      frames_in_flight_set    = true;
     }
-
-    /*
-      Find graphics queue index
-    */
+    else if (arg.rfind("--objects=", 0) == 0)
     {
-      const auto queue_family_properties = physical_device_.getQueueFamilyProperties();
-      for(int i = 0; i < queue_family_properties.size(); ++i)
-      {
-        if(queue_family_properties[i].queueFlags & vk::QueueFlagBits::eGraphics)
-        {
-          graphics_queue_index_ = i;
-          break;
-        }
-      }
-      // TODO : Error process here
+      config.object_count = static_cast<uint32_t>(std::stoul(arg.substr(10)));
     }
-
-#ifdef DEBUG
+    else if (arg == "--occluder")
     {
-      const auto ci = vk::DebugReportCallbackCreateInfoEXT({}, &DebugMessageCallback,  nullptr);
-      instance_->createDebugReportCallbackEXT(ci);
+      config.occluder = true;
     }
-#endif
-
-    /*
-      Create logical device
-    */
+    else if (arg == "--cpu-draws")
     {
-      const float default_queue_priority(1.0f);
-      auto queue_ci = vk::DeviceQueueCreateInfo({}, graphics_queue_index_, 1, &default_queue_priority);
-
-      std::vector<const char*> extensions;
-      {
-        // Get all device extensions
-        const auto ext_properties = physical_device_.enumerateDeviceExtensionProperties();
-        for(const auto& p : ext_properties)
-        {
-          extensions.push_back(p.extensionName);
-        }
-      }
-
-      auto device_ci = vk::DeviceCreateInfo();
-      device_ci.setPQueueCreateInfos(&queue_ci);
-      device_ci.setQueueCreateInfoCount(1);
-      device_ci.setPpEnabledExtensionNames(extensions.data());
-      device_ci.setEnabledExtensionCount(extensions.size());
-
-      device_ = physical_device_.createDeviceUnique(device_ci);
-      VULKAN_HPP_DEFAULT_DISPATCHER.init(device_.get());
+      config.gpu_driven = false;
     }
-
-    /*
-      Get device queue
-    */
+    else if (arg == "--no-async-compute")
     {
-      device_->getQueue(graphics_queue_index_, 0, &device_queue_);
+      config.async_compute = false;
     }
-
-    /*
-      Command Pool creation
-      Command Buffer creation
-      Fence for command buffer
-      GPU に命令を送るコマンドバッファを保持するもの
-    */
-    {
-      auto pool_ci = vk::CommandPoolCreateInfo({}, graphics_queue_index_);
-      pool_ci.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
-      command_pool_ = device_->createCommandPoolUnique(pool_ci);
-
-      // Allocate command buffer from the command pool.
-      const auto buffer_ci = vk::CommandBufferAllocateInfo(command_pool_.get(),
-                                                           vk::CommandBufferLevel::ePrimary,
-                                                           1);
-      command_buffers_ = device_->allocateCommandBuffersUnique(buffer_ci);
-
-      // Create fence
-      const auto fence_ci = vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled);
-      fences_.resize(command_buffers_.size());
-      for(auto& f : fences_)
-      {
-        f = device_->createFenceUnique(fence_ci);
-      }
+    else if (arg == "--no-transfer-queue")
+    {
+      config.dedicated_transfer = false;
     }
-
-    /*
-      Create swapchain
-      描画結果をdisplay 上に表示するためには必要
-      描画待ちのバックバッファをタイミングに合わせて切り替えている
-
-      surface 作成 -> forat 確定
-                   -> surface size 取得
-                   -> present モード確認 -> swapchain をつくる
-    */
-    {
-      /*
-        Create surface
-      */
-      auto surface_c_type = VkSurfaceKHR(surface_.get());
-      glfwCreateWindowSurface(instance_.get(), window, nullptr, &surface_c_type);
-      surface_ = vk::UniqueSurfaceKHR(surface_c_type);
-
-      /*
-        Get the supported format
-      */
-      const auto formats = physical_device_.getSurfaceFormatsKHR(surface_.get());
-      assert(!formats.empty());
-      const auto format = (formats[0].format == vk::Format::eUndefined)
-                          ? vk::Format::eB8G8R8A8Unorm
-                          : formats[0].format;
-
-      // Get surface capabilities
-      surface_capabilities_ = physical_device_.getSurfaceCapabilitiesKHR(surface_.get());
-
-      /*
-        Get the surface size
-        そのまま currentExtent を使うと無効な値が入っていることがある
-      */
-      auto extent = surface_capabilities_.currentExtent;
-      if(extent.width == std::numeric_limits<uint32_t>::max())
+    else if (arg == "--no-command-reuse")
+    {
+      config.reuse_command_buffers = false;
+    }
+    else if (arg == "--hot-reload")
+    {
+      config.hot_reload_shaders = true;
+    }
+    else if (arg.rfind("--msaa=", 0) == 0)
+    {
+      config.msaa_samples = static_cast<uint32_t>(std::stoul(arg.substr(7)));
+    }
+    else if (arg == "--sample-shading")
+    {
+      config.sample_shading = true;
+    }
+    else if (arg.rfind("--threads=", 0) == 0)
+    {
+      config.worker_threads = static_cast<uint32_t>(std::stoul(arg.substr(10)));
+    }
+    else if (arg.rfind("--trace=", 0) == 0)
+    {
+      trace_path = arg.substr(8);
+    }
+    else if (arg.rfind("--mesh=", 0) == 0)
+    {
+      config.mesh_path = arg.substr(7);
+    }
+    else if (arg.rfind("--write-test-mesh=", 0) == 0)
+    {
+      test_mesh_path = arg.substr(18);
+    }
+    else if (arg.rfind("--mesh-segments=", 0) == 0)
+    {
+      test_mesh_segments = static_cast<uint32_t>(std::stoul(arg.substr(16)));
+    }
+    else if (arg.rfind("--texture=", 0) == 0)
+    {
+      texture_paths.push_back(arg.substr(10));
+    }
+    else if (arg.rfind("--texture-budget-mb=", 0) == 0)
+    {
+      config.texture_budget_bytes = std::stoull(arg.substr(20)) << 20;
+    }
+    else if (arg.rfind("--write-test-texture=", 0) == 0)
+    {
+      test_texture_path = arg.substr(21);
+    }
+    else if (arg.rfind("--texture-size=", 0) == 0)
+    {
+      test_texture_size = static_cast<uint32_t>(std::stoul(arg.substr(15)));
+    }
+    else if (arg == "--batch")
+    {
+      batch = true;
+    }
+    else if (arg.rfind("--frame-range=", 0) == 0)
+    {
+      // first-last, inclusive
+      const auto range = arg.substr(14);
+      const auto dash  = range.find('-');
+      if (dash == std::string::npos)
       {
-        // サーフェスサイズが未定義
-        // 自由にサイズを指定していいのでウィンドウのサイズにする
-        extent = vk::Extent2D(kWidth, kHeight);
+        std::cerr << "Invalid frame range: " << range << " (first-last)" << std::endl;
+        return -1;
       }
-
-      const auto present_mode = vk::PresentModeKHR::eFifo;
-      const auto transform    = (surface_capabilities_.supportedTransforms & vk::SurfaceTransformFlagBitsKHR::eIdentity)
-                                ? vk::SurfaceTransformFlagBitsKHR::eIdentity
-                                : surface_capabilities_.currentTransform;
-      const auto composite    = (surface_capabilities_.supportedCompositeAlpha & vk::CompositeAlphaFlagBitsKHR::ePreMultiplied)
-                                  ? vk::CompositeAlphaFlagBitsKHR::ePreMultiplied
-                                  : (surface_capabilities_.supportedCompositeAlpha & vk::CompositeAlphaFlagBitsKHR::ePostMultiplied)
-                                      ? vk::CompositeAlphaFlagBitsKHR::ePostMultiplied :
-                                        (surface_capabilities_.supportedCompositeAlpha & vk::CompositeAlphaFlagBitsKHR::eInherit)
-                                        ? vk::CompositeAlphaFlagBitsKHR::eInherit
-                                        : vk::CompositeAlphaFlagBitsKHR::eOpaque;
-      /*
-        Swapchain creation
-      */
-      auto ci = vk::SwapchainCreateInfoKHR(vk::SwapchainCreateFlagsKHR(),
-                                           surface_.get(),
-                                           surface_capabilities_.minImageCount,
-                                           format,
-                                           vk::ColorSpaceKHR::eSrgbNonlinear,
-                                           extent,
-                                           1,
-                                           vk::ImageUsageFlagBits::eColorAttachment,
-                                           vk::SharingMode::eExclusive,
-                                           0,
-                                           nullptr,
-                                           transform,
-                                           composite,
-                                           present_mode,
-                                           true,
-                                           nullptr);
-      swapchain_ = device_->createSwapchainKHRUnique(ci);
-      swapchain_extent_ = extent;
-
-      /*
-        Create views for swapchain
-      */
-      const auto component_mapping = vk::ComponentMapping(vk::ComponentSwizzle::eR,
-                                                          vk::ComponentSwizzle::eG,
-                                                          vk::ComponentSwizzle::eB,
-                                                          vk::ComponentSwizzle::eA);
-      const auto subresource_range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1);
-      const auto swapchain_images = device_->getSwapchainImagesKHR(swapchain_.get());
-      for(const auto& image : swapchain_images)
+      first_frame = std::stoull(range.substr(0, dash));
+      last_frame  = std::stoull(range.substr(dash + 1));
+      if (last_frame < first_frame)
       {
-        const auto ci = vk::ImageViewCreateInfo(vk::ImageViewCreateFlags(),
-                                                image,
-                                                vk::ImageViewType::e2D,
-                                                format,
-                                                component_mapping,
-                                                subresource_range);
-        swapchain_image_views_.push_back(device_->createImageViewUnique(ci));
+        std::cerr << "Invalid frame range: " << range << " (first-last)" << std::endl;
+        return -1;
       }
     }
-
-    /*
-      depth buffer creation
-      スワップチェインには表示用のイメージが含まれているが、デプスバッファはない
-    */
-    {
-      // Create image for depth buffer
-      const auto depth_format = vk::Format::eD16Unorm;
-      const auto format_properties = physical_device_.getFormatProperties(depth_format);
-      vk::ImageTiling tiling;
-      if(format_properties.linearTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment)
+    else if (arg.rfind("--camera-path=", 0) == 0)
+    {
+      if (!camera_path.Load(arg.substr(14)))
       {
-        tiling = vk::ImageTiling::eLinear;
+        return -1;
       }
-      else if(format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment)
+    }
+    else if (arg.rfind("--camera-keys=", 0) == 0)
+    {
+      // The same keyframes inline, e.g. --camera-keys="0 0 0 1; 240 0.3 0.2 4"
+      if (!camera_path.Parse(arg.substr(14)))
       {
-        tiling = vk::ImageTiling::eOptimal;
+        std::cerr << "Invalid camera keys: " << arg.substr(14) << " (frame x y zoom; ...)" << std::endl;
+        return -1;
       }
-      else
+    }
+    else if (arg.rfind("--output=", 0) == 0)
+    {
+      output_prefix = arg.substr(9);
+    }
+    else if (arg.rfind("--format=", 0) == 0)
+    {
+      if (!ParseImageFileFormat(arg.substr(9), &output_format))
       {
-        std::cerr << "Depth stencil attachment is not supported for D16Unorm depth format." << std::endl;
+        std::cerr << "Unknown image format: " << arg.substr(9) << " (ppm, png, raw)" << std::endl;
+        return -1;
       }
-
-      const auto image_ci = vk::ImageCreateInfo(vk::ImageCreateFlags(),
-                                                vk::ImageType::e2D,
-                                                depth_format,
-                                                vk::Extent3D(swapchain_extent_.width, swapchain_extent_.height, 1),
-                                                1,
-                                                1,
-                                                vk::SampleCountFlagBits::e1,
-                                                tiling,
-                                                vk::ImageUsageFlagBits::eDepthStencilAttachment);
-      depth_image_ = device_->createImageUnique(image_ci);
-
-      // Allocate device memory for depth buffer and bind it
-      const auto memory_properties  = physical_device_.getMemoryProperties();
-      const auto memory_requirement = device_->getImageMemoryRequirements(depth_image_.get());
-      const auto memory_type_index  = MemoryTypeIndex(memory_requirement.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-      // assert(memory_type_index != ~0);
-      const auto ai = vk::MemoryAllocateInfo(memory_requirement.size, memory_type_index);
-      depth_memory_ = device_->allocateMemoryUnique(ai);
-
-      device_->bindImageMemory(depth_image_.get(), depth_memory_.get(), 0);
-
-      // Create depth image view
-      const auto component_mapping = vk::ComponentMapping(vk::ComponentSwizzle::eR,
-                                                          vk::ComponentSwizzle::eG,
-                                                          vk::ComponentSwizzle::eB,
-                                                          vk::ComponentSwizzle::eA);
-      const auto subresource_range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1);
-      const auto view_ci = vk::ImageViewCreateInfo(vk::ImageViewCreateFlags(),
-                                                   depth_image_.get(),
-                                                   vk::ImageViewType::e2D,
-                                                   depth_format,
-                                                   component_mapping,
-                                                   subresource_range);
-      depth_image_view_ = device_->createImageViewUnique(view_ci);
     }
-
-    /*
-      RenderPass creation
-    */
-    {
-      std::array<vk::AttachmentDescription, 2> attachments;
-      // color
-      attachments[0] = vk::AttachmentDescription(vk::AttachmentDescriptionFlags(),
-                                                 surface_format_.format,
-                                                 vk::SampleCountFlagBits::e1,
-                                                 vk::AttachmentLoadOp::eClear,
-                                                 vk::AttachmentStoreOp::eStore,
-                                                 vk::AttachmentLoadOp::eDontCare,
-                                                 vk::AttachmentStoreOp::eDontCare,
-                                                 vk::ImageLayout::eUndefined,
-                                                 vk::ImageLayout::eDepthStencilAttachmentOptimal);
-      // depth
-      attachments[1] = vk::AttachmentDescription(vk::AttachmentDescriptionFlags(),
-                                                 vk::Format::eD16Unorm,
-                                                 vk::SampleCountFlagBits::e1,
-                                                 vk::AttachmentLoadOp::eClear,
-                                                 vk::AttachmentStoreOp::eStore,
-                                                 vk::AttachmentLoadOp::eDontCare,
-                                                 vk::AttachmentStoreOp::eDontCare,
-                                                 vk::ImageLayout::eUndefined,
-                                                 vk::ImageLayout::eDepthStencilAttachmentOptimal);
-
-      const auto color_reference = vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal);
-      const auto depth_reference = vk::AttachmentReference(1, vk::ImageLayout::eDepthStencilAttachmentOptimal);
-
-      auto subpass_description = vk::SubpassDescription(vk::SubpassDescriptionFlags(),
-                                                        vk::PipelineBindPoint::eGraphics,
-                                                        0,
-                                                        nullptr,
-                                                        1,
-                                                        &color_reference,
-                                                        nullptr,
-                                                        &depth_reference);
-      const auto ci = vk::RenderPassCreateInfo(vk::RenderPassCreateFlags(),
-                                               2,
-                                               attachments.data(),
-                                               1,
-                                               &subpass_description);
-      render_pass_ = device_->createRenderPassUnique(ci);
+    else if (arg.rfind("--encoders=", 0) == 0)
+    {
+      encoder_threads = static_cast<uint32_t>(std::stoul(arg.substr(11)));
     }
-
-    /*
-      Create framebuffer
-      Swapchain の image view の数だけ用意する
-    */
-    {
-      auto ci = vk::FramebufferCreateInfo();
-      ci.setRenderPass(render_pass_.get());
-      ci.setWidth(kWidth);
-      ci.setHeight(kHeight);
-      ci.setLayers(1);
-
-      std::array<vk::ImageView, 2> attachments;
-      // attachment[0] は swapchain の image view
-      attachments[1] = depth_image_view_.get();
-
-      framebuffers_.reserve(swapchain_image_views_.size());
-      for(auto& view : swapchain_image_views_)
+    else if (arg.rfind("--frames=", 0) == 0)
+    {
+      frame_count = static_cast<uint32_t>(std::stoul(arg.substr(9)));
+    }
+    else if (arg.rfind("--present-mode=", 0) == 0)
+    {
+      if (!ParsePresentMode(arg.substr(15), &config.present_mode))
       {
-        attachments[0] = view.get();
-        const auto ci = vk::FramebufferCreateInfo(vk::FramebufferCreateFlags(),
-                                                  render_pass_.get(),
-                                                  2,
-                                                  attachments.data(),
-                                                  swapchain_extent_.width,
-                                                  swapchain_extent_.height,
-                                                  1);
-
-        framebuffers_.push_back(device_->createFramebufferUnique(ci));
+        std::cerr << "Unknown present mode: " << arg.substr(15)
+                  << " (immediate, mailbox, fifo, fifo_relaxed)" << std::endl;
+        return -1;
       }
     }
-
-    /*
-      Create Semaphores
-    */
+    else if (arg.rfind("--swapchain-images=", 0) == 0)
+    {
+      config.swapchain_images = static_cast<uint32_t>(std::stoul(arg.substr(19)));
+    }
+    else if (arg.rfind("--max-queued-frames=", 0) == 0)
     {
-      const auto ci = vk::SemaphoreCreateInfo();
-      semaphore_render_complete_  = device_->createSemaphoreUnique(ci);
-      semaphore_present_complete_ = device_->createSemaphoreUnique(ci);
+      config.max_queued_frames = static_cast<uint32_t>(std::stoul(arg.substr(20)));
+    }
+    else
+    {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return -1;
     }
   }
 
-  void Render()
+  // Write a test scene for --mesh and exit.
+  if (!test_mesh_path.empty())
   {
-    const auto current_buffer = device_->acquireNextImageKHR(swapchain_.get(), UINT64_MAX, semaphore_present_complete_.get(), nullptr);
-    assert(current_buffer.result == vk::Result::eSuccess);
-    assert(current_buffer.value < framebuffers_.size());
-
-    device_->waitForFences(fences_[current_buffer.value].get(), VK_TRUE, UINT64_MAX);
-
-    // Clear color
-    std::array<vk::ClearValue, 2> clear_colors = {vk::ClearValue(std::array<float, 4>{0.5f, 0.25f, 0.25f, 0.0f}), // Color
-                                                  vk::ClearValue(std::array<float, 4>{1.0f, 0.0f})};              // Depth
+    if (!WriteTestScene(test_mesh_path, test_mesh_segments, 16))
+    {
+      return -1;
+    }
+    std::cout << "Wrote " << test_mesh_path << std::endl;
+    return 0;
+  }
 
-    // Write commands to CommandBuffer
-    auto command_buffer_begin_info = vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlags());
-    command_buffers_[current_buffer.value]->begin(command_buffer_begin_info);
+  // Write a test texture for --texture and exit.
+  if (!test_texture_path.empty())
+  {
+    if (!WriteTestTexture(test_texture_path, test_texture_size))
+    {
+      return -1;
+    }
+    std::cout << "Wrote " << test_texture_path << std::endl;
+    return 0;
+  }
 
-    // Begin the render pass
-    auto render_pass_begin_info = vk::RenderPassBeginInfo(render_pass_.get(),
-                                                          framebuffers_[current_buffer.value].get(),
-                                                          vk::Rect2D(vk::Offset2D(0, 0), swapchain_extent_),
-                                                          clear_colors.size(),
-                                                          clear_colors.data());
-    command_buffers_[current_buffer.value]->beginRenderPass(render_pass_begin_info, vk::SubpassContents::eInline);
+  if (batch)
+  {
+    // Every encoder busy plus a couple of frames on the GPU, so neither side waits on the other.
+    config.headless = true;
+    if (!frames_in_flight_set)
+    {
+      config.frames_in_flight = std::max(config.frames_in_flight, encoder_threads + 2);
+    }
+  }
 
-    /*
-      write commands here...
-    */
+  if (!config.headless)
+  {
+    if (!glfwInit())
+    {
+      std::cerr << "Failed to initialize GLFW3." << std::endl;
+      return -1;
+    }
+    if (!glfwVulkanSupported())
+    {
+      std::cerr << "GLFW3 does not support Vulkan." << std::endl;
+      return -1;
+    }
 
-    // End the render pass
-    command_buffers_[current_buffer.value]->endRenderPass();
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    glfwWindowHint(GLFW_RESIZABLE, 1);
+    window = glfwCreateWindow(kWidth, kHeight, "Vulkan", nullptr, nullptr);
+  }
 
-    // End of writing to CommandBuffer
-    command_buffers_[current_buffer.value]->end();
+  static vk::DynamicLoader dl;
+  auto vkGetInstanceProcAddr = dl.getProcAddress<PFN_vkGetInstanceProcAddr>("vkGetInstanceProcAddr");
+  VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
 
-    /*
-      submit commands
-    */
-    auto wait_stage_mask = vk::PipelineStageFlags(vk::PipelineStageFlagBits::eColorAttachmentOutput);
-    auto submit_info     = vk::SubmitInfo(1,
-                                          &(semaphore_present_complete_.get()),
-                                          &wait_stage_mask,
-                                          1,
-                                          &command_buffers_[0].get(),
-                                          1,
-                                          &(semaphore_render_complete_.get()));
-    device_->resetFences(fences_[current_buffer.value].get());
-    device_queue_.submit(submit_info, fences_[current_buffer.value].get());
+  auto renderer = VkRenderer(config, window);
+  if (window)
+  {
+    glfwSetWindowUserPointer(window, &renderer);
+    glfwSetFramebufferSizeCallback(window, [](GLFWwindow* w, int, int) {
+      static_cast<VkRenderer*>(glfwGetWindowUserPointer(w))->NotifyResized();
+    });
+  }
 
-    // Present
-    auto present_info = vk::PresentInfoKHR(1,
-                                           &semaphore_render_complete_.get(),
-                                           1,
-                                           &swapchain_.get(),
-                                           &current_buffer.value);
-    device_queue_.presentKHR(present_info);
+  // Every texture is wanted at full resolution; the budget decides what stays resident.
+  std::vector<TextureHandle> textures;
+  for (const auto& path : texture_paths)
+  {
+    textures.push_back(renderer.LoadTexture(path));
   }
+  auto touch_textures = [&renderer, &textures]() {
+    for (const auto texture : textures)
+    {
+      renderer.TouchTexture(texture);
+    }
+  };
 
-  ~VkRenderer() {}
+  {
+    const auto start = std::chrono::steady_clock::now();
+    renderer.WaitForPipelines();
+    const auto seconds  = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto pipeline = renderer.GetPipelineStats();
+    const auto shaders  = renderer.GetShaderStats();
+    std::cout << "Pipelines ready in " << seconds * 1000.0 << " ms ("
+              << pipeline.compiled << " compiled, " << pipeline.failed << " failed, cache "
+              << (pipeline.cache_valid ? "warm, " : "cold, ") << pipeline.cache_bytes_loaded << " bytes)" << std::endl;
+    std::cout << "Shaders: " << shaders.modules_created << " modules from " << shaders.requests << " requests ("
+              << shaders.deduplicated << " deduplicated), loaded in " << shaders.load_seconds * 1000.0 << " ms" << std::endl;
+  }
 
-  uint32_t MemoryTypeIndex(uint32_t type_bits, vk::MemoryPropertyFlags flags)
+  bool batch_failed = false;
+  if (batch)
   {
-    const auto prop = physical_device_.getMemoryProperties();
-    for (uint32_t i = 0; i < prop.memoryTypeCount; i++)
+    FrameWriter writer(output_prefix, output_format, encoder_threads);
+    const auto  base = renderer.FrameCount();
+    renderer.SetReadbackHandoff([&writer, base, first_frame](ReadbackLease lease) {
+      const auto number = first_frame + (lease.FrameIndex() - base);
+      writer.Submit(std::move(lease), number);
+    });
+
+    FrameUniforms uniforms;
+    const auto    start = std::chrono::steady_clock::now();
+    for (uint64_t f = first_frame; f <= last_frame; ++f)
     {
-      if ((type_bits & 1) == 1)
-      {
-        if ((prop.memoryTypes[i].propertyFlags & flags) == flags)
-        {
-          return i;
-        }
-      }
-      type_bits >>= 1;
+      uniforms.camera = camera_path.Sample(f);
+      renderer.SetFrameUniforms(uniforms);
+      touch_textures();
+      renderer.Render();
+      renderer.PollReadbacks();
     }
-    return 0;
+    renderer.PollReadbacks(true);
+    batch_failed = !writer.Finish();
+    renderer.SetReadbackHandoff(nullptr);
+
+    // Sustained: from the first submit until the last file is on disk.
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto written = writer.Stats();
+    std::cout << "Batch: " << written.frames << " frames written to " << writer.FileName(first_frame)
+              << (written.frames > 1 ? " .. " + writer.FileName(last_frame) : "") << " in " << seconds << " s, "
+              << written.frames / seconds << " fps sustained ("
+              << written.bytes / seconds / 1.0e6 << " MB/s, "
+              << (written.frames ? written.encode_seconds / written.frames * 1000.0 : 0.0) << " ms per frame on "
+              << encoder_threads << " encoder threads";
+    if (written.failures)
+    {
+      std::cout << ", " << written.failures << " failed";
+    }
+    std::cout << ")" << std::endl;
+  }
+  else if (config.headless)
+  {
+    uint64_t read_back = 0;
+    renderer.SetReadbackCallback([&read_back](uint64_t, const void*, size_t) { ++read_back; });
+    for (uint32_t i = 0; i < frame_count; ++i)
+    {
+      touch_textures();
+      renderer.Render();
+      renderer.PollReadbacks();
+    }
+    renderer.PollReadbacks(true);
+    std::cout << "Rendered " << read_back << " frames headlessly." << std::endl;
+  }
+  else
+  {
+    for (uint32_t i = 0; i < frame_count; ++i)
+    {
+      // Poll right after Render() returns: with --max-queued-frames this is when input is freshest.
+      glfwPollEvents();
+      touch_textures();
+      renderer.Render();
+    }
+    std::cout << "Present mode: " << PresentModeName(renderer.GetPresentMode())
+              << ", swapchain recreations: " << renderer.SwapchainRecreations() << std::endl;
   }
 
-private:
-  vk::UniqueInstance                        instance_;
-  vk::PhysicalDevice                        physical_device_;
-  vk::PhysicalDeviceMemoryProperties        physical_device_memory_properties_;
-  uint32_t                                  graphics_queue_index_;
-  vk::UniqueDevice                          device_;
-  vk::Queue                                 device_queue_;
-
-  vk::UniqueCommandPool                     command_pool_;
-  std::vector<vk::UniqueCommandBuffer>      command_buffers_;
-  std::vector<vk::UniqueFence>              fences_;
+  if (renderer.GpuDriven())
+  {
+    const auto culling = renderer.GetGpuDrivenStats();
+    std::cout << "GPU-driven draws: " << culling.visible << " of " << culling.objects << " objects visible"
+              << (renderer.AsyncCompute() ? ", culled on the async compute queue" : "") << std::endl;
+  }
+  else
+  {
+    std::cout << "CPU-recorded draws" << std::endl;
+  }
 
-  vk::UniqueSurfaceKHR                      surface_;
-  vk::SurfaceFormatKHR                      surface_format_;
-  vk::SurfaceCapabilitiesKHR                surface_capabilities_;
-  vk::UniqueSwapchainKHR                    swapchain_;
-  vk::Extent2D                              swapchain_extent_;
-  std::vector<vk::UniqueImageView>          swapchain_image_views_;
+  if (const auto scene = renderer.GetStreamedScene())
+  {
+    if (scene->failed)
+    {
+      std::cout << "Failed to stream " << scene->path << std::endl;
+    }
+    else if (scene->ready)
+    {
+      std::cout << "Streamed " << scene->total_bytes << " bytes in " << scene->seconds * 1000.0 << " ms ("
+                << static_cast<double>(scene->total_bytes) / scene->seconds / 1.0e9 << " GB/s)" << std::endl;
+    }
+    else
+    {
+      std::cout << "Still streaming: " << scene->bytes_uploaded << " of " << scene->total_bytes << " bytes" << std::endl;
+    }
+  }
 
-  vk::UniqueImage                           depth_image_;
-  vk::UniqueDeviceMemory                    depth_memory_;
-  vk::UniqueImageView                       depth_image_view_;
+  if (!textures.empty())
+  {
+    const auto texture = renderer.GetTextureStats();
+    std::cout << "Textures: " << texture.textures - texture.failed << " of " << texture.textures << " loaded, "
+              << texture.resident_bytes << " of " << texture.budget_bytes << " budget bytes resident"
+              << (texture.driver_budget ? " (VK_EXT_memory_budget)" : "") << ", "
+              << texture.mips_streamed << " mips streamed, " << texture.mips_evicted << " evicted" << std::endl;
+  }
 
-  vk::UniqueRenderPass                      render_pass_;
+  if (renderer.Bindless())
+  {
+    const auto bindless = renderer.GetBindlessStats();
+    std::cout << "Bindless table: " << bindless.images << " of " << bindless.image_capacity << " image slots, "
+              << bindless.buffers << " of " << bindless.buffer_capacity << " buffer slots, "
+              << bindless.writes << " descriptor writes" << std::endl;
+  }
 
-  std::vector<vk::UniqueFramebuffer>        framebuffers_;
+  if (config.msaa_samples > 1)
+  {
+    const auto targets = renderer.GetRenderTargetStats();
+    std::cout << "MSAA: " << renderer.MsaaSamples() << "x of " << config.msaa_samples << "x requested"
+              << (renderer.SampleShading() ? ", per-sample shading" : "") << ", "
+              << targets.transient_images << " transient attachments (" << targets.lazy_bytes << " bytes lazily allocated)"
+              << std::endl;
+  }
 
-  vk::UniqueSemaphore                       semaphore_render_complete_;
-  vk::UniqueSemaphore                       semaphore_present_complete_;
-};
+  const auto& stats = renderer.GetPipeliningStats();
+  std::cout << "Frames in flight: " << config.frames_in_flight
+            << ", CPU/GPU overlap: " << stats.Overlap() * 100.0 << "%"
+            << ", average GPU queue depth: " << stats.AverageGpuQueueDepth() << std::endl;
+  if (!renderer.GpuDriven())
+  {
+    const auto& reuse = renderer.GetCommandReuseStats();
+    std::cout << "Main pass recordings: " << reuse.hits << " reused, " << reuse.misses << " recorded ("
+              << reuse.HitRate() * 100.0 << "% hit rate)" << std::endl;
+  }
 
-int main(int argc, char *argv[])
-{
-  if (!glfwInit())
+  const auto& profiler = renderer.GetProfiler();
+  for (const auto& label : profiler.Labels())
   {
-    std::cerr << "Failed to initialize GLFW3." << std::endl;
-    return -1;
+    std::cout << label << ": p50 " << profiler.Percentile(label, 0.50)
+              << " ms, p95 " << profiler.Percentile(label, 0.95)
+              << " ms, p99 " << profiler.Percentile(label, 0.99) << " ms" << std::endl;
   }
-  if (!glfwVulkanSupported())
+  if (!trace_path.empty() && !profiler.WriteChromeTrace(trace_path))
   {
-    std::cerr << "GLFW3 does not support Vulkan." << std::endl;
-    return -1;
+    std::cerr << "Failed to write trace: " << trace_path << std::endl;
   }
 
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, 0);
-  window = glfwCreateWindow(kWidth, kHeight, "Vulkan", nullptr, nullptr);
+  const auto deletion = renderer.GetDeletionStats();
+  std::cout << "Deferred destruction: " << deletion.destroyed << " of " << deletion.deferred << " released objects destroyed in "
+            << deletion.batches << " batches (peak " << deletion.peak_pending << " pending)" << std::endl;
 
-  static vk::DynamicLoader dl;
-  auto vkGetInstanceProcAddr = dl.getProcAddress<PFN_vkGetInstanceProcAddr>("vkGetInstanceProcAddr");
-  VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
+  const auto memory = renderer.GetMemoryStats();
+  std::cout << "Device memory: " << memory.block_count << " blocks, "
+            << memory.allocation_count << " allocations, "
+            << memory.bytes_used << " bytes used, "
+            << memory.bytes_wasted << " bytes wasted, "
+            << memory.bytes_reserved << " bytes reserved" << std::endl;
 
-  auto renderer = VkRenderer();
-  renderer.Render();
+  if (config.headless)
+  {
+    return batch_failed ? -1 : 0;
+  }
 
   while (glfwWindowShouldClose(window) == GLFW_FALSE)
   {
     glfwPollEvents();
+    touch_textures();
+    renderer.Render();
   }
+  renderer.WaitIdle();
   glfwTerminate();
 
   return 0;
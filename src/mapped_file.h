@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+  Read-only memory mapping of a whole file. Move-only.
+*/
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) : data_(other.data_), size_(other.size_)
+  {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+  MappedFile& operator=(MappedFile&& other)
+  {
+    if(this != &other)
+    {
+      Close();
+      data_       = other.data_;
+      size_       = other.size_;
+      other.data_ = nullptr;
+      other.size_ = 0;
+    }
+    return *this;
+  }
+  ~MappedFile() { Close(); }
+
+  bool Open(const std::string& path)
+  {
+    Close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+      return false;
+    }
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+      ::close(fd);
+      return false;
+    }
+    void* data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive.
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+      return false;
+    }
+    data_ = static_cast<const uint8_t*>(data);
+    size_ = static_cast<size_t>(st.st_size);
+    // The loader reads front to back once: ask for aggressive readahead.
+    ::madvise(const_cast<uint8_t*>(data_), size_, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  void Close()
+  {
+    if(data_)
+    {
+      ::munmap(const_cast<uint8_t*>(data_), size_);
+      data_ = nullptr;
+      size_ = 0;
+    }
+  }
+
+  // Drop pages in [offset, offset + size) that are no longer needed, so RSS stays bounded on huge files.
+  void Release(size_t offset, size_t size) const
+  {
+    const auto page  = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const auto begin = (offset + page - 1) / page * page;
+    const auto end   = (offset + size) / page * page;
+    if(data_ && end > begin)
+    {
+      ::madvise(const_cast<uint8_t*>(data_) + begin, end - begin, MADV_DONTNEED);
+    }
+  }
+
+  const uint8_t* Data() const { return data_; }
+  size_t         Size() const { return size_; }
+
+private:
+  const uint8_t* data_ = nullptr;
+  size_t         size_ = 0;
+};
@@ -0,0 +1,1056 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+/*
+  Device memory sub-allocator
+
+  vkAllocateMemory is slow and limited to maxMemoryAllocationCount live allocations,
+  so resources are placed inside large blocks instead of owning a vk::DeviceMemory each.
+
+  - small requests   : fixed-size slots carved out of slabs (power-of-two size classes)
+  - medium requests  : first-fit inside a block, neighbours coalesced on free
+  - large requests   : a dedicated vk::DeviceMemory
+  - per-frame data   : LinearArena / RingArena over one buffer
+  - per-frame uniforms: UniformRing, one region per frame in flight, lock-free per thread
+
+  Linear (buffers, linear images) and optimal resources are kept bufferImageGranularity
+  apart when they share a block.
+*/
+
+enum class MemoryUsage
+{
+  eGpuOnly,  // device local, never mapped
+  eCpuToGpu, // host visible, written by the CPU every frame (staging, uniforms)
+  eGpuToCpu, // host visible, read back by the CPU (prefers cached memory)
+  eGpuLazy,  // transient attachments: lazily allocated where available (tilers), else device local
+};
+
+enum class ResourceKind : uint32_t
+{
+  eLinear  = 0, // buffers and linear tiled images
+  eOptimal = 1, // optimal tiled images
+};
+
+struct MemoryBlock;
+struct Slab;
+
+struct Allocation
+{
+  vk::DeviceMemory memory;
+  vk::DeviceSize   offset      = 0;
+  vk::DeviceSize   size        = 0;
+  void*            mapped      = nullptr; // persistently mapped pointer, null if not host visible
+  uint32_t         memory_type = 0;
+
+  // Bookkeeping for the allocator
+  MemoryBlock*     block        = nullptr;
+  Slab*            slab         = nullptr;
+  vk::DeviceSize   chunk_offset = 0;
+  vk::DeviceSize   alignment    = 1;
+  ResourceKind     kind         = ResourceKind::eLinear;
+
+  explicit operator bool() const { return static_cast<bool>(memory); }
+};
+
+struct AllocatorStats
+{
+  uint64_t       block_count      = 0; // live vkAllocateMemory calls
+  uint64_t       dedicated_count  = 0;
+  uint64_t       allocation_count = 0;
+  vk::DeviceSize bytes_reserved   = 0; // device memory owned by the allocator
+  vk::DeviceSize bytes_used       = 0; // requested by live allocations
+  vk::DeviceSize bytes_wasted     = 0; // alignment/granularity padding, size-class padding and idle slab slots
+
+  vk::DeviceSize BytesFree() const { return bytes_reserved - bytes_used - bytes_wasted; }
+};
+
+// Ask the caller to copy `allocation`'s contents into `destination` and rebind the resource.
+struct DefragmentationMove
+{
+  Allocation* allocation;
+  Allocation  destination;
+};
+
+struct MemoryBlock
+{
+  struct Chunk
+  {
+    vk::DeviceSize size    = 0;
+    vk::DeviceSize padding = 0; // bytes in front of the allocation, only for used chunks
+    bool           free    = true;
+    ResourceKind   kind    = ResourceKind::eLinear;
+  };
+
+  vk::DeviceMemory                   memory;
+  vk::DeviceSize                     size        = 0;
+  vk::DeviceSize                     used        = 0;
+  uint32_t                           memory_type = 0;
+  bool                               dedicated   = false;
+  void*                              mapped      = nullptr;
+  std::map<vk::DeviceSize, Chunk>    chunks; // keyed by offset, covers the whole block
+
+  /*
+    First-fit placement. Linear and optimal neighbours are kept `granularity` apart.
+    On success sets the chunk the allocation owns and the aligned offset inside it.
+  */
+  bool Place(vk::DeviceSize  size,
+             vk::DeviceSize  alignment,
+             ResourceKind    kind,
+             vk::DeviceSize  granularity,
+             vk::DeviceSize* chunk_offset,
+             vk::DeviceSize* offset)
+  {
+    const auto align_up     = [](vk::DeviceSize v, vk::DeviceSize a) { return (v + a - 1) / a * a; };
+    // Resource A ends at `end_of_a` (exclusive), resource B starts at `start_of_b`.
+    const auto on_same_page = [granularity](vk::DeviceSize end_of_a, vk::DeviceSize start_of_b) {
+      return (end_of_a - 1) / granularity == start_of_b / granularity;
+    };
+    for(auto it = chunks.begin(); it != chunks.end(); ++it)
+    {
+      if(!it->second.free || it->second.size < size)
+      {
+        continue;
+      }
+      const auto chunk_begin = it->first;
+      const auto chunk_end   = chunk_begin + it->second.size;
+      auto       placed      = align_up(chunk_begin, alignment);
+
+      // Keep linear and optimal resources on different granularity pages.
+      if(it != chunks.begin())
+      {
+        const auto prev = std::prev(it);
+        if(!prev->second.free && prev->second.kind != kind && on_same_page(prev->first + prev->second.size, placed))
+        {
+          placed = align_up(placed, granularity);
+        }
+      }
+      if(placed + size > chunk_end)
+      {
+        continue;
+      }
+      const auto next = std::next(it);
+      if(next != chunks.end() && placed + size == chunk_end &&
+         !next->second.free && next->second.kind != kind && on_same_page(placed + size, next->first))
+      {
+        continue;
+      }
+
+      // Split: [chunk_begin, placed + size) becomes used, the tail stays free.
+      const auto used_size = placed + size - chunk_begin;
+      if(used_size < it->second.size)
+      {
+        chunks[chunk_begin + used_size] = Chunk{it->second.size - used_size, 0, true, kind};
+      }
+      it->second = Chunk{used_size, placed - chunk_begin, false, kind};
+      used      += used_size;
+
+      *chunk_offset = chunk_begin;
+      *offset       = placed;
+      return true;
+    }
+    return false;
+  }
+
+  // Free the chunk at `chunk_offset` and coalesce it with free neighbours. Returns its padding.
+  vk::DeviceSize Release(vk::DeviceSize chunk_offset)
+  {
+    auto it = chunks.find(chunk_offset);
+    assert(it != chunks.end() && !it->second.free);
+    const auto padding = it->second.padding;
+    used              -= it->second.size;
+    it->second.free    = true;
+    it->second.padding = 0;
+
+    const auto next = std::next(it);
+    if(next != chunks.end() && next->second.free)
+    {
+      it->second.size += next->second.size;
+      chunks.erase(next);
+    }
+    if(it != chunks.begin())
+    {
+      const auto prev = std::prev(it);
+      if(prev->second.free)
+      {
+        prev->second.size += it->second.size;
+        chunks.erase(it);
+      }
+    }
+    return padding;
+  }
+};
+
+struct Slab
+{
+  Allocation            backing;
+  vk::DeviceSize        slot_size  = 0;
+  uint32_t              slot_count = 0;
+  std::vector<uint32_t> free_slots;
+};
+
+class DeviceAllocator
+{
+public:
+  static constexpr vk::DeviceSize kDefaultBlockSize = 64ull * 1024 * 1024;
+  static constexpr vk::DeviceSize kMinSizeClass     = 256;
+  static constexpr uint32_t       kSizeClassCount   = 9; // 256 B .. 64 KiB
+  static constexpr uint32_t       kSlotsPerSlab     = 64;
+
+  DeviceAllocator(vk::PhysicalDevice physical_device, vk::Device device)
+    : device_(device)
+  {
+    memory_properties_ = physical_device.getMemoryProperties();
+    const auto limits  = physical_device.getProperties().limits;
+    buffer_image_granularity_ = limits.bufferImageGranularity;
+    non_coherent_atom_size_   = limits.nonCoherentAtomSize;
+    max_allocation_count_     = limits.maxMemoryAllocationCount;
+
+    pools_.resize(memory_properties_.memoryTypeCount);
+    for(uint32_t i = 0; i < memory_properties_.memoryTypeCount; ++i)
+    {
+      // Small heaps (e.g. 256 MiB BAR) get smaller blocks so one block does not eat the heap.
+      const auto heap_size = memory_properties_.memoryHeaps[memory_properties_.memoryTypes[i].heapIndex].size;
+      pools_[i].block_size = std::min(kDefaultBlockSize, std::max<vk::DeviceSize>(heap_size / 8, 1024 * 1024));
+    }
+  }
+
+  DeviceAllocator(const DeviceAllocator&) = delete;
+  DeviceAllocator& operator=(const DeviceAllocator&) = delete;
+
+  ~DeviceAllocator()
+  {
+    for(auto& pool : pools_)
+    {
+      for(auto& block : pool.blocks)
+      {
+        device_.freeMemory(block->memory);
+      }
+    }
+  }
+
+  /*
+    Pick a memory type allowed by `type_bits` that has every `required` flag,
+    preferring one that also has the `preferred` flags.
+    Throws if nothing matches instead of silently returning type 0.
+  */
+  uint32_t FindMemoryType(uint32_t type_bits, vk::MemoryPropertyFlags required,
+                          vk::MemoryPropertyFlags preferred = vk::MemoryPropertyFlags()) const
+  {
+    uint32_t best       = VK_MAX_MEMORY_TYPES;
+    uint32_t best_score = 0;
+    for(uint32_t i = 0; i < memory_properties_.memoryTypeCount; ++i)
+    {
+      const auto flags = memory_properties_.memoryTypes[i].propertyFlags;
+      if(!(type_bits & (1u << i)) || (flags & required) != required)
+      {
+        continue;
+      }
+      const auto score = 1 + PopCount(static_cast<uint32_t>(flags & preferred));
+      if(score > best_score)
+      {
+        best       = i;
+        best_score = score;
+      }
+    }
+    if(best == VK_MAX_MEMORY_TYPES)
+    {
+      throw std::runtime_error("No memory type satisfies the requested properties.");
+    }
+    return best;
+  }
+
+  Allocation Allocate(const vk::MemoryRequirements& requirements, MemoryUsage usage, ResourceKind kind)
+  {
+    vk::MemoryPropertyFlags required;
+    vk::MemoryPropertyFlags preferred;
+    switch(usage)
+    {
+      case MemoryUsage::eGpuOnly:
+        preferred = vk::MemoryPropertyFlagBits::eDeviceLocal;
+        break;
+      case MemoryUsage::eCpuToGpu:
+        required  = vk::MemoryPropertyFlagBits::eHostVisible;
+        preferred = vk::MemoryPropertyFlagBits::eHostCoherent;
+        break;
+      case MemoryUsage::eGpuToCpu:
+        required  = vk::MemoryPropertyFlagBits::eHostVisible;
+        preferred = vk::MemoryPropertyFlagBits::eHostCached;
+        break;
+      case MemoryUsage::eGpuLazy:
+        preferred = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated;
+        break;
+    }
+    const auto memory_type = FindMemoryType(requirements.memoryTypeBits, required, preferred);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    return AllocateLocked(memory_type, requirements.size, requirements.alignment, kind, nullptr, true);
+  }
+
+  Allocation AllocateForImage(vk::Image image, MemoryUsage usage, vk::ImageTiling tiling = vk::ImageTiling::eOptimal)
+  {
+    const auto kind       = (tiling == vk::ImageTiling::eOptimal) ? ResourceKind::eOptimal : ResourceKind::eLinear;
+    const auto allocation = Allocate(device_.getImageMemoryRequirements(image), usage, kind);
+    device_.bindImageMemory(image, allocation.memory, allocation.offset);
+    return allocation;
+  }
+
+  Allocation AllocateForBuffer(vk::Buffer buffer, MemoryUsage usage)
+  {
+    const auto allocation = Allocate(device_.getBufferMemoryRequirements(buffer), usage, ResourceKind::eLinear);
+    device_.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+    return allocation;
+  }
+
+  void Free(Allocation& allocation)
+  {
+    if(!allocation)
+    {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    FreeLocked(allocation);
+    allocation = Allocation();
+  }
+
+  bool IsCoherent(const Allocation& allocation) const
+  {
+    const auto flags = memory_properties_.memoryTypes[allocation.memory_type].propertyFlags;
+    return static_cast<bool>(flags & vk::MemoryPropertyFlagBits::eHostCoherent);
+  }
+
+  // Physical pages are only committed if the resource spills out of tile memory.
+  bool IsLazilyAllocated(const Allocation& allocation) const
+  {
+    const auto flags = memory_properties_.memoryTypes[allocation.memory_type].propertyFlags;
+    return static_cast<bool>(flags & vk::MemoryPropertyFlagBits::eLazilyAllocated);
+  }
+
+  // Make GPU writes visible to the host. No-op for coherent memory.
+  void Invalidate(const Allocation& allocation)
+  {
+    if(!IsCoherent(allocation))
+    {
+      device_.invalidateMappedMemoryRanges(AtomAlignedRange(allocation));
+    }
+  }
+
+  // Make host writes visible to the GPU. No-op for coherent memory.
+  void Flush(const Allocation& allocation)
+  {
+    if(!IsCoherent(allocation))
+    {
+      device_.flushMappedMemoryRanges(AtomAlignedRange(allocation));
+    }
+  }
+
+  AllocatorStats Stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  /*
+    Defragmentation hooks
+    PlanDefragmentation() picks allocations in the emptiest block of each memory type and
+    reserves room for them in fuller blocks, without allocating new device memory.
+    The caller copies the contents (vkCmdCopyBuffer / vkCmdCopyImage), rebinds its resources
+    to `destination`, waits for the copies, then calls CompleteDefragmentation().
+    Slab and dedicated allocations never move.
+  */
+  std::vector<DefragmentationMove> PlanDefragmentation(const std::vector<Allocation*>& movable,
+                                                       vk::DeviceSize max_bytes = VK_WHOLE_SIZE)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<DefragmentationMove> moves;
+    vk::DeviceSize                   moved_bytes = 0;
+    for(auto& pool : pools_)
+    {
+      // Find the least used shared block; it is the one worth emptying.
+      MemoryBlock* source = nullptr;
+      uint32_t     shared = 0;
+      for(auto& block : pool.blocks)
+      {
+        if(block->dedicated)
+        {
+          continue;
+        }
+        ++shared;
+        if(!source || block->used < source->used)
+        {
+          source = block.get();
+        }
+      }
+      if(!source || shared < 2)
+      {
+        continue;
+      }
+      for(auto* allocation : movable)
+      {
+        if(allocation->block != source || allocation->slab || moved_bytes + allocation->size > max_bytes)
+        {
+          continue;
+        }
+        auto destination = AllocateLocked(allocation->memory_type, allocation->size, allocation->alignment,
+                                          allocation->kind, source, false);
+        if(!destination)
+        {
+          continue;
+        }
+        moved_bytes += allocation->size;
+        moves.push_back({allocation, destination});
+      }
+    }
+    return moves;
+  }
+
+  void CompleteDefragmentation(std::vector<DefragmentationMove>& moves)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto& move : moves)
+    {
+      FreeLocked(*move.allocation);
+      *move.allocation = move.destination;
+    }
+    moves.clear();
+  }
+
+  vk::Device GetDevice() const { return device_; }
+
+private:
+  struct MemoryTypePool
+  {
+    vk::DeviceSize                                                    block_size = kDefaultBlockSize;
+    std::vector<std::unique_ptr<MemoryBlock>>                         blocks;
+    std::array<std::array<std::vector<std::unique_ptr<Slab>>, kSizeClassCount>, 2> slabs;
+  };
+
+  static uint32_t PopCount(uint32_t v)
+  {
+    uint32_t count = 0;
+    for(; v; v &= v - 1)
+    {
+      ++count;
+    }
+    return count;
+  }
+
+  static vk::DeviceSize AlignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+  {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+  static vk::DeviceSize AlignDown(vk::DeviceSize value, vk::DeviceSize alignment)
+  {
+    return value / alignment * alignment;
+  }
+
+  // Index of the smallest size class that fits, or kSizeClassCount if the request is too large.
+  static uint32_t SizeClass(vk::DeviceSize size, vk::DeviceSize alignment)
+  {
+    const auto needed = std::max(size, alignment);
+    uint32_t   index  = 0;
+    for(auto class_size = kMinSizeClass; class_size < needed && index < kSizeClassCount; class_size <<= 1)
+    {
+      ++index;
+    }
+    return index;
+  }
+
+  vk::MappedMemoryRange AtomAlignedRange(const Allocation& allocation) const
+  {
+    const auto begin = AlignDown(allocation.offset, non_coherent_atom_size_);
+    auto       end   = AlignUp(allocation.offset + allocation.size, non_coherent_atom_size_);
+    const auto block_size = allocation.block ? allocation.block->size : allocation.offset + allocation.size;
+    end = std::min(end, block_size);
+    return vk::MappedMemoryRange(allocation.memory, begin, end - begin);
+  }
+
+  MemoryBlock* CreateBlock(uint32_t memory_type, vk::DeviceSize size, bool dedicated)
+  {
+    if(stats_.block_count >= max_allocation_count_)
+    {
+      throw std::runtime_error("maxMemoryAllocationCount exceeded.");
+    }
+    auto block         = std::make_unique<MemoryBlock>();
+    block->memory      = device_.allocateMemory(vk::MemoryAllocateInfo(size, memory_type));
+    block->size        = size;
+    block->memory_type = memory_type;
+    block->dedicated   = dedicated;
+    block->chunks[0]   = MemoryBlock::Chunk{size, 0, true, ResourceKind::eLinear};
+
+    // Host visible blocks stay mapped for their whole lifetime.
+    if(memory_properties_.memoryTypes[memory_type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+    {
+      block->mapped = device_.mapMemory(block->memory, 0, VK_WHOLE_SIZE);
+    }
+
+    ++stats_.block_count;
+    stats_.dedicated_count += dedicated ? 1 : 0;
+    stats_.bytes_reserved  += size;
+
+    auto& blocks = pools_[memory_type].blocks;
+    blocks.push_back(std::move(block));
+    return blocks.back().get();
+  }
+
+  void DestroyBlock(MemoryBlock* block)
+  {
+    auto& blocks = pools_[block->memory_type].blocks;
+    const auto it = std::find_if(blocks.begin(), blocks.end(),
+                                 [block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; });
+    assert(it != blocks.end());
+
+    --stats_.block_count;
+    stats_.dedicated_count -= block->dedicated ? 1 : 0;
+    stats_.bytes_reserved  -= block->size;
+
+    device_.freeMemory(block->memory);
+    blocks.erase(it);
+  }
+
+  // First-fit placement inside one block. Returns false if the block has no room.
+  bool AllocateInBlock(MemoryBlock& block, vk::DeviceSize size, vk::DeviceSize alignment, ResourceKind kind,
+                       Allocation* out)
+  {
+    vk::DeviceSize chunk_offset = 0;
+    vk::DeviceSize offset       = 0;
+    if(!block.Place(size, alignment, kind, buffer_image_granularity_, &chunk_offset, &offset))
+    {
+      return false;
+    }
+    out->memory       = block.memory;
+    out->offset       = offset;
+    out->size         = size;
+    out->mapped       = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+    out->memory_type  = block.memory_type;
+    out->block        = &block;
+    out->chunk_offset = chunk_offset;
+    out->alignment    = alignment;
+    out->kind         = kind;
+
+    stats_.bytes_wasted += offset - chunk_offset;
+    return true;
+  }
+
+  void FreeInBlock(MemoryBlock& block, vk::DeviceSize chunk_offset)
+  {
+    stats_.bytes_wasted -= block.Release(chunk_offset);
+  }
+
+  Allocation AllocateLocked(uint32_t memory_type, vk::DeviceSize size, vk::DeviceSize alignment, ResourceKind kind,
+                            MemoryBlock* exclude, bool allow_new_block)
+  {
+    auto&      pool = pools_[memory_type];
+    Allocation allocation;
+
+    // Small: size-class slabs.
+    const auto size_class = SizeClass(size, alignment);
+    if(size_class < kSizeClassCount && !exclude)
+    {
+      auto& slabs = pool.slabs[static_cast<uint32_t>(kind)][size_class];
+      Slab* slab  = nullptr;
+      for(auto& s : slabs)
+      {
+        if(!s->free_slots.empty())
+        {
+          slab = s.get();
+          break;
+        }
+      }
+      if(!slab)
+      {
+        const auto slot_size = kMinSizeClass << size_class;
+        auto       new_slab  = std::make_unique<Slab>();
+        new_slab->backing    = AllocateLocked(memory_type, slot_size * kSlotsPerSlab, slot_size, kind, nullptr, true);
+        new_slab->slot_size  = slot_size;
+        new_slab->slot_count = kSlotsPerSlab;
+        for(uint32_t i = kSlotsPerSlab; i > 0; --i)
+        {
+          new_slab->free_slots.push_back(i - 1);
+        }
+        // The slab's own allocation is accounted as waste until its slots are handed out.
+        stats_.allocation_count -= 1;
+        stats_.bytes_used       -= new_slab->backing.size;
+        stats_.bytes_wasted     += new_slab->backing.size;
+        slabs.push_back(std::move(new_slab));
+        slab = slabs.back().get();
+      }
+      const auto slot = slab->free_slots.back();
+      slab->free_slots.pop_back();
+
+      allocation              = slab->backing;
+      allocation.offset       = slab->backing.offset + slot * slab->slot_size;
+      allocation.size         = size;
+      allocation.mapped       = slab->backing.mapped ? static_cast<char*>(slab->backing.mapped) + slot * slab->slot_size : nullptr;
+      allocation.slab         = slab;
+      allocation.chunk_offset = slot;
+      allocation.alignment    = alignment;
+
+      stats_.allocation_count += 1;
+      stats_.bytes_used       += size;
+      stats_.bytes_wasted     -= size;
+      return allocation;
+    }
+
+    // Large: dedicated memory.
+    if(size > pool.block_size / 2)
+    {
+      if(!allow_new_block)
+      {
+        return allocation;
+      }
+      auto* block = CreateBlock(memory_type, size, true);
+      AllocateInBlock(*block, size, 1, kind, &allocation);
+      allocation.alignment = alignment;
+      stats_.allocation_count += 1;
+      stats_.bytes_used       += size;
+      return allocation;
+    }
+
+    // Medium: first fit in an existing block, fullest blocks first would need sorting; creation order is fine.
+    for(auto& block : pool.blocks)
+    {
+      if(block->dedicated || block.get() == exclude || block->size - block->used < size)
+      {
+        continue;
+      }
+      if(AllocateInBlock(*block, size, alignment, kind, &allocation))
+      {
+        stats_.allocation_count += 1;
+        stats_.bytes_used       += size;
+        return allocation;
+      }
+    }
+    if(!allow_new_block)
+    {
+      return allocation;
+    }
+    auto* block = CreateBlock(memory_type, pool.block_size, false);
+    const auto placed = AllocateInBlock(*block, size, alignment, kind, &allocation);
+    assert(placed);
+    (void)placed;
+    stats_.allocation_count += 1;
+    stats_.bytes_used       += size;
+    return allocation;
+  }
+
+  void FreeLocked(const Allocation& allocation)
+  {
+    stats_.allocation_count -= 1;
+    stats_.bytes_used       -= allocation.size;
+
+    if(allocation.slab)
+    {
+      auto* slab = allocation.slab;
+      stats_.bytes_wasted += allocation.size;
+      slab->free_slots.push_back(static_cast<uint32_t>(allocation.chunk_offset));
+      if(slab->free_slots.size() == slab->slot_count)
+      {
+        // Keep one empty slab per class around to avoid churn.
+        auto&      slabs      = pools_[slab->backing.memory_type].slabs[static_cast<uint32_t>(slab->backing.kind)]
+                                     [SizeClass(slab->slot_size, slab->slot_size)];
+        const auto empty_count = std::count_if(slabs.begin(), slabs.end(), [](const std::unique_ptr<Slab>& s) {
+          return s->free_slots.size() == s->slot_count;
+        });
+        if(empty_count > 1)
+        {
+          stats_.allocation_count += 1;
+          stats_.bytes_used       += slab->backing.size;
+          stats_.bytes_wasted     -= slab->backing.size;
+          FreeLocked(slab->backing);
+          slabs.erase(std::find_if(slabs.begin(), slabs.end(),
+                                   [slab](const std::unique_ptr<Slab>& s) { return s.get() == slab; }));
+        }
+      }
+      return;
+    }
+
+    auto* block = allocation.block;
+    FreeInBlock(*block, allocation.chunk_offset);
+    if(block->dedicated)
+    {
+      DestroyBlock(block);
+      return;
+    }
+    // Release an empty block as long as another shared block remains for this memory type.
+    if(block->used == 0)
+    {
+      const auto& blocks = pools_[block->memory_type].blocks;
+      const auto  shared = std::count_if(blocks.begin(), blocks.end(),
+                                         [](const std::unique_ptr<MemoryBlock>& b) { return !b->dedicated; });
+      if(shared > 1)
+      {
+        DestroyBlock(block);
+      }
+    }
+  }
+
+  vk::Device                         device_;
+  vk::PhysicalDeviceMemoryProperties memory_properties_;
+  vk::DeviceSize                     buffer_image_granularity_ = 1;
+  vk::DeviceSize                     non_coherent_atom_size_   = 1;
+  uint32_t                           max_allocation_count_     = 4096;
+  std::vector<MemoryTypePool>        pools_;
+  AllocatorStats                     stats_;
+  mutable std::mutex                 mutex_;
+};
+
+/*
+  Region handed out by the arenas. `buffer` + `offset` can be bound directly
+  (e.g. as a dynamic uniform offset); `mapped` is null for device local arenas.
+*/
+struct ArenaRegion
+{
+  vk::Buffer     buffer;
+  vk::DeviceSize offset = 0;
+  vk::DeviceSize size   = 0;
+  void*          mapped = nullptr;
+
+  explicit operator bool() const { return static_cast<bool>(buffer); }
+};
+
+/*
+  Bump allocator over one buffer. Everything is released at once by Reset().
+  Use one per frame in flight for data that is rebuilt every frame.
+*/
+class LinearArena
+{
+public:
+  LinearArena() = default;
+  LinearArena(DeviceAllocator& allocator, vk::DeviceSize capacity, vk::BufferUsageFlags usage, MemoryUsage memory_usage)
+    : allocator_(&allocator)
+  {
+    const auto device = allocator.GetDevice();
+    buffer_     = device.createBufferUnique(vk::BufferCreateInfo(vk::BufferCreateFlags(), capacity, usage, vk::SharingMode::eExclusive));
+    allocation_ = allocator.AllocateForBuffer(buffer_.get(), memory_usage);
+    capacity_   = capacity;
+  }
+
+  LinearArena(LinearArena&& other) { *this = std::move(other); }
+  LinearArena& operator=(LinearArena&& other)
+  {
+    Release();
+    allocator_        = other.allocator_;
+    buffer_           = std::move(other.buffer_);
+    allocation_       = other.allocation_;
+    capacity_         = other.capacity_;
+    head_             = other.head_;
+    other.allocator_  = nullptr;
+    other.allocation_ = Allocation();
+    return *this;
+  }
+
+  ~LinearArena() { Release(); }
+
+  // Returns an empty region when the arena is full.
+  ArenaRegion Allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16)
+  {
+    const auto offset = (head_ + alignment - 1) / alignment * alignment;
+    if(offset + size > capacity_)
+    {
+      return ArenaRegion();
+    }
+    head_ = offset + size;
+    return ArenaRegion{buffer_.get(), offset, size,
+                       allocation_.mapped ? static_cast<char*>(allocation_.mapped) + offset : nullptr};
+  }
+
+  void Reset() { head_ = 0; }
+
+  vk::DeviceSize Used() const { return head_; }
+  vk::DeviceSize Capacity() const { return capacity_; }
+  vk::Buffer GetBuffer() const { return buffer_.get(); }
+  const Allocation& GetAllocation() const { return allocation_; }
+
+private:
+  void Release()
+  {
+    buffer_.reset();
+    if(allocator_)
+    {
+      allocator_->Free(allocation_);
+    }
+  }
+
+  DeviceAllocator* allocator_ = nullptr;
+  vk::UniqueBuffer buffer_;
+  Allocation       allocation_;
+  vk::DeviceSize   capacity_  = 0;
+  vk::DeviceSize   head_      = 0;
+};
+
+/*
+  Offset bookkeeping of RingArena, without the buffer.
+  Allocations made after BeginFrame(n) belong to frame n.
+  Retire(n) gives back everything up to and including frame n once its fence has signaled.
+*/
+class RingCursor
+{
+public:
+  static constexpr vk::DeviceSize kNoSpace = ~vk::DeviceSize(0);
+
+  RingCursor() = default;
+  explicit RingCursor(vk::DeviceSize capacity) : capacity_(capacity) {}
+
+  void BeginFrame(uint64_t frame_index)
+  {
+    frames_.push_back(FrameMarker{frame_index, consumed_});
+  }
+
+  /*
+    Returns the offset, or kNoSpace while the GPU still holds the space.
+    A wrap consumes the skipped tail until it retires, so only sizes up to half the capacity
+    are guaranteed to fit eventually; callers keep their requests within that.
+  */
+  vk::DeviceSize Allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16)
+  {
+    if(Used() == 0)
+    {
+      // Nothing in flight: start over at the beginning instead of wrapping around later.
+      head_ = 0;
+    }
+    auto offset = (head_ + alignment - 1) / alignment * alignment;
+    if(offset + size > capacity_)
+    {
+      // Wrap around; the skipped end of the buffer is consumed until retired.
+      offset = 0;
+    }
+    const auto skipped = (offset >= head_) ? offset - head_ : capacity_ - head_;
+    if(Used() + skipped + size > capacity_)
+    {
+      return kNoSpace;
+    }
+    head_      = offset + size;
+    consumed_ += skipped + size;
+    return offset;
+  }
+
+  void Retire(uint64_t completed_frame)
+  {
+    while(!frames_.empty() && frames_.front().frame_index <= completed_frame)
+    {
+      frames_.erase(frames_.begin());
+    }
+    // Everything consumed before the oldest live frame began is free again.
+    retired_ = frames_.empty() ? consumed_ : frames_.front().consumed_at_begin;
+  }
+
+  vk::DeviceSize Used() const { return consumed_ - retired_; }
+  vk::DeviceSize Capacity() const { return capacity_; }
+
+private:
+  struct FrameMarker
+  {
+    uint64_t       frame_index;
+    vk::DeviceSize consumed_at_begin;
+  };
+
+  vk::DeviceSize           capacity_  = 0;
+  vk::DeviceSize           head_      = 0;
+  // Monotonic byte counters; their difference is the space still owned by the GPU.
+  vk::DeviceSize           consumed_  = 0;
+  vk::DeviceSize           retired_   = 0;
+  std::vector<FrameMarker> frames_;
+};
+
+/*
+  Ring allocator over one buffer, shared by all frames in flight; see RingCursor.
+*/
+class RingArena
+{
+public:
+  RingArena() = default;
+  RingArena(DeviceAllocator& allocator, vk::DeviceSize capacity, vk::BufferUsageFlags usage, MemoryUsage memory_usage)
+    : allocator_(&allocator)
+  {
+    const auto device = allocator.GetDevice();
+    buffer_     = device.createBufferUnique(vk::BufferCreateInfo(vk::BufferCreateFlags(), capacity, usage, vk::SharingMode::eExclusive));
+    allocation_ = allocator.AllocateForBuffer(buffer_.get(), memory_usage);
+    cursor_     = RingCursor(capacity);
+  }
+
+  RingArena(RingArena&& other) { *this = std::move(other); }
+  RingArena& operator=(RingArena&& other)
+  {
+    Release();
+    allocator_        = other.allocator_;
+    buffer_           = std::move(other.buffer_);
+    allocation_       = other.allocation_;
+    cursor_           = std::move(other.cursor_);
+    other.allocator_  = nullptr;
+    other.allocation_ = Allocation();
+    return *this;
+  }
+
+  ~RingArena() { Release(); }
+
+  void BeginFrame(uint64_t frame_index) { cursor_.BeginFrame(frame_index); }
+
+  // Returns an empty region while the GPU still holds the space.
+  ArenaRegion Allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16)
+  {
+    const auto offset = cursor_.Allocate(size, alignment);
+    if(offset == RingCursor::kNoSpace)
+    {
+      return ArenaRegion();
+    }
+    return ArenaRegion{buffer_.get(), offset, size,
+                       allocation_.mapped ? static_cast<char*>(allocation_.mapped) + offset : nullptr};
+  }
+
+  void Retire(uint64_t completed_frame) { cursor_.Retire(completed_frame); }
+
+  vk::DeviceSize Used() const { return cursor_.Used(); }
+  vk::DeviceSize Capacity() const { return cursor_.Capacity(); }
+  vk::Buffer GetBuffer() const { return buffer_.get(); }
+  const Allocation& GetAllocation() const { return allocation_; }
+
+private:
+  void Release()
+  {
+    buffer_.reset();
+    if(allocator_)
+    {
+      allocator_->Free(allocation_);
+    }
+  }
+
+  DeviceAllocator* allocator_ = nullptr;
+  vk::UniqueBuffer buffer_;
+  Allocation       allocation_;
+  RingCursor       cursor_;
+};
+
+/*
+  Persistently mapped uniform buffer with one region per frame in flight.
+  BeginFrame(region) rewinds a region once the fence of the frame that last used it has
+  signaled. After that Allocate() never locks and never calls the driver: each thread takes
+  kThreadBlock-sized blocks out of the region with one atomic add and bumps inside its own
+  block. Offsets are multiples of minUniformBufferOffsetAlignment, so they can be passed
+  straight as dynamic offsets of a eUniformBufferDynamic descriptor over GetBuffer().
+*/
+class UniformRing
+{
+public:
+  static constexpr vk::DeviceSize kThreadBlock = 4096;
+
+  UniformRing(DeviceAllocator& allocator,
+              vk::DeviceSize   region_size,
+              uint32_t         regions,
+              uint32_t         threads,
+              vk::DeviceSize   alignment)
+    : allocator_(allocator), cursors_(threads), alignment_(std::max<vk::DeviceSize>(alignment, 1))
+  {
+    // minUniformBufferOffsetAlignment is a power of two of at most 256, so blocks stay aligned.
+    assert(kThreadBlock % alignment_ == 0);
+    region_size_ = std::max(kThreadBlock, (region_size + kThreadBlock - 1) / kThreadBlock * kThreadBlock);
+
+    const auto device = allocator.GetDevice();
+    buffer_     = device.createBufferUnique(vk::BufferCreateInfo(vk::BufferCreateFlags(),
+                                                                 region_size_ * regions,
+                                                                 vk::BufferUsageFlagBits::eUniformBuffer,
+                                                                 vk::SharingMode::eExclusive));
+    allocation_ = allocator.AllocateForBuffer(buffer_.get(), MemoryUsage::eCpuToGpu);
+    if(!allocation_.mapped)
+    {
+      throw std::runtime_error("Uniform ring memory is not host visible");
+    }
+  }
+
+  UniformRing(const UniformRing&) = delete;
+  UniformRing& operator=(const UniformRing&) = delete;
+
+  ~UniformRing()
+  {
+    buffer_.reset();
+    allocator_.Free(allocation_);
+  }
+
+  // Call from the render thread while no job is allocating.
+  void BeginFrame(uint32_t region)
+  {
+    peak_bytes_  = std::max(peak_bytes_, std::min(head_.load(std::memory_order_relaxed), region_size_));
+    region_base_ = region_size_ * region;
+    head_.store(0, std::memory_order_relaxed);
+    for(auto& cursor : cursors_)
+    {
+      cursor.next = 0;
+      cursor.end  = 0;
+    }
+  }
+
+  // Returns an empty region when this frame's region is full.
+  ArenaRegion Allocate(uint32_t thread_index, vk::DeviceSize size)
+  {
+    const auto aligned = (size + alignment_ - 1) / alignment_ * alignment_;
+    auto&      cursor  = cursors_[thread_index];
+    if(cursor.next + aligned > cursor.end)
+    {
+      // The rest of the old block is abandoned; it is at most one block per thread per frame.
+      const auto block = std::max(kThreadBlock, aligned);
+      const auto start = head_.fetch_add(block, std::memory_order_relaxed);
+      if(start + block > region_size_)
+      {
+        overflows_.fetch_add(1, std::memory_order_relaxed);
+        return ArenaRegion();
+      }
+      cursor.next = start;
+      cursor.end  = start + block;
+    }
+    const auto offset = region_base_ + cursor.next;
+    cursor.next += aligned;
+    return ArenaRegion{buffer_.get(), offset, size, static_cast<char*>(allocation_.mapped) + offset};
+  }
+
+  template <typename T>
+  ArenaRegion Write(uint32_t thread_index, const T& value)
+  {
+    const auto region = Allocate(thread_index, sizeof(T));
+    if(region)
+    {
+      std::memcpy(region.mapped, &value, sizeof(T));
+    }
+    return region;
+  }
+
+  // Make this frame's writes visible to the GPU before submitting. No-op for coherent memory.
+  void Flush() { allocator_.Flush(allocation_); }
+
+  vk::Buffer GetBuffer() const { return buffer_.get(); }
+  vk::DeviceSize RegionSize() const { return region_size_; }
+  // Largest region use seen at BeginFrame(), including abandoned block tails.
+  vk::DeviceSize PeakBytes() const { return peak_bytes_; }
+  uint64_t Overflows() const { return overflows_.load(std::memory_order_relaxed); }
+
+private:
+  // One cache line per thread, so bumping never shares a line with another thread.
+  struct alignas(64) ThreadCursor
+  {
+    vk::DeviceSize next = 0;
+    vk::DeviceSize end  = 0;
+  };
+
+  DeviceAllocator&            allocator_;
+  vk::UniqueBuffer            buffer_;
+  Allocation                  allocation_;
+  std::vector<ThreadCursor>   cursors_;
+  vk::DeviceSize              alignment_   = 1;
+  vk::DeviceSize              region_size_ = 0;
+  vk::DeviceSize              region_base_ = 0;
+  std::atomic<vk::DeviceSize> head_{0}; // bytes of the current region handed out as blocks
+  std::atomic<uint64_t>       overflows_{0};
+  vk::DeviceSize              peak_bytes_  = 0;
+};
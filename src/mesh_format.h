@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/*
+  .hkm binary mesh / scene format
+
+  Laid out to be mmap()ed and copied into staging memory as-is, with no parsing:
+
+    MeshFileHeader
+    MeshRecord[mesh_count]
+    InstanceRecord[instance_count]
+    vertex blob   MeshVertex[vertex_count]  at vertices_offset (kMeshBlobAlignment aligned)
+    index blob    uint32_t[index_count]     at indices_offset  (kMeshBlobAlignment aligned)
+
+  Little endian only. The blobs are page aligned so the loader can stream them in
+  page-sized runs and drop pages it has already copied.
+*/
+constexpr uint32_t kMeshFileMagic     = 0x4d4b4948; // "HIKM"
+constexpr uint32_t kMeshFileVersion   = 1;
+constexpr uint64_t kMeshBlobAlignment = 4096;
+
+struct MeshVertex
+{
+  float position[3];
+  float normal[3];
+  float uv[2];
+};
+
+struct MeshFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t mesh_count;
+  uint32_t instance_count;
+  uint32_t vertex_stride; // sizeof(MeshVertex)
+  uint32_t index_size;    // sizeof(uint32_t)
+  uint32_t reserved[2];
+  uint64_t vertex_count;
+  uint64_t index_count;
+  uint64_t meshes_offset;
+  uint64_t instances_offset;
+  uint64_t vertices_offset;
+  uint64_t indices_offset;
+};
+
+// Index range of one mesh in the blobs. The first 16 bytes match MeshDraw.
+struct MeshRecord
+{
+  uint32_t index_count;
+  uint32_t first_index;
+  int32_t  vertex_offset;
+  uint32_t padding;
+  float    bounds[4]; // xyz: center, w: radius (mesh space)
+};
+
+struct InstanceRecord
+{
+  float    transform[4]; // xy: offset, z: scale (same as DrawItem)
+  uint32_t mesh_id;
+  uint32_t padding[3];
+};
+
+static_assert(sizeof(MeshVertex) == 32, "MeshVertex is part of the file format");
+static_assert(sizeof(MeshFileHeader) == 80, "MeshFileHeader is part of the file format");
+static_assert(sizeof(MeshRecord) == 32, "MeshRecord is part of the file format");
+static_assert(sizeof(InstanceRecord) == 32, "InstanceRecord is part of the file format");
+
+/*
+  Validated view of a mapped .hkm file. The tables point straight into the mapping.
+*/
+class MeshFile
+{
+public:
+  bool Open(const std::string& path)
+  {
+    if(!file_.Open(path))
+    {
+      std::cerr << "Failed to map mesh file: " << path << std::endl;
+      return false;
+    }
+    if(!Validate())
+    {
+      std::cerr << "Invalid mesh file: " << path << std::endl;
+      file_.Close();
+      return false;
+    }
+    return true;
+  }
+
+  const MeshFileHeader& Header() const { return *reinterpret_cast<const MeshFileHeader*>(file_.Data()); }
+
+  const MeshRecord* Meshes() const
+  {
+    return reinterpret_cast<const MeshRecord*>(file_.Data() + Header().meshes_offset);
+  }
+
+  const InstanceRecord* Instances() const
+  {
+    return reinterpret_cast<const InstanceRecord*>(file_.Data() + Header().instances_offset);
+  }
+
+  const uint8_t* Vertices() const { return file_.Data() + Header().vertices_offset; }
+  uint64_t       VertexBytes() const { return Header().vertex_count * sizeof(MeshVertex); }
+  const uint8_t* Indices() const { return file_.Data() + Header().indices_offset; }
+  uint64_t       IndexBytes() const { return Header().index_count * sizeof(uint32_t); }
+
+  const MappedFile& File() const { return file_; }
+
+private:
+  bool Validate() const
+  {
+    const auto size = static_cast<uint64_t>(file_.Size());
+    if(size < sizeof(MeshFileHeader))
+    {
+      return false;
+    }
+    const auto& h       = Header();
+    auto        fits    = [size](uint64_t offset, uint64_t bytes) { return offset <= size && bytes <= size - offset; };
+    return h.magic == kMeshFileMagic &&
+           h.version == kMeshFileVersion &&
+           h.vertex_stride == sizeof(MeshVertex) &&
+           h.index_size == sizeof(uint32_t) &&
+           h.vertices_offset % kMeshBlobAlignment == 0 &&
+           h.indices_offset % kMeshBlobAlignment == 0 &&
+           fits(h.meshes_offset, uint64_t(h.mesh_count) * sizeof(MeshRecord)) &&
+           fits(h.instances_offset, uint64_t(h.instance_count) * sizeof(InstanceRecord)) &&
+           fits(h.vertices_offset, h.vertex_count * sizeof(MeshVertex)) &&
+           fits(h.indices_offset, h.index_count * sizeof(uint32_t));
+  }
+
+  MappedFile file_;
+};
+
+/*
+  Write a .hkm file. Used by tools and by the benchmarks to produce test scenes.
+*/
+inline bool WriteMeshFile(const std::string&                 path,
+                          const std::vector<MeshRecord>&     meshes,
+                          const std::vector<InstanceRecord>& instances,
+                          const std::vector<MeshVertex>&     vertices,
+                          const std::vector<uint32_t>&       indices)
+{
+  auto align = [](uint64_t v) { return (v + kMeshBlobAlignment - 1) / kMeshBlobAlignment * kMeshBlobAlignment; };
+
+  MeshFileHeader header   = {};
+  header.magic            = kMeshFileMagic;
+  header.version          = kMeshFileVersion;
+  header.mesh_count       = static_cast<uint32_t>(meshes.size());
+  header.instance_count   = static_cast<uint32_t>(instances.size());
+  header.vertex_stride    = sizeof(MeshVertex);
+  header.index_size       = sizeof(uint32_t);
+  header.vertex_count     = vertices.size();
+  header.index_count      = indices.size();
+  header.meshes_offset    = sizeof(MeshFileHeader);
+  header.instances_offset = header.meshes_offset + meshes.size() * sizeof(MeshRecord);
+  header.vertices_offset  = align(header.instances_offset + instances.size() * sizeof(InstanceRecord));
+  header.indices_offset   = align(header.vertices_offset + vertices.size() * sizeof(MeshVertex));
+
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  if(!ofs)
+  {
+    std::cerr << "Failed to write mesh file: " << path << std::endl;
+    return false;
+  }
+  auto pad_to = [&ofs](uint64_t offset) {
+    static const std::array<char, 4096> zeros = {};
+    auto position = static_cast<uint64_t>(ofs.tellp());
+    while(position < offset)
+    {
+      const auto n = std::min<uint64_t>(zeros.size(), offset - position);
+      ofs.write(zeros.data(), static_cast<std::streamsize>(n));
+      position += n;
+    }
+  };
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(meshes.data()), meshes.size() * sizeof(MeshRecord));
+  ofs.write(reinterpret_cast<const char*>(instances.data()), instances.size() * sizeof(InstanceRecord));
+  pad_to(header.vertices_offset);
+  ofs.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(MeshVertex));
+  pad_to(header.indices_offset);
+  ofs.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+  return static_cast<bool>(ofs);
+}
+
+/*
+  Test scene: one UV sphere with `segments` x `segments` quads, instanced on a grid.
+  Vertex data grows with segments^2 (about 32 * segments^2 bytes), so large segment
+  counts produce multi-GB files for load benchmarks.
+*/
+inline bool WriteTestScene(const std::string& path, uint32_t segments, uint32_t instance_count)
+{
+  segments = std::max(segments, 3u);
+  std::vector<MeshVertex> vertices;
+  std::vector<uint32_t>   indices;
+  vertices.reserve(size_t(segments + 1) * (segments + 1));
+  indices.reserve(size_t(segments) * segments * 6);
+
+  const float pi = 3.14159265358979f;
+  for(uint32_t y = 0; y <= segments; ++y)
+  {
+    const float v     = float(y) / segments;
+    const float theta = v * pi;
+    for(uint32_t x = 0; x <= segments; ++x)
+    {
+      const float u   = float(x) / segments;
+      const float phi = u * 2.0f * pi;
+      const float nx  = std::sin(theta) * std::cos(phi);
+      const float ny  = std::cos(theta);
+      const float nz  = std::sin(theta) * std::sin(phi);
+      vertices.push_back(MeshVertex{{nx * 0.5f, ny * 0.5f, nz * 0.5f}, {nx, ny, nz}, {u, v}});
+    }
+  }
+  for(uint32_t y = 0; y < segments; ++y)
+  {
+    for(uint32_t x = 0; x < segments; ++x)
+    {
+      const uint32_t a = y * (segments + 1) + x;
+      const uint32_t b = a + segments + 1;
+      indices.insert(indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+    }
+  }
+
+  std::vector<MeshRecord> meshes = {MeshRecord{static_cast<uint32_t>(indices.size()), 0, 0, 0, {0.0f, 0.0f, 0.0f, 0.5f}}};
+
+  std::vector<InstanceRecord> instances;
+  const auto columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(std::max(instance_count, 1u)))));
+  const auto scale   = 1.0f / columns;
+  for(uint32_t i = 0; i < instance_count; ++i)
+  {
+    const auto x = (i % columns + 0.5f) * 2.0f * scale - 1.0f;
+    const auto y = (i / columns + 0.5f) * 2.0f * scale - 1.0f;
+    instances.push_back(InstanceRecord{{x, y, scale * 2.0f, 0.0f}, 0, {0, 0, 0}});
+  }
+  return WriteMeshFile(path, meshes, instances, vertices, indices);
+}
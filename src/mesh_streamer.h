@@ -0,0 +1,558 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "memory_allocator.h"
+#include "mesh_format.h"
+
+/*
+  A scene file streamed into device-local vertex / index buffers.
+  Everything but the atomics is written by the streaming thread before `ready` is set and
+  is read-only afterwards.
+*/
+struct StreamedMesh
+{
+  StreamedMesh(DeviceAllocator& allocator) : allocator(allocator) {}
+  StreamedMesh(const StreamedMesh&) = delete;
+  StreamedMesh& operator=(const StreamedMesh&) = delete;
+  ~StreamedMesh()
+  {
+    vertex_buffer.reset();
+    index_buffer.reset();
+    allocator.Free(vertex_allocation);
+    allocator.Free(index_allocation);
+  }
+
+  DeviceAllocator&            allocator;
+  std::string                 path;
+  std::vector<MeshRecord>     meshes;
+  std::vector<InstanceRecord> instances;
+  vk::UniqueBuffer            vertex_buffer;
+  Allocation                  vertex_allocation;
+  vk::UniqueBuffer            index_buffer;
+  Allocation                  index_allocation;
+
+  std::atomic<bool>           ready{false};  // every chunk has landed; safe to draw
+  std::atomic<bool>           failed{false};
+  std::atomic<uint64_t>       total_bytes{0};    // vertex + index blobs
+  std::atomic<uint64_t>       bytes_uploaded{0};
+  std::atomic<double>         seconds{0.0};  // Load() to ready
+};
+
+/*
+  Background mesh streaming
+
+  A worker thread maps each requested file, allocates its device-local buffers and
+  copies the vertex / index blobs chunk by chunk into a persistently mapped staging ring,
+  recording one transfer command buffer per chunk. Nothing is parsed: chunks are plain
+  memcpy()s out of the mapping, so throughput is bounded by the disk (and page cache).
+
+  Submission depends on whether the device has a dedicated transfer queue:
+    dedicated: the worker owns the transfer queue and submits every chunk itself, so copies
+               run on the copy engine while the graphics queue renders. After the last chunk
+               it releases the buffers to the graphics family and signals a semaphore; the
+               render thread's Acquire() records the matching acquire barriers, makes its
+               frame wait on the semaphore and marks the mesh ready.
+    shared:    the worker never touches the queue. The render thread calls Submit() once per
+               frame to hand the recorded chunks to the graphics queue in one batch, so the
+               queue needs no lock. The mesh is ready once the last batch's fence signals.
+  Either way, staging space is recycled as soon as the batch that read it completes.
+*/
+class MeshStreamer
+{
+public:
+  // A null `transfer_queue` selects the shared mode; the queue must not be used by anyone else.
+  MeshStreamer(vk::Device       device,
+               DeviceAllocator& allocator,
+               uint32_t         graphics_queue_family,
+               vk::Queue        transfer_queue,
+               uint32_t         transfer_queue_family,
+               vk::DeviceSize   staging_bytes = 64ull << 20,
+               vk::DeviceSize   chunk_bytes   = 8ull << 20)
+    : device_(device),
+      allocator_(allocator),
+      graphics_family_(graphics_queue_family),
+      transfer_queue_(transfer_queue),
+      transfer_family_(transfer_queue ? transfer_queue_family : graphics_queue_family),
+      chunk_bytes_(std::min(chunk_bytes, staging_bytes / 2)), // larger chunks can starve in the ring (RingCursor::Allocate)
+      staging_(allocator, staging_bytes, vk::BufferUsageFlagBits::eTransferSrc, MemoryUsage::eCpuToGpu)
+  {
+    // Chunk command buffers are recycled individually once their batch completes.
+    command_pool_ = device_.createCommandPoolUnique(
+      vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+                                transfer_family_));
+
+    worker_ = std::thread([this] { WorkerLoop(); });
+  }
+
+  MeshStreamer(const MeshStreamer&) = delete;
+  MeshStreamer& operator=(const MeshStreamer&) = delete;
+
+  ~MeshStreamer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+
+    for(auto& batch : in_flight_)
+    {
+      device_.waitForFences(batch.fence.get(), VK_TRUE, UINT64_MAX);
+    }
+    in_flight_.clear();
+    pending_.clear();
+    handoffs_.clear();
+  }
+
+  bool Dedicated() const { return static_cast<bool>(transfer_queue_); }
+
+  // Stages the frame waiting on Acquire()'s semaphores must block before the first use.
+  static vk::PipelineStageFlags HandoffStages()
+  {
+    return vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader |
+           vk::PipelineStageFlagBits::eComputeShader;
+  }
+
+  // Queue `path` for streaming and return immediately. Poll the result's `ready` flag.
+  std::shared_ptr<StreamedMesh> Load(const std::string& path)
+  {
+    auto mesh  = std::make_shared<StreamedMesh>(allocator_);
+    mesh->path = path;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_.push_back(Request{mesh, std::chrono::steady_clock::now()});
+    }
+    cv_.notify_all();
+    return mesh;
+  }
+
+  /*
+    Render thread, once per frame: submit every chunk recorded since the last call.
+    The chunks end with a transfer -> vertex input barrier, so later submissions on the
+    same queue see the data.
+  */
+  void Submit(vk::Queue queue)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(pending_.empty())
+    {
+      return;
+    }
+    SubmitLocked(queue, std::move(pending_), nullptr);
+    pending_.clear();
+  }
+
+  /*
+    Render thread, dedicated mode, while recording a frame (outside a render pass):
+    take ownership of every mesh whose upload has been released by the transfer queue.
+    The frame's submission must wait on the returned semaphores at HandoffStages() and
+    keep them alive until its fence signals. The meshes are drawable from here on.
+  */
+  std::vector<vk::UniqueSemaphore> Acquire(vk::CommandBuffer command_buffer)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<vk::UniqueSemaphore> semaphores;
+    for(auto& handoff : handoffs_)
+    {
+      auto& mesh = *handoff.mesh;
+      if(transfer_family_ != graphics_family_)
+      {
+        const auto barriers = OwnershipBarriers(mesh, vk::AccessFlags(), kReadAccess);
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                       HandoffStages(),
+                                       vk::DependencyFlags(),
+                                       nullptr,
+                                       barriers,
+                                       nullptr);
+      }
+      mesh.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - handoff.start).count();
+      mesh.ready   = true;
+      semaphores.push_back(std::move(handoff.semaphore));
+    }
+    handoffs_.clear();
+    return semaphores;
+  }
+
+private:
+  struct Request
+  {
+    std::shared_ptr<StreamedMesh>         mesh;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  struct Chunk
+  {
+    vk::UniqueCommandBuffer               command_buffer;
+    uint64_t                              sequence = 0; // RingArena "frame" owning the staging space
+    vk::DeviceSize                        bytes    = 0;
+    std::shared_ptr<StreamedMesh>         mesh;
+    bool                                  last     = false;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  struct Batch
+  {
+    vk::UniqueFence    fence;
+    std::vector<Chunk> chunks;
+  };
+
+  // A mesh released by the transfer queue, waiting for the render thread to acquire it.
+  struct Handoff
+  {
+    std::shared_ptr<StreamedMesh>         mesh;
+    vk::UniqueSemaphore                   semaphore;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  static constexpr vk::AccessFlags kReadAccess = vk::AccessFlagBits::eVertexAttributeRead |
+                                                 vk::AccessFlagBits::eIndexRead |
+                                                 vk::AccessFlagBits::eShaderRead;
+
+  // Release (transfer queue) or acquire (graphics queue) half of the queue family ownership transfer.
+  std::array<vk::BufferMemoryBarrier, 2> OwnershipBarriers(const StreamedMesh& mesh, vk::AccessFlags src, vk::AccessFlags dst) const
+  {
+    return {vk::BufferMemoryBarrier(src, dst, transfer_family_, graphics_family_, mesh.vertex_buffer.get(), 0, VK_WHOLE_SIZE),
+            vk::BufferMemoryBarrier(src, dst, transfer_family_, graphics_family_, mesh.index_buffer.get(), 0, VK_WHOLE_SIZE)};
+  }
+
+  // Called with the lock held.
+  void SubmitLocked(vk::Queue queue, std::vector<Chunk> chunks, vk::Semaphore signal)
+  {
+    Batch batch;
+    batch.fence = AcquireFence();
+    std::vector<vk::CommandBuffer> command_buffers;
+    for(auto& chunk : chunks)
+    {
+      command_buffers.push_back(chunk.command_buffer.get());
+    }
+    queue.submit(vk::SubmitInfo(0, nullptr, nullptr,
+                                static_cast<uint32_t>(command_buffers.size()), command_buffers.data(),
+                                signal ? 1 : 0, &signal),
+                 batch.fence.get());
+    batch.chunks = std::move(chunks);
+    in_flight_.push_back(std::move(batch));
+    cv_.notify_all();
+  }
+
+  vk::UniqueFence AcquireFence()
+  {
+    if(!free_fences_.empty())
+    {
+      auto fence = std::move(free_fences_.back());
+      free_fences_.pop_back();
+      device_.resetFences(fence.get());
+      return fence;
+    }
+    return device_.createFenceUnique(vk::FenceCreateInfo());
+  }
+
+  // Recycle completed batches, oldest first. Called with the lock held.
+  void Reclaim()
+  {
+    while(!in_flight_.empty() && device_.getFenceStatus(in_flight_.front().fence.get()) == vk::Result::eSuccess)
+    {
+      auto& batch = in_flight_.front();
+      for(auto& chunk : batch.chunks)
+      {
+        staging_.Retire(chunk.sequence);
+        chunk.mesh->bytes_uploaded += chunk.bytes;
+        if(chunk.last)
+        {
+          chunk.mesh->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - chunk.start).count();
+          chunk.mesh->ready   = true;
+        }
+        chunk.command_buffer->reset(vk::CommandBufferResetFlags());
+        free_command_buffers_.push_back(std::move(chunk.command_buffer));
+      }
+      free_fences_.push_back(std::move(batch.fence));
+      in_flight_.pop_front();
+    }
+  }
+
+  /*
+    Reserve `bytes` of staging space for chunk `sequence`, waiting for the GPU when the
+    ring is full. Returns an empty region when shutting down.
+  */
+  ArenaRegion ReserveStaging(std::unique_lock<std::mutex>& lock, uint64_t sequence, vk::DeviceSize bytes)
+  {
+    staging_.BeginFrame(sequence);
+    for(;;)
+    {
+      Reclaim();
+      if(quit_)
+      {
+        return ArenaRegion();
+      }
+      if(const auto region = staging_.Allocate(bytes))
+      {
+        return region;
+      }
+      if(!in_flight_.empty())
+      {
+        // Wait for the oldest batch without holding the lock, so Submit() is never blocked.
+        const auto fence = in_flight_.front().fence.get();
+        lock.unlock();
+        device_.waitForFences(fence, VK_TRUE, UINT64_MAX);
+        lock.lock();
+      }
+      else
+      {
+        // Everything is recorded but not yet submitted: wait for the render thread.
+        cv_.wait(lock, [this] { return quit_ || !in_flight_.empty(); });
+      }
+    }
+  }
+
+  // Draw ranges must stay inside the blobs; the GPU does not bounds-check index fetches.
+  static bool ValidateRanges(const MeshFile& file)
+  {
+    const auto& header = file.Header();
+    for(uint32_t i = 0; i < header.mesh_count; ++i)
+    {
+      const auto& mesh = file.Meshes()[i];
+      if(uint64_t(mesh.first_index) + mesh.index_count > header.index_count)
+      {
+        std::cerr << "Mesh " << i << " indexes past the end of the index blob." << std::endl;
+        return false;
+      }
+    }
+    for(uint32_t i = 0; i < header.instance_count; ++i)
+    {
+      if(file.Instances()[i].mesh_id >= header.mesh_count)
+      {
+        std::cerr << "Instance " << i << " references a missing mesh." << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  vk::UniqueCommandBuffer AcquireCommandBuffer()
+  {
+    if(!free_command_buffers_.empty())
+    {
+      auto command_buffer = std::move(free_command_buffers_.back());
+      free_command_buffers_.pop_back();
+      return command_buffer;
+    }
+    return std::move(device_.allocateCommandBuffersUnique(
+      vk::CommandBufferAllocateInfo(command_pool_.get(), vk::CommandBufferLevel::ePrimary, 1))[0]);
+  }
+
+  void Stream(std::unique_lock<std::mutex>& lock, const Request& request)
+  {
+    auto& mesh = *request.mesh;
+
+    // Mapping, validation and allocation happen without the lock; only the ring is shared.
+    lock.unlock();
+    MeshFile file;
+    bool     ok = file.Open(mesh.path) && ValidateRanges(file);
+    if(ok)
+    {
+      const auto& header = file.Header();
+      mesh.meshes.assign(file.Meshes(), file.Meshes() + header.mesh_count);
+      mesh.instances.assign(file.Instances(), file.Instances() + header.instance_count);
+      mesh.total_bytes = file.VertexBytes() + file.IndexBytes();
+
+      auto create = [this](vk::DeviceSize size, vk::BufferUsageFlags usage, vk::UniqueBuffer* buffer, Allocation* allocation) {
+        *buffer     = device_.createBufferUnique(vk::BufferCreateInfo(vk::BufferCreateFlags(),
+                                                                      std::max<vk::DeviceSize>(size, 16),
+                                                                      usage | vk::BufferUsageFlagBits::eTransferDst,
+                                                                      vk::SharingMode::eExclusive));
+        *allocation = allocator_.AllocateForBuffer(buffer->get(), MemoryUsage::eGpuOnly);
+      };
+      create(file.VertexBytes(), vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+             &mesh.vertex_buffer, &mesh.vertex_allocation);
+      create(file.IndexBytes(), vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+             &mesh.index_buffer, &mesh.index_allocation);
+    }
+    lock.lock();
+    if(!ok)
+    {
+      mesh.failed = true;
+      return;
+    }
+
+    struct Blob
+    {
+      const uint8_t* data;
+      uint64_t       size;
+      uint64_t       file_offset;
+      vk::Buffer     destination;
+    };
+    const std::array<Blob, 2> blobs = {
+      Blob{file.Vertices(), file.VertexBytes(), file.Header().vertices_offset, mesh.vertex_buffer.get()},
+      Blob{file.Indices(), file.IndexBytes(), file.Header().indices_offset, mesh.index_buffer.get()}};
+
+    uint64_t queued = 0;
+    for(const auto& blob : blobs)
+    {
+      for(uint64_t done = 0; done < blob.size;)
+      {
+        const auto     bytes    = std::min<uint64_t>(chunk_bytes_, blob.size - done);
+        const auto     sequence = next_sequence_++;
+        const auto     region   = ReserveStaging(lock, sequence, bytes);
+        if(!region)
+        {
+          return;
+        }
+        auto command_buffer = AcquireCommandBuffer();
+
+        // The copy out of the mapping is the only per-byte CPU work.
+        lock.unlock();
+        std::memcpy(region.mapped, blob.data + done, static_cast<size_t>(bytes));
+        file.File().Release(static_cast<size_t>(blob.file_offset + done), static_cast<size_t>(bytes));
+        allocator_.Flush(staging_.GetAllocation());
+
+        command_buffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        command_buffer->copyBuffer(region.buffer, blob.destination, vk::BufferCopy(region.offset, done, bytes));
+        if(!Dedicated())
+        {
+          // Same queue as the draws: a barrier is enough. Transfer queues have no vertex stages.
+          command_buffer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                          HandoffStages(),
+                                          vk::DependencyFlags(),
+                                          vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite, kReadAccess),
+                                          nullptr,
+                                          nullptr);
+        }
+        command_buffer->end();
+        lock.lock();
+
+        done   += bytes;
+        queued += bytes;
+        Chunk chunk;
+        chunk.command_buffer = std::move(command_buffer);
+        chunk.sequence       = sequence;
+        chunk.bytes          = bytes;
+        chunk.mesh           = request.mesh;
+        chunk.last           = !Dedicated() && queued == mesh.total_bytes;
+        chunk.start          = request.start;
+        if(Dedicated())
+        {
+          std::vector<Chunk> single;
+          single.push_back(std::move(chunk));
+          SubmitLocked(transfer_queue_, std::move(single), nullptr);
+        }
+        else
+        {
+          pending_.push_back(std::move(chunk));
+        }
+      }
+    }
+
+    if(Dedicated() && mesh.total_bytes > 0)
+    {
+      Release(request, next_sequence_ - 1);
+    }
+
+    // Empty blobs: nothing to wait for.
+    if(mesh.total_bytes == 0)
+    {
+      mesh.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - request.start).count();
+      mesh.ready   = true;
+    }
+  }
+
+  /*
+    Dedicated mode: release both buffers to the graphics family after the last copy and
+    signal a semaphore for the render thread's Acquire(). Queue order puts the release
+    behind every chunk of the mesh.
+  */
+  void Release(const Request& request, uint64_t last_sequence)
+  {
+    auto command_buffer = AcquireCommandBuffer();
+    command_buffer->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    if(transfer_family_ != graphics_family_)
+    {
+      const auto barriers = OwnershipBarriers(*request.mesh, vk::AccessFlagBits::eTransferWrite, vk::AccessFlags());
+      command_buffer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                      vk::PipelineStageFlagBits::eBottomOfPipe,
+                                      vk::DependencyFlags(),
+                                      nullptr,
+                                      barriers,
+                                      nullptr);
+    }
+    command_buffer->end();
+
+    Handoff handoff;
+    handoff.mesh      = request.mesh;
+    handoff.semaphore = device_.createSemaphoreUnique(vk::SemaphoreCreateInfo());
+    handoff.start     = request.start;
+
+    Chunk chunk;
+    chunk.command_buffer = std::move(command_buffer);
+    chunk.sequence       = last_sequence; // no staging space of its own
+    chunk.mesh           = request.mesh;
+    std::vector<Chunk> single;
+    single.push_back(std::move(chunk));
+    SubmitLocked(transfer_queue_, std::move(single), handoff.semaphore.get());
+    handoffs_.push_back(std::move(handoff));
+  }
+
+  void WorkerLoop()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(;;)
+    {
+      cv_.wait(lock, [this] { return quit_ || !requests_.empty() || !in_flight_.empty(); });
+      if(quit_)
+      {
+        return;
+      }
+      if(!requests_.empty())
+      {
+        const auto request = requests_.front();
+        requests_.pop_front();
+        Stream(lock, request);
+        continue;
+      }
+      // Nothing new to stream: retire the submitted chunks so their meshes become ready.
+      const auto fence = in_flight_.front().fence.get();
+      lock.unlock();
+      device_.waitForFences(fence, VK_TRUE, UINT64_MAX);
+      lock.lock();
+      Reclaim();
+    }
+  }
+
+  vk::Device                           device_;
+  DeviceAllocator&                     allocator_;
+  uint32_t                             graphics_family_;
+  vk::Queue                            transfer_queue_; // worker thread only; null in shared mode
+  uint32_t                             transfer_family_;
+  vk::DeviceSize                       chunk_bytes_;
+  RingArena                            staging_; // guarded by mutex_ after construction
+  uint64_t                             next_sequence_ = 0;
+  vk::UniqueCommandPool                command_pool_; // worker thread only
+
+  std::mutex                           mutex_;
+  std::condition_variable              cv_;
+  bool                                 quit_ = false;
+  std::deque<Request>                  requests_;
+  std::vector<Chunk>                   pending_;   // recorded, waiting for Submit()
+  std::deque<Batch>                    in_flight_; // submitted, waiting for their fence
+  std::vector<Handoff>                 handoffs_;  // released, waiting for Acquire()
+  std::vector<vk::UniqueCommandBuffer> free_command_buffers_;
+  std::vector<vk::UniqueFence>         free_fences_;
+
+
+  std::thread                          worker_;
+};
@@ -0,0 +1,724 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "deletion_queue.h"
+#include "shader_cache.h"
+#include "vertex_format.h"
+
+// Value for one `layout(constant_id = id)` constant, baked in when the pipeline is created.
+struct SpecializationConstant
+{
+  uint32_t id;
+  uint32_t value; // bools are 0 / 1
+};
+
+// FNV-1a over the little-endian bytes of `v`. constexpr, so fixed state can be hashed at compile time.
+constexpr uint64_t kHashSeed = 14695981039346656037ull;
+
+constexpr uint64_t HashBytes(uint64_t h, uint64_t v, uint32_t bytes)
+{
+  for(uint32_t i = 0; i < bytes; ++i)
+  {
+    h = (h ^ ((v >> (8 * i)) & 0xff)) * 1099511628211ull;
+  }
+  return h;
+}
+constexpr uint64_t HashU32(uint64_t h, uint32_t v) { return HashBytes(h, v, 4); }
+constexpr uint64_t HashU64(uint64_t h, uint64_t v) { return HashBytes(h, v, 8); }
+
+// Fixed-function state of a graphics pipeline. A literal type, so pipeline templates declare it constexpr.
+struct RasterState
+{
+  vk::PrimitiveTopology topology      = vk::PrimitiveTopology::eTriangleList;
+  vk::PolygonMode       polygon_mode  = vk::PolygonMode::eFill;
+  vk::CullModeFlagBits  cull_mode     = vk::CullModeFlagBits::eBack;
+  vk::FrontFace         front_face    = vk::FrontFace::eCounterClockwise;
+  bool                  depth_test    = true;
+  bool                  depth_write   = true;
+  vk::CompareOp         depth_compare = vk::CompareOp::eLessOrEqual;
+  bool                  blend         = false;
+
+  constexpr uint64_t Hash(uint64_t h = kHashSeed) const
+  {
+    h = HashU32(h, static_cast<uint32_t>(topology));
+    h = HashU32(h, static_cast<uint32_t>(polygon_mode));
+    h = HashU32(h, static_cast<uint32_t>(cull_mode));
+    h = HashU32(h, static_cast<uint32_t>(front_face));
+    h = HashU32(h, depth_test);
+    h = HashU32(h, depth_write);
+    h = HashU32(h, static_cast<uint32_t>(depth_compare));
+    return HashU32(h, blend);
+  }
+
+  constexpr RasterState WithCullMode(vk::CullModeFlagBits mode) const
+  {
+    auto state      = *this;
+    state.cull_mode = mode;
+    return state;
+  }
+};
+
+// Raster state plus vertex input: everything about a graphics pipeline a template fixes at compile time.
+constexpr uint64_t HashFixedState(const RasterState&                         raster,
+                                  const vk::VertexInputBindingDescription*   bindings,
+                                  size_t                                     binding_count,
+                                  const vk::VertexInputAttributeDescription* attributes,
+                                  size_t                                     attribute_count)
+{
+  uint64_t h = raster.Hash();
+  h          = HashU32(h, static_cast<uint32_t>(binding_count));
+  for(size_t i = 0; i < binding_count; ++i)
+  {
+    h = HashU32(h, bindings[i].binding);
+    h = HashU32(h, bindings[i].stride);
+    h = HashU32(h, static_cast<uint32_t>(bindings[i].inputRate));
+  }
+  h = HashU32(h, static_cast<uint32_t>(attribute_count));
+  for(size_t i = 0; i < attribute_count; ++i)
+  {
+    h = HashU32(h, attributes[i].location);
+    h = HashU32(h, attributes[i].binding);
+    h = HashU32(h, static_cast<uint32_t>(attributes[i].format));
+    h = HashU32(h, attributes[i].offset);
+  }
+  return h;
+}
+
+/*
+  Everything that goes into a graphics or compute pipeline.
+  A non-empty compute_shader makes it a compute pipeline; only `layout` is used besides it.
+  Two states with the same Hash() share one vk::Pipeline. Graphics pipelines known at compile
+  time are better built with GraphicsPipelineTemplate below.
+*/
+struct PipelineState
+{
+  std::string             vertex_shader;   // SPIR-V file paths
+  std::string             fragment_shader;
+  std::string             compute_shader;
+
+  RasterState             raster;
+  vk::SampleCountFlagBits samples            = vk::SampleCountFlagBits::e1;
+  // Fraction of samples shaded individually (sampleRateShading); 0 shades once per pixel.
+  float                   min_sample_shading = 0.0f;
+
+  std::vector<vk::VertexInputBindingDescription>   bindings;
+  std::vector<vk::VertexInputAttributeDescription> attributes;
+
+  // Applied to every stage; ids a stage does not declare are ignored. One permutation per value set.
+  std::vector<SpecializationConstant> specialization;
+
+  vk::PipelineLayout      layout;
+  vk::RenderPass          render_pass;
+  uint32_t                subpass = 0;
+
+  // HashFixedState() of raster / bindings / attributes, set by GraphicsPipelineTemplate. 0 = computed by Hash().
+  uint64_t                fixed_hash = 0;
+
+  // FNV-1a over every field. 64 bits is plenty for the number of pipelines we create.
+  uint64_t Hash() const
+  {
+    uint64_t h   = kHashSeed;
+    auto     add = [&h](const std::string& s) {
+      for(const auto c : s)
+      {
+        h = HashBytes(h, static_cast<uint8_t>(c), 1);
+      }
+    };
+
+    add(vertex_shader);
+    h = HashU32(h, 0xffffffffu);
+    add(fragment_shader);
+    h = HashU32(h, 0xffffffffu);
+    add(compute_shader);
+    h = HashU64(h, fixed_hash ? fixed_hash
+                              : HashFixedState(raster, bindings.data(), bindings.size(), attributes.data(), attributes.size()));
+    h = HashU32(h, static_cast<uint32_t>(samples));
+    uint32_t shading_bits = 0;
+    std::memcpy(&shading_bits, &min_sample_shading, sizeof(shading_bits));
+    h = HashU32(h, shading_bits);
+    for(const auto& c : specialization)
+    {
+      h = HashU32(h, c.id);
+      h = HashU32(h, c.value);
+    }
+    h = HashU64(h, (uint64_t)static_cast<VkPipelineLayout>(layout));
+    h = HashU64(h, (uint64_t)static_cast<VkRenderPass>(render_pass));
+    return HashU32(h, subpass);
+  }
+};
+
+/*
+  Compile-time graphics pipeline description
+
+  `Desc` declares, as static constexpr members:
+    kVertexShader, kFragmentShader  file names under the shader directory (const char*)
+    kRaster                         RasterState
+    kVertex                         VertexLayout of the vertex buffer (NoVertexInput for none)
+    kInputs                         std::array<ShaderInput, N>: the vertex shader's inputs
+  The binding and attribute arrays and the fixed part of the state hash are computed by the
+  compiler, and a vertex struct that does not match the shader's inputs fails to build.
+  State() only fills in the handles known at run time.
+*/
+template <typename Desc>
+struct GraphicsPipelineTemplate
+{
+  static_assert(Desc::kVertex.Valid(), "Vertex attributes overlap or do not fit the vertex stride.");
+  static_assert(Desc::kVertex.Feeds(Desc::kInputs), "The vertex layout does not match the vertex shader's inputs.");
+
+  static constexpr auto     kBindings   = Desc::kVertex.Bindings();
+  static constexpr auto     kAttributes = Desc::kVertex.Attributes();
+  static constexpr uint64_t kFixedHash  = HashFixedState(Desc::kRaster, kBindings.data(), kBindings.size(),
+                                                         kAttributes.data(), kAttributes.size());
+
+  static PipelineState State(const std::string&      shader_dir,
+                             vk::PipelineLayout      layout,
+                             vk::RenderPass          render_pass,
+                             vk::SampleCountFlagBits samples            = vk::SampleCountFlagBits::e1,
+                             float                   min_sample_shading = 0.0f)
+  {
+    PipelineState state;
+    state.vertex_shader      = shader_dir + "/" + Desc::kVertexShader;
+    state.fragment_shader    = shader_dir + "/" + Desc::kFragmentShader;
+    state.raster             = Desc::kRaster;
+    state.samples            = samples;
+    state.min_sample_shading = min_sample_shading;
+    state.bindings.assign(kBindings.begin(), kBindings.end());
+    state.attributes.assign(kAttributes.begin(), kAttributes.end());
+    state.layout             = layout;
+    state.render_pass        = render_pass;
+    state.fixed_hash         = kFixedHash;
+    return state;
+  }
+};
+
+// Slot of a requested pipeline, 1-based; 0 is never returned by Request(), so it can mean "none".
+using PipelineHandle = uint32_t;
+
+struct PipelineStats
+{
+  uint64_t requested          = 0;
+  uint64_t deduplicated       = 0; // requests answered by an existing pipeline
+  uint64_t compiled           = 0;
+  uint64_t failed             = 0;
+  uint64_t reloaded           = 0; // pipelines rebuilt because a shader changed on disk
+  double   compile_seconds    = 0.0; // summed over workers
+  size_t   cache_bytes_loaded = 0;
+  bool     cache_valid        = false;
+};
+
+/*
+  Pipeline creation subsystem
+
+  Pipelines are compiled on background threads against one vk::PipelineCache.
+  The cache is written to `cache_path` on destruction and reused on the next launch
+  when its header matches this device (vendor, device id and pipelineCacheUUID),
+  so warm starts skip the driver's shader compilation.
+  Shader modules come from a ShaderCache, so every file is loaded once however many
+  permutations use it.
+
+  Hot reload: ReloadChangedShaders() queues every pipeline using a changed file for
+  recompilation. Get() keeps returning the old pipeline until the new one is ready; the old
+  one goes to the owner's DeletionQueue, which destroys it once no frame can still use it.
+
+  Request() hashes the state once; the handle it returns indexes a fixed table of atomics,
+  so Get() on the render thread is a single load with no lock and no hashing.
+*/
+class PipelineManager
+{
+public:
+  PipelineManager(vk::PhysicalDevice physical_device, vk::Device device, DeletionQueue& deletion_queue,
+                  std::string cache_path, uint32_t worker_count = 0)
+    : device_(device), deletion_queue_(deletion_queue), cache_path_(std::move(cache_path)), shaders_(device),
+      slots_(new Slot[kMaxPipelines])
+  {
+    for(uint32_t i = 0; i < kMaxPipelines; ++i)
+    {
+      slots_[i].pipeline.store(VK_NULL_HANDLE, std::memory_order_relaxed);
+      slots_[i].version.store(0, std::memory_order_relaxed);
+    }
+    device_properties_ = physical_device.getProperties();
+
+    /*
+      Pipeline cache creation
+      ヘッダが現在のデバイスと一致しない場合は空のキャッシュから始める
+    */
+    std::vector<uint8_t> initial_data = LoadCacheFile();
+    auto ci = vk::PipelineCacheCreateInfo(vk::PipelineCacheCreateFlags(), initial_data.size(), initial_data.data());
+    cache_  = device_.createPipelineCacheUnique(ci);
+    stats_.cache_bytes_loaded = initial_data.size();
+    stats_.cache_valid        = !initial_data.empty();
+
+    if(worker_count == 0)
+    {
+      // Leave one core for the render thread.
+      const auto cores = std::thread::hardware_concurrency();
+      worker_count     = cores > 1 ? cores - 1 : 1;
+    }
+    for(uint32_t i = 0; i < worker_count; ++i)
+    {
+      workers_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  PipelineManager(const PipelineManager&) = delete;
+  PipelineManager& operator=(const PipelineManager&) = delete;
+
+  ~PipelineManager()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    queue_cv_.notify_all();
+    for(auto& worker : workers_)
+    {
+      worker.join();
+    }
+
+    Save();
+
+    for(auto& entry : entries_)
+    {
+      if(entry.second->pipeline)
+      {
+        device_.destroyPipeline(entry.second->pipeline);
+      }
+    }
+  }
+
+  /*
+    Queue `state` for compilation and return immediately.
+    Requesting an identical state again returns the same handle without recompiling.
+  */
+  PipelineHandle Request(const PipelineState& state)
+  {
+    const auto hash = state.Hash();
+    PipelineHandle handle = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.requested;
+      const auto it = entries_.find(hash);
+      if(it != entries_.end())
+      {
+        ++stats_.deduplicated;
+        return it->second->handle;
+      }
+      if(entries_.size() >= kMaxPipelines)
+      {
+        throw std::runtime_error("Too many pipelines; raise PipelineManager::kMaxPipelines.");
+      }
+      handle        = static_cast<PipelineHandle>(entries_.size() + 1);
+      auto entry    = std::make_unique<Entry>();
+      entry->state  = state;
+      entry->handle = handle;
+      entry->queued = true;
+      queue_.push_back(entry.get());
+      entries_.emplace(hash, std::move(entry));
+    }
+    queue_cv_.notify_one();
+    return handle;
+  }
+
+  // Null until the pipeline has finished compiling (or if it failed). Lock-free; any thread.
+  vk::Pipeline Get(PipelineHandle handle) const
+  {
+    if(handle == 0 || handle > kMaxPipelines)
+    {
+      return vk::Pipeline();
+    }
+    return vk::Pipeline(slots_[handle - 1].pipeline.load(std::memory_order_acquire));
+  }
+
+  /*
+    Number of times the handle's pipeline has been published (compiled, reloaded or failed);
+    0 before the first. Unlike vk::Pipeline values, which the driver may hand out again after
+    a reloaded pipeline is destroyed, versions never repeat, so they can key cached recordings.
+    Read it before Get(): the pipeline is then at least as new as the version.
+  */
+  uint32_t Version(PipelineHandle handle) const
+  {
+    if(handle == 0 || handle > kMaxPipelines)
+    {
+      return 0;
+    }
+    return slots_[handle - 1].version.load(std::memory_order_acquire);
+  }
+
+  /*
+    Check the shader files for changes, at most every kReloadInterval, and queue the pipelines
+    that use a changed file. `frame` is the frame being recorded: a pipeline replaced from
+    now on may have been used by it. Returns the number of pipelines queued.
+  */
+  uint32_t ReloadChangedShaders(uint64_t frame)
+  {
+    const auto now = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      frame_ = frame;
+      if(now - last_reload_check_ < kReloadInterval)
+      {
+        return 0;
+      }
+      last_reload_check_ = now;
+    }
+
+    const auto changed = shaders_.Refresh();
+    if(changed.empty())
+    {
+      return 0;
+    }
+    uint32_t queued = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for(auto& entry : entries_)
+      {
+        auto&      e    = *entry.second;
+        const bool uses = std::any_of(changed.begin(), changed.end(), [&e](const std::string& path) {
+          return path == e.state.vertex_shader || path == e.state.fragment_shader || path == e.state.compute_shader;
+        });
+        if(uses && !e.queued)
+        {
+          e.queued = true;
+          queue_.push_back(&e);
+          ++queued;
+        }
+      }
+    }
+    for(const auto& path : changed)
+    {
+      std::clog << "Shader changed: " << path << std::endl;
+    }
+    queue_cv_.notify_all();
+    return queued;
+  }
+
+  // Block until every queued pipeline has been compiled.
+  void WaitIdle()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return queue_.empty() && busy_workers_ == 0; });
+  }
+
+  // Write the pipeline cache to disk. Written to a temporary file first so a crash never leaves a torn cache.
+  bool Save() const
+  {
+    if(cache_path_.empty())
+    {
+      return false;
+    }
+    const auto data      = device_.getPipelineCacheData(cache_.get());
+    const auto temp_path = cache_path_ + ".tmp";
+    {
+      std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+      if(!ofs)
+      {
+        std::cerr << "Failed to write pipeline cache: " << temp_path << std::endl;
+        return false;
+      }
+      ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+    return std::rename(temp_path.c_str(), cache_path_.c_str()) == 0;
+  }
+
+  PipelineStats Stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  ShaderCacheStats ShaderStats() const { return shaders_.Stats(); }
+
+  vk::PipelineCache GetCache() const { return cache_.get(); }
+
+private:
+  static constexpr std::chrono::milliseconds kReloadInterval{500};
+
+  // Request() throws beyond this. Sized so the slot table is a few pages.
+  static constexpr uint32_t kMaxPipelines = 1024;
+
+  struct Entry
+  {
+    PipelineState  state;
+    vk::Pipeline   pipeline; // what slots_[handle - 1] publishes
+    PipelineHandle handle = 0;
+    bool           queued = false; // waiting in queue_; guarded by mutex_
+  };
+
+  // What Get() / Version() read without the lock.
+  struct Slot
+  {
+    std::atomic<VkPipeline> pipeline;
+    std::atomic<uint32_t>   version;
+  };
+
+  // Specialization data for one pipeline; must outlive the create call.
+  struct Specialization
+  {
+    std::vector<vk::SpecializationMapEntry> entries;
+    std::vector<uint32_t>                   data;
+    vk::SpecializationInfo                  info;
+
+    explicit Specialization(const std::vector<SpecializationConstant>& constants)
+    {
+      for(const auto& c : constants)
+      {
+        entries.push_back(vk::SpecializationMapEntry(c.id, static_cast<uint32_t>(data.size() * sizeof(uint32_t)), sizeof(uint32_t)));
+        data.push_back(c.value);
+      }
+      info = vk::SpecializationInfo(static_cast<uint32_t>(entries.size()), entries.data(),
+                                    data.size() * sizeof(uint32_t), data.data());
+    }
+
+    const vk::SpecializationInfo* Get() const { return entries.empty() ? nullptr : &info; }
+  };
+
+  std::vector<uint8_t> LoadCacheFile() const
+  {
+    std::ifstream ifs(cache_path_, std::ios::binary | std::ios::ate);
+    if(!ifs)
+    {
+      return {};
+    }
+    std::vector<uint8_t> data(static_cast<size_t>(ifs.tellg()));
+    ifs.seekg(0);
+    ifs.read(reinterpret_cast<char*>(data.data()), data.size());
+
+    /*
+      VkPipelineCacheHeaderVersionOne
+        uint32_t length, version, vendorID, deviceID
+        uint8_t  pipelineCacheUUID[VK_UUID_SIZE]
+    */
+    constexpr size_t kHeaderSize = 16 + VK_UUID_SIZE;
+    if(data.size() < kHeaderSize)
+    {
+      return {};
+    }
+    uint32_t header[4];
+    std::memcpy(header, data.data(), sizeof(header));
+    const bool valid = header[0] >= kHeaderSize &&
+                       header[1] == static_cast<uint32_t>(VK_PIPELINE_CACHE_HEADER_VERSION_ONE) &&
+                       header[2] == device_properties_.vendorID &&
+                       header[3] == device_properties_.deviceID &&
+                       std::memcmp(data.data() + 16, device_properties_.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    if(!valid)
+    {
+      std::cerr << "Pipeline cache " << cache_path_ << " was built for another device or driver; ignoring it." << std::endl;
+      return {};
+    }
+    return data;
+  }
+
+  vk::Pipeline CompileCompute(const PipelineState& state)
+  {
+    const auto compute_module = shaders_.Get(state.compute_shader);
+    if(!compute_module)
+    {
+      return vk::Pipeline();
+    }
+    const Specialization specialization(state.specialization);
+    const auto stage = vk::PipelineShaderStageCreateInfo(vk::PipelineShaderStageCreateFlags(),
+                                                         vk::ShaderStageFlagBits::eCompute,
+                                                         compute_module,
+                                                         "main",
+                                                         specialization.Get());
+    const auto ci = vk::ComputePipelineCreateInfo(vk::PipelineCreateFlags(), stage, state.layout);
+
+    vk::Pipeline pipeline;
+    const auto   result = device_.createComputePipelines(cache_.get(), 1, &ci, nullptr, &pipeline);
+    if(result != vk::Result::eSuccess)
+    {
+      std::cerr << "Failed to create compute pipeline: " << vk::to_string(result) << std::endl;
+      return vk::Pipeline();
+    }
+    return pipeline;
+  }
+
+  vk::Pipeline Compile(const PipelineState& state)
+  {
+    if(!state.compute_shader.empty())
+    {
+      return CompileCompute(state);
+    }
+
+    const auto vertex_module   = shaders_.Get(state.vertex_shader);
+    const auto fragment_module = shaders_.Get(state.fragment_shader);
+    if(!vertex_module || !fragment_module)
+    {
+      return vk::Pipeline();
+    }
+
+    const Specialization specialization(state.specialization);
+    std::array<vk::PipelineShaderStageCreateInfo, 2> stages;
+    stages[0] = vk::PipelineShaderStageCreateInfo(vk::PipelineShaderStageCreateFlags(),
+                                                  vk::ShaderStageFlagBits::eVertex,
+                                                  vertex_module,
+                                                  "main",
+                                                  specialization.Get());
+    stages[1] = vk::PipelineShaderStageCreateInfo(vk::PipelineShaderStageCreateFlags(),
+                                                  vk::ShaderStageFlagBits::eFragment,
+                                                  fragment_module,
+                                                  "main",
+                                                  specialization.Get());
+
+    const auto vertex_input = vk::PipelineVertexInputStateCreateInfo(vk::PipelineVertexInputStateCreateFlags(),
+                                                                     static_cast<uint32_t>(state.bindings.size()),
+                                                                     state.bindings.data(),
+                                                                     static_cast<uint32_t>(state.attributes.size()),
+                                                                     state.attributes.data());
+    const auto input_assembly = vk::PipelineInputAssemblyStateCreateInfo(vk::PipelineInputAssemblyStateCreateFlags(),
+                                                                         state.raster.topology);
+    // Viewport and scissor are dynamic so a swapchain resize does not invalidate pipelines.
+    const auto viewport = vk::PipelineViewportStateCreateInfo(vk::PipelineViewportStateCreateFlags(), 1, nullptr, 1, nullptr);
+
+    auto rasterization = vk::PipelineRasterizationStateCreateInfo();
+    rasterization.setPolygonMode(state.raster.polygon_mode);
+    rasterization.setCullMode(state.raster.cull_mode);
+    rasterization.setFrontFace(state.raster.front_face);
+    rasterization.setLineWidth(1.0f);
+
+    auto multisample = vk::PipelineMultisampleStateCreateInfo();
+    multisample.setRasterizationSamples(state.samples);
+    multisample.setSampleShadingEnable(state.min_sample_shading > 0.0f);
+    multisample.setMinSampleShading(state.min_sample_shading);
+
+    auto depth_stencil = vk::PipelineDepthStencilStateCreateInfo();
+    depth_stencil.setDepthTestEnable(state.raster.depth_test);
+    depth_stencil.setDepthWriteEnable(state.raster.depth_write);
+    depth_stencil.setDepthCompareOp(state.raster.depth_compare);
+
+    auto blend_attachment = vk::PipelineColorBlendAttachmentState();
+    blend_attachment.setBlendEnable(state.raster.blend);
+    blend_attachment.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha);
+    blend_attachment.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha);
+    blend_attachment.setColorBlendOp(vk::BlendOp::eAdd);
+    blend_attachment.setSrcAlphaBlendFactor(vk::BlendFactor::eOne);
+    blend_attachment.setDstAlphaBlendFactor(vk::BlendFactor::eZero);
+    blend_attachment.setAlphaBlendOp(vk::BlendOp::eAdd);
+    blend_attachment.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                                       vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+    auto color_blend = vk::PipelineColorBlendStateCreateInfo();
+    color_blend.setAttachmentCount(1);
+    color_blend.setPAttachments(&blend_attachment);
+
+    const std::array<vk::DynamicState, 2> dynamic_states = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    const auto dynamic = vk::PipelineDynamicStateCreateInfo(vk::PipelineDynamicStateCreateFlags(),
+                                                            static_cast<uint32_t>(dynamic_states.size()),
+                                                            dynamic_states.data());
+
+    auto ci = vk::GraphicsPipelineCreateInfo();
+    ci.setStageCount(static_cast<uint32_t>(stages.size()));
+    ci.setPStages(stages.data());
+    ci.setPVertexInputState(&vertex_input);
+    ci.setPInputAssemblyState(&input_assembly);
+    ci.setPViewportState(&viewport);
+    ci.setPRasterizationState(&rasterization);
+    ci.setPMultisampleState(&multisample);
+    ci.setPDepthStencilState(&depth_stencil);
+    ci.setPColorBlendState(&color_blend);
+    ci.setPDynamicState(&dynamic);
+    ci.setLayout(state.layout);
+    ci.setRenderPass(state.render_pass);
+    ci.setSubpass(state.subpass);
+
+    // The pipeline cache is internally synchronized, so workers share it freely.
+    vk::Pipeline pipeline;
+    const auto   result = device_.createGraphicsPipelines(cache_.get(), 1, &ci, nullptr, &pipeline);
+    if(result != vk::Result::eSuccess)
+    {
+      std::cerr << "Failed to create graphics pipeline: " << vk::to_string(result) << std::endl;
+      return vk::Pipeline();
+    }
+    return pipeline;
+  }
+
+  void WorkerLoop()
+  {
+    for(;;)
+    {
+      Entry* entry = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        queue_cv_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+        if(quit_)
+        {
+          return;
+        }
+        entry = queue_.front();
+        queue_.pop_front();
+        entry->queued = false;
+        ++busy_workers_;
+      }
+
+      const auto start    = std::chrono::steady_clock::now();
+      const auto pipeline = Compile(entry->state);
+      const auto seconds  = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(pipeline && entry->pipeline)
+        {
+          // Reload: the render thread may have used the old one while recording frame_.
+          const auto device = device_;
+          const auto old    = entry->pipeline;
+          deletion_queue_.Defer(frame_ + 1, [device, old] { device.destroyPipeline(old); });
+          ++stats_.reloaded;
+        }
+        if(pipeline || !entry->pipeline)
+        {
+          // A reload that fails to compile keeps the old pipeline.
+          entry->pipeline = pipeline;
+        }
+        auto& slot = slots_[entry->handle - 1];
+        slot.pipeline.store(static_cast<VkPipeline>(entry->pipeline), std::memory_order_release);
+        slot.version.fetch_add(1, std::memory_order_release);
+        stats_.compiled        += pipeline ? 1 : 0;
+        stats_.failed          += pipeline ? 0 : 1;
+        stats_.compile_seconds += seconds;
+        --busy_workers_;
+      }
+      idle_cv_.notify_all();
+    }
+  }
+
+  vk::Device                                               device_;
+  DeletionQueue&                                           deletion_queue_;
+  vk::PhysicalDeviceProperties                             device_properties_;
+  std::string                                              cache_path_;
+  vk::UniquePipelineCache                                  cache_;
+
+  mutable std::mutex                                       mutex_;
+  std::condition_variable                                  queue_cv_;
+  std::condition_variable                                  idle_cv_;
+  std::unordered_map<uint64_t, std::unique_ptr<Entry>>     entries_; // by PipelineState::Hash()
+  std::deque<Entry*>                                       queue_;
+  uint32_t                                                 busy_workers_ = 0;
+  bool                                                     quit_         = false;
+  PipelineStats                                            stats_;
+  uint64_t                                                 frame_ = 0;
+  std::chrono::steady_clock::time_point                    last_reload_check_;
+
+  ShaderCache                                              shaders_;
+  std::unique_ptr<Slot[]>                                  slots_; // by handle - 1, written under mutex_
+
+  std::vector<std::thread>                                 workers_;
+};
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+/*
+  Keeps the last `window` samples and answers percentile queries over them.
+*/
+class RollingHistogram
+{
+public:
+  explicit RollingHistogram(size_t window = 1024) : window_(window) { samples_.reserve(window); }
+
+  void Add(double value)
+  {
+    if(samples_.size() < window_)
+    {
+      samples_.push_back(value);
+    }
+    else
+    {
+      samples_[next_] = value;
+    }
+    next_ = (next_ + 1) % window_;
+  }
+
+  // p in [0, 1]
+  double Percentile(double p) const
+  {
+    if(samples_.empty())
+    {
+      return 0.0;
+    }
+    auto       sorted = samples_;
+    const auto index  = std::min(sorted.size() - 1, static_cast<size_t>(p * (sorted.size() - 1) + 0.5));
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+  }
+
+  size_t Count() const { return samples_.size(); }
+
+private:
+  size_t              window_;
+  size_t              next_ = 0;
+  std::vector<double> samples_;
+};
+
+// Counters from the pipeline statistics query around the main pass.
+struct PipelineStatistics
+{
+  uint64_t input_assembly_vertices    = 0;
+  uint64_t input_assembly_primitives  = 0;
+  uint64_t vertex_shader_invocations  = 0;
+  uint64_t clipping_primitives        = 0;
+  uint64_t fragment_shader_invocations = 0;
+};
+
+/*
+  Frame profiler
+
+  GPU: one timestamp query pool per frame in flight. BeginGpuScope()/EndGpuScope() bracket
+       render passes and dispatches with labeled timestamps; results are read back when the
+       frame context comes round again, after its fence has signaled, so nothing stalls.
+       An optional pipeline statistics query can wrap the main pass.
+  CPU: ScopedCpuTimer / RecordCpu() time stages such as acquire, fence wait, record,
+       submit and present.
+
+  Every sample lands in a rolling histogram keyed by label (p50/p95/p99) and, up to
+  kMaxTraceEvents, in a trace that WriteChromeTrace() exports for chrome://tracing.
+*/
+class Profiler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr uint32_t kMaxQueriesPerFrame = 128;
+  static constexpr size_t   kMaxTraceEvents     = 1u << 20;
+
+  Profiler(vk::PhysicalDevice physical_device, vk::Device device, uint32_t queue_family_index,
+           uint32_t frames_in_flight, bool pipeline_statistics)
+    : device_(device), epoch_(Clock::now())
+  {
+    const auto properties   = physical_device.getProperties();
+    const auto queue_family = physical_device.getQueueFamilyProperties()[queue_family_index];
+    timestamp_period_ns_    = properties.limits.timestampPeriod;
+    timestamps_supported_   = queue_family.timestampValidBits > 0 && timestamp_period_ns_ > 0.0f;
+    timestamp_mask_         = queue_family.timestampValidBits >= 64 ? ~0ull : ((1ull << queue_family.timestampValidBits) - 1);
+
+    if(pipeline_statistics)
+    {
+      statistic_flags_ = vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices |
+                         vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives |
+                         vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+                         vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+                         vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+    }
+
+    frames_.resize(frames_in_flight);
+    for(auto& frame : frames_)
+    {
+      if(timestamps_supported_)
+      {
+        frame.timestamps = device_.createQueryPoolUnique(
+          vk::QueryPoolCreateInfo(vk::QueryPoolCreateFlags(), vk::QueryType::eTimestamp, kMaxQueriesPerFrame));
+      }
+      if(statistic_flags_)
+      {
+        frame.statistics = device_.createQueryPoolUnique(
+          vk::QueryPoolCreateInfo(vk::QueryPoolCreateFlags(), vk::QueryType::ePipelineStatistics, 1, statistic_flags_));
+      }
+    }
+  }
+
+  /*
+    GPU side
+  */
+
+  // Call after the frame context's fence has signaled and before recording into it again.
+  void CollectFrame(uint32_t slot)
+  {
+    auto& frame = frames_[slot];
+    if(frame.query_count > 0)
+    {
+      std::vector<uint64_t> ticks(frame.query_count);
+      const auto result = device_.getQueryPoolResults(frame.timestamps.get(), 0, frame.query_count,
+                                                      ticks.size() * sizeof(uint64_t), ticks.data(),
+                                                      sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+      if(result == vk::Result::eSuccess)
+      {
+        // GPU ticks are placed on the CPU timeline relative to the frame's submit time.
+        const auto origin = ticks[0] & timestamp_mask_;
+        for(const auto& scope : frame.scopes)
+        {
+          const auto begin_ms = TicksToMs((ticks[scope.begin_query] & timestamp_mask_) - origin);
+          const auto end_ms   = TicksToMs((ticks[scope.end_query] & timestamp_mask_) - origin);
+          AddSample(std::string("gpu:") + scope.name, end_ms - begin_ms, kGpuTrack, frame.submit_ms + begin_ms);
+        }
+      }
+    }
+    if(frame.statistics_active)
+    {
+      std::array<uint64_t, 5> values = {};
+      const auto result = device_.getQueryPoolResults(frame.statistics.get(), 0, 1, sizeof(values), values.data(),
+                                                      sizeof(values), vk::QueryResultFlagBits::e64);
+      if(result == vk::Result::eSuccess)
+      {
+        last_statistics_ = PipelineStatistics{values[0], values[1], values[2], values[3], values[4]};
+      }
+    }
+    frame.query_count       = 0;
+    frame.statistics_active = false;
+    frame.scopes.clear();
+  }
+
+  // Reset this slot's queries and open the implicit "frame" scope. Must be outside a render pass.
+  void BeginFrame(vk::CommandBuffer command_buffer, uint32_t slot)
+  {
+    current_ = slot;
+    auto& frame = frames_[slot];
+    if(timestamps_supported_)
+    {
+      command_buffer.resetQueryPool(frame.timestamps.get(), 0, kMaxQueriesPerFrame);
+    }
+    if(statistic_flags_)
+    {
+      command_buffer.resetQueryPool(frame.statistics.get(), 0, 1);
+    }
+    frame_scope_ = BeginGpuScope(command_buffer, "frame");
+  }
+
+  void EndFrame(vk::CommandBuffer command_buffer)
+  {
+    EndGpuScope(command_buffer, frame_scope_);
+  }
+
+  // Remember when the frame was submitted so its GPU scopes can be placed on the trace.
+  void MarkSubmitted() { frames_[current_].submit_ms = NowMs(); }
+
+  // Returns a scope id for EndGpuScope(), or ~0u when out of queries / unsupported.
+  uint32_t BeginGpuScope(vk::CommandBuffer command_buffer, const char* name)
+  {
+    auto& frame = frames_[current_];
+    if(!timestamps_supported_ || frame.query_count + 2 > kMaxQueriesPerFrame)
+    {
+      return ~0u;
+    }
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frame.timestamps.get(), frame.query_count);
+    frame.scopes.push_back(GpuScope{name, frame.query_count, 0});
+    frame.query_count += 2;
+    return static_cast<uint32_t>(frame.scopes.size() - 1);
+  }
+
+  void EndGpuScope(vk::CommandBuffer command_buffer, uint32_t scope_id)
+  {
+    if(scope_id == ~0u)
+    {
+      return;
+    }
+    auto& scope     = frames_[current_].scopes[scope_id];
+    scope.end_query = scope.begin_query + 1;
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, frames_[current_].timestamps.get(), scope.end_query);
+  }
+
+  // Wrap the main pass. Secondaries executed inside need the same flags in their inheritance info.
+  void BeginStatistics(vk::CommandBuffer command_buffer)
+  {
+    if(statistic_flags_)
+    {
+      command_buffer.beginQuery(frames_[current_].statistics.get(), 0, vk::QueryControlFlags());
+      frames_[current_].statistics_active = true;
+    }
+  }
+
+  void EndStatistics(vk::CommandBuffer command_buffer)
+  {
+    if(frames_[current_].statistics_active)
+    {
+      command_buffer.endQuery(frames_[current_].statistics.get(), 0);
+    }
+  }
+
+  vk::QueryPipelineStatisticFlags StatisticFlags() const { return statistic_flags_; }
+  const PipelineStatistics& LastStatistics() const { return last_statistics_; }
+
+  /*
+    CPU side
+  */
+
+  void RecordCpu(const char* name, Clock::time_point begin, Clock::time_point end)
+  {
+    const auto begin_ms = std::chrono::duration<double, std::milli>(begin - epoch_).count();
+    const auto dur_ms   = std::chrono::duration<double, std::milli>(end - begin).count();
+    AddSample(std::string("cpu:") + name, dur_ms, kCpuTrack, begin_ms);
+  }
+
+  /*
+    Results
+  */
+
+  // Labels seen so far, e.g. "cpu:acquire" or "gpu:main pass".
+  std::vector<std::string> Labels() const
+  {
+    std::vector<std::string> labels;
+    for(const auto& h : histograms_)
+    {
+      labels.push_back(h.first);
+    }
+    return labels;
+  }
+
+  // Milliseconds; 0 if the label has no samples.
+  double Percentile(const std::string& label, double p) const
+  {
+    const auto it = histograms_.find(label);
+    return it == histograms_.end() ? 0.0 : it->second.Percentile(p);
+  }
+
+  /*
+    Forget the samples so far, e.g. once a benchmark's warmup is over. GPU results of frames
+    still in flight are dropped too, so they cannot land in the new window. The trace is kept.
+  */
+  void ResetSamples()
+  {
+    histograms_.clear();
+    for(auto& frame : frames_)
+    {
+      frame.query_count       = 0;
+      frame.statistics_active = false;
+      frame.scopes.clear();
+    }
+  }
+
+  bool WriteChromeTrace(const std::string& path) const
+  {
+    std::ofstream ofs(path);
+    if(!ofs)
+    {
+      return false;
+    }
+    ofs << "{\"traceEvents\":[\n";
+    ofs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << kCpuTrack << ",\"args\":{\"name\":\"CPU\"}},\n";
+    ofs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << kGpuTrack << ",\"args\":{\"name\":\"GPU\"}}";
+    for(const auto& e : events_)
+    {
+      // Chrome trace timestamps are in microseconds.
+      ofs << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.track
+          << ",\"ts\":" << e.begin_ms * 1000.0 << ",\"dur\":" << e.duration_ms * 1000.0 << "}";
+    }
+    ofs << "\n]}\n";
+    return true;
+  }
+
+private:
+  static constexpr uint32_t kCpuTrack = 1;
+  static constexpr uint32_t kGpuTrack = 2;
+
+  struct GpuScope
+  {
+    const char* name;
+    uint32_t    begin_query;
+    uint32_t    end_query;
+  };
+
+  struct FrameQueries
+  {
+    vk::UniqueQueryPool   timestamps;
+    vk::UniqueQueryPool   statistics;
+    uint32_t              query_count       = 0;
+    bool                  statistics_active = false;
+    double                submit_ms         = 0.0;
+    std::vector<GpuScope> scopes;
+  };
+
+  struct TraceEvent
+  {
+    std::string name;
+    uint32_t    track;
+    double      begin_ms;
+    double      duration_ms;
+  };
+
+  double NowMs() const { return std::chrono::duration<double, std::milli>(Clock::now() - epoch_).count(); }
+
+  double TicksToMs(uint64_t ticks) const { return ticks * static_cast<double>(timestamp_period_ns_) * 1e-6; }
+
+  void AddSample(const std::string& label, double duration_ms, uint32_t track, double begin_ms)
+  {
+    histograms_[label].Add(duration_ms);
+    if(events_.size() < kMaxTraceEvents)
+    {
+      events_.push_back(TraceEvent{label, track, begin_ms, duration_ms});
+    }
+  }
+
+  vk::Device                              device_;
+  Clock::time_point                       epoch_;
+  float                                   timestamp_period_ns_  = 0.0f;
+  bool                                    timestamps_supported_ = false;
+  uint64_t                                timestamp_mask_       = ~0ull;
+  vk::QueryPipelineStatisticFlags         statistic_flags_;
+
+  std::vector<FrameQueries>               frames_;
+  uint32_t                                current_     = 0;
+  uint32_t                                frame_scope_ = ~0u;
+  PipelineStatistics                      last_statistics_;
+
+  std::map<std::string, RollingHistogram> histograms_;
+  std::vector<TraceEvent>                 events_;
+};
+
+/*
+  Times the enclosing block as a CPU stage.
+  {
+    ScopedCpuTimer timer(profiler, "submit");
+    queue.submit(...);
+  }
+*/
+class ScopedCpuTimer
+{
+public:
+  ScopedCpuTimer(Profiler& profiler, const char* name)
+    : profiler_(profiler), name_(name), begin_(Profiler::Clock::now())
+  {
+  }
+  ~ScopedCpuTimer() { profiler_.RecordCpu(name_, begin_, Profiler::Clock::now()); }
+
+private:
+  Profiler&                   profiler_;
+  const char*                 name_;
+  Profiler::Clock::time_point begin_;
+};
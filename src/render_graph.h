@@ -0,0 +1,816 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "deletion_queue.h"
+#include "memory_allocator.h"
+
+/*
+  Render graph
+
+  Passes and the images they touch are declared once, up front:
+    CreateImage()    image owned by the graph, sized to the graph extent
+    ImportImage()    image owned by someone else (swapchain images), one per version
+    AddRenderPass()  writes color / depth attachments, optionally resolving multisampled colors
+    AddPass()        compute or transfer work reading images outside a render pass
+
+  Compile() walks the declared uses in order and derives everything that used to be written
+  by hand: image usage flags, attachment load/store ops, initial/final layouts, subpass
+  dependencies and the barriers in front of non-render passes. An image that is only ever
+  used as an attachment and is not imported never leaves tile memory: it gets
+  eTransientAttachment, eDontCare store and lazily allocated memory where the device has it.
+
+  Realize() creates the size-dependent objects (images, memory, views, framebuffers) and is
+  called again on resize. Images whose lifetimes (first to last pass) do not overlap share
+  memory. Release() destroys them at once and needs an idle GPU; Release(queue, frames) hands
+  them to a DeletionQueue so frames still in flight keep theirs.
+
+  Execute() records the passes. Render pass callbacks begin and end the render pass
+  themselves (from GraphPassContext::begin), so they can pick inline or secondary contents.
+*/
+
+using GraphResource = uint32_t;
+using GraphPass     = uint32_t;
+constexpr GraphResource kNoGraphResource = ~0u;
+
+enum class GraphAccess
+{
+  eColorAttachment,   // written as a color attachment
+  eResolveAttachment, // written by resolving a multisampled color attachment at the end of the subpass
+  eDepthAttachment,   // depth tested and written
+  eComputeSampled,    // sampled from a compute shader
+  eTransferSource,    // copied from
+};
+
+struct GraphImageDesc
+{
+  std::string             name;
+  vk::Format              format  = vk::Format::eUndefined;
+  vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+  // Used when the first pass writing the image clears it.
+  vk::ClearValue          clear;
+};
+
+// Handed to the record callback of every pass.
+struct GraphPassContext
+{
+  vk::RenderPassBeginInfo begin;   // render passes only
+  vk::Extent2D            extent;
+  uint32_t                version = 0; // which imported image this execution uses (e.g. swapchain image index)
+};
+
+using GraphRecordFunction = std::function<void(vk::CommandBuffer, const GraphPassContext&)>;
+
+struct GraphMemoryStats
+{
+  uint32_t       images           = 0; // owned by the graph
+  uint32_t       transient_images = 0;
+  uint32_t       memory_slots     = 0; // allocations after aliasing
+  vk::DeviceSize bytes            = 0; // memory actually allocated
+  vk::DeviceSize unaliased_bytes  = 0; // what one allocation per image would have cost
+  vk::DeviceSize lazy_bytes       = 0; // part of `bytes` in lazily allocated memory (usually never committed)
+};
+
+inline bool IsDepthFormat(vk::Format format)
+{
+  switch(format)
+  {
+    case vk::Format::eD16Unorm:
+    case vk::Format::eX8D24UnormPack32:
+    case vk::Format::eD32Sfloat:
+    case vk::Format::eD16UnormS8Uint:
+    case vk::Format::eD24UnormS8Uint:
+    case vk::Format::eD32SfloatS8Uint:
+      return true;
+    default:
+      return false;
+  }
+}
+
+class RenderGraph
+{
+public:
+  RenderGraph(vk::Device device, DeviceAllocator& allocator)
+    : device_(device), allocator_(allocator)
+  {
+  }
+
+  RenderGraph(const RenderGraph&) = delete;
+  RenderGraph& operator=(const RenderGraph&) = delete;
+
+  ~RenderGraph() { Release(); }
+
+  GraphResource CreateImage(const GraphImageDesc& desc)
+  {
+    resources_.emplace_back();
+    resources_.back().desc = desc;
+    return static_cast<GraphResource>(resources_.size() - 1);
+  }
+
+  /*
+    `initial_layout` is the layout the owner leaves the image in before the first pass; eUndefined
+    if its contents do not matter. `final_layout` is the layout the image must be in after the
+    last pass, e.g. ePresentSrcKHR.
+  */
+  GraphResource ImportImage(const GraphImageDesc& desc, vk::ImageLayout initial_layout, vk::ImageLayout final_layout)
+  {
+    resources_.emplace_back();
+    auto& resource          = resources_.back();
+    resource.desc           = desc;
+    resource.imported       = true;
+    resource.initial_layout = initial_layout;
+    resource.final_layout   = final_layout;
+    return static_cast<GraphResource>(resources_.size() - 1);
+  }
+
+  /*
+    `depth` may be kNoGraphResource. `resolves`, if given, pairs each color with a single-sampled
+    image of the same format that the subpass resolves it into (kNoGraphResource for none).
+    A multisampled color that is resolved and not used again never leaves tile memory.
+  */
+  GraphPass AddRenderPass(const std::string& name, const std::vector<GraphResource>& colors, GraphResource depth,
+                          GraphRecordFunction record, const std::vector<GraphResource>& resolves = {})
+  {
+    if(!resolves.empty() && resolves.size() != colors.size())
+    {
+      throw std::runtime_error("Render graph pass " + name + ": one resolve target per color attachment.");
+    }
+    const auto index = static_cast<GraphPass>(passes_.size());
+    passes_.emplace_back();
+    auto& pass       = passes_.back();
+    pass.name        = name;
+    pass.render_pass = true;
+    pass.record      = std::move(record);
+    pass.resolves    = resolves;
+    for(const auto color : colors)
+    {
+      pass.uses.push_back({color, GraphAccess::eColorAttachment});
+    }
+    if(depth != kNoGraphResource)
+    {
+      pass.uses.push_back({depth, GraphAccess::eDepthAttachment});
+    }
+    for(size_t i = 0; i < resolves.size(); ++i)
+    {
+      if(resolves[i] == kNoGraphResource)
+      {
+        continue;
+      }
+      const auto& source = resources_.at(colors[i]).desc;
+      const auto& target = resources_.at(resolves[i]).desc;
+      if(source.samples == vk::SampleCountFlagBits::e1 || target.samples != vk::SampleCountFlagBits::e1 ||
+         source.format != target.format)
+      {
+        throw std::runtime_error("Render graph pass " + name + ": " + target.name + " cannot resolve " + source.name + ".");
+      }
+      pass.uses.push_back({resolves[i], GraphAccess::eResolveAttachment});
+    }
+    return index;
+  }
+
+  GraphPass AddPass(const std::string& name, const std::vector<std::pair<GraphResource, GraphAccess>>& reads,
+                    GraphRecordFunction record)
+  {
+    const auto index = static_cast<GraphPass>(passes_.size());
+    passes_.emplace_back();
+    auto& pass  = passes_.back();
+    pass.name   = name;
+    pass.record = std::move(record);
+    for(const auto& read : reads)
+    {
+      if(read.second == GraphAccess::eColorAttachment || read.second == GraphAccess::eResolveAttachment ||
+         read.second == GraphAccess::eDepthAttachment)
+      {
+        throw std::runtime_error("Render graph pass " + name + ": attachments belong to render passes.");
+      }
+      pass.uses.push_back({read.first, read.second});
+    }
+    return index;
+  }
+
+  /*
+    Derive usage, load/store ops, layouts and synchronization from the declared uses,
+    and create the render passes. Formats and sample counts are fixed from here on.
+  */
+  void Compile()
+  {
+    for(auto& resource : resources_)
+    {
+      resource.uses.clear();
+    }
+    for(GraphPass p = 0; p < passes_.size(); ++p)
+    {
+      for(const auto& use : passes_[p].uses)
+      {
+        resources_.at(use.resource).uses.push_back({p, use.access});
+      }
+    }
+
+    // Every stage the graph touches; the first use of an image in a frame waits for all of them,
+    // which covers the previous frame and whatever image shared its memory.
+    graph_stages_ = vk::PipelineStageFlagBits::eColorAttachmentOutput; // swapchain acquire waits here
+    graph_writes_ = vk::AccessFlags();
+    for(auto& resource : resources_)
+    {
+      resource.usage = vk::ImageUsageFlags();
+      for(const auto& use : resource.uses)
+      {
+        const auto info = Info(use.access);
+        resource.usage |= info.usage;
+        graph_stages_  |= info.stages;
+        graph_writes_  |= info.access & kAttachmentWrites;
+      }
+      // Written by one render pass and never looked at again.
+      resource.transient = !resource.imported && resource.uses.size() == 1 && Info(resource.uses.front().access).write;
+      if(resource.transient)
+      {
+        resource.usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+      }
+      if(!resource.imported && resource.uses.empty())
+      {
+        std::cerr << "Render graph image " << resource.desc.name << " is never used." << std::endl;
+      }
+      if(!resource.imported && !resource.uses.empty() && !Info(resource.uses.front().access).write)
+      {
+        throw std::runtime_error("Render graph image " + resource.desc.name + " is read before any pass writes it.");
+      }
+    }
+
+    for(GraphPass p = 0; p < passes_.size(); ++p)
+    {
+      auto& pass = passes_[p];
+      pass.barriers.clear();
+      if(pass.render_pass)
+      {
+        CreateRenderPass(p);
+        continue;
+      }
+      // Outside render passes the graph inserts the layout transitions itself.
+      for(const auto& use : pass.uses)
+      {
+        const auto& resource = resources_[use.resource];
+        const auto  position = UseIndex(resource, p, use.access);
+        const auto  info     = Info(use.access);
+        if(position == 0)
+        {
+          // Imported images keep whatever the owner left in them; graph images are written first, so nothing is lost.
+          const auto old_layout = resource.imported ? resource.initial_layout : vk::ImageLayout::eUndefined;
+          pass.barriers.push_back({use.resource, old_layout, info.layout,
+                                   graph_stages_, graph_writes_, info.stages, info.access});
+          continue;
+        }
+        const auto& previous = resource.uses[position - 1];
+        if(passes_[previous.pass].render_pass)
+        {
+          // The render pass's final layout and outgoing dependency already cover this use.
+          continue;
+        }
+        const auto before = Info(previous.access);
+        if(before.layout != info.layout || before.write)
+        {
+          pass.barriers.push_back({use.resource, before.layout, info.layout,
+                                   before.stages, before.write ? before.access : vk::AccessFlags(),
+                                   info.stages, info.access});
+        }
+      }
+    }
+    compiled_ = true;
+  }
+
+  // Images and views of an imported resource, one per version. Call before Realize().
+  void SetImported(GraphResource resource, const std::vector<vk::Image>& images, const std::vector<vk::ImageView>& views)
+  {
+    auto& r           = resources_.at(resource);
+    r.imported_images = images;
+    r.imported_views  = views;
+  }
+
+  /*
+    Create images, memory, views and framebuffers for `extent`, replacing any earlier ones.
+  */
+  void Realize(vk::Extent2D extent)
+  {
+    if(!compiled_)
+    {
+      throw std::runtime_error("RenderGraph::Realize() called before Compile().");
+    }
+    Release();
+    extent_ = extent;
+    stats_  = GraphMemoryStats();
+
+    struct Placement
+    {
+      GraphResource          resource;
+      vk::MemoryRequirements requirements;
+      GraphPass              first;
+      GraphPass              last;
+    };
+    std::vector<Placement> placements;
+    for(GraphResource r = 0; r < resources_.size(); ++r)
+    {
+      auto& resource = resources_[r];
+      if(resource.imported || resource.uses.empty())
+      {
+        continue;
+      }
+      const auto image_ci = vk::ImageCreateInfo(vk::ImageCreateFlags(),
+                                                vk::ImageType::e2D,
+                                                resource.desc.format,
+                                                vk::Extent3D(extent.width, extent.height, 1),
+                                                1,
+                                                1,
+                                                resource.desc.samples,
+                                                vk::ImageTiling::eOptimal,
+                                                resource.usage);
+      resource.image = device_.createImageUnique(image_ci);
+      placements.push_back({r, device_.getImageMemoryRequirements(resource.image.get()),
+                            resource.uses.front().pass, resource.uses.back().pass});
+      stats_.images           += 1;
+      stats_.transient_images += resource.transient ? 1 : 0;
+      stats_.unaliased_bytes  += placements.back().requirements.size;
+    }
+
+    /*
+      Aliasing
+      Largest images first; each goes into the first slot whose images are all dead while it
+      is alive and whose memory types it can use. Transient images only share with transient
+      ones, since lazily allocated memory is only valid for them.
+    */
+    std::sort(placements.begin(), placements.end(), [](const Placement& a, const Placement& b) {
+      return a.requirements.size > b.requirements.size;
+    });
+    struct Slot
+    {
+      vk::MemoryRequirements        requirements;
+      bool                          transient = false;
+      std::vector<const Placement*> members;
+    };
+    std::vector<Slot> slots;
+    for(const auto& placement : placements)
+    {
+      const bool transient = resources_[placement.resource].transient;
+      Slot*      target    = nullptr;
+      for(auto& slot : slots)
+      {
+        const bool disjoint = std::none_of(slot.members.begin(), slot.members.end(), [&placement](const Placement* other) {
+          return other->first <= placement.last && placement.first <= other->last;
+        });
+        if(disjoint && slot.transient == transient &&
+           (slot.requirements.memoryTypeBits & placement.requirements.memoryTypeBits))
+        {
+          target = &slot;
+          break;
+        }
+      }
+      if(!target)
+      {
+        slots.emplace_back();
+        target               = &slots.back();
+        target->requirements = placement.requirements;
+        target->transient    = transient;
+      }
+      target->requirements.size            = std::max(target->requirements.size, placement.requirements.size);
+      target->requirements.alignment       = std::max(target->requirements.alignment, placement.requirements.alignment);
+      target->requirements.memoryTypeBits &= placement.requirements.memoryTypeBits;
+      target->members.push_back(&placement);
+    }
+
+    for(const auto& slot : slots)
+    {
+      auto allocation = allocator_.Allocate(slot.requirements,
+                                            slot.transient ? MemoryUsage::eGpuLazy : MemoryUsage::eGpuOnly,
+                                            ResourceKind::eOptimal);
+      for(const auto* member : slot.members)
+      {
+        device_.bindImageMemory(resources_[member->resource].image.get(), allocation.memory, allocation.offset);
+      }
+      stats_.memory_slots += 1;
+      stats_.bytes        += allocation.size;
+      stats_.lazy_bytes   += allocator_.IsLazilyAllocated(allocation) ? allocation.size : 0;
+      allocations_.push_back(allocation);
+    }
+
+    for(auto& resource : resources_)
+    {
+      if(!resource.image)
+      {
+        continue;
+      }
+      const auto aspect  = IsDepthFormat(resource.desc.format) ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor;
+      const auto view_ci = vk::ImageViewCreateInfo(vk::ImageViewCreateFlags(),
+                                                   resource.image.get(),
+                                                   vk::ImageViewType::e2D,
+                                                   resource.desc.format,
+                                                   vk::ComponentMapping(),
+                                                   vk::ImageSubresourceRange(aspect, 0, 1, 0, 1));
+      resource.view = device_.createImageViewUnique(view_ci);
+    }
+
+    // One framebuffer per version of the imported attachments (e.g. per swapchain image).
+    for(auto& pass : passes_)
+    {
+      if(!pass.render_pass)
+      {
+        continue;
+      }
+      for(uint32_t version = 0; version < Versions(); ++version)
+      {
+        std::vector<vk::ImageView> attachments;
+        for(const auto& use : pass.uses)
+        {
+          attachments.push_back(View(use.resource, version));
+        }
+        const auto ci = vk::FramebufferCreateInfo(vk::FramebufferCreateFlags(),
+                                                  pass.handle.get(),
+                                                  static_cast<uint32_t>(attachments.size()),
+                                                  attachments.data(),
+                                                  extent.width,
+                                                  extent.height,
+                                                  1);
+        pass.framebuffers.push_back(device_.createFramebufferUnique(ci));
+      }
+    }
+  }
+
+  // Destroy everything Realize() created. Render passes survive.
+  void Release()
+  {
+    for(auto& pass : passes_)
+    {
+      pass.framebuffers.clear();
+    }
+    for(auto& resource : resources_)
+    {
+      resource.view.reset();
+      resource.image.reset();
+    }
+    for(auto& allocation : allocations_)
+    {
+      allocator_.Free(allocation);
+    }
+    allocations_.clear();
+  }
+
+  // Like Release(), but destroyed by `queue` once `frame_count` frames have completed.
+  void Release(DeletionQueue& queue, uint64_t frame_count)
+  {
+    std::vector<vk::UniqueFramebuffer> framebuffers;
+    std::vector<vk::UniqueImageView>   views;
+    std::vector<vk::UniqueImage>       images;
+    for(auto& pass : passes_)
+    {
+      std::move(pass.framebuffers.begin(), pass.framebuffers.end(), std::back_inserter(framebuffers));
+      pass.framebuffers.clear();
+    }
+    for(auto& resource : resources_)
+    {
+      views.push_back(std::move(resource.view));
+      images.push_back(std::move(resource.image));
+    }
+    auto& allocator = allocator_;
+    queue.Defer(frame_count,
+                [framebuffers = std::move(framebuffers),
+                 views        = std::move(views),
+                 images       = std::move(images),
+                 allocations  = std::move(allocations_),
+                 &allocator]() mutable {
+                  framebuffers.clear();
+                  views.clear();
+                  images.clear();
+                  for(auto& allocation : allocations)
+                  {
+                    allocator.Free(allocation);
+                  }
+                });
+    allocations_.clear();
+  }
+
+  // Record every pass. `version` selects the imported images, e.g. the acquired swapchain image.
+  void Execute(vk::CommandBuffer command_buffer, uint32_t version)
+  {
+    for(const auto& pass : passes_)
+    {
+      GraphPassContext context;
+      context.extent  = extent_;
+      context.version = version;
+      if(pass.render_pass)
+      {
+        context.begin = vk::RenderPassBeginInfo(pass.handle.get(),
+                                                pass.framebuffers.at(version).get(),
+                                                vk::Rect2D(vk::Offset2D(0, 0), extent_),
+                                                static_cast<uint32_t>(pass.clear_values.size()),
+                                                pass.clear_values.data());
+      }
+      if(!pass.barriers.empty())
+      {
+        std::vector<vk::ImageMemoryBarrier> barriers;
+        vk::PipelineStageFlags              src_stages;
+        vk::PipelineStageFlags              dst_stages;
+        for(const auto& b : pass.barriers)
+        {
+          const auto& resource = resources_[b.resource];
+          const auto  aspect   = IsDepthFormat(resource.desc.format) ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor;
+          barriers.push_back(vk::ImageMemoryBarrier(b.src_access,
+                                                    b.dst_access,
+                                                    b.old_layout,
+                                                    b.new_layout,
+                                                    VK_QUEUE_FAMILY_IGNORED,
+                                                    VK_QUEUE_FAMILY_IGNORED,
+                                                    Image(b.resource, version),
+                                                    vk::ImageSubresourceRange(aspect, 0, 1, 0, 1)));
+          src_stages |= b.src_stages;
+          dst_stages |= b.dst_stages;
+        }
+        command_buffer.pipelineBarrier(src_stages, dst_stages, vk::DependencyFlags(), nullptr, nullptr, barriers);
+      }
+      pass.record(command_buffer, context);
+    }
+  }
+
+  vk::RenderPass GetRenderPass(GraphPass pass) const { return passes_.at(pass).handle.get(); }
+
+  vk::Image Image(GraphResource resource, uint32_t version = 0) const
+  {
+    const auto& r = resources_.at(resource);
+    return r.imported ? r.imported_images.at(version) : r.image.get();
+  }
+
+  vk::ImageView View(GraphResource resource, uint32_t version = 0) const
+  {
+    const auto& r = resources_.at(resource);
+    return r.imported ? r.imported_views.at(version) : r.view.get();
+  }
+
+  // Never stored to memory; only valid inside the render pass that uses it.
+  bool IsTransient(GraphResource resource) const { return resources_.at(resource).transient; }
+
+  // Number of imported image sets (at least 1).
+  uint32_t Versions() const
+  {
+    size_t versions = 1;
+    for(const auto& resource : resources_)
+    {
+      versions = std::max(versions, resource.imported_views.size());
+    }
+    return static_cast<uint32_t>(versions);
+  }
+
+  vk::Extent2D            Extent() const { return extent_; }
+  const GraphMemoryStats& MemoryStats() const { return stats_; }
+
+private:
+  static constexpr vk::AccessFlags kAttachmentWrites = vk::AccessFlagBits::eColorAttachmentWrite |
+                                                       vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+
+  struct AccessInfo
+  {
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags        access;
+    vk::ImageLayout        layout;
+    vk::ImageUsageFlags    usage;
+    bool                   write;
+  };
+
+  static AccessInfo Info(GraphAccess access)
+  {
+    switch(access)
+    {
+      case GraphAccess::eColorAttachment:
+        return {vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+                vk::ImageLayout::eColorAttachmentOptimal,
+                vk::ImageUsageFlagBits::eColorAttachment,
+                true};
+      case GraphAccess::eResolveAttachment:
+        return {vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                vk::AccessFlagBits::eColorAttachmentWrite,
+                vk::ImageLayout::eColorAttachmentOptimal,
+                vk::ImageUsageFlagBits::eColorAttachment,
+                true};
+      case GraphAccess::eDepthAttachment:
+        return {vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+                vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+                vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                vk::ImageUsageFlagBits::eDepthStencilAttachment,
+                true};
+      case GraphAccess::eComputeSampled:
+        return {vk::PipelineStageFlagBits::eComputeShader,
+                vk::AccessFlagBits::eShaderRead,
+                vk::ImageLayout::eShaderReadOnlyOptimal,
+                vk::ImageUsageFlagBits::eSampled,
+                false};
+      case GraphAccess::eTransferSource:
+        return {vk::PipelineStageFlagBits::eTransfer,
+                vk::AccessFlagBits::eTransferRead,
+                vk::ImageLayout::eTransferSrcOptimal,
+                vk::ImageUsageFlagBits::eTransferSrc,
+                false};
+    }
+    return {};
+  }
+
+  struct ResourceUse
+  {
+    GraphPass   pass;
+    GraphAccess access;
+  };
+
+  struct Resource
+  {
+    GraphImageDesc           desc;
+    bool                     imported       = false;
+    vk::ImageLayout          initial_layout = vk::ImageLayout::eUndefined; // imported only
+    vk::ImageLayout          final_layout   = vk::ImageLayout::eUndefined; // imported only
+    std::vector<ResourceUse> uses;                                         // in pass order
+
+    // Derived by Compile()
+    vk::ImageUsageFlags      usage;
+    bool                     transient = false;
+
+    // Created by Realize()
+    vk::UniqueImage            image;
+    vk::UniqueImageView        view;
+    std::vector<vk::Image>     imported_images;
+    std::vector<vk::ImageView> imported_views;
+  };
+
+  struct PassUse
+  {
+    GraphResource resource;
+    GraphAccess   access;
+  };
+
+  struct Barrier
+  {
+    GraphResource          resource;
+    vk::ImageLayout        old_layout;
+    vk::ImageLayout        new_layout;
+    vk::PipelineStageFlags src_stages;
+    vk::AccessFlags        src_access;
+    vk::PipelineStageFlags dst_stages;
+    vk::AccessFlags        dst_access;
+  };
+
+  struct Pass
+  {
+    std::string                        name;
+    bool                               render_pass = false;
+    std::vector<PassUse>               uses; // render passes: colors, then depth, then resolve targets
+    std::vector<GraphResource>         resolves; // per color, kNoGraphResource when not resolved
+    GraphRecordFunction                record;
+
+    vk::UniqueRenderPass               handle;
+    std::vector<vk::ClearValue>        clear_values;
+    std::vector<Barrier>               barriers; // recorded before the pass, non-render passes only
+    std::vector<vk::UniqueFramebuffer> framebuffers;
+  };
+
+  // Position of (pass, access) in the resource's use list.
+  static size_t UseIndex(const Resource& resource, GraphPass pass, GraphAccess access)
+  {
+    for(size_t i = 0; i < resource.uses.size(); ++i)
+    {
+      if(resource.uses[i].pass == pass && resource.uses[i].access == access)
+      {
+        return i;
+      }
+    }
+    throw std::runtime_error("Render graph use not found for " + resource.desc.name + ".");
+  }
+
+  void CreateRenderPass(GraphPass p)
+  {
+    auto& pass = passes_[p];
+    pass.clear_values.clear();
+
+    std::vector<vk::AttachmentDescription> attachments;
+    std::vector<vk::AttachmentReference>   color_references;
+    std::vector<vk::AttachmentReference>   resolve_references(pass.resolves.size(),
+                                                              vk::AttachmentReference(VK_ATTACHMENT_UNUSED,
+                                                                                      vk::ImageLayout::eUndefined));
+    vk::AttachmentReference                depth_reference;
+    bool                                   has_depth = false;
+    vk::PipelineStageFlags                 pass_stages;
+    vk::AccessFlags                        pass_access;
+    vk::AccessFlags                        pass_writes;
+    vk::PipelineStageFlags                 next_stages;
+    vk::AccessFlags                        next_access;
+
+    for(const auto& use : pass.uses)
+    {
+      const auto& resource = resources_[use.resource];
+      const auto  position = UseIndex(resource, p, use.access);
+      const auto  info     = Info(use.access);
+      const bool  first    = position == 0;
+      const bool  last     = position + 1 == resource.uses.size();
+
+      // Clear on the first write of the frame, keep the contents otherwise; a resolve overwrites every pixel.
+      // Store only when a later pass or the image's owner reads the result.
+      const bool resolve = use.access == GraphAccess::eResolveAttachment;
+      const auto load    = resolve ? vk::AttachmentLoadOp::eDontCare
+                                   : first ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eLoad;
+      const auto store   = (!last || resource.imported) ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+      const auto initial_layout = first ? vk::ImageLayout::eUndefined : Info(resource.uses[position - 1].access).layout;
+      auto       final_layout   = info.layout;
+      if(!last)
+      {
+        const auto next = Info(resource.uses[position + 1].access);
+        final_layout    = next.layout;
+        next_stages    |= next.stages;
+        next_access    |= next.access;
+      }
+      else if(resource.imported)
+      {
+        final_layout = resource.final_layout;
+      }
+
+      const auto index = static_cast<uint32_t>(attachments.size());
+      attachments.push_back(vk::AttachmentDescription(vk::AttachmentDescriptionFlags(),
+                                                      resource.desc.format,
+                                                      resource.desc.samples,
+                                                      load,
+                                                      store,
+                                                      vk::AttachmentLoadOp::eDontCare,
+                                                      vk::AttachmentStoreOp::eDontCare,
+                                                      initial_layout,
+                                                      final_layout));
+      pass.clear_values.push_back(resource.desc.clear);
+      if(use.access == GraphAccess::eDepthAttachment)
+      {
+        depth_reference = vk::AttachmentReference(index, info.layout);
+        has_depth       = true;
+      }
+      else if(resolve)
+      {
+        const auto color = std::find(pass.resolves.begin(), pass.resolves.end(), use.resource) - pass.resolves.begin();
+        resolve_references[color] = vk::AttachmentReference(index, info.layout);
+      }
+      else
+      {
+        color_references.push_back(vk::AttachmentReference(index, info.layout));
+      }
+      pass_stages |= info.stages;
+      pass_access |= info.access;
+      pass_writes |= info.access & kAttachmentWrites;
+    }
+
+    const auto subpass = vk::SubpassDescription(vk::SubpassDescriptionFlags(),
+                                                vk::PipelineBindPoint::eGraphics,
+                                                0,
+                                                nullptr,
+                                                static_cast<uint32_t>(color_references.size()),
+                                                color_references.data(),
+                                                resolve_references.empty() ? nullptr : resolve_references.data(),
+                                                has_depth ? &depth_reference : nullptr);
+
+    // In: after everything the graph did before (previous frame, aliased images, swapchain acquire).
+    // Out: before the passes that read the attachments next.
+    std::vector<vk::SubpassDependency> dependencies;
+    dependencies.push_back(vk::SubpassDependency(VK_SUBPASS_EXTERNAL,
+                                                 0,
+                                                 graph_stages_,
+                                                 pass_stages,
+                                                 graph_writes_,
+                                                 pass_access));
+    if(next_stages)
+    {
+      dependencies.push_back(vk::SubpassDependency(0,
+                                                   VK_SUBPASS_EXTERNAL,
+                                                   pass_stages,
+                                                   next_stages,
+                                                   pass_writes,
+                                                   next_access));
+    }
+
+    const auto ci = vk::RenderPassCreateInfo(vk::RenderPassCreateFlags(),
+                                             static_cast<uint32_t>(attachments.size()),
+                                             attachments.data(),
+                                             1,
+                                             &subpass,
+                                             static_cast<uint32_t>(dependencies.size()),
+                                             dependencies.data());
+    pass.handle = device_.createRenderPassUnique(ci);
+  }
+
+  vk::Device              device_;
+  DeviceAllocator&        allocator_;
+  std::vector<Resource>   resources_;
+  std::vector<Pass>       passes_;
+  std::vector<Allocation> allocations_;
+  vk::PipelineStageFlags  graph_stages_;
+  vk::AccessFlags         graph_writes_;
+  vk::Extent2D            extent_;
+  GraphMemoryStats        stats_;
+  bool                    compiled_ = false;
+};
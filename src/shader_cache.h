@@ -0,0 +1,189 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "mapped_file.h"
+
+struct ShaderCacheStats
+{
+  uint64_t requests        = 0;
+  uint64_t files_loaded    = 0; // mmap + hash, including reloads
+  uint64_t modules_created = 0;
+  uint64_t deduplicated    = 0; // loads whose contents matched an existing module
+  uint64_t reloads         = 0; // files whose contents changed on disk
+  uint64_t bytes_loaded    = 0;
+  double   load_seconds    = 0.0;
+};
+
+/*
+  SPIR-V shader module cache
+
+  Files are mmap()ed and handed to vkCreateShaderModule straight from the mapping (no copy
+  through an ifstream buffer). Modules are keyed by a 64-bit FNV-1a hash of the contents,
+  so different paths with identical SPIR-V, and reloads that did not change anything,
+  share one vk::ShaderModule.
+
+  Refresh() re-stats every file and reloads the ones whose size or mtime moved. Modules are
+  never destroyed before the cache itself, so pipelines still compiling against an older
+  version of a file stay valid.
+  All methods are thread safe.
+*/
+class ShaderCache
+{
+public:
+  static constexpr uint32_t kSpirvMagic = 0x07230203;
+
+  explicit ShaderCache(vk::Device device) : device_(device) {}
+
+  ShaderCache(const ShaderCache&) = delete;
+  ShaderCache& operator=(const ShaderCache&) = delete;
+
+  // Null if the file is missing or not SPIR-V.
+  vk::ShaderModule Get(const std::string& path)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.requests;
+    const auto it = files_.find(path);
+    if(it != files_.end() && it->second.loaded)
+    {
+      return modules_.at(it->second.hash).get();
+    }
+    auto& file = files_[path];
+    Stat(path, &file);
+    return LoadLocked(path, &file) ? modules_.at(file.hash).get() : vk::ShaderModule();
+  }
+
+  // Content hash of a loaded file, 0 if it has not been loaded.
+  uint64_t Hash(const std::string& path) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = files_.find(path);
+    return it != files_.end() && it->second.loaded ? it->second.hash : 0;
+  }
+
+  /*
+    Reload every file that changed on disk since it was loaded.
+    Returns the paths whose contents are now different; Get() returns the new module for them.
+    A file that fails to load (e.g. caught mid-write) keeps its old module until the next change.
+  */
+  std::vector<std::string> Refresh()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> changed;
+    for(auto& entry : files_)
+    {
+      auto file = entry.second;
+      if(!Stat(entry.first, &file) || (file.size == entry.second.size && file.mtime_ns == entry.second.mtime_ns))
+      {
+        continue;
+      }
+      const auto previous = entry.second.hash;
+      if(LoadLocked(entry.first, &file) && file.hash != previous)
+      {
+        ++stats_.reloads;
+        changed.push_back(entry.first);
+      }
+      // Remember the new timestamp even on failure, so a broken file is reported once per change.
+      entry.second.size     = file.size;
+      entry.second.mtime_ns = file.mtime_ns;
+      if(file.loaded)
+      {
+        entry.second.hash   = file.hash;
+        entry.second.loaded = true;
+      }
+    }
+    return changed;
+  }
+
+  ShaderCacheStats Stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+private:
+  struct File
+  {
+    uint64_t hash     = 0;
+    int64_t  size     = -1;
+    int64_t  mtime_ns = 0;
+    bool     loaded   = false;
+  };
+
+  static bool Stat(const std::string& path, File* file)
+  {
+    struct stat st;
+    if(::stat(path.c_str(), &st) != 0)
+    {
+      return false;
+    }
+    file->size     = static_cast<int64_t>(st.st_size);
+    file->mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+  }
+
+  // Same FNV-1a as PipelineState::Hash(), a word at a time since SPIR-V is a word stream.
+  static uint64_t HashWords(const uint32_t* words, size_t count)
+  {
+    uint64_t h = 14695981039346656037ull;
+    for(size_t i = 0; i < count; ++i)
+    {
+      h = (h ^ words[i]) * 1099511628211ull;
+    }
+    return h;
+  }
+
+  bool LoadLocked(const std::string& path, File* file)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    MappedFile mapping;
+    if(!mapping.Open(path))
+    {
+      std::cerr << "Failed to open shader: " << path << std::endl;
+      return false;
+    }
+    // mmap is page aligned, so the mapping can be read as words in place.
+    const auto* words = reinterpret_cast<const uint32_t*>(mapping.Data());
+    if(mapping.Size() % sizeof(uint32_t) != 0 || words[0] != kSpirvMagic)
+    {
+      std::cerr << "Not a SPIR-V binary: " << path << std::endl;
+      return false;
+    }
+    const auto word_count = mapping.Size() / sizeof(uint32_t);
+    const auto hash       = HashWords(words, word_count);
+
+    ++stats_.files_loaded;
+    stats_.bytes_loaded += mapping.Size();
+    if(modules_.count(hash))
+    {
+      ++stats_.deduplicated;
+    }
+    else
+    {
+      const auto ci = vk::ShaderModuleCreateInfo(vk::ShaderModuleCreateFlags(), mapping.Size(), words);
+      modules_.emplace(hash, device_.createShaderModuleUnique(ci));
+      ++stats_.modules_created;
+    }
+    file->hash   = hash;
+    file->loaded = true;
+    stats_.load_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+  }
+
+  vk::Device                                           device_;
+  mutable std::mutex                                   mutex_;
+  std::unordered_map<std::string, File>                files_;
+  std::unordered_map<uint64_t, vk::UniqueShaderModule> modules_;
+  ShaderCacheStats                                     stats_;
+};
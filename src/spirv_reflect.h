@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "mapped_file.h"
+
+// One `layout(set = set, binding = binding)` variable of a shader.
+struct ShaderDescriptor
+{
+  uint32_t           set     = 0;
+  uint32_t           binding = 0;
+  vk::DescriptorType type    = vk::DescriptorType::eSampler;
+  bool               array   = false; // sized or runtime array
+};
+
+/*
+  Descriptor bindings declared by a SPIR-V module
+
+  Only what is needed to check a shader against a descriptor set layout: set, binding and
+  descriptor type of every resource variable. Returns false if `words` is not SPIR-V or uses
+  a resource type this does not know (texel buffers, input attachments, ...).
+*/
+inline bool ReflectDescriptors(const uint32_t* words, size_t word_count, std::vector<ShaderDescriptor>* descriptors)
+{
+  // Opcodes, decorations and storage classes of the SPIR-V 1.x specification.
+  enum : uint32_t
+  {
+    kOpTypeImage        = 25,
+    kOpTypeSampler      = 26,
+    kOpTypeSampledImage = 27,
+    kOpTypeArray        = 28,
+    kOpTypeRuntimeArray = 29,
+    kOpTypeStruct       = 30,
+    kOpTypePointer      = 32,
+    kOpVariable         = 59,
+    kOpDecorate         = 71,
+
+    kDecorationBlock         = 2,
+    kDecorationBufferBlock   = 3,
+    kDecorationBinding       = 33,
+    kDecorationDescriptorSet = 34,
+
+    kStorageUniformConstant = 0,
+    kStorageUniform         = 2,
+    kStorageStorageBuffer   = 12,
+  };
+  struct Id
+  {
+    uint32_t op       = 0;
+    uint32_t operand0 = 0; // pointee / element / image type; for images the `sampled` operand
+    uint32_t storage  = 0; // pointers and variables
+    uint32_t set      = ~0u;
+    uint32_t binding  = ~0u;
+    bool     block    = false;
+    bool     buffer   = false; // BufferBlock
+  };
+
+  if(word_count < 5 || words[0] != 0x07230203)
+  {
+    return false;
+  }
+  std::unordered_map<uint32_t, Id> ids;
+  std::vector<uint32_t>            variables;
+  for(size_t i = 5; i < word_count;)
+  {
+    const auto count = words[i] >> 16;
+    const auto op    = words[i] & 0xffff;
+    if(count == 0 || i + count > word_count)
+    {
+      return false;
+    }
+    const auto* operands = words + i + 1;
+    switch(op)
+    {
+      case kOpDecorate:
+      {
+        auto& id = ids[operands[0]];
+        switch(operands[1])
+        {
+          case kDecorationBlock:         id.block   = true; break;
+          case kDecorationBufferBlock:   id.buffer  = true; break;
+          case kDecorationBinding:       id.binding = operands[2]; break;
+          case kDecorationDescriptorSet: id.set     = operands[2]; break;
+        }
+        break;
+      }
+      case kOpTypeImage:
+        // result, sampled type, dim, depth, arrayed, ms, sampled (1: sampled, 2: storage)
+        ids[operands[0]].op       = op;
+        ids[operands[0]].operand0 = operands[6];
+        break;
+      case kOpTypeSampler:
+      case kOpTypeStruct:
+        ids[operands[0]].op = op;
+        break;
+      case kOpTypeSampledImage:
+      case kOpTypeArray:
+      case kOpTypeRuntimeArray:
+        ids[operands[0]].op       = op;
+        ids[operands[0]].operand0 = operands[1];
+        break;
+      case kOpTypePointer:
+        ids[operands[0]].op       = op;
+        ids[operands[0]].storage  = operands[1];
+        ids[operands[0]].operand0 = operands[2];
+        break;
+      case kOpVariable:
+        ids[operands[1]].op       = op;
+        ids[operands[1]].operand0 = operands[0];
+        ids[operands[1]].storage  = operands[2];
+        variables.push_back(operands[1]);
+        break;
+    }
+    i += count;
+  }
+
+  descriptors->clear();
+  for(const auto variable : variables)
+  {
+    const auto& v = ids[variable];
+    if(v.set == ~0u || v.binding == ~0u)
+    {
+      continue; // inputs, outputs, push constants, private variables
+    }
+    ShaderDescriptor descriptor;
+    descriptor.set     = v.set;
+    descriptor.binding = v.binding;
+
+    const auto* type = &ids[ids[v.operand0].operand0];
+    if(type->op == kOpTypeArray || type->op == kOpTypeRuntimeArray)
+    {
+      descriptor.array = true;
+      type             = &ids[type->operand0];
+    }
+    if(type->op == kOpTypeSampler)
+    {
+      descriptor.type = vk::DescriptorType::eSampler;
+    }
+    else if(type->op == kOpTypeSampledImage)
+    {
+      descriptor.type = vk::DescriptorType::eCombinedImageSampler;
+    }
+    else if(type->op == kOpTypeImage && (type->operand0 == 1 || type->operand0 == 2))
+    {
+      descriptor.type = type->operand0 == 1 ? vk::DescriptorType::eSampledImage : vk::DescriptorType::eStorageImage;
+    }
+    else if(type->op == kOpTypeStruct && (v.storage == kStorageStorageBuffer || type->buffer))
+    {
+      descriptor.type = vk::DescriptorType::eStorageBuffer;
+    }
+    else if(type->op == kOpTypeStruct && v.storage == kStorageUniform && type->block)
+    {
+      descriptor.type = vk::DescriptorType::eUniformBuffer;
+    }
+    else
+    {
+      return false;
+    }
+    descriptors->push_back(descriptor);
+  }
+  return true;
+}
+
+// ReflectDescriptors() of a SPIR-V file.
+inline bool ReflectDescriptors(const std::string& path, std::vector<ShaderDescriptor>* descriptors)
+{
+  MappedFile mapping;
+  if(!mapping.Open(path) || mapping.Size() % sizeof(uint32_t) != 0)
+  {
+    std::cerr << "Failed to open shader: " << path << std::endl;
+    return false;
+  }
+  // mmap is page aligned, so the mapping can be read as words in place.
+  return ReflectDescriptors(reinterpret_cast<const uint32_t*>(mapping.Data()), mapping.Size() / sizeof(uint32_t), descriptors);
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/*
+  .hkt texture container
+
+  GPU-compressed (or plain RGBA8) mip chains, stored exactly as vkCmdCopyBufferToImage
+  wants them, so streaming a mip is a memcpy out of the mapping:
+
+    TextureFileHeader
+    TextureMipRecord[mip_count]   mip 0 is the full resolution level
+    mip blobs                     each at a kTextureBlobAlignment aligned offset
+
+  `format` is a VkFormat value. Little endian only.
+*/
+constexpr uint32_t kTextureFileMagic     = 0x544b4948; // "HIKT"
+constexpr uint32_t kTextureFileVersion   = 1;
+constexpr uint32_t kMaxTextureMips       = 16;
+constexpr uint64_t kTextureBlobAlignment = 4096;
+
+// VkFormat values the container may hold.
+constexpr uint32_t kTextureFormatRgba8 = 37;  // VK_FORMAT_R8G8B8A8_UNORM
+constexpr uint32_t kTextureFormatBc1   = 133; // VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+constexpr uint32_t kTextureFormatBc7   = 145; // VK_FORMAT_BC7_UNORM_BLOCK
+
+struct TextureFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mip_count;
+  uint32_t reserved[2];
+};
+
+struct TextureMipRecord
+{
+  uint64_t offset;
+  uint64_t size;
+  uint32_t width;
+  uint32_t height;
+};
+
+static_assert(sizeof(TextureFileHeader) == 32, "TextureFileHeader is part of the file format");
+static_assert(sizeof(TextureMipRecord) == 24, "TextureMipRecord is part of the file format");
+
+// Block footprint of a container format. Zero bytes for formats the container does not know.
+struct TextureBlock
+{
+  uint32_t extent = 1; // texels per block side
+  uint32_t bytes  = 0;
+};
+
+inline TextureBlock TextureBlockOf(uint32_t format)
+{
+  switch(format)
+  {
+    case kTextureFormatRgba8: return TextureBlock{1, 4};
+    case kTextureFormatBc1:   return TextureBlock{4, 8};
+    case kTextureFormatBc7:   return TextureBlock{4, 16};
+    default:                  return TextureBlock{};
+  }
+}
+
+inline uint64_t TextureMipBytes(uint32_t format, uint32_t width, uint32_t height)
+{
+  const auto block = TextureBlockOf(format);
+  return uint64_t((width + block.extent - 1) / block.extent) * ((height + block.extent - 1) / block.extent) * block.bytes;
+}
+
+/*
+  Validated view of a mapped .hkt file. Mip data points straight into the mapping.
+*/
+class TextureFile
+{
+public:
+  bool Open(const std::string& path)
+  {
+    if(!file_.Open(path))
+    {
+      std::cerr << "Failed to map texture file: " << path << std::endl;
+      return false;
+    }
+    if(!Validate())
+    {
+      std::cerr << "Invalid texture file: " << path << std::endl;
+      file_.Close();
+      return false;
+    }
+    return true;
+  }
+
+  const TextureFileHeader& Header() const { return *reinterpret_cast<const TextureFileHeader*>(file_.Data()); }
+
+  const TextureMipRecord& Mip(uint32_t level) const
+  {
+    return reinterpret_cast<const TextureMipRecord*>(file_.Data() + sizeof(TextureFileHeader))[level];
+  }
+
+  const uint8_t* MipData(uint32_t level) const { return file_.Data() + Mip(level).offset; }
+
+  const MappedFile& File() const { return file_; }
+
+private:
+  bool Validate() const
+  {
+    const auto size = static_cast<uint64_t>(file_.Size());
+    if(size < sizeof(TextureFileHeader))
+    {
+      return false;
+    }
+    const auto& h = Header();
+    if(h.magic != kTextureFileMagic || h.version != kTextureFileVersion || TextureBlockOf(h.format).bytes == 0 ||
+       h.mip_count == 0 || h.mip_count > kMaxTextureMips || h.width == 0 || h.height == 0 ||
+       sizeof(TextureFileHeader) + uint64_t(h.mip_count) * sizeof(TextureMipRecord) > size)
+    {
+      return false;
+    }
+    for(uint32_t level = 0; level < h.mip_count; ++level)
+    {
+      const auto& mip = Mip(level);
+      if(mip.width != std::max(h.width >> level, 1u) || mip.height != std::max(h.height >> level, 1u) ||
+         mip.size != TextureMipBytes(h.format, mip.width, mip.height) ||
+         mip.offset % kTextureBlobAlignment != 0 || mip.offset > size || mip.size > size - mip.offset)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  MappedFile file_;
+};
+
+/*
+  Write a .hkt file. `mips` holds mip_count levels, finest first, each exactly
+  TextureMipBytes() long.
+*/
+inline bool WriteTextureFile(const std::string&                       path,
+                             uint32_t                                 format,
+                             uint32_t                                 width,
+                             uint32_t                                 height,
+                             const std::vector<std::vector<uint8_t>>& mips)
+{
+  auto align = [](uint64_t v) { return (v + kTextureBlobAlignment - 1) / kTextureBlobAlignment * kTextureBlobAlignment; };
+
+  TextureFileHeader header = {};
+  header.magic             = kTextureFileMagic;
+  header.version           = kTextureFileVersion;
+  header.format            = format;
+  header.width             = width;
+  header.height            = height;
+  header.mip_count         = static_cast<uint32_t>(mips.size());
+
+  std::vector<TextureMipRecord> records;
+  auto offset = align(sizeof(TextureFileHeader) + mips.size() * sizeof(TextureMipRecord));
+  for(uint32_t level = 0; level < mips.size(); ++level)
+  {
+    const auto w = std::max(width >> level, 1u);
+    const auto h = std::max(height >> level, 1u);
+    records.push_back(TextureMipRecord{offset, mips[level].size(), w, h});
+    offset = align(offset + mips[level].size());
+  }
+
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  if(!ofs)
+  {
+    std::cerr << "Failed to write texture file: " << path << std::endl;
+    return false;
+  }
+  auto pad_to = [&ofs](uint64_t target) {
+    static const std::array<char, 4096> zeros = {};
+    auto position = static_cast<uint64_t>(ofs.tellp());
+    while(position < target)
+    {
+      const auto n = std::min<uint64_t>(zeros.size(), target - position);
+      ofs.write(zeros.data(), static_cast<std::streamsize>(n));
+      position += n;
+    }
+  };
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(TextureMipRecord));
+  for(uint32_t level = 0; level < mips.size(); ++level)
+  {
+    pad_to(records[level].offset);
+    ofs.write(reinterpret_cast<const char*>(mips[level].data()), static_cast<std::streamsize>(mips[level].size()));
+  }
+  return static_cast<bool>(ofs);
+}
+
+/*
+  Test texture: a checkerboard with a different tint per mip, so the resident level is
+  visible on screen. BC1 by default (solid-color blocks encode without a compressor);
+  RGBA8 for devices without BC support. `size` is rounded up to a power of two.
+*/
+inline bool WriteTestTexture(const std::string& path, uint32_t size, bool compressed = true)
+{
+  uint32_t extent = 4;
+  while(extent < size && extent < (1u << (kMaxTextureMips - 1)))
+  {
+    extent <<= 1;
+  }
+  const auto format = compressed ? kTextureFormatBc1 : kTextureFormatRgba8;
+
+  // Cycles through six tints; the checker squares stay 8 texels wide on every level.
+  static const std::array<std::array<uint8_t, 3>, 6> kTints = {{{255, 80, 80},
+                                                                {80, 255, 80},
+                                                                {80, 80, 255},
+                                                                {255, 255, 80},
+                                                                {80, 255, 255},
+                                                                {255, 80, 255}}};
+  auto texel = [](const std::array<uint8_t, 3>& tint, uint32_t x, uint32_t y) {
+    const bool dark = ((x / 8) + (y / 8)) % 2 != 0;
+    return std::array<uint8_t, 3>{static_cast<uint8_t>(dark ? tint[0] / 4 : tint[0]),
+                                  static_cast<uint8_t>(dark ? tint[1] / 4 : tint[1]),
+                                  static_cast<uint8_t>(dark ? tint[2] / 4 : tint[2])};
+  };
+
+  std::vector<std::vector<uint8_t>> mips;
+  for(uint32_t level = 0, w = extent; level < kMaxTextureMips && w >= 1; ++level, w >>= 1)
+  {
+    const auto& tint = kTints[level % kTints.size()];
+    std::vector<uint8_t> data(static_cast<size_t>(TextureMipBytes(format, w, w)));
+    if(compressed)
+    {
+      // One BC1 block per 4x4 texels: color0 == color1 and all indices 0 give a solid block.
+      const auto blocks = std::max(w / 4, 1u);
+      for(uint32_t by = 0; by < blocks; ++by)
+      {
+        for(uint32_t bx = 0; bx < blocks; ++bx)
+        {
+          const auto     c   = texel(tint, bx * 4, by * 4);
+          const uint16_t rgb = static_cast<uint16_t>(((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3));
+          auto*          out = &data[(size_t(by) * blocks + bx) * 8];
+          std::memcpy(out, &rgb, 2);
+          std::memcpy(out + 2, &rgb, 2);
+          std::memset(out + 4, 0, 4);
+        }
+      }
+    }
+    else
+    {
+      for(uint32_t y = 0; y < w; ++y)
+      {
+        for(uint32_t x = 0; x < w; ++x)
+        {
+          const auto c = texel(tint, x, y);
+          auto*      out = &data[(size_t(y) * w + x) * 4];
+          out[0] = c[0];
+          out[1] = c[1];
+          out[2] = c[2];
+          out[3] = 255;
+        }
+      }
+    }
+    mips.push_back(std::move(data));
+  }
+  return WriteTextureFile(path, format, extent, extent, mips);
+}
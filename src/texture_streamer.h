@@ -0,0 +1,713 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "capabilities.h"
+#include "deletion_queue.h"
+#include "memory_allocator.h"
+#include "texture_format.h"
+
+// Index of a texture in its TextureStreamer.
+using TextureHandle = uint32_t;
+
+struct TextureStats
+{
+  uint32_t       textures       = 0; // loaded, including failed ones
+  uint32_t       failed         = 0;
+  vk::DeviceSize resident_bytes = 0; // resident mips, excluding allocation padding
+  vk::DeviceSize peak_bytes     = 0;
+  vk::DeviceSize budget_bytes   = 0;
+  uint64_t       mips_streamed  = 0;
+  uint64_t       mips_evicted   = 0;
+  uint64_t       bytes_streamed = 0;
+  uint64_t       rebuilds       = 0; // image reallocations, one per texture per residency change
+  bool           driver_budget  = false; // budget follows VK_EXT_memory_budget rather than a cap or a heap fraction
+};
+
+/*
+  Texture streaming with mip residency
+
+  Every texture lives in one optimally tiled image holding a contiguous run of its mip chain,
+  from the finest resident level down to the 1x1 tail. Callers Touch() the textures they are
+  about to sample with the finest level they want; once per frame Update():
+    - loads what is missing one level at a time, coarse to fine, so a texture is drawable
+      (blurry) as soon as its small mips are in,
+    - evicts the finest levels of the least recently touched textures while the resident set
+      is over budget.
+  Levels no larger than kPinnedExtent are loaded together on first use and never evicted.
+
+  Residency changes rebuild the image: a new one with the new level range is created, the
+  levels both share are copied on the GPU, the new ones come from staging, and the old image
+  goes to the deletion queue. View() / Version() change accordingly; descriptors must follow.
+
+  The budget is the configured cap, else half of what VK_EXT_memory_budget says this process
+  can still use of the largest device-local heap (plus what textures hold already), else a
+  quarter of that heap.
+
+  A worker thread maps the .hkt files and copies mips out of the mapping into a staging ring;
+  it never records or submits. Copies are recorded by the render thread into its frame.
+*/
+class TextureStreamer
+{
+public:
+  // Mips with both sides at or below this stay resident as long as the texture exists.
+  static constexpr uint32_t kPinnedExtent = 64;
+  // Frames between VK_EXT_memory_budget queries.
+  static constexpr uint64_t kBudgetInterval = 60;
+
+  // `budget_bytes` of 0 derives the budget from the device. Mips up to half of `staging_bytes`
+  // can be streamed: 4096x4096 RGBA8 with the default.
+  TextureStreamer(vk::PhysicalDevice        physical_device,
+                  vk::Device                device,
+                  DeviceAllocator&          allocator,
+                  DeletionQueue&            deletion_queue,
+                  const DeviceCapabilities& caps,
+                  vk::DeviceSize            budget_bytes  = 0,
+                  vk::DeviceSize            staging_bytes = 128ull << 20)
+    : physical_device_(physical_device),
+      device_(device),
+      allocator_(allocator),
+      deletion_queue_(deletion_queue),
+      bc_supported_(caps.texture_compression_bc),
+      memory_budget_(caps.memory_budget),
+      budget_cap_(budget_bytes),
+      staging_(allocator, staging_bytes, vk::BufferUsageFlagBits::eTransferSrc, MemoryUsage::eCpuToGpu)
+  {
+    // Views only contain resident levels, so the sampler never clamps the LOD itself.
+    sampler_ = device_.createSamplerUnique(vk::SamplerCreateInfo(vk::SamplerCreateFlags(),
+                                                                 vk::Filter::eLinear,
+                                                                 vk::Filter::eLinear,
+                                                                 vk::SamplerMipmapMode::eLinear,
+                                                                 vk::SamplerAddressMode::eRepeat,
+                                                                 vk::SamplerAddressMode::eRepeat,
+                                                                 vk::SamplerAddressMode::eRepeat,
+                                                                 0.0f,
+                                                                 VK_FALSE,
+                                                                 1.0f,
+                                                                 VK_FALSE,
+                                                                 vk::CompareOp::eNever,
+                                                                 0.0f,
+                                                                 VK_LOD_CLAMP_NONE));
+    stats_.budget_bytes  = QueryBudget();
+    stats_.driver_budget = !budget_cap_ && memory_budget_;
+
+    worker_ = std::thread([this] { WorkerLoop(); });
+  }
+
+  TextureStreamer(const TextureStreamer&) = delete;
+  TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+  // The owner must have idled the device: resident images are destroyed right away.
+  ~TextureStreamer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+    for(auto& texture : textures_)
+    {
+      texture->view.reset();
+      texture->image.reset();
+      allocator_.Free(texture->allocation);
+    }
+  }
+
+  // Render thread. Queue `path` for opening; the texture is drawable once View() is non-null.
+  TextureHandle Load(const std::string& path)
+  {
+    auto texture  = std::make_unique<Texture>();
+    texture->path = path;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(Job{texture.get(), kOpenJob});
+    }
+    cv_.notify_all();
+    textures_.push_back(std::move(texture));
+    return static_cast<TextureHandle>(textures_.size() - 1);
+  }
+
+  // Render thread, before Update(): the texture is sampled this frame, at `level` or coarser.
+  void Touch(TextureHandle handle, uint32_t level = 0)
+  {
+    auto& texture        = *textures_[handle];
+    texture.wanted_level = texture.last_used == frame_ ? std::min(texture.wanted_level, level) : level;
+    texture.last_used    = frame_;
+  }
+
+  /*
+    Render thread, once per frame while recording `frame_index` (outside a render pass).
+    `completed_frames` frames have finished on the GPU; their staging space is recycled.
+    Records the residency changes into `command_buffer`; images they replace are released
+    for frame_index + 1.
+  */
+  void Update(vk::CommandBuffer command_buffer, uint64_t frame_index, uint64_t completed_frames)
+  {
+    frame_ = frame_index;
+
+    std::vector<Texture*> opened;
+    std::vector<Texture*> failed;
+    std::vector<Staged>   staged;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while(!consumed_.empty() && consumed_.front().frame_index < completed_frames)
+      {
+        staging_.Retire(consumed_.front().sequence);
+        consumed_.pop_front();
+      }
+      opened.swap(opened_);
+      failed.swap(failed_);
+      staged.swap(staged_);
+    }
+    cv_.notify_all();
+
+    for(auto texture : failed)
+    {
+      texture->failed = true;
+    }
+    for(auto texture : opened)
+    {
+      // format / mip_count were written by the worker before it published the texture under the lock.
+      texture->opened      = true;
+      texture->pinned_base = texture->mip_count - 1;
+      while(texture->pinned_base > 0 && std::max(texture->file.Mip(texture->pinned_base - 1).width,
+                                                 texture->file.Mip(texture->pinned_base - 1).height) <= kPinnedExtent)
+      {
+        --texture->pinned_base;
+      }
+      texture->resident_base = texture->mip_count;
+      texture->queued_base   = texture->mip_count;
+    }
+
+    if(!staged.empty())
+    {
+      consumed_.push_back(Consumed{frame_index, staged.back().sequence});
+      ApplyStaged(command_buffer, staged);
+    }
+
+    if(!budget_cap_ && memory_budget_ && frame_index % kBudgetInterval == 0)
+    {
+      stats_.budget_bytes = QueryBudget();
+    }
+
+    RequestMips();
+    if(resident_bytes_ > stats_.budget_bytes)
+    {
+      Evict(command_buffer, resident_bytes_ - stats_.budget_bytes);
+    }
+    frame_ = frame_index + 1;
+  }
+
+  // Null until the first levels are resident, or when the file failed to load.
+  vk::ImageView View(TextureHandle handle) const { return textures_[handle]->view.get(); }
+  // Bumped whenever View() changes.
+  uint32_t Version(TextureHandle handle) const { return textures_[handle]->version; }
+  // Finest resident level. Only meaningful while View() is non-null.
+  uint32_t ResidentLevel(TextureHandle handle) const { return textures_[handle]->resident_base; }
+  bool Failed(TextureHandle handle) const { return textures_[handle]->failed; }
+  uint32_t Count() const { return static_cast<uint32_t>(textures_.size()); }
+
+  vk::Sampler Sampler() const { return sampler_.get(); }
+
+  TextureStats Stats() const
+  {
+    auto stats           = stats_;
+    stats.textures       = static_cast<uint32_t>(textures_.size());
+    stats.failed         = static_cast<uint32_t>(std::count_if(textures_.begin(), textures_.end(),
+                                                               [](const std::unique_ptr<Texture>& t) { return t->failed; }));
+    stats.resident_bytes = resident_bytes_;
+    return stats;
+  }
+
+private:
+  static constexpr uint32_t kOpenJob = ~0u;
+
+  struct Texture
+  {
+    std::string         path;
+    TextureFile         file;      // opened by the worker, read-only once published
+    vk::Format          format;
+    uint32_t            mip_count = 0;
+
+    // Render thread only; everything below `failed` is valid once `opened` is set
+    bool                opened        = false;
+    bool                failed        = false;
+    uint32_t            pinned_base   = 0; // levels from here down are never evicted
+    uint32_t            resident_base = 0; // finest level in `image`; mip_count when there is none
+    uint32_t            queued_base   = 0; // finest level resident or on its way
+    uint32_t            wanted_level  = 0;
+    uint64_t            last_used     = 0; // frame of the last Touch()
+    uint32_t            version       = 0;
+    uint32_t            evict_base    = 0; // scratch for Evict()
+    vk::UniqueImage     image;
+    Allocation          allocation;
+    vk::UniqueImageView view;
+  };
+
+  // Open the file (kOpenJob) or stage one mip.
+  struct Job
+  {
+    Texture* texture;
+    uint32_t level;
+  };
+
+  // A mip copied into staging, waiting for the render thread.
+  struct Staged
+  {
+    Texture*    texture;
+    uint32_t    level;
+    ArenaRegion region;
+    uint64_t    sequence; // RingArena "frame" owning the staging space
+  };
+
+  // Staging read by a frame's copies, free once that frame completes.
+  struct Consumed
+  {
+    uint64_t frame_index;
+    uint64_t sequence;
+  };
+
+  vk::DeviceSize MipBytes(const Texture& texture, uint32_t level) const { return texture.file.Mip(level).size; }
+
+  vk::DeviceSize LevelBytes(const Texture& texture, uint32_t base) const
+  {
+    vk::DeviceSize bytes = 0;
+    for(uint32_t level = base; level < texture.mip_count; ++level)
+    {
+      bytes += MipBytes(texture, level);
+    }
+    return bytes;
+  }
+
+  vk::DeviceSize QueryBudget() const
+  {
+    if(budget_cap_)
+    {
+      return budget_cap_;
+    }
+    const auto memory = physical_device_.getMemoryProperties();
+    uint32_t   heap   = 0;
+    for(uint32_t i = 0; i < memory.memoryHeapCount; ++i)
+    {
+      if((memory.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) &&
+         memory.memoryHeaps[i].size > memory.memoryHeaps[heap].size)
+      {
+        heap = i;
+      }
+    }
+    if(!memory_budget_)
+    {
+      return memory.memoryHeaps[heap].size / 4;
+    }
+    // Usage covers every process on the device and our own textures; leave half of the rest to everyone else.
+    const auto chain     = physical_device_.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2,
+                                                                 vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    const auto& budget   = chain.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    const auto available = budget.heapBudget[heap] > budget.heapUsage[heap] ? budget.heapBudget[heap] - budget.heapUsage[heap] : 0;
+    return (available + resident_bytes_) / 2;
+  }
+
+  // Turn the staged mips into residency, one rebuild per texture.
+  void ApplyStaged(vk::CommandBuffer command_buffer, std::vector<Staged>& staged)
+  {
+    // Stable, so each texture's levels stay in request order (coarse to fine).
+    std::stable_sort(staged.begin(), staged.end(), [](const Staged& a, const Staged& b) { return a.texture < b.texture; });
+    for(size_t first = 0; first < staged.size();)
+    {
+      auto last = first;
+      while(last < staged.size() && staged[last].texture == staged[first].texture)
+      {
+        ++last;
+      }
+      auto& texture  = *staged[first].texture;
+      auto  new_base = texture.resident_base;
+      std::vector<Staged> levels;
+      for(auto i = first; i < last; ++i)
+      {
+        // Requests are contiguous and eviction skips textures with loads in flight, so this always holds.
+        if(staged[i].level + 1 == new_base)
+        {
+          new_base = staged[i].level;
+          levels.push_back(staged[i]);
+        }
+      }
+      if(!levels.empty())
+      {
+        Rebuild(command_buffer, texture, new_base, levels);
+      }
+      first = last;
+    }
+  }
+
+  /*
+    Replace the texture's image with one holding levels [new_base, mip_count): retained levels
+    are copied from the old image, `staged` ones from the staging ring.
+  */
+  void Rebuild(vk::CommandBuffer command_buffer, Texture& texture, uint32_t new_base, const std::vector<Staged>& staged)
+  {
+    const auto  old_base = texture.resident_base;
+    const auto  levels   = texture.mip_count - new_base;
+    const auto& top      = texture.file.Mip(new_base);
+
+    auto image      = device_.createImageUnique(vk::ImageCreateInfo(vk::ImageCreateFlags(),
+                                                                    vk::ImageType::e2D,
+                                                                    texture.format,
+                                                                    vk::Extent3D(top.width, top.height, 1),
+                                                                    levels,
+                                                                    1,
+                                                                    vk::SampleCountFlagBits::e1,
+                                                                    vk::ImageTiling::eOptimal,
+                                                                    vk::ImageUsageFlagBits::eSampled |
+                                                                      vk::ImageUsageFlagBits::eTransferDst |
+                                                                      vk::ImageUsageFlagBits::eTransferSrc,
+                                                                    vk::SharingMode::eExclusive,
+                                                                    0,
+                                                                    nullptr,
+                                                                    vk::ImageLayout::eUndefined));
+    auto allocation = allocator_.AllocateForImage(image.get(), MemoryUsage::eGpuOnly);
+
+    auto range = [](uint32_t base, uint32_t count) {
+      return vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, base, count, 0, 1);
+    };
+    auto layers = [](uint32_t level) { return vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1); };
+
+    std::vector<vk::ImageMemoryBarrier> to_transfer = {vk::ImageMemoryBarrier(vk::AccessFlags(),
+                                                                              vk::AccessFlagBits::eTransferWrite,
+                                                                              vk::ImageLayout::eUndefined,
+                                                                              vk::ImageLayout::eTransferDstOptimal,
+                                                                              VK_QUEUE_FAMILY_IGNORED,
+                                                                              VK_QUEUE_FAMILY_IGNORED,
+                                                                              image.get(),
+                                                                              range(0, levels))};
+    if(texture.image)
+    {
+      // Earlier frames sampled it; the copy only has to wait for those reads.
+      to_transfer.push_back(vk::ImageMemoryBarrier(vk::AccessFlagBits::eShaderRead,
+                                                   vk::AccessFlagBits::eTransferRead,
+                                                   vk::ImageLayout::eShaderReadOnlyOptimal,
+                                                   vk::ImageLayout::eTransferSrcOptimal,
+                                                   VK_QUEUE_FAMILY_IGNORED,
+                                                   VK_QUEUE_FAMILY_IGNORED,
+                                                   texture.image.get(),
+                                                   range(0, texture.mip_count - old_base)));
+    }
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eTransfer,
+                                   vk::DependencyFlags(),
+                                   nullptr,
+                                   nullptr,
+                                   to_transfer);
+
+    if(texture.image)
+    {
+      std::vector<vk::ImageCopy> copies;
+      for(auto level = std::max(old_base, new_base); level < texture.mip_count; ++level)
+      {
+        const auto& mip = texture.file.Mip(level);
+        copies.push_back(vk::ImageCopy(layers(level - old_base),
+                                       vk::Offset3D(),
+                                       layers(level - new_base),
+                                       vk::Offset3D(),
+                                       vk::Extent3D(mip.width, mip.height, 1)));
+      }
+      command_buffer.copyImage(texture.image.get(), vk::ImageLayout::eTransferSrcOptimal,
+                               image.get(), vk::ImageLayout::eTransferDstOptimal, copies);
+    }
+    for(const auto& s : staged)
+    {
+      const auto& mip = texture.file.Mip(s.level);
+      command_buffer.copyBufferToImage(s.region.buffer,
+                                       image.get(),
+                                       vk::ImageLayout::eTransferDstOptimal,
+                                       vk::BufferImageCopy(s.region.offset, 0, 0, layers(s.level - new_base),
+                                                           vk::Offset3D(), vk::Extent3D(mip.width, mip.height, 1)));
+      stats_.mips_streamed  += 1;
+      stats_.bytes_streamed += mip.size;
+    }
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::DependencyFlags(),
+                                   nullptr,
+                                   nullptr,
+                                   vk::ImageMemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                                                          vk::AccessFlagBits::eShaderRead,
+                                                          vk::ImageLayout::eTransferDstOptimal,
+                                                          vk::ImageLayout::eShaderReadOnlyOptimal,
+                                                          VK_QUEUE_FAMILY_IGNORED,
+                                                          VK_QUEUE_FAMILY_IGNORED,
+                                                          image.get(),
+                                                          range(0, levels)));
+
+    auto view = device_.createImageViewUnique(vk::ImageViewCreateInfo(vk::ImageViewCreateFlags(),
+                                                                      image.get(),
+                                                                      vk::ImageViewType::e2D,
+                                                                      texture.format,
+                                                                      vk::ComponentMapping(),
+                                                                      range(0, levels)));
+
+    // This frame's copies read the old image; earlier frames may still sample it.
+    if(texture.image)
+    {
+      auto& allocator = allocator_;
+      deletion_queue_.Defer(frame_ + 1,
+                            [view = std::move(texture.view), image = std::move(texture.image),
+                             allocation = texture.allocation, &allocator]() mutable {
+                              view.reset();
+                              image.reset();
+                              allocator.Free(allocation);
+                            });
+    }
+
+    resident_bytes_       += LevelBytes(texture, new_base);
+    resident_bytes_       -= old_base < texture.mip_count ? LevelBytes(texture, old_base) : 0;
+    stats_.peak_bytes      = std::max(stats_.peak_bytes, resident_bytes_);
+    stats_.rebuilds       += 1;
+    texture.image          = std::move(image);
+    texture.allocation     = allocation;
+    texture.view           = std::move(view);
+    texture.resident_base  = new_base;
+    texture.version       += 1;
+  }
+
+  /*
+    Queue the next level of every texture touched this frame. Textures with nothing resident get
+    their whole pinned tail at once; the rest step one level finer per request. A level that
+    does not fit the budget is only requested if eviction of colder textures can make room.
+  */
+  void RequestMips()
+  {
+    std::vector<Job> jobs;
+    vk::DeviceSize   in_flight = 0;
+    for(const auto& texture : textures_)
+    {
+      if(texture->opened && texture->queued_base < texture->resident_base)
+      {
+        in_flight += LevelBytes(*texture, texture->queued_base) - LevelBytes(*texture, texture->resident_base);
+      }
+    }
+    for(auto& owned : textures_)
+    {
+      auto& texture = *owned;
+      if(!texture.opened || texture.last_used != frame_ ||
+         texture.queued_base != texture.resident_base)
+      {
+        continue;
+      }
+      const auto target = std::min(texture.wanted_level, texture.pinned_base);
+      if(texture.queued_base <= target)
+      {
+        continue;
+      }
+      const auto next  = texture.resident_base == texture.mip_count ? texture.pinned_base : texture.resident_base - 1;
+      const auto bytes = LevelBytes(texture, next) - LevelBytes(texture, texture.queued_base);
+      // The pinned tail always loads: without it the texture cannot be drawn at all.
+      if(next < texture.pinned_base && resident_bytes_ + in_flight + bytes > stats_.budget_bytes &&
+         ColdBytes() < resident_bytes_ + in_flight + bytes - stats_.budget_bytes)
+      {
+        continue;
+      }
+      for(auto level = texture.queued_base; level-- > next;)
+      {
+        jobs.push_back(Job{&texture, level});
+      }
+      in_flight          += bytes;
+      texture.queued_base = next;
+    }
+    if(!jobs.empty())
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.insert(jobs_.end(), jobs.begin(), jobs.end());
+      }
+      cv_.notify_all();
+    }
+  }
+
+  // Resident levels eviction may drop: finer than the tail, on textures not touched this frame.
+  vk::DeviceSize ColdBytes() const
+  {
+    vk::DeviceSize bytes = 0;
+    for(const auto& texture : textures_)
+    {
+      if(Evictable(*texture) && texture->last_used != frame_)
+      {
+        bytes += LevelBytes(*texture, texture->resident_base) - LevelBytes(*texture, texture->pinned_base);
+      }
+    }
+    return bytes;
+  }
+
+  bool Evictable(const Texture& texture) const
+  {
+    return texture.opened && texture.resident_base < texture.pinned_base && texture.queued_base == texture.resident_base;
+  }
+
+  /*
+    Drop the finest levels of the least recently touched textures until `bytes` are freed.
+    Textures touched this frame only lose levels finer than they asked for.
+  */
+  void Evict(vk::CommandBuffer command_buffer, vk::DeviceSize bytes)
+  {
+    std::vector<Texture*> candidates;
+    for(auto& texture : textures_)
+    {
+      if(Evictable(*texture))
+      {
+        texture->evict_base = texture->resident_base;
+        candidates.push_back(texture.get());
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Texture* a, const Texture* b) { return a->last_used < b->last_used; });
+
+    vk::DeviceSize freed = 0;
+    for(auto texture : candidates)
+    {
+      const auto floor = texture->last_used == frame_ ? std::min(texture->wanted_level, texture->pinned_base)
+                                                      : texture->pinned_base;
+      while(freed < bytes && texture->evict_base < floor)
+      {
+        freed += MipBytes(*texture, texture->evict_base);
+        ++texture->evict_base;
+      }
+      if(texture->evict_base != texture->resident_base)
+      {
+        stats_.mips_evicted  += texture->evict_base - texture->resident_base;
+        Rebuild(command_buffer, *texture, texture->evict_base, {});
+        texture->queued_base  = texture->resident_base;
+      }
+      if(freed >= bytes)
+      {
+        break;
+      }
+    }
+  }
+
+  // Worker: map and check the file. Publishes the texture under the lock.
+  void Open(std::unique_lock<std::mutex>& lock, Texture& texture)
+  {
+    lock.unlock();
+    bool ok = texture.file.Open(texture.path);
+    if(ok)
+    {
+      const auto& header = texture.file.Header();
+      texture.format     = static_cast<vk::Format>(header.format);
+      texture.mip_count  = header.mip_count;
+
+      const auto features = physical_device_.getFormatProperties(texture.format).optimalTilingFeatures;
+      const auto needed   = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eTransferDst;
+      const bool bc       = header.format != kTextureFormatRgba8;
+      if((bc && !bc_supported_) || (features & needed) != needed)
+      {
+        std::cerr << "Texture format " << vk::to_string(texture.format) << " is not supported: " << texture.path << std::endl;
+        ok = false;
+      }
+      for(uint32_t level = 0; ok && level < texture.mip_count; ++level)
+      {
+        // Larger requests can wait forever behind the ring's wrapped tail (RingCursor::Allocate).
+        if(texture.file.Mip(level).size > staging_.Capacity() / 2)
+        {
+          std::cerr << "Texture mip " << level << " is larger than half the staging ring: " << texture.path << std::endl;
+          ok = false;
+        }
+      }
+    }
+    lock.lock();
+    if(!ok)
+    {
+      failed_.push_back(&texture);
+      return;
+    }
+    opened_.push_back(&texture);
+  }
+
+  // Worker: copy one mip into staging, waiting for the GPU to free space when the ring is full.
+  void Stage(std::unique_lock<std::mutex>& lock, const Job& job)
+  {
+    const auto& mip      = job.texture->file.Mip(job.level);
+    const auto  sequence = next_sequence_++;
+    staging_.BeginFrame(sequence);
+    ArenaRegion region;
+    // BC blocks are at most 16 bytes, which also satisfies the 4 byte rule for buffer offsets.
+    while(!(region = staging_.Allocate(mip.size, 16)))
+    {
+      cv_.wait(lock);
+      if(quit_)
+      {
+        return;
+      }
+    }
+
+    lock.unlock();
+    std::memcpy(region.mapped, job.texture->file.MipData(job.level), static_cast<size_t>(mip.size));
+    // Evicted mips are read again from the page cache (or disk) rather than kept in RSS.
+    job.texture->file.File().Release(static_cast<size_t>(mip.offset), static_cast<size_t>(mip.size));
+    allocator_.Flush(staging_.GetAllocation());
+    lock.lock();
+    staged_.push_back(Staged{job.texture, job.level, region, sequence});
+  }
+
+  void WorkerLoop()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(;;)
+    {
+      cv_.wait(lock, [this] { return quit_ || !jobs_.empty(); });
+      if(quit_)
+      {
+        return;
+      }
+      const auto job = jobs_.front();
+      jobs_.pop_front();
+      if(job.level == kOpenJob)
+      {
+        Open(lock, *job.texture);
+      }
+      else
+      {
+        Stage(lock, job);
+      }
+    }
+  }
+
+  vk::PhysicalDevice                    physical_device_;
+  vk::Device                            device_;
+  DeviceAllocator&                      allocator_;
+  DeletionQueue&                        deletion_queue_;
+  bool                                  bc_supported_;
+  bool                                  memory_budget_;
+  vk::DeviceSize                        budget_cap_;
+  vk::UniqueSampler                     sampler_;
+
+  // Render thread only
+  std::vector<std::unique_ptr<Texture>> textures_;
+  uint64_t                              frame_          = 0; // frame the next Update() records
+  vk::DeviceSize                        resident_bytes_ = 0;
+  TextureStats                          stats_;
+  std::deque<Consumed>                  consumed_; // guarded by mutex_
+
+  std::mutex                            mutex_;
+  std::condition_variable               cv_;
+  bool                                  quit_ = false;
+  RingArena                             staging_; // guarded by mutex_ after construction
+  uint64_t                              next_sequence_ = 0;
+  std::deque<Job>                       jobs_;
+  std::vector<Texture*>                 opened_;
+  std::vector<Texture*>                 failed_;
+  std::vector<Staged>                   staged_;
+
+  std::thread                           worker_;
+};
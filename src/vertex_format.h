@@ -0,0 +1,230 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+/*
+  Compile-time vertex formats
+
+  A vertex struct's attributes are declared once, as a constexpr VertexLayout:
+
+    constexpr auto kLayout = MakeVertexLayout<MeshVertex>(
+      VertexAttributeOf<decltype(MeshVertex::position)>(0, offsetof(MeshVertex, position)),
+      VertexAttributeOf<decltype(MeshVertex::normal)>(1, offsetof(MeshVertex, normal)));
+
+  Formats follow from the member types, and the Vulkan binding / attribute descriptions are
+  generated from the layout at compile time. A shader's `layout(location = N) in` list is
+  declared next to it as ShaderInputs, and static_assert(layout.Feeds(inputs)) turns a
+  shader / struct mismatch into a build error instead of garbage on screen.
+*/
+
+enum class ShaderScalar : uint32_t
+{
+  eFloat, // float, vecN (also normalized integer formats)
+  eInt,   // int, ivecN
+  eUint,  // uint, uvecN
+};
+
+// One `layout(location = location) in` variable of a vertex shader.
+struct ShaderInput
+{
+  uint32_t     location;
+  ShaderScalar scalar;
+  uint32_t     components;
+};
+
+// Formats of 1..4 component vectors of a scalar type.
+template <typename T>
+struct VertexScalar;
+
+template <>
+struct VertexScalar<float>
+{
+  static constexpr ShaderScalar              kScalar  = ShaderScalar::eFloat;
+  static constexpr std::array<vk::Format, 4> kFormats = {vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat,
+                                                         vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat};
+};
+
+template <>
+struct VertexScalar<int32_t>
+{
+  static constexpr ShaderScalar              kScalar  = ShaderScalar::eInt;
+  static constexpr std::array<vk::Format, 4> kFormats = {vk::Format::eR32Sint, vk::Format::eR32G32Sint,
+                                                         vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint};
+};
+
+template <>
+struct VertexScalar<uint32_t>
+{
+  static constexpr ShaderScalar              kScalar  = ShaderScalar::eUint;
+  static constexpr std::array<vk::Format, 4> kFormats = {vk::Format::eR32Uint, vk::Format::eR32G32Uint,
+                                                         vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint};
+};
+
+// Vertex format of a struct member type. Unsupported types fail to compile.
+template <typename T>
+struct VertexComponent
+{
+  static constexpr ShaderScalar kScalar     = VertexScalar<T>::kScalar;
+  static constexpr uint32_t     kComponents = 1;
+  static constexpr vk::Format   kFormat     = VertexScalar<T>::kFormats[0];
+};
+
+template <typename T, size_t N>
+struct VertexComponent<T[N]>
+{
+  static_assert(N >= 1 && N <= 4, "Vertex attributes have one to four components.");
+  static constexpr ShaderScalar kScalar     = VertexScalar<T>::kScalar;
+  static constexpr uint32_t     kComponents = static_cast<uint32_t>(N);
+  static constexpr vk::Format   kFormat     = VertexScalar<T>::kFormats[N - 1];
+};
+
+template <typename T, size_t N>
+struct VertexComponent<std::array<T, N>> : VertexComponent<T[N]>
+{
+};
+
+// Normalized bytes, e.g. vertex colors; the shader reads a vec4.
+template <>
+struct VertexComponent<uint8_t[4]>
+{
+  static constexpr ShaderScalar kScalar     = ShaderScalar::eFloat;
+  static constexpr uint32_t     kComponents = 4;
+  static constexpr vk::Format   kFormat     = vk::Format::eR8G8B8A8Unorm;
+};
+
+struct VertexAttribute
+{
+  uint32_t     location;
+  uint32_t     offset;
+  uint32_t     size; // bytes
+  vk::Format   format;
+  ShaderScalar scalar;
+  uint32_t     components;
+};
+
+// Attribute for a member of type `Member` at `offset` (offsetof) in the vertex.
+template <typename Member>
+constexpr VertexAttribute VertexAttributeOf(uint32_t location, size_t offset)
+{
+  return VertexAttribute{location,
+                         static_cast<uint32_t>(offset),
+                         static_cast<uint32_t>(sizeof(Member)),
+                         VertexComponent<Member>::kFormat,
+                         VertexComponent<Member>::kScalar,
+                         VertexComponent<Member>::kComponents};
+}
+
+template <typename Vertex>
+struct VertexStride
+{
+  static constexpr uint32_t kValue = static_cast<uint32_t>(sizeof(Vertex));
+};
+
+template <>
+struct VertexStride<void>
+{
+  static constexpr uint32_t kValue = 0;
+};
+
+/*
+  The attributes of one vertex buffer binding. `Vertex` is the struct in the buffer; void
+  declares a pipeline without vertex input (e.g. positions from gl_VertexIndex).
+*/
+template <typename Vertex, size_t N, vk::VertexInputRate Rate = vk::VertexInputRate::eVertex>
+struct VertexLayout
+{
+  static constexpr uint32_t kStride       = VertexStride<Vertex>::kValue;
+  static constexpr size_t   kBindingCount = N > 0 ? 1 : 0;
+
+  std::array<VertexAttribute, N> attributes;
+
+  constexpr std::array<vk::VertexInputBindingDescription, kBindingCount> Bindings(uint32_t binding = 0) const
+  {
+    return MakeBindings(binding, std::make_index_sequence<kBindingCount>());
+  }
+
+  constexpr std::array<vk::VertexInputAttributeDescription, N> Attributes(uint32_t binding = 0) const
+  {
+    return MakeAttributes(binding, std::make_index_sequence<N>());
+  }
+
+  // Attributes fit in the stride, and neither their locations nor their bytes overlap.
+  constexpr bool Valid() const
+  {
+    for(size_t i = 0; i < N; ++i)
+    {
+      if(attributes[i].offset + attributes[i].size > kStride)
+      {
+        return false;
+      }
+      for(size_t j = i + 1; j < N; ++j)
+      {
+        if(attributes[i].location == attributes[j].location ||
+           (attributes[i].offset < attributes[j].offset + attributes[j].size &&
+            attributes[j].offset < attributes[i].offset + attributes[i].size))
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  /*
+    Every shader input has an attribute at its location with the same scalar type and component
+    count. Stricter than Vulkan, which fills missing components with (0, 0, 1): a differing count
+    here is nearly always a struct and a shader that drifted apart. Attributes the shader does
+    not read are allowed.
+  */
+  template <size_t M>
+  constexpr bool Feeds(const std::array<ShaderInput, M>& inputs) const
+  {
+    for(size_t i = 0; i < M; ++i)
+    {
+      bool found = false;
+      for(size_t j = 0; j < N; ++j)
+      {
+        if(attributes[j].location == inputs[i].location)
+        {
+          found = attributes[j].scalar == inputs[i].scalar && attributes[j].components == inputs[i].components;
+        }
+      }
+      if(!found)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  template <size_t... I>
+  constexpr std::array<vk::VertexInputBindingDescription, kBindingCount> MakeBindings(uint32_t binding, std::index_sequence<I...>) const
+  {
+    static_cast<void>(binding); // unused when the pack is empty
+    return {{(static_cast<void>(I), vk::VertexInputBindingDescription(binding, kStride, Rate))...}};
+  }
+
+  template <size_t... I>
+  constexpr std::array<vk::VertexInputAttributeDescription, N> MakeAttributes(uint32_t binding, std::index_sequence<I...>) const
+  {
+    static_cast<void>(binding);
+    return {{vk::VertexInputAttributeDescription(attributes[I].location, binding, attributes[I].format, attributes[I].offset)...}};
+  }
+};
+
+template <typename Vertex, vk::VertexInputRate Rate = vk::VertexInputRate::eVertex, typename... Attributes>
+constexpr VertexLayout<Vertex, sizeof...(Attributes), Rate> MakeVertexLayout(const Attributes&... attributes)
+{
+  return VertexLayout<Vertex, sizeof...(Attributes), Rate>{{{attributes...}}};
+}
+
+// Pipelines that generate their vertices in the shader.
+using NoVertexInput = VertexLayout<void, 0>;
@@ -0,0 +1,2072 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+
+#include "bindless_table.h"
+#include "capabilities.h"
+#include "deletion_queue.h"
+#include "gpu_driven.h"
+#include "memory_allocator.h"
+#include "job_system.h"
+#include "mesh_streamer.h"
+#include "pipeline_manager.h"
+#include "profiler.h"
+#include "render_graph.h"
+#include "spirv_reflect.h"
+#include "texture_streamer.h"
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <GLFW/glfw3native.h>
+
+#ifndef HIKARI_SHADER_DIR
+#define HIKARI_SHADER_DIR "shaders"
+#endif
+
+constexpr uint32_t kWidth  = 512;
+constexpr uint32_t kHeight = 512;
+struct RendererConfig
+{
+  // Render into device-owned images instead of a GLFW surface + swapchain.
+  // Works on display-less machines (e.g. lavapipe on CI).
+  bool     headless                = false;
+  uint32_t width                   = kWidth;
+  uint32_t height                  = kHeight;
+  // Frames the CPU may record ahead of the GPU. Independent of the swapchain image count.
+  // In headless mode this is also the size of the readback staging ring.
+  uint32_t frames_in_flight        = 2;
+
+  // Job threads used to record secondary command buffers. 0 = one per core minus the render thread.
+  uint32_t worker_threads          = 0;
+  uint32_t draws_per_job           = 256;
+  // Size of each frame context's region of the uniform ring (FrameUniforms and other per-frame constants).
+  uint32_t uniform_bytes_per_frame = 64 * 1024;
+  // Keep the recorded secondaries per framebuffer and only re-record them when what they draw changes.
+  bool     reuse_command_buffers   = true;
+  // Bind one global descriptor table (set 1, images / buffers / samplers addressed by index) per frame.
+  // Needs descriptor indexing with update-after-bind; skipped without it.
+  bool     bindless                = true;
+  // Cull on the GPU and draw through indirect commands instead of recording one draw per object.
+  // Falls back to the secondary command buffer path when the device lacks multiDrawIndirect.
+  bool     gpu_driven              = true;
+  // Run the culling pass on an async compute queue and stream uploads on a transfer queue,
+  // when the device has such queue families. Otherwise both use the graphics queue.
+  bool     async_compute           = true;
+  bool     dedicated_transfer      = true;
+  // Size of the test scene.
+  uint32_t object_count            = 1;
+  // Add a large triangle in front of the middle of the test scene, hiding the ones behind it
+  // from GPU occlusion culling.
+  bool     occluder                = false;
+  // Multisample anti-aliasing: 1 (off), 2, 4 or 8 samples, clamped to what the device supports.
+  // The multisampled color and depth stay in tile memory and are resolved at the end of the main pass.
+  uint32_t msaa_samples            = 1;
+  // With MSAA, run the fragment shader per sample instead of per pixel (needs sampleRateShading).
+  bool     sample_shading          = false;
+  // .hkm scene streamed in the background and drawn on top of the test scene once resident.
+  // With the bindless table it is textured with the first LoadTexture() texture.
+  std::string mesh_path;
+  // Device memory streamed textures may keep resident. 0 = derived from VK_EXT_memory_budget or the heap size.
+  uint64_t    texture_budget_bytes = 0;
+
+  std::string shader_dir          = HIKARI_SHADER_DIR;
+  // Pipeline cache blob reused across launches. Empty disables persistence.
+  std::string pipeline_cache_path = "pipeline_cache.bin";
+  // Watch the SPIR-V files and rebuild the pipelines using one when it changes (development).
+  bool        hot_reload_shaders  = false;
+
+  /*
+    Presentation (ignored in headless mode)
+    present_mode falls back to FIFO when the surface does not support it.
+    swapchain_images: 0 = minImageCount, plus one for mailbox.
+    max_queued_frames bounds input-to-present latency: Render() returns only once at most
+    this many frames are queued on the GPU, so input polled right after it is at most that
+    many frames old when it reaches the screen. 0 = bounded by frames_in_flight alone.
+  */
+  vk::PresentModeKHR present_mode      = vk::PresentModeKHR::eFifo;
+  uint32_t           swapchain_images  = 0;
+  uint32_t           max_queued_frames = 0;
+
+  // Print the selected device, negotiated extensions and stage timings to std::clog.
+  bool        log_startup         = true;
+};
+
+inline const char* PresentModeName(vk::PresentModeKHR mode)
+{
+  switch(mode)
+  {
+    case vk::PresentModeKHR::eImmediate:   return "immediate";
+    case vk::PresentModeKHR::eMailbox:     return "mailbox";
+    case vk::PresentModeKHR::eFifo:        return "fifo";
+    case vk::PresentModeKHR::eFifoRelaxed: return "fifo_relaxed";
+    default:                               return "unknown";
+  }
+}
+
+// Accepts the names returned by PresentModeName().
+inline bool ParsePresentMode(const std::string& name, vk::PresentModeKHR* mode)
+{
+  for(const auto candidate : {vk::PresentModeKHR::eImmediate,
+                              vk::PresentModeKHR::eMailbox,
+                              vk::PresentModeKHR::eFifo,
+                              vk::PresentModeKHR::eFifoRelaxed})
+  {
+    if(name == PresentModeName(candidate))
+    {
+      *mode = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// One object of the test scene. Matches the push constant block in triangle.vert.
+struct DrawItem
+{
+  std::array<float, 4> transform; // xy: offset, z: scale, w: depth
+};
+
+// Bindless slots of a draw's texture, pushed for the fragment stage after DrawItem. Matches mesh_textured.frag.
+struct MaterialSlots
+{
+  uint32_t image   = kNoBindlessSlot;
+  uint32_t sampler = kNoBindlessSlot;
+};
+
+// The test triangle, generated in triangle.vert from gl_VertexIndex.
+struct TrianglePipeline
+{
+  static constexpr const char*                kVertexShader   = "triangle.vert.spv";
+  static constexpr const char*                kFragmentShader = "triangle.frag.spv";
+  static constexpr RasterState                kRaster         = RasterState().WithCullMode(vk::CullModeFlagBits::eNone);
+  static constexpr NoVertexInput              kVertex         = {};
+  static constexpr std::array<ShaderInput, 0> kInputs         = {};
+};
+
+// Streamed .hkm meshes. kInputs mirrors the `in` variables of mesh.vert.
+struct MeshPipeline
+{
+  static constexpr const char*                kVertexShader   = "mesh.vert.spv";
+  static constexpr const char*                kFragmentShader = "triangle.frag.spv";
+  static constexpr RasterState                kRaster         = RasterState().WithCullMode(vk::CullModeFlagBits::eNone);
+  static constexpr auto                       kVertex         = MakeVertexLayout<MeshVertex>(
+    VertexAttributeOf<decltype(MeshVertex::position)>(0, offsetof(MeshVertex, position)),
+    VertexAttributeOf<decltype(MeshVertex::normal)>(1, offsetof(MeshVertex, normal)),
+    VertexAttributeOf<decltype(MeshVertex::uv)>(2, offsetof(MeshVertex, uv)));
+  static constexpr std::array<ShaderInput, 3> kInputs         = {{{0, ShaderScalar::eFloat, 3},   // in_position
+                                                                  {1, ShaderScalar::eFloat, 3},   // in_normal
+                                                                  {2, ShaderScalar::eFloat, 2}}}; // in_uv
+};
+
+// The same with a texture from the bindless table; needs the table bound as set 1.
+struct TexturedMeshPipeline : MeshPipeline
+{
+  static constexpr const char* kFragmentShader = "mesh_textured.frag.spv";
+};
+
+// Bounding radius of the unit test triangle in triangle.vert (farthest vertex is (0.5, 0.5)).
+constexpr float kTriangleRadius = 0.7072f;
+
+/*
+  CPU/GPU overlap measured by Render().
+  overlap: fraction of CPU frame time not spent blocked on the GPU.
+  1.0 means recording never waited, 0.0 means CPU and GPU ran in lockstep.
+*/
+struct PipeliningStats
+{
+  uint64_t frames       = 0;
+  double   cpu_seconds  = 0.0;
+  double   wait_seconds = 0.0;
+  uint64_t gpu_busy_sum = 0;
+
+  double Overlap() const { return cpu_seconds > 0.0 ? 1.0 - wait_seconds / cpu_seconds : 0.0; }
+  // Average number of earlier frames not yet known to be complete at submit time (fence waits and readbacks).
+  double AverageGpuQueueDepth() const { return frames ? double(gpu_busy_sum) / frames : 0.0; }
+};
+
+/*
+  Per-frame constants, set 0 binding 0 of every graphics pipeline (the `Frame` block in triangle.frag).
+  std140: keep members vec4-sized.
+*/
+struct FrameUniforms
+{
+  std::array<float, 4> color_scale = {1.0f, 1.0f, 1.0f, 1.0f}; // rgb multiplier, a unused
+  // 2D camera over the NDC scene: screen = (position - xy) * z. GPU culling sees it too. w unused.
+  std::array<float, 4> camera      = {0.0f, 0.0f, 1.0f, 0.0f};
+};
+
+// Uniform ring usage. Peak includes block tails left by threads.
+struct UniformStats
+{
+  uint64_t region_bytes = 0; // per frame context
+  uint64_t peak_bytes   = 0;
+  uint64_t overflows    = 0; // allocations that did not fit
+};
+
+/*
+  Reuse of the main pass's recorded secondary command buffers (CPU draw path only).
+  hit: the frame executed an earlier recording as is; miss: the pass was re-recorded.
+*/
+struct CommandReuseStats
+{
+  uint64_t hits   = 0;
+  uint64_t misses = 0;
+
+  double HitRate() const { return hits + misses ? double(hits) / (hits + misses) : 0.0; }
+};
+
+// Wall time of each constructor stage, in milliseconds.
+struct StartupTimings
+{
+  double instance_ms        = 0.0;
+  double device_ms          = 0.0; // physical device selection + logical device
+  double frame_resources_ms = 0.0; // command pools, sync objects, profiler
+  double swapchain_ms       = 0.0; // surface + swapchain, or the offscreen target in headless mode
+  double render_targets_ms  = 0.0; // render graph (passes, attachments, framebuffers), pipeline requests
+
+  double TotalMs() const { return instance_ms + device_ms + frame_resources_ms + swapchain_ms + render_targets_ms; }
+};
+
+// Called once a headless frame has landed in host memory.
+// `data` is tightly packed RGBA8 and only valid during the call.
+using ReadbackCallback = std::function<void(uint64_t frame_index, const void* data, size_t size)>;
+
+// Whether a frame context's readback buffer is lent out. Owned by the context.
+struct ReadbackGate
+{
+  std::mutex              mutex;
+  std::condition_variable released;
+  bool                    leased = false;
+};
+
+/*
+  A headless frame's readback buffer, lent to another thread without copying.
+  The mapping stays valid until the lease is released (or destroyed); until then the renderer
+  will not record into that frame context again, so a slow consumer throttles rendering
+  instead of being overwritten. Move-only, and safe to release from any thread.
+*/
+class ReadbackLease
+{
+public:
+  ReadbackLease() = default;
+  ReadbackLease(ReadbackGate* gate, uint64_t frame_index, const void* data, size_t size, vk::Extent2D extent)
+    : gate_(gate), frame_index_(frame_index), data_(data), size_(size), extent_(extent)
+  {
+  }
+  ReadbackLease(ReadbackLease&& other) noexcept { *this = std::move(other); }
+  ReadbackLease& operator=(ReadbackLease&& other) noexcept
+  {
+    if(this != &other)
+    {
+      Release();
+      gate_        = other.gate_;
+      frame_index_ = other.frame_index_;
+      data_        = other.data_;
+      size_        = other.size_;
+      extent_      = other.extent_;
+      other.gate_  = nullptr;
+    }
+    return *this;
+  }
+  ~ReadbackLease() { Release(); }
+
+  // Hand the buffer back. Data() must not be read afterwards.
+  void Release()
+  {
+    if(!gate_)
+    {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(gate_->mutex);
+      gate_->leased = false;
+    }
+    gate_->released.notify_all();
+    gate_ = nullptr;
+  }
+
+  explicit operator bool() const { return gate_ != nullptr; }
+
+  uint64_t FrameIndex() const { return frame_index_; }
+  // Tightly packed RGBA8 rows, top row first.
+  const uint8_t* Data() const { return static_cast<const uint8_t*>(data_); }
+  size_t Size() const { return size_; }
+  uint32_t Width() const { return extent_.width; }
+  uint32_t Height() const { return extent_.height; }
+
+private:
+  ReadbackGate* gate_        = nullptr;
+  uint64_t      frame_index_ = 0;
+  const void*   data_        = nullptr;
+  size_t        size_        = 0;
+  vk::Extent2D  extent_;
+};
+
+// Takes over a headless frame instead of the ReadbackCallback. Called on the render thread.
+using ReadbackHandoff = std::function<void(ReadbackLease lease)>;
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL DebugMessageCallback(VkDebugReportFlagsEXT      flags,
+                                                           VkDebugReportObjectTypeEXT objectType,
+                                                           uint64_t object, size_t location,
+                                                           int32_t     messageCode,
+                                                           const char *pLayerPrefix,
+                                                           const char *pMessage, void *pUserData)
+{
+  VkBool32 ret = VK_FALSE;
+  if (flags & VK_DEBUG_REPORT_INFORMATION_BIT_EXT ||
+    flags & VK_DEBUG_REPORT_DEBUG_BIT_EXT)
+  {
+    ret = VK_TRUE;
+  }
+  std::stringstream ss;
+  if (pLayerPrefix)
+  {
+    ss << "[" << pLayerPrefix << "] ";
+  }
+  ss << pMessage << std::endl;
+  std::cerr << ss.str().c_str() << std::endl;
+
+  return ret;
+}
+
+class VkRenderer
+{
+public:
+  // `window` is only used when config.headless is false.
+  explicit VkRenderer(const RendererConfig& config = RendererConfig(), GLFWwindow* window = nullptr)
+    : config_(config), window_(window)
+  {
+    using Clock = std::chrono::steady_clock;
+    auto stage_start = Clock::now();
+    auto end_stage   = [&stage_start](double& ms) {
+      const auto now = Clock::now();
+      ms          = std::chrono::duration<double, std::milli>(now - stage_start).count();
+      stage_start = now;
+    };
+
+    /*
+      Instance creation
+      Only the extensions the window system needs, plus validation in debug builds.
+    */
+    {
+      const auto appinfo = vk::ApplicationInfo(nullptr, 1, nullptr, 1, kMinimumApiVersion);
+
+      std::vector<const char*> required;
+      if(!config_.headless)
+      {
+        uint32_t    count = 0;
+        const auto  names = glfwGetRequiredInstanceExtensions(&count);
+        required.assign(names, names + count);
+      }
+#ifdef DEBUG
+      instance_caps_ = NegotiateInstance(required, true);
+#else
+      instance_caps_ = NegotiateInstance(required, false);
+#endif
+
+      auto instance_create_info = vk::InstanceCreateInfo({},
+                                                         &appinfo,
+                                                         static_cast<uint32_t>(instance_caps_.layers.size()),
+                                                         instance_caps_.layers.data(),
+                                                         static_cast<uint32_t>(instance_caps_.extensions.size()),
+                                                         instance_caps_.extensions.data());
+      instance_ = vk::createInstanceUnique(instance_create_info);
+      VULKAN_HPP_DEFAULT_DISPATCHER.init(instance_.get());
+    }
+
+    end_stage(startup_timings_.instance_ms);
+
+    if(instance_caps_.debug_report)
+    {
+      const auto ci = vk::DebugReportCallbackCreateInfoEXT(vk::DebugReportFlagBitsEXT::eError |
+                                                           vk::DebugReportFlagBitsEXT::eWarning |
+                                                           vk::DebugReportFlagBitsEXT::ePerformanceWarning,
+                                                           &DebugMessageCallback,
+                                                           nullptr);
+      debug_report_ = instance_->createDebugReportCallbackEXTUnique(ci);
+    }
+
+    /*
+      Select physical device
+      Every device is scored; the graphics queue family comes out of the same pass.
+    */
+    {
+      DeviceRequirements requirements;
+      if(!config_.headless)
+      {
+        requirements.extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        const auto instance       = instance_.get();
+        requirements.can_present = [instance](vk::PhysicalDevice device, uint32_t family) {
+          return glfwGetPhysicalDevicePresentationSupport(instance, device, family) == GLFW_TRUE;
+        };
+      }
+      caps_                              = SelectPhysicalDevice(instance_.get(), requirements);
+      physical_device_                   = caps_.physical_device;
+      graphics_queue_index_              = caps_.graphics_queue_index;
+      physical_device_memory_properties_ = physical_device_.getMemoryProperties();
+    }
+
+    /*
+      Create logical device
+      One graphics queue, plus async compute and transfer queues from their own families.
+    */
+    {
+      compute_queue_index_  = config_.async_compute ? caps_.compute_queue_index : kNoQueueFamily;
+      transfer_queue_index_ = config_.dedicated_transfer ? caps_.transfer_queue_index : kNoQueueFamily;
+      // The second queue of the compute family when transfer shares it (and async compute is on).
+      const uint32_t transfer_queue_slot = transfer_queue_index_ == compute_queue_index_ ? caps_.transfer_queue_slot : 0;
+
+      const std::array<float, 2>           priorities = {1.0f, 1.0f};
+      std::vector<vk::DeviceQueueCreateInfo> queue_cis;
+      auto add_queue = [&](uint32_t family, uint32_t slot) {
+        if(family == kNoQueueFamily)
+        {
+          return;
+        }
+        for(auto& ci : queue_cis)
+        {
+          if(ci.queueFamilyIndex == family)
+          {
+            ci.queueCount = std::max(ci.queueCount, slot + 1);
+            return;
+          }
+        }
+        queue_cis.push_back(vk::DeviceQueueCreateInfo({}, family, slot + 1, priorities.data()));
+      };
+      add_queue(graphics_queue_index_, 0);
+      add_queue(compute_queue_index_, 0);
+      add_queue(transfer_queue_index_, transfer_queue_slot);
+
+      auto device_ci = vk::DeviceCreateInfo();
+      device_ci.setPEnabledFeatures(&caps_.features);
+      device_ci.setPQueueCreateInfos(queue_cis.data());
+      device_ci.setQueueCreateInfoCount(static_cast<uint32_t>(queue_cis.size()));
+      device_ci.setPpEnabledExtensionNames(caps_.extensions.data());
+      device_ci.setEnabledExtensionCount(static_cast<uint32_t>(caps_.extensions.size()));
+      if(caps_.descriptor_indexing)
+      {
+        device_ci.setPNext(&caps_.descriptor_indexing_features);
+      }
+
+      device_ = physical_device_.createDeviceUnique(device_ci);
+      VULKAN_HPP_DEFAULT_DISPATCHER.init(device_.get());
+
+      // Every image and buffer below is placed through the sub-allocator.
+      allocator_ = std::make_unique<DeviceAllocator>(physical_device_, device_.get());
+    }
+
+    end_stage(startup_timings_.device_ms);
+
+    /*
+      Get device queue
+    */
+    {
+      device_->getQueue(graphics_queue_index_, 0, &device_queue_);
+      if(compute_queue_index_ != kNoQueueFamily)
+      {
+        compute_queue_ = device_->getQueue(compute_queue_index_, 0);
+      }
+      if(transfer_queue_index_ != kNoQueueFamily)
+      {
+        transfer_queue_ = device_->getQueue(transfer_queue_index_,
+                                            transfer_queue_index_ == compute_queue_index_ ? caps_.transfer_queue_slot : 0);
+      }
+    }
+
+    /*
+      Command Pool creation
+      Frame contexts creation
+      GPU に命令を送るコマンドバッファを保持するもの
+      frames in flight の数だけ command buffer / fence / semaphore を用意し、
+      CPU が frame N+1 を記録している間に GPU が frame N を実行できるようにする
+
+      Every frame context has one transient pool for its primary buffer, reset in bulk when
+      the context comes round again, never buffer by buffer. Secondaries live in pools owned
+      by their recording (RecordedPass) and are reset only when re-recorded.
+    */
+    {
+      jobs_ = std::make_unique<JobSystem>(config_.worker_threads);
+
+      profiler_ = std::make_unique<Profiler>(physical_device_,
+                                             device_.get(),
+                                             graphics_queue_index_,
+                                             config_.frames_in_flight,
+                                             caps_.pipeline_statistics);
+
+      assert(config_.frames_in_flight > 0);
+      const auto pool_ci      = vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient, graphics_queue_index_);
+      // Fences start signaled so the first use of each frame context does not block.
+      const auto fence_ci     = vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled);
+      const auto semaphore_ci = vk::SemaphoreCreateInfo();
+      frames_.resize(config_.frames_in_flight);
+      for(uint32_t i = 0; i < config_.frames_in_flight; ++i)
+      {
+        auto& frame = frames_[i];
+        frame.command_pool = device_->createCommandPoolUnique(pool_ci);
+        const auto buffer_ai = vk::CommandBufferAllocateInfo(frame.command_pool.get(),
+                                                             vk::CommandBufferLevel::ePrimary,
+                                                             1);
+        frame.command_buffer  = std::move(device_->allocateCommandBuffersUnique(buffer_ai)[0]);
+        frame.fence           = device_->createFenceUnique(fence_ci);
+        frame.image_available = device_->createSemaphoreUnique(semaphore_ci);
+
+        if(compute_queue_index_ != kNoQueueFamily)
+        {
+          frame.compute_command_pool   = device_->createCommandPoolUnique(
+            vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient, compute_queue_index_));
+          frame.compute_command_buffer = std::move(device_->allocateCommandBuffersUnique(
+            vk::CommandBufferAllocateInfo(frame.compute_command_pool.get(), vk::CommandBufferLevel::ePrimary, 1))[0]);
+          frame.cull_finished          = device_->createSemaphoreUnique(semaphore_ci);
+          frame.pyramid_built          = device_->createSemaphoreUnique(semaphore_ci);
+        }
+      }
+    }
+
+    /*
+      Per-frame uniforms
+      One persistently mapped ring, a region per frame context, bound through a dynamic offset.
+      The descriptor set is written once: only the offset changes from frame to frame.
+    */
+    {
+      uniforms_ = std::make_unique<UniformRing>(*allocator_,
+                                                config_.uniform_bytes_per_frame,
+                                                config_.frames_in_flight,
+                                                jobs_->ThreadCount(),
+                                                caps_.properties.limits.minUniformBufferOffsetAlignment);
+
+      const auto binding = vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBufferDynamic, 1,
+                                                          vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment);
+      frame_set_layout_  = device_->createDescriptorSetLayoutUnique(
+        vk::DescriptorSetLayoutCreateInfo(vk::DescriptorSetLayoutCreateFlags(), 1, &binding));
+      const auto pool_size = vk::DescriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, 1);
+      frame_descriptor_pool_ = device_->createDescriptorPoolUnique(
+        vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlags(), 1, 1, &pool_size));
+      frame_set_ = device_->allocateDescriptorSets(
+        vk::DescriptorSetAllocateInfo(frame_descriptor_pool_.get(), 1, &frame_set_layout_.get()))[0];
+
+      const auto buffer_info = vk::DescriptorBufferInfo(uniforms_->GetBuffer(), 0, sizeof(FrameUniforms));
+      device_->updateDescriptorSets(vk::WriteDescriptorSet(frame_set_, 0, 0, 1, vk::DescriptorType::eUniformBufferDynamic,
+                                                           nullptr, &buffer_info),
+                                    nullptr);
+    }
+
+    /*
+      Bindless resource table
+      One set per frame context so slots can be rewritten while other frames are in flight.
+    */
+    if(config_.bindless && caps_.descriptor_indexing)
+    {
+      bindless_ = std::make_unique<BindlessTable>(device_.get(), caps_, deletion_queue_, config_.frames_in_flight);
+      for(uint32_t i = 0; i < config_.frames_in_flight; ++i)
+      {
+        frames_[i].bindless_set = bindless_->Set(i);
+      }
+    }
+
+    end_stage(startup_timings_.frame_resources_ms);
+
+    /*
+      Create swapchain
+      描画結果をdisplay 上に表示するためには必要
+      描画待ちのバックバッファをタイミングに合わせて切り替えている
+
+      surface 作成 -> forat 確定
+                   -> surface size 取得
+                   -> present モード確認 -> swapchain をつくる
+    */
+    if(!config_.headless)
+    {
+      /*
+        Create surface
+      */
+      auto surface_c_type = VkSurfaceKHR(surface_.get());
+      glfwCreateWindowSurface(instance_.get(), window_, nullptr, &surface_c_type);
+      // The deleter needs the instance, otherwise destroying the surface goes through a null handle.
+      surface_ = vk::UniqueSurfaceKHR(surface_c_type,
+                                      vk::ObjectDestroy<vk::Instance, VULKAN_HPP_DEFAULT_DISPATCHER_TYPE>(instance_.get()));
+
+      /*
+        Get the supported format
+        The render pass is built for this format, so it stays fixed across swapchain recreation.
+      */
+      const auto formats = physical_device_.getSurfaceFormatsKHR(surface_.get());
+      assert(!formats.empty());
+      const auto format = (formats[0].format == vk::Format::eUndefined)
+                          ? vk::Format::eB8G8R8A8Unorm
+                          : formats[0].format;
+      surface_format_ = vk::SurfaceFormatKHR(format, formats[0].colorSpace);
+      color_format_   = format;
+
+      /*
+        Present mode
+        FIFO is the only mode every implementation has to support, so it is the fallback.
+      */
+      const auto present_modes = physical_device_.getSurfacePresentModesKHR(surface_.get());
+      present_mode_ = vk::PresentModeKHR::eFifo;
+      if(std::find(present_modes.begin(), present_modes.end(), config_.present_mode) != present_modes.end())
+      {
+        present_mode_ = config_.present_mode;
+      }
+      else
+      {
+        std::cerr << "Present mode " << PresentModeName(config_.present_mode)
+                  << " is not supported, falling back to fifo." << std::endl;
+      }
+
+      CreateSwapchain();
+    }
+    else
+    {
+      /*
+        Offscreen color target for headless rendering
+        swapchain の代わりに device が持つ image に描画し、staging buffer にコピーして読み戻す
+        The image itself belongs to the render graph.
+      */
+      color_format_     = vk::Format::eR8G8B8A8Unorm;
+      swapchain_extent_ = vk::Extent2D(config_.width, config_.height);
+    }
+
+    /*
+      Readback ring for headless rendering
+      Each frame context owns a host-visible staging buffer.
+      A buffer is only waited on when the ring wraps around, so the queue never stalls on readback.
+    */
+    if(config_.headless)
+    {
+      const auto frame_size = vk::DeviceSize(swapchain_extent_.width) * swapchain_extent_.height * 4;
+      for(auto& slot : frames_)
+      {
+        const auto buffer_ci = vk::BufferCreateInfo(vk::BufferCreateFlags(),
+                                                    frame_size,
+                                                    vk::BufferUsageFlagBits::eTransferDst,
+                                                    vk::SharingMode::eExclusive);
+        slot.readback_buffer = device_->createBufferUnique(buffer_ci);
+
+        // GpuToCpu prefers host cached memory, which makes the CPU read much faster.
+        // The allocator keeps host visible blocks persistently mapped.
+        slot.readback_allocation = allocator_->AllocateForBuffer(slot.readback_buffer.get(), MemoryUsage::eGpuToCpu);
+        slot.readback_size       = static_cast<size_t>(frame_size);
+        slot.readback_gate       = std::make_unique<ReadbackGate>();
+      }
+    }
+
+    end_stage(startup_timings_.swapchain_ms);
+
+    /*
+      Render graph
+      main pass (color + depth) -> depth pyramid (GPU-driven path) -> readback copy (headless)
+      Load/store ops, layouts and dependencies come out of Compile(). Depth is only stored
+      when the pyramid samples it; otherwise it is a transient attachment that never leaves
+      tile memory on tilers. With MSAA the main pass draws into transient multisampled
+      color and depth and resolves into the color target in the same subpass.
+      The render passes stay fixed across resizes, so pipelines compiled against them stay valid.
+    */
+    {
+      // スワップチェインには表示用のイメージが含まれているが、デプスバッファはない
+      const auto depth_format   = vk::Format::eD16Unorm;
+      const auto depth_features = physical_device_.getFormatProperties(depth_format).optimalTilingFeatures;
+      if(!(depth_features & vk::FormatFeatureFlagBits::eDepthStencilAttachment))
+      {
+        std::cerr << "Depth stencil attachment is not supported for D16Unorm depth format." << std::endl;
+      }
+      msaa_samples_ = caps_.MsaaSamples(config_.msaa_samples);
+      if(msaa_samples_ != vk::SampleCountFlagBits::e1 && config_.sample_shading)
+      {
+        if(caps_.sample_rate_shading)
+        {
+          min_sample_shading_ = 1.0f;
+        }
+        else
+        {
+          std::cerr << "Sample rate shading is not supported, shading once per pixel." << std::endl;
+        }
+      }
+      // The GPU-driven path builds its occlusion pyramid from depth when the format can be sampled.
+      // A multisampled depth buffer cannot be, so MSAA leaves culling to the frustum test.
+      depth_sampleable_ = config_.gpu_driven && caps_.multi_draw_indirect &&
+                          (depth_features & vk::FormatFeatureFlagBits::eSampledImage) &&
+                          msaa_samples_ == vk::SampleCountFlagBits::e1;
+
+      graph_ = std::make_unique<RenderGraph>(device_.get(), *allocator_);
+
+      GraphImageDesc color;
+      color.name    = "color";
+      color.format  = color_format_;
+      color.clear   = vk::ClearValue(std::array<float, 4>{0.5f, 0.25f, 0.25f, 0.0f});
+      // Headless frames are copied out by the readback pass, swapchain images are presented.
+      // The main pass clears the swapchain image, so its previous contents are not kept.
+      color_target_ = config_.headless ? graph_->CreateImage(color)
+                                       : graph_->ImportImage(color, vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR);
+
+      GraphImageDesc depth;
+      depth.name    = "depth";
+      depth.format  = depth_format;
+      depth.samples = msaa_samples_;
+      depth.clear   = vk::ClearValue(vk::ClearDepthStencilValue(1.0f, 0));
+      depth_target_ = graph_->CreateImage(depth);
+
+      auto record_main_pass = [this](vk::CommandBuffer command_buffer, const GraphPassContext& context) {
+        RecordMainPass(command_buffer, context);
+      };
+      if(msaa_samples_ != vk::SampleCountFlagBits::e1)
+      {
+        // Only the main pass touches the multisampled color, so the graph makes it transient;
+        // the subpass resolves it into the color target on tile.
+        GraphImageDesc msaa_color = color;
+        msaa_color.name    = "msaa color";
+        msaa_color.samples = msaa_samples_;
+        msaa_color_target_ = graph_->CreateImage(msaa_color);
+        main_pass_         = graph_->AddRenderPass("main", {msaa_color_target_}, depth_target_, record_main_pass,
+                                                   {color_target_});
+      }
+      else
+      {
+        main_pass_ = graph_->AddRenderPass("main", {color_target_}, depth_target_, record_main_pass);
+      }
+      if(depth_sampleable_)
+      {
+        graph_->AddPass("depth pyramid", {{depth_target_, GraphAccess::eComputeSampled}},
+                        [this](vk::CommandBuffer command_buffer, const GraphPassContext&) {
+                          if(recording_.gpu_driven)
+                          {
+                            const auto pyramid = profiler_->BeginGpuScope(command_buffer, "depth pyramid");
+                            gpu_scene_->RecordDepthPyramid(command_buffer, frame_uniforms_.camera);
+                            profiler_->EndGpuScope(command_buffer, pyramid);
+                          }
+                        });
+      }
+      if(config_.headless)
+      {
+        graph_->AddPass("readback", {{color_target_, GraphAccess::eTransferSource}},
+                        [this](vk::CommandBuffer command_buffer, const GraphPassContext&) {
+                          const auto readback = profiler_->BeginGpuScope(command_buffer, "readback copy");
+                          RecordReadback(command_buffer, *recording_.frame);
+                          profiler_->EndGpuScope(command_buffer, readback);
+                        });
+      }
+      graph_->Compile();
+      render_pass_ = graph_->GetRenderPass(main_pass_);
+      RealizeRenderTargets();
+    }
+
+    /*
+      Pipeline subsystem
+      Pipelines compile on worker threads against a VkPipelineCache persisted on disk.
+      Render() skips draws whose pipeline is not ready yet instead of stalling.
+    */
+    {
+      // Per-draw transform (xy offset, scale) and texture slots are pushed as constants; set 0 is the frame's uniforms, set 1 the bindless table.
+      const std::array<vk::PushConstantRange, 2> push_constant_ranges = {
+        vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(DrawItem)),
+        vk::PushConstantRange(vk::ShaderStageFlagBits::eFragment, sizeof(DrawItem), sizeof(MaterialSlots))};
+      std::vector<vk::DescriptorSetLayout> set_layouts = {frame_set_layout_.get()};
+      if(bindless_)
+      {
+        set_layouts.push_back(bindless_->Layout());
+      }
+      pipeline_layout_  = device_->createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo(vk::PipelineLayoutCreateFlags(),
+                                                                                           static_cast<uint32_t>(set_layouts.size()),
+                                                                                           set_layouts.data(),
+                                                                                           static_cast<uint32_t>(push_constant_ranges.size()),
+                                                                                           push_constant_ranges.data()));
+      pipeline_manager_ = std::make_unique<PipelineManager>(physical_device_,
+                                                              device_.get(),
+                                                              deletion_queue_,
+                                                              config_.pipeline_cache_path);
+
+      triangle_pipeline_ = pipeline_manager_->Request(GraphicsPipelineTemplate<TrianglePipeline>::State(
+        config_.shader_dir, pipeline_layout_.get(), render_pass_, msaa_samples_, min_sample_shading_));
+    }
+
+    /*
+      Streamed scene
+      Loading starts right away; Render() draws the scene once every chunk is resident.
+    */
+    if(!config_.mesh_path.empty())
+    {
+      // Textured through the bindless table when there is one and the shader's set 1 matches it.
+      if(bindless_)
+      {
+        const auto path = config_.shader_dir + "/" + TexturedMeshPipeline::kFragmentShader;
+        std::vector<ShaderDescriptor> descriptors;
+        scene_textured_ = ReflectDescriptors(path, &descriptors) && bindless_->Accepts(descriptors, 1);
+        if(!scene_textured_)
+        {
+          std::cerr << "Shader does not match the bindless table, drawing the scene untextured: " << path << std::endl;
+        }
+      }
+      mesh_pipeline_ = pipeline_manager_->Request(
+        scene_textured_ ? GraphicsPipelineTemplate<TexturedMeshPipeline>::State(config_.shader_dir, pipeline_layout_.get(), render_pass_,
+                                                                               msaa_samples_, min_sample_shading_)
+                        : GraphicsPipelineTemplate<MeshPipeline>::State(config_.shader_dir, pipeline_layout_.get(), render_pass_,
+                                                                       msaa_samples_, min_sample_shading_));
+
+      mesh_streamer_  = std::make_unique<MeshStreamer>(device_.get(),
+                                                       *allocator_,
+                                                       graphics_queue_index_,
+                                                       transfer_queue_,
+                                                       transfer_queue_index_);
+      streamed_scene_ = mesh_streamer_->Load(config_.mesh_path);
+    }
+
+    /*
+      Test scene
+      object_count triangles laid out on a grid at depths between 0.5 and 0.9, and optionally
+      an occluder at depth 0.1 over the middle of the grid, drawn first.
+    */
+    {
+      const auto columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(config_.object_count))));
+      const auto scale   = 1.0f / columns;
+      draw_items_.reserve(config_.object_count + 1);
+      if(config_.occluder)
+      {
+        draw_items_.push_back(DrawItem{{0.0f, 0.0f, 1.5f, 0.1f}});
+      }
+      for(uint32_t i = 0; i < config_.object_count; ++i)
+      {
+        const auto x     = (i % columns + 0.5f) * 2.0f * scale - 1.0f;
+        const auto y     = (i / columns + 0.5f) * 2.0f * scale - 1.0f;
+        const auto depth = 0.5f + 0.4f * ((i * 7) % 16) / 15.0f;
+        draw_items_.push_back(DrawItem{{x, y, scale, depth}});
+      }
+    }
+
+    /*
+      GPU-driven path
+      The same scene in SoA storage buffers, culled and drawn without per-object CPU work.
+    */
+    if(config_.gpu_driven && caps_.multi_draw_indirect)
+    {
+      GpuScene scene;
+      scene.transforms.reserve(draw_items_.size());
+      scene.bounds.reserve(draw_items_.size());
+      for(const auto& item : draw_items_)
+      {
+        scene.transforms.push_back(item.transform);
+        scene.bounds.push_back({item.transform[0], item.transform[1], item.transform[3], item.transform[2] * kTriangleRadius});
+      }
+      scene.mesh_ids.assign(draw_items_.size(), 0);
+      scene.meshes.push_back(MeshDraw{3, 0, 0, 0});
+      scene.indices = {0, 1, 2};
+
+      std::vector<uint32_t> families = {graphics_queue_index_};
+      if(compute_queue_index_ != kNoQueueFamily)
+      {
+        families.push_back(compute_queue_index_);
+      }
+
+      gpu_scene_ = std::make_unique<GpuDrivenScene>(device_.get(),
+                                                    *allocator_,
+                                                    *pipeline_manager_,
+                                                    caps_,
+                                                    render_pass_,
+                                                    msaa_samples_,
+                                                    min_sample_shading_,
+                                                    frame_set_layout_.get(),
+                                                    bindless_ ? bindless_->Layout() : vk::DescriptorSetLayout(),
+                                                    config_.shader_dir,
+                                                    config_.frames_in_flight,
+                                                    device_queue_,
+                                                    graphics_queue_index_,
+                                                    families,
+                                                    scene);
+      gpu_scene_->SetDepthBuffer(graph_->View(depth_target_), swapchain_extent_, depth_sampleable_, deletion_queue_, frame_index_);
+    }
+
+    end_stage(startup_timings_.render_targets_ms);
+
+    if(config_.log_startup)
+    {
+      LogStartup();
+    }
+  }
+
+  void Render()
+  {
+    using Clock = std::chrono::steady_clock;
+
+    if(!config_.headless && swapchain_dirty_ && !RecreateSwapchain())
+    {
+      return;
+    }
+
+    const auto frame_start = Clock::now();
+
+    const auto slot           = static_cast<uint32_t>(frame_index_ % frames_.size());
+    auto&      frame          = frames_[slot];
+    const auto command_buffer = frame.command_buffer.get();
+
+    /*
+      Wait for the GPU to finish the frame that last used this context.
+      With N frames in flight this only blocks when the CPU is N frames ahead.
+    */
+    if(config_.headless)
+    {
+      // The ring wrapped around: the oldest frame must leave the staging buffer before it is reused.
+      if(readback_completed_ + frames_.size() <= frame_index_)
+      {
+        DeliverReadback(frame);
+      }
+      // With a handoff, the buffer may still be out on loan from this or an earlier delivery.
+      WaitForReadbackLease(frame);
+    }
+    else
+    {
+      device_->waitForFences(frame.fence.get(), VK_TRUE, UINT64_MAX);
+    }
+    auto wait_end = Clock::now();
+    profiler_->RecordCpu("fence wait", frame_start, wait_end);
+
+    /*
+      Acquire before recycling anything, so an out-of-date swapchain can bail out
+      with the frame context untouched.
+    */
+    uint32_t image_index = 0;
+    if(!config_.headless)
+    {
+      const auto acquire_start = Clock::now();
+      try
+      {
+        const auto current_buffer = device_->acquireNextImageKHR(swapchain_.get(), UINT64_MAX, frame.image_available.get(), nullptr);
+        assert(current_buffer.value < images_in_flight_.size());
+        image_index = current_buffer.value;
+        // Suboptimal still signals the semaphore: render this frame, recreate before the next.
+        if(current_buffer.result == vk::Result::eSuboptimalKHR)
+        {
+          swapchain_dirty_ = true;
+        }
+      }
+      catch(const vk::OutOfDateKHRError&)
+      {
+        swapchain_dirty_ = true;
+        return;
+      }
+
+      // The swapchain can hand back an image that an older frame context is still rendering to.
+      const auto acquire_end = Clock::now();
+      if(images_in_flight_[image_index] && images_in_flight_[image_index] != frame.fence.get())
+      {
+        device_->waitForFences(images_in_flight_[image_index], VK_TRUE, UINT64_MAX);
+      }
+      images_in_flight_[image_index] = frame.fence.get();
+      wait_end += Clock::now() - acquire_end;
+      profiler_->RecordCpu("acquire", acquire_start, Clock::now());
+    }
+
+    // Whatever was released while the finished frames were in flight (resizes, pipeline reloads) goes now, in one batch.
+    deletion_queue_.Collect(CompletedFrames());
+    if(config_.hot_reload_shaders)
+    {
+      pipeline_manager_->ReloadChangedShaders(frame_index_);
+    }
+
+    // The context's queries are complete now; read them before they are reset.
+    profiler_->CollectFrame(slot);
+    if(gpu_scene_)
+    {
+      gpu_scene_->Collect(slot);
+    }
+
+    // The GPU is done with this context: recycle all of its command buffers at once.
+    device_->resetCommandPool(frame.command_pool.get(), vk::CommandPoolResetFlags());
+    if(frame.compute_command_pool)
+    {
+      device_->resetCommandPool(frame.compute_command_pool.get(), vk::CommandPoolResetFlags());
+    }
+    frame.upload_semaphores.clear();
+
+    // The context's region of the uniform ring is free again too. Nothing below allocates or calls the driver.
+    uniforms_->BeginFrame(slot);
+    frame.uniform_offset = static_cast<uint32_t>(uniforms_->Write(0, frame_uniforms_).offset);
+
+    const auto record_start = Clock::now();
+
+    // Write commands to CommandBuffer
+    auto command_buffer_begin_info = vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    command_buffer.begin(command_buffer_begin_info);
+    profiler_->BeginFrame(command_buffer, slot);
+
+    // Meshes finished on the transfer queue change hands here; the submit waits for their release.
+    if(mesh_streamer_)
+    {
+      frame.upload_semaphores = mesh_streamer_->Acquire(command_buffer);
+    }
+    // Texture mips staged since the last frame land, and cold ones go, before anything samples them.
+    if(texture_streamer_)
+    {
+      const auto textures = profiler_->BeginGpuScope(command_buffer, "textures");
+      texture_streamer_->Update(command_buffer, frame_index_, CompletedFrames());
+      profiler_->EndGpuScope(command_buffer, textures);
+    }
+    // Descriptor writes only, after the texture views this frame samples are final.
+    if(bindless_)
+    {
+      SyncBindlessTextures();
+      bindless_->Apply(slot);
+    }
+
+    // Until its pipelines have compiled, the GPU-driven path falls back to recording draws on the CPU.
+    const bool gpu_driven = gpu_scene_ && gpu_scene_->Ready();
+    const bool async_cull = gpu_driven && compute_queue_;
+    if(async_cull)
+    {
+      // Submitted to the compute queue ahead of this frame. Not timed: the profiler's queries live on the graphics queue.
+      const auto compute_command_buffer = frame.compute_command_buffer.get();
+      compute_command_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+      gpu_scene_->RecordCull(compute_command_buffer, slot, frame_uniforms_.camera);
+      compute_command_buffer.end();
+    }
+    else if(gpu_driven)
+    {
+      const auto cull = profiler_->BeginGpuScope(command_buffer, "cull");
+      gpu_scene_->RecordCull(command_buffer, slot, frame_uniforms_.camera);
+      profiler_->EndGpuScope(command_buffer, cull);
+    }
+
+    // main pass, depth pyramid and readback, with the barriers between them.
+    recording_ = GraphFrame{&frame, slot, gpu_driven};
+    graph_->Execute(command_buffer, image_index);
+
+    // End of writing to CommandBuffer
+    profiler_->EndFrame(command_buffer);
+    command_buffer.end();
+    profiler_->RecordCpu("record", record_start, Clock::now());
+
+    /*
+      submit commands
+    */
+    // Earlier frames not yet known to be complete, i.e. how deep the pipeline is. No driver call.
+    const auto gpu_busy = frame_index_ - CompletedFrames();
+
+    const auto submit_start = Clock::now();
+    uniforms_->Flush();
+    // Streamed chunks go first so this and later frames see them.
+    if(mesh_streamer_)
+    {
+      mesh_streamer_->Submit(device_queue_);
+    }
+
+    std::vector<vk::Semaphore>          wait_semaphores;
+    std::vector<vk::PipelineStageFlags> wait_stages;
+    std::vector<vk::Semaphore>          signal_semaphores;
+    if(!config_.headless)
+    {
+      wait_semaphores.push_back(frame.image_available.get());
+      wait_stages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+      signal_semaphores.push_back(swapchain_render_finished_[image_index].get());
+    }
+    for(const auto& semaphore : frame.upload_semaphores)
+    {
+      wait_semaphores.push_back(semaphore.get());
+      wait_stages.push_back(MeshStreamer::HandoffStages());
+    }
+
+    /*
+      Async cull
+      compute: waits for the previous frame's pyramid, culls, signals cull_finished
+      graphics: waits for cull_finished before the indirect draws, signals pyramid_built
+    */
+    if(async_cull)
+    {
+      const auto compute_command_buffer = frame.compute_command_buffer.get();
+      const auto wait_stage             = vk::PipelineStageFlags(vk::PipelineStageFlagBits::eComputeShader);
+      const auto compute_submit         = vk::SubmitInfo(pending_pyramid_ ? 1 : 0,
+                                                         &pending_pyramid_,
+                                                         &wait_stage,
+                                                         1,
+                                                         &compute_command_buffer,
+                                                         1,
+                                                         &frame.cull_finished.get());
+      compute_queue_.submit(compute_submit, nullptr);
+      pending_pyramid_ = nullptr;
+
+      wait_semaphores.push_back(frame.cull_finished.get());
+      // Compute too: this frame's pyramid build overwrites what the cull reads.
+      wait_stages.push_back(vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader);
+      signal_semaphores.push_back(frame.pyramid_built.get());
+    }
+
+    device_->resetFences(frame.fence.get());
+    const auto submit_info = vk::SubmitInfo(static_cast<uint32_t>(wait_semaphores.size()),
+                                            wait_semaphores.data(),
+                                            wait_stages.data(),
+                                            1,
+                                            &command_buffer,
+                                            static_cast<uint32_t>(signal_semaphores.size()),
+                                            signal_semaphores.data());
+    device_queue_.submit(submit_info, frame.fence.get());
+    profiler_->MarkSubmitted();
+    profiler_->RecordCpu("submit", submit_start, Clock::now());
+    if(async_cull)
+    {
+      pending_pyramid_ = frame.pyramid_built.get();
+    }
+
+    if(!config_.headless)
+    {
+      // Present
+      const auto present_start = Clock::now();
+      auto       present_info  = vk::PresentInfoKHR(1,
+                                                    &swapchain_render_finished_[image_index].get(),
+                                                    1,
+                                                    &swapchain_.get(),
+                                                    &image_index);
+      try
+      {
+        if(device_queue_.presentKHR(present_info) == vk::Result::eSuboptimalKHR)
+        {
+          swapchain_dirty_ = true;
+        }
+      }
+      catch(const vk::OutOfDateKHRError&)
+      {
+        swapchain_dirty_ = true;
+      }
+      profiler_->RecordCpu("present", present_start, Clock::now());
+    }
+
+    frame.frame_index = frame_index_++;
+
+    /*
+      Latency bound
+      Leave at most max_queued_frames frames on the GPU. Waiting here rather than at the top of
+      the next Render() means the caller samples input after the wait, not before it.
+      At max_queued_frames >= frames_in_flight the fence wait in Render() already gives the same bound.
+    */
+    const auto max_queued = config_.max_queued_frames;
+    if(max_queued > 0 && max_queued < frames_.size() && frame_index_ > max_queued)
+    {
+      const auto pacing_start = Clock::now();
+      const auto& oldest      = frames_[(frame_index_ - 1 - max_queued) % frames_.size()];
+      device_->waitForFences(oldest.fence.get(), VK_TRUE, UINT64_MAX);
+      const auto pacing_end = Clock::now();
+      profiler_->RecordCpu("pacing", pacing_start, pacing_end);
+      pipelining_stats_.wait_seconds += std::chrono::duration<double>(pacing_end - pacing_start).count();
+    }
+
+    const auto frame_end = Clock::now();
+    profiler_->RecordCpu("frame", frame_start, frame_end);
+    pipelining_stats_.frames        += 1;
+    pipelining_stats_.cpu_seconds   += std::chrono::duration<double>(frame_end - frame_start).count();
+    pipelining_stats_.wait_seconds  += std::chrono::duration<double>(wait_end - frame_start).count();
+    pipelining_stats_.gpu_busy_sum  += gpu_busy;
+  }
+
+  /*
+    Hand finished headless frames to the readback callback, oldest first.
+    Never blocks unless `wait` is set, in which case every in-flight frame is drained.
+    Returns the number of frames delivered.
+  */
+  uint32_t PollReadbacks(bool wait = false)
+  {
+    uint32_t delivered = 0;
+    while(readback_completed_ < frame_index_)
+    {
+      auto& frame = frames_[readback_completed_ % frames_.size()];
+      if(!wait && device_->getFenceStatus(frame.fence.get()) != vk::Result::eSuccess)
+      {
+        break;
+      }
+      DeliverReadback(frame);
+      ++delivered;
+    }
+    return delivered;
+  }
+
+  void SetReadbackCallback(ReadbackCallback callback) { readback_callback_ = std::move(callback); }
+
+  /*
+    Lend finished headless frames out instead of calling the ReadbackCallback: the handoff gets
+    the mapped readback buffer itself, and the frame context is not reused until it comes back.
+    Lets encoder threads work on frame N while the GPU renders N+1.. with no copy in between.
+  */
+  void SetReadbackHandoff(ReadbackHandoff handoff) { readback_handoff_ = std::move(handoff); }
+
+  uint64_t FrameCount() const { return frame_index_; }
+
+  const PipeliningStats& GetPipeliningStats() const { return pipelining_stats_; }
+
+  // Start the profiler percentiles, pipelining and command reuse stats over, e.g. after a warmup.
+  void ResetMeasurements()
+  {
+    profiler_->ResetSamples();
+    pipelining_stats_    = PipeliningStats();
+    command_reuse_stats_ = CommandReuseStats();
+  }
+
+  // Mark the swapchain for recreation, e.g. from a GLFW framebuffer size callback.
+  // Needed on platforms that never report out-of-date on resize.
+  void NotifyResized() { swapchain_dirty_ = true; }
+
+  // The mode actually in use after fallback.
+  vk::PresentModeKHR GetPresentMode() const { return present_mode_; }
+
+  uint32_t SwapchainRecreations() const { return swapchain_recreations_; }
+
+  /*
+    Re-record the main pass on the next frame of every context.
+    Call after changing anything the recorded draws depend on that Render() cannot see.
+    Pipeline swaps, the streamed scene becoming resident and swapchain rebuilds are tracked already.
+  */
+  void InvalidateRecordedPasses() { ++scene_generation_; }
+
+  const CommandReuseStats& GetCommandReuseStats() const { return command_reuse_stats_; }
+
+  DeletionQueueStats GetDeletionStats() const { return deletion_queue_.Stats(); }
+
+  // Constants for the next frames, copied into the uniform ring by each Render(). Never re-records a pass.
+  void SetFrameUniforms(const FrameUniforms& uniforms) { frame_uniforms_ = uniforms; }
+
+  UniformStats GetUniformStats() const
+  {
+    return UniformStats{uniforms_->RegionSize(), uniforms_->PeakBytes(), uniforms_->Overflows()};
+  }
+
+  /*
+    Orderly shutdown: let the GPU finish, then drain the deletion queue while the device and
+    the allocator still exist. The members go afterwards, in reverse declaration order.
+  */
+  ~VkRenderer()
+  {
+    // Leased readback buffers are still being read; they are freed below.
+    for(auto& frame : frames_)
+    {
+      WaitForReadbackLease(frame);
+    }
+    device_->waitIdle();
+    deletion_queue_.Flush();
+    for(auto& frame : frames_)
+    {
+      frame.readback_buffer.reset();
+      allocator_->Free(frame.readback_allocation);
+    }
+  }
+
+  AllocatorStats GetMemoryStats() const { return allocator_->Stats(); }
+
+  PipelineStats GetPipelineStats() const { return pipeline_manager_->Stats(); }
+  ShaderCacheStats GetShaderStats() const { return pipeline_manager_->ShaderStats(); }
+
+  const StartupTimings& GetStartupTimings() const { return startup_timings_; }
+
+  std::string DeviceName() const { return caps_.DeviceName(); }
+  const DeviceCapabilities& GetCapabilities() const { return caps_; }
+
+  // Whether culling / streaming run on their own queues (false when disabled or unsupported).
+  bool AsyncCompute() const { return static_cast<bool>(compute_queue_); }
+  bool DedicatedTransfer() const { return static_cast<bool>(transfer_queue_); }
+
+  // Whether draws go through the GPU culling path (false when unsupported or disabled).
+  bool GpuDriven() const { return static_cast<bool>(gpu_scene_); }
+  GpuDrivenStats GetGpuDrivenStats() const { return gpu_scene_ ? gpu_scene_->Stats() : GpuDrivenStats(); }
+
+  // Attachments owned by the render graph, after aliasing.
+  const GraphMemoryStats& GetRenderTargetStats() const { return graph_->MemoryStats(); }
+
+  // Samples per pixel of the main pass after clamping RendererConfig::msaa_samples, and whether each is shaded.
+  uint32_t MsaaSamples() const { return static_cast<uint32_t>(msaa_samples_); }
+  bool SampleShading() const { return min_sample_shading_ > 0.0f; }
+
+  // Null without RendererConfig::mesh_path. Poll `ready` / `failed` for the load's progress.
+  const StreamedMesh* GetStreamedScene() const { return streamed_scene_.get(); }
+
+  /*
+    Stream a .hkt texture. Its mips load as it is touched, within RendererConfig::texture_budget_bytes.
+    The streamer starts with the first texture; uploads are recorded into the frames on the graphics queue.
+  */
+  TextureHandle LoadTexture(const std::string& path)
+  {
+    if(!texture_streamer_)
+    {
+      texture_streamer_ = std::make_unique<TextureStreamer>(physical_device_,
+                                                            device_.get(),
+                                                            *allocator_,
+                                                            deletion_queue_,
+                                                            caps_,
+                                                            config_.texture_budget_bytes);
+    }
+    return texture_streamer_->Load(path);
+  }
+
+  // The texture is sampled in the next frame at `level` or coarser. Call before Render().
+  void TouchTexture(TextureHandle handle, uint32_t level = 0) { texture_streamer_->Touch(handle, level); }
+
+  TextureStats GetTextureStats() const { return texture_streamer_ ? texture_streamer_->Stats() : TextureStats(); }
+
+  // Null before the first LoadTexture().
+  const TextureStreamer* GetTextureStreamer() const { return texture_streamer_.get(); }
+
+  // Whether set 1 of the main pass layout is the bindless table (false when disabled or unsupported).
+  bool Bindless() const { return static_cast<bool>(bindless_); }
+  BindlessStats GetBindlessStats() const { return bindless_ ? bindless_->Stats() : BindlessStats(); }
+
+  /*
+    Index of the texture in the table's image array, kNoBindlessSlot until its first mips are resident.
+    Stable for the texture's lifetime: residency changes rewrite the slot, not move it.
+  */
+  uint32_t TextureSlot(TextureHandle handle) const
+  {
+    return handle < bindless_textures_.size() ? bindless_textures_[handle].slot : kNoBindlessSlot;
+  }
+  // The streamed textures' sampler in the table's sampler array.
+  uint32_t TextureSamplerSlot() const { return texture_sampler_slot_; }
+
+  const Profiler& GetProfiler() const { return *profiler_; }
+
+  // Block until the GPU has finished every submitted frame.
+  void WaitIdle() { device_->waitIdle(); }
+
+  // Block until every requested pipeline has compiled, e.g. before benchmarking.
+  void WaitForPipelines() { pipeline_manager_->WaitIdle(); }
+
+private:
+  // Secondary command buffers recorded by one job thread for one recorded pass.
+  struct ThreadCommandPool
+  {
+    vk::UniqueCommandPool                pool;
+    std::vector<vk::UniqueCommandBuffer> secondaries;
+    uint32_t                             used = 0;
+  };
+
+  // Everything a main pass recording bakes in besides the framebuffer. A recording is reused only while it matches.
+  struct MainPassKey
+  {
+    // PipelineManager::Version() rather than the vk::Pipeline: a hot reload may get a destroyed pipeline's handle value back.
+    uint32_t     triangle       = 0;
+    uint32_t     scene          = 0;               // 0 until the streamed scene is resident
+    uint32_t     uniform_offset = 0;               // the frame context's dynamic offset into the uniform ring
+    uint64_t     generation     = 0;               // scene_generation_ at record time
+    uint32_t     scene_image    = kNoBindlessSlot; // SceneMaterial(), pushed by the scene's draws
+
+    bool operator==(const MainPassKey& other) const
+    {
+      return triangle == other.triangle && scene == other.scene && uniform_offset == other.uniform_offset &&
+             generation == other.generation && scene_image == other.scene_image;
+    }
+  };
+
+  /*
+    The main pass's secondaries for one (frame context, framebuffer) pair.
+    Owning its pools means the entry can be reset in bulk without touching the other framebuffers' recordings.
+  */
+  struct RecordedPass
+  {
+    std::vector<ThreadCommandPool> thread_pools;
+    std::vector<vk::CommandBuffer> secondaries;
+    MainPassKey                    key;
+    bool                           valid = false;
+  };
+
+  struct FrameContext
+  {
+    vk::UniqueCommandPool   command_pool;
+    vk::UniqueCommandBuffer command_buffer;
+    vk::UniqueFence         fence;
+    vk::UniqueSemaphore     image_available;
+
+    // Async compute (only with a compute queue)
+    vk::UniqueCommandPool   compute_command_pool;
+    vk::UniqueCommandBuffer compute_command_buffer;
+    vk::UniqueSemaphore     cull_finished;
+    vk::UniqueSemaphore     pyramid_built;
+
+    // Streamed meshes acquired by this frame; released once its fence has signaled.
+    std::vector<vk::UniqueSemaphore> upload_semaphores;
+
+    // Main pass recordings, one per graph version (swapchain image)
+    std::vector<RecordedPass> recorded_passes;
+    // This frame's FrameUniforms in the uniform ring. The same every time the context comes round.
+    uint32_t                uniform_offset  = 0;
+    // The context's copy of the bindless table; null without one.
+    vk::DescriptorSet       bindless_set;
+
+    // Headless readback staging buffer
+    vk::UniqueBuffer        readback_buffer;
+    Allocation              readback_allocation;
+    size_t                  readback_size   = 0;
+    // Held while the buffer is lent out through a ReadbackHandoff
+    std::unique_ptr<ReadbackGate> readback_gate;
+
+    uint64_t                frame_index     = 0;
+  };
+
+  // A streamed texture's entry in the bindless table.
+  struct BindlessTexture
+  {
+    uint32_t slot    = kNoBindlessSlot;
+    uint32_t version = 0; // TextureStreamer::Version() the slot was last written with
+  };
+
+  // What the render graph's pass callbacks record for, set by Render() before Execute().
+  struct GraphFrame
+  {
+    FrameContext* frame      = nullptr;
+    uint32_t      slot       = 0;
+    bool          gpu_driven = false;
+  };
+
+  /*
+    Create the swapchain for the surface's current size.
+    When one already exists it is passed as oldSwapchain, so the presentation engine can
+    finish presenting its images while the new one takes over.
+  */
+  void CreateSwapchain()
+  {
+    // Get surface capabilities
+    surface_capabilities_ = physical_device_.getSurfaceCapabilitiesKHR(surface_.get());
+
+    /*
+      Get the surface size
+      そのまま currentExtent を使うと無効な値が入っていることがある
+    */
+    auto extent = surface_capabilities_.currentExtent;
+    if(extent.width == std::numeric_limits<uint32_t>::max())
+    {
+      // サーフェスサイズが未定義
+      // 自由にサイズを指定していいのでウィンドウのサイズにする
+      int width  = 0;
+      int height = 0;
+      glfwGetFramebufferSize(window_, &width, &height);
+      extent = vk::Extent2D(std::min(std::max(static_cast<uint32_t>(width), surface_capabilities_.minImageExtent.width),
+                                     surface_capabilities_.maxImageExtent.width),
+                            std::min(std::max(static_cast<uint32_t>(height), surface_capabilities_.minImageExtent.height),
+                                     surface_capabilities_.maxImageExtent.height));
+    }
+
+    // Mailbox needs a spare image to replace the queued one without blocking.
+    auto image_count = config_.swapchain_images;
+    if(image_count == 0)
+    {
+      image_count = surface_capabilities_.minImageCount + (present_mode_ == vk::PresentModeKHR::eMailbox ? 1 : 0);
+    }
+    image_count = std::max(image_count, surface_capabilities_.minImageCount);
+    if(surface_capabilities_.maxImageCount > 0)
+    {
+      image_count = std::min(image_count, surface_capabilities_.maxImageCount);
+    }
+
+    const auto transform    = (surface_capabilities_.supportedTransforms & vk::SurfaceTransformFlagBitsKHR::eIdentity)
+                              ? vk::SurfaceTransformFlagBitsKHR::eIdentity
+                              : surface_capabilities_.currentTransform;
+    const auto composite    = (surface_capabilities_.supportedCompositeAlpha & vk::CompositeAlphaFlagBitsKHR::ePreMultiplied)
+                                ? vk::CompositeAlphaFlagBitsKHR::ePreMultiplied
+                                : (surface_capabilities_.supportedCompositeAlpha & vk::CompositeAlphaFlagBitsKHR::ePostMultiplied)
+                                    ? vk::CompositeAlphaFlagBitsKHR::ePostMultiplied :
+                                      (surface_capabilities_.supportedCompositeAlpha & vk::CompositeAlphaFlagBitsKHR::eInherit)
+                                      ? vk::CompositeAlphaFlagBitsKHR::eInherit
+                                      : vk::CompositeAlphaFlagBitsKHR::eOpaque;
+    /*
+      Swapchain creation
+    */
+    auto ci = vk::SwapchainCreateInfoKHR(vk::SwapchainCreateFlagsKHR(),
+                                         surface_.get(),
+                                         image_count,
+                                         surface_format_.format,
+                                         surface_format_.colorSpace,
+                                         extent,
+                                         1,
+                                         vk::ImageUsageFlagBits::eColorAttachment,
+                                         vk::SharingMode::eExclusive,
+                                         0,
+                                         nullptr,
+                                         transform,
+                                         composite,
+                                         present_mode_,
+                                         true,
+                                         swapchain_.get());
+    auto swapchain = device_->createSwapchainKHRUnique(ci);
+    // Frames in flight may still render to the retired swapchain's images; its views and semaphores go before the swapchain itself.
+    if(swapchain_)
+    {
+      deletion_queue_.Defer(frame_index_,
+                            [views      = std::move(swapchain_image_views_),
+                             semaphores = std::move(swapchain_render_finished_),
+                             old        = std::move(swapchain_)]() mutable {
+                              views.clear();
+                              semaphores.clear();
+                              old.reset();
+                            });
+    }
+    swapchain_image_views_.clear();
+    swapchain_render_finished_.clear();
+    swapchain_        = std::move(swapchain);
+    swapchain_extent_ = extent;
+
+    /*
+      Create views for swapchain
+    */
+    const auto component_mapping = vk::ComponentMapping(vk::ComponentSwizzle::eR,
+                                                        vk::ComponentSwizzle::eG,
+                                                        vk::ComponentSwizzle::eB,
+                                                        vk::ComponentSwizzle::eA);
+    const auto subresource_range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    swapchain_images_ = device_->getSwapchainImagesKHR(swapchain_.get());
+    for(const auto& image : swapchain_images_)
+    {
+      const auto ci = vk::ImageViewCreateInfo(vk::ImageViewCreateFlags(),
+                                              image,
+                                              vk::ImageViewType::e2D,
+                                              surface_format_.format,
+                                              component_mapping,
+                                              subresource_range);
+      swapchain_image_views_.push_back(device_->createImageViewUnique(ci));
+      swapchain_render_finished_.push_back(device_->createSemaphoreUnique(vk::SemaphoreCreateInfo()));
+    }
+  }
+
+  // Size-dependent render graph objects for swapchain_extent_ and the current swapchain images.
+  void RealizeRenderTargets()
+  {
+    if(!config_.headless)
+    {
+      std::vector<vk::ImageView> views;
+      for(const auto& view : swapchain_image_views_)
+      {
+        views.push_back(view.get());
+      }
+      graph_->SetImported(color_target_, swapchain_images_, views);
+    }
+    graph_->Realize(swapchain_extent_);
+
+    // Which frame context's fence last used each swapchain image
+    images_in_flight_.assign(graph_->Versions(), vk::Fence());
+
+    // Recordings reference the old framebuffers and may be pending; their pools go once those frames finish.
+    for(auto& frame : frames_)
+    {
+      if(!frame.recorded_passes.empty())
+      {
+        deletion_queue_.Defer(frame_index_, [passes = std::move(frame.recorded_passes)]() mutable { passes.clear(); });
+      }
+      frame.recorded_passes.clear();
+      frame.recorded_passes.resize(graph_->Versions());
+    }
+  }
+
+  /*
+    Rebuild everything that depends on the surface size: swapchain, views and the render
+    graph's attachments and framebuffers. The device, render passes, pipelines and frame
+    contexts are kept. The old objects go to the deletion queue instead of draining the GPU.
+    Returns false while the window is minimized; Render() retries on the next call.
+  */
+  bool RecreateSwapchain()
+  {
+    int width  = 0;
+    int height = 0;
+    glfwGetFramebufferSize(window_, &width, &height);
+    if(width == 0 || height == 0)
+    {
+      return false;
+    }
+
+    graph_->Release(deletion_queue_, frame_index_);
+    CreateSwapchain();
+    RealizeRenderTargets();
+    if(gpu_scene_)
+    {
+      gpu_scene_->SetDepthBuffer(graph_->View(depth_target_), swapchain_extent_, depth_sampleable_, deletion_queue_, frame_index_);
+    }
+    swapchain_dirty_ = false;
+    ++swapchain_recreations_;
+    return true;
+  }
+
+  vk::CommandBuffer AcquireSecondary(ThreadCommandPool& thread_pool)
+  {
+    if(thread_pool.used == thread_pool.secondaries.size())
+    {
+      const auto ai = vk::CommandBufferAllocateInfo(thread_pool.pool.get(), vk::CommandBufferLevel::eSecondary, 1);
+      thread_pool.secondaries.push_back(std::move(device_->allocateCommandBuffersUnique(ai)[0]));
+    }
+    return thread_pool.secondaries[thread_pool.used++].get();
+  }
+
+  // Cached recordings are executed again on later frames, so they cannot be one-time-submit.
+  vk::CommandBufferUsageFlags SecondaryUsage() const
+  {
+    return config_.reuse_command_buffers
+             ? vk::CommandBufferUsageFlags(vk::CommandBufferUsageFlagBits::eRenderPassContinue)
+             : vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+  }
+
+  /*
+    Record the scene into secondary command buffers, draws_per_job draws per buffer.
+    Jobs run on the job system and use their own thread's pool, so no locking is needed.
+    The returned buffers are in draw order regardless of which thread recorded them.
+  */
+  std::vector<vk::CommandBuffer> RecordDraws(std::vector<ThreadCommandPool>& thread_pools,
+                                             vk::Framebuffer                 framebuffer,
+                                             vk::Pipeline                    pipeline,
+                                             const FrameContext&             frame)
+  {
+    if(!pipeline || draw_items_.empty())
+    {
+      return {};
+    }
+
+    const auto draws_per_job = std::max(1u, config_.draws_per_job);
+    const auto job_count     = static_cast<uint32_t>((draw_items_.size() + draws_per_job - 1) / draws_per_job);
+    std::vector<vk::CommandBuffer> secondaries(job_count);
+
+    jobs_->ParallelFor(job_count, [&](uint32_t job, uint32_t thread_index) {
+      const auto command_buffer = AcquireSecondary(thread_pools[thread_index]);
+
+      // Secondaries run inside the main pass's pipeline statistics query and must say so.
+      const auto inheritance = vk::CommandBufferInheritanceInfo(render_pass_,
+                                                                0,
+                                                                framebuffer,
+                                                                VK_FALSE,
+                                                                vk::QueryControlFlags(),
+                                                                profiler_->StatisticFlags());
+      command_buffer.begin(vk::CommandBufferBeginInfo(SecondaryUsage(), &inheritance));
+
+      const auto viewport = vk::Viewport(0.0f, 0.0f,
+                                         static_cast<float>(swapchain_extent_.width),
+                                         static_cast<float>(swapchain_extent_.height),
+                                         0.0f, 1.0f);
+      command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+      BindFrameSets(command_buffer, frame);
+      command_buffer.setViewport(0, viewport);
+      command_buffer.setScissor(0, vk::Rect2D(vk::Offset2D(0, 0), swapchain_extent_));
+
+      const auto begin = job * draws_per_job;
+      const auto end   = std::min<size_t>(begin + draws_per_job, draw_items_.size());
+      for(auto i = begin; i < end; ++i)
+      {
+        command_buffer.pushConstants(pipeline_layout_.get(), vk::ShaderStageFlagBits::eVertex, 0,
+                                     sizeof(DrawItem), &draw_items_[i]);
+        command_buffer.draw(3, 1, 0, 0);
+      }
+      command_buffer.end();
+
+      secondaries[job] = command_buffer;
+    });
+    return secondaries;
+  }
+
+  bool SceneReady() const
+  {
+    return streamed_scene_ && streamed_scene_->ready && pipeline_manager_->Get(mesh_pipeline_);
+  }
+
+  // The streamed scene's texture: the first streamed texture, kNoBindlessSlot until it is resident.
+  MaterialSlots SceneMaterial() const
+  {
+    MaterialSlots material;
+    if(TextureSlot(0) != kNoBindlessSlot)
+    {
+      material.image   = TextureSlot(0);
+      material.sampler = texture_sampler_slot_;
+    }
+    return material;
+  }
+
+  // Set 0 (uniforms at the frame's offset) and, when there is one, set 1 (the frame's bindless table).
+  void BindFrameSets(vk::CommandBuffer command_buffer, const FrameContext& frame) const
+  {
+    if(frame.bindless_set)
+    {
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout_.get(), 0,
+                                        {frame_set_, frame.bindless_set}, frame.uniform_offset);
+    }
+    else
+    {
+      command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline_layout_.get(), 0, frame_set_, frame.uniform_offset);
+    }
+  }
+
+  // One indexed draw per instance of the streamed scene. Does nothing until it is resident.
+  void RecordSceneDraws(vk::CommandBuffer command_buffer, const FrameContext& frame)
+  {
+    if(!SceneReady())
+    {
+      return;
+    }
+    const auto& scene = *streamed_scene_;
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline_manager_->Get(mesh_pipeline_));
+    BindFrameSets(command_buffer, frame);
+    command_buffer.setViewport(0, vk::Viewport(0.0f, 0.0f,
+                                               static_cast<float>(swapchain_extent_.width),
+                                               static_cast<float>(swapchain_extent_.height),
+                                               0.0f, 1.0f));
+    command_buffer.setScissor(0, vk::Rect2D(vk::Offset2D(0, 0), swapchain_extent_));
+    command_buffer.bindVertexBuffers(0, scene.vertex_buffer.get(), vk::DeviceSize(0));
+    command_buffer.bindIndexBuffer(scene.index_buffer.get(), 0, vk::IndexType::eUint32);
+    if(scene_textured_)
+    {
+      const auto material = SceneMaterial();
+      command_buffer.pushConstants(pipeline_layout_.get(), vk::ShaderStageFlagBits::eFragment, sizeof(DrawItem),
+                                   sizeof(material), &material);
+    }
+    for(const auto& instance : scene.instances)
+    {
+      const auto& mesh = scene.meshes[instance.mesh_id];
+      command_buffer.pushConstants(pipeline_layout_.get(), vk::ShaderStageFlagBits::eVertex, 0,
+                                   sizeof(instance.transform), instance.transform);
+      command_buffer.drawIndexed(mesh.index_count, 1, mesh.first_index, mesh.vertex_offset, 0);
+    }
+  }
+
+  // The CPU path draws the streamed scene from one extra secondary, after the test scene's.
+  vk::CommandBuffer RecordSceneSecondary(std::vector<ThreadCommandPool>& thread_pools,
+                                         vk::Framebuffer                 framebuffer,
+                                         const FrameContext&             frame)
+  {
+    // The jobs have finished, so the render thread may borrow the first thread's pool.
+    const auto command_buffer = AcquireSecondary(thread_pools[0]);
+    const auto inheritance    = vk::CommandBufferInheritanceInfo(render_pass_,
+                                                                 0,
+                                                                 framebuffer,
+                                                                 VK_FALSE,
+                                                                 vk::QueryControlFlags(),
+                                                                 profiler_->StatisticFlags());
+    command_buffer.begin(vk::CommandBufferBeginInfo(SecondaryUsage(), &inheritance));
+    RecordSceneDraws(command_buffer, frame);
+    command_buffer.end();
+    return command_buffer;
+  }
+
+  /*
+    The main pass's secondaries for this frame, re-recorded only when stale.
+    Entries are per frame context as well as per framebuffer: the context's fence has been
+    waited on, so none of its recordings is pending and each can be reset or executed again
+    without SIMULTANEOUS_USE.
+  */
+  const std::vector<vk::CommandBuffer>& RecordedMainPass(RecordedPass&       recorded,
+                                                        vk::Framebuffer     framebuffer,
+                                                        const FrameContext& frame)
+  {
+    // Versions first: what gets recorded below is then at least as new as the key says.
+    const auto key = MainPassKey{pipeline_manager_->Version(triangle_pipeline_),
+                                 SceneReady() ? pipeline_manager_->Version(mesh_pipeline_) : 0,
+                                 frame.uniform_offset,
+                                 scene_generation_,
+                                 scene_textured_ ? SceneMaterial().image : kNoBindlessSlot};
+    if(config_.reuse_command_buffers && recorded.valid && recorded.key == key)
+    {
+      ++command_reuse_stats_.hits;
+      return recorded.secondaries;
+    }
+    ++command_reuse_stats_.misses;
+
+    if(recorded.thread_pools.empty())
+    {
+      // Long-lived, unlike the frame contexts' pools: recordings survive many frames.
+      const auto pool_ci = vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlags(), graphics_queue_index_);
+      recorded.thread_pools.resize(jobs_->ThreadCount());
+      for(auto& thread_pool : recorded.thread_pools)
+      {
+        thread_pool.pool = device_->createCommandPoolUnique(pool_ci);
+      }
+    }
+    for(auto& thread_pool : recorded.thread_pools)
+    {
+      if(thread_pool.used > 0)
+      {
+        device_->resetCommandPool(thread_pool.pool.get(), vk::CommandPoolResetFlags());
+        thread_pool.used = 0;
+      }
+    }
+
+    recorded.secondaries = RecordDraws(recorded.thread_pools, framebuffer, pipeline_manager_->Get(triangle_pipeline_), frame);
+    if(key.scene)
+    {
+      recorded.secondaries.push_back(RecordSceneSecondary(recorded.thread_pools, framebuffer, frame));
+    }
+    recorded.key   = key;
+    recorded.valid = true;
+    return recorded.secondaries;
+  }
+
+  // The render graph's main pass. Runs inside graph_->Execute(), for the frame in recording_.
+  void RecordMainPass(vk::CommandBuffer command_buffer, const GraphPassContext& context)
+  {
+    auto&      frame     = *recording_.frame;
+    const auto main_pass = profiler_->BeginGpuScope(command_buffer, "main pass");
+    profiler_->BeginStatistics(command_buffer);
+    if(recording_.gpu_driven)
+    {
+      // A few indirect commands, recorded inline.
+      command_buffer.beginRenderPass(context.begin, vk::SubpassContents::eInline);
+      gpu_scene_->RecordDraws(command_buffer, recording_.slot, context.extent, frame_set_, frame.uniform_offset,
+                              frame.bindless_set);
+      RecordSceneDraws(command_buffer, frame);
+    }
+    else
+    {
+      // Draws are recorded into secondary buffers in parallel, once per framebuffer while nothing
+      // changes; the primary only stitches them.
+      command_buffer.beginRenderPass(context.begin, vk::SubpassContents::eSecondaryCommandBuffers);
+      const auto& secondaries = RecordedMainPass(frame.recorded_passes[context.version],
+                                                 context.begin.framebuffer,
+                                                 frame);
+      if(!secondaries.empty())
+      {
+        command_buffer.executeCommands(secondaries);
+      }
+    }
+    command_buffer.endRenderPass();
+    profiler_->EndStatistics(command_buffer);
+    profiler_->EndGpuScope(command_buffer, main_pass);
+  }
+
+  void RecordReadback(vk::CommandBuffer command_buffer, FrameContext& frame)
+  {
+    // The graph leaves the image in TransferSrcOptimal for this pass.
+    const auto region = vk::BufferImageCopy(0,
+                                            0,
+                                            0,
+                                            vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+                                            vk::Offset3D(0, 0, 0),
+                                            vk::Extent3D(swapchain_extent_.width, swapchain_extent_.height, 1));
+    command_buffer.copyImageToBuffer(graph_->Image(color_target_), vk::ImageLayout::eTransferSrcOptimal, frame.readback_buffer.get(), region);
+
+    // Make the copy visible to the host once the fence signals.
+    const auto barrier = vk::BufferMemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                                                 vk::AccessFlagBits::eHostRead,
+                                                 VK_QUEUE_FAMILY_IGNORED,
+                                                 VK_QUEUE_FAMILY_IGNORED,
+                                                 frame.readback_buffer.get(),
+                                                 0,
+                                                 VK_WHOLE_SIZE);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eHost,
+                                   vk::DependencyFlags(),
+                                   nullptr,
+                                   barrier,
+                                   nullptr);
+  }
+
+  void LogStartup() const
+  {
+    std::stringstream ss;
+    ss << "Device: " << caps_.DeviceName() << " (score " << caps_.score << ")" << std::endl;
+    ss << "Instance extensions:";
+    for(const auto name : instance_caps_.extensions)
+    {
+      ss << " " << name;
+    }
+    ss << std::endl << "Device extensions:";
+    for(const auto name : caps_.extensions)
+    {
+      ss << " " << name;
+    }
+    ss << std::endl;
+    ss << "Queues: graphics family " << graphics_queue_index_;
+    if(compute_queue_)
+    {
+      ss << ", async compute family " << compute_queue_index_;
+    }
+    if(transfer_queue_)
+    {
+      ss << ", transfer family " << transfer_queue_index_;
+    }
+    ss << std::endl;
+    const auto& g = graph_->MemoryStats();
+    ss << "Render targets: " << g.images << " images (" << g.transient_images << " transient), "
+       << (g.bytes >> 10) << " KiB in " << g.memory_slots << " allocations"
+       << " (" << (g.unaliased_bytes >> 10) << " KiB unaliased, " << (g.lazy_bytes >> 10) << " KiB lazily allocated)"
+       << std::endl;
+    const auto& t = startup_timings_;
+    ss << "Startup: " << t.TotalMs() << " ms"
+       << " (instance " << t.instance_ms
+       << ", device " << t.device_ms
+       << ", frame resources " << t.frame_resources_ms
+       << ", swapchain " << t.swapchain_ms
+       << ", render targets " << t.render_targets_ms << ")" << std::endl;
+    std::clog << ss.str();
+  }
+
+  /*
+    Point each streamed texture's slot at its current view. A texture takes its slot with its first
+    resident mips and keeps it; residency changes only rewrite it, which reaches each frame
+    context's set through BindlessTable::Apply() while older frames keep sampling the old view.
+  */
+  void SyncBindlessTextures()
+  {
+    if(!texture_streamer_)
+    {
+      return;
+    }
+    if(texture_sampler_slot_ == kNoBindlessSlot)
+    {
+      texture_sampler_slot_ = bindless_->AddSampler(texture_streamer_->Sampler());
+    }
+    bindless_textures_.resize(texture_streamer_->Count());
+    for(TextureHandle handle = 0; handle < bindless_textures_.size(); ++handle)
+    {
+      auto&      entry   = bindless_textures_[handle];
+      const auto view    = texture_streamer_->View(handle);
+      const auto version = texture_streamer_->Version(handle);
+      if(!view || version == entry.version)
+      {
+        continue;
+      }
+      if(entry.slot == kNoBindlessSlot)
+      {
+        entry.slot = bindless_->AddImage(view);
+      }
+      else
+      {
+        bindless_->UpdateImage(entry.slot, view);
+      }
+      entry.version = version;
+    }
+  }
+
+  /*
+    Number of frames the GPU is known to have finished (frames 0 .. n-1).
+    Valid after Render()'s fence wait: the context being reused ran frame frame_index_ - frames_.size().
+  */
+  uint64_t CompletedFrames() const
+  {
+    if(config_.headless)
+    {
+      return readback_completed_;
+    }
+    return frame_index_ + 1 > frames_.size() ? frame_index_ + 1 - frames_.size() : 0;
+  }
+
+  void DeliverReadback(FrameContext& frame)
+  {
+    device_->waitForFences(frame.fence.get(), VK_TRUE, UINT64_MAX);
+    allocator_->Invalidate(frame.readback_allocation);
+    if(readback_handoff_)
+    {
+      {
+        std::lock_guard<std::mutex> lock(frame.readback_gate->mutex);
+        frame.readback_gate->leased = true;
+      }
+      readback_handoff_(ReadbackLease(frame.readback_gate.get(),
+                                      frame.frame_index,
+                                      frame.readback_allocation.mapped,
+                                      frame.readback_size,
+                                      swapchain_extent_));
+    }
+    else if(readback_callback_)
+    {
+      readback_callback_(frame.frame_index, frame.readback_allocation.mapped, frame.readback_size);
+    }
+    ++readback_completed_;
+  }
+
+  // Block until the context's readback buffer is back from its lease. Free when nothing holds it.
+  void WaitForReadbackLease(FrameContext& frame)
+  {
+    if(!frame.readback_gate)
+    {
+      return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(frame.readback_gate->mutex);
+    if(!frame.readback_gate->leased)
+    {
+      return;
+    }
+    frame.readback_gate->released.wait(lock, [&frame] { return !frame.readback_gate->leased; });
+    lock.unlock();
+    profiler_->RecordCpu("readback lease", start, std::chrono::steady_clock::now());
+  }
+
+  RendererConfig                            config_;
+  GLFWwindow*                               window_ = nullptr;
+  StartupTimings                            startup_timings_;
+
+  InstanceCapabilities                      instance_caps_;
+  vk::UniqueInstance                        instance_;
+  vk::UniqueDebugReportCallbackEXT          debug_report_;
+  DeviceCapabilities                        caps_;
+  vk::PhysicalDevice                        physical_device_;
+  vk::PhysicalDeviceMemoryProperties        physical_device_memory_properties_;
+  uint32_t                                  graphics_queue_index_;
+  uint32_t                                  compute_queue_index_  = kNoQueueFamily;
+  uint32_t                                  transfer_queue_index_ = kNoQueueFamily;
+  vk::UniqueDevice                          device_;
+  vk::Queue                                 device_queue_;
+  vk::Queue                                 compute_queue_;  // render thread only
+  vk::Queue                                 transfer_queue_; // owned by the mesh streamer's thread
+  std::unique_ptr<DeviceAllocator>          allocator_;
+  // Declared before everything that releases into it, so it outlives them; drained by ~VkRenderer().
+  DeletionQueue                             deletion_queue_;
+
+  std::unique_ptr<JobSystem>                jobs_;
+  std::unique_ptr<Profiler>                 profiler_;
+  std::unique_ptr<UniformRing>              uniforms_;
+  vk::UniqueDescriptorSetLayout             frame_set_layout_;
+  vk::UniqueDescriptorPool                  frame_descriptor_pool_;
+  vk::DescriptorSet                         frame_set_; // freed with the pool
+  std::unique_ptr<BindlessTable>            bindless_;
+  std::vector<FrameContext>                 frames_;
+  std::vector<vk::Fence>                    images_in_flight_;
+  uint64_t                                  frame_index_ = 0;
+  PipeliningStats                           pipelining_stats_;
+  // Bumped by InvalidateRecordedPasses(); recordings from an older generation are stale.
+  uint64_t                                  scene_generation_ = 0;
+  CommandReuseStats                         command_reuse_stats_;
+  FrameUniforms                             frame_uniforms_;
+  // Signaled by the last graphics submission, not yet waited on by the next async cull.
+  vk::Semaphore                             pending_pyramid_;
+
+  vk::UniqueSurfaceKHR                      surface_;
+  vk::SurfaceFormatKHR                      surface_format_;
+  vk::SurfaceCapabilitiesKHR                surface_capabilities_;
+  vk::Format                                color_format_;
+  vk::PresentModeKHR                        present_mode_ = vk::PresentModeKHR::eFifo;
+  vk::UniqueSwapchainKHR                    swapchain_;
+  vk::Extent2D                              swapchain_extent_;
+  bool                                      swapchain_dirty_       = false;
+  uint32_t                                  swapchain_recreations_ = 0;
+  std::vector<vk::Image>                    swapchain_images_;
+  std::vector<vk::UniqueImageView>          swapchain_image_views_;
+  /*
+    Signaled by the submit, waited on by present. One per image rather than per frame context:
+    the frame fence does not cover present's wait, but acquiring the image again does.
+  */
+  std::vector<vk::UniqueSemaphore>          swapchain_render_finished_;
+
+  // Owns the attachments, render passes and framebuffers.
+  std::unique_ptr<RenderGraph>              graph_;
+  GraphResource                             color_target_       = kNoGraphResource;
+  GraphResource                             depth_target_       = kNoGraphResource;
+  GraphResource                             msaa_color_target_  = kNoGraphResource; // with MSAA only
+  vk::SampleCountFlagBits                   msaa_samples_       = vk::SampleCountFlagBits::e1;
+  float                                     min_sample_shading_ = 0.0f;
+  GraphPass                                 main_pass_          = 0;
+  GraphFrame                                recording_;
+  bool                                      depth_sampleable_   = false;
+
+  vk::RenderPass                            render_pass_; // graph_'s main pass
+  vk::UniquePipelineLayout                  pipeline_layout_;
+  std::unique_ptr<PipelineManager>          pipeline_manager_;
+  PipelineHandle                            triangle_pipeline_ = 0;
+  std::vector<DrawItem>                     draw_items_;
+  std::unique_ptr<GpuDrivenScene>           gpu_scene_;
+  PipelineHandle                            mesh_pipeline_ = 0;
+  bool                                      scene_textured_ = false; // mesh_pipeline_ is TexturedMeshPipeline
+  std::unique_ptr<MeshStreamer>             mesh_streamer_;
+  std::shared_ptr<StreamedMesh>             streamed_scene_;
+  std::unique_ptr<TextureStreamer>          texture_streamer_;
+  // Table slot of each streamed texture and the view version it holds, indexed by TextureHandle.
+  std::vector<BindlessTexture>              bindless_textures_;
+  uint32_t                                  texture_sampler_slot_ = kNoBindlessSlot;
+
+  // Headless rendering
+  uint64_t                                  readback_completed_ = 0;
+  ReadbackCallback                          readback_callback_;
+  ReadbackHandoff                           readback_handoff_;
+};
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include "vulkan.hpp"
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+#include "deletion_queue.h"
+#include "frame_writer.h"
+#include "memory_allocator.h"
+
+/*
+  hikari_test
+
+  CPU-side bookkeeping that needs no Vulkan device: block placement, the staging ring,
+  deferred destruction order and the PNG encoder. Run by ctest; exits non-zero on failure.
+*/
+
+namespace
+{
+int failures = 0;
+
+#define CHECK(condition)                                                                     \
+  do                                                                                         \
+  {                                                                                          \
+    if(!(condition))                                                                         \
+    {                                                                                        \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+      ++failures;                                                                            \
+    }                                                                                        \
+  } while(false)
+
+MemoryBlock EmptyBlock(vk::DeviceSize size)
+{
+  MemoryBlock block;
+  block.size      = size;
+  block.chunks[0] = MemoryBlock::Chunk{size, 0, true, ResourceKind::eLinear};
+  return block;
+}
+
+// Freed neighbours merge back into one chunk, whichever order they go in.
+void TestBlockCoalesce()
+{
+  auto           block        = EmptyBlock(1024);
+  vk::DeviceSize chunk_offset = 0;
+  vk::DeviceSize offsets[3]   = {};
+  for(auto& offset : offsets)
+  {
+    CHECK(block.Place(256, 1, ResourceKind::eLinear, 1, &chunk_offset, &offset));
+  }
+  CHECK(offsets[0] == 0 && offsets[1] == 256 && offsets[2] == 512);
+  CHECK(block.chunks.size() == 4);
+  CHECK(block.used == 768);
+
+  block.Release(offsets[1]);
+  CHECK(block.chunks.size() == 4); // used neighbours on both sides
+  block.Release(offsets[0]);
+  CHECK(block.chunks.size() == 3);
+  CHECK(block.chunks.at(0).free && block.chunks.at(0).size == 512);
+  block.Release(offsets[2]);
+  CHECK(block.chunks.size() == 1);
+  CHECK(block.chunks.at(0).free && block.chunks.at(0).size == 1024);
+  CHECK(block.used == 0);
+
+  // The freed space is found again by first fit.
+  vk::DeviceSize offset = 0;
+  CHECK(block.Place(1024, 1, ResourceKind::eLinear, 1, &chunk_offset, &offset));
+  CHECK(offset == 0);
+}
+
+// Linear and optimal resources never share a bufferImageGranularity page.
+void TestBlockGranularity()
+{
+  auto           block        = EmptyBlock(4096);
+  vk::DeviceSize chunk_offset = 0;
+  vk::DeviceSize linear       = 0;
+  vk::DeviceSize optimal      = 0;
+  CHECK(block.Place(100, 4, ResourceKind::eLinear, 1024, &chunk_offset, &linear));
+  CHECK(block.Place(100, 4, ResourceKind::eOptimal, 1024, &chunk_offset, &optimal));
+  CHECK(linear == 0);
+  CHECK(optimal == 1024);
+  CHECK(chunk_offset == 100);
+  CHECK(block.Release(chunk_offset) == 1024 - 100);
+}
+
+void TestRingWrap()
+{
+  RingCursor ring(1024);
+  ring.BeginFrame(0);
+  CHECK(ring.Allocate(400) == 0);
+  ring.BeginFrame(1);
+  CHECK(ring.Allocate(400) == 400);
+
+  // The 224-byte tail is too small, and wrapping would overwrite frame 0.
+  ring.BeginFrame(2);
+  CHECK(ring.Allocate(400) == RingCursor::kNoSpace);
+  CHECK(ring.Used() == 800);
+
+  // Once frame 0 retires the allocation wraps, and the skipped tail counts as used.
+  ring.Retire(0);
+  CHECK(ring.Used() == 400);
+  CHECK(ring.Allocate(400) == 0);
+  CHECK(ring.Used() == 1024);
+
+  // The tail is given back with the frame that skipped it.
+  ring.Retire(1);
+  CHECK(ring.Used() == 624);
+  ring.Retire(2);
+  CHECK(ring.Used() == 0);
+}
+
+// An empty ring starts over at offset 0 instead of wrapping, so large requests cannot starve.
+void TestRingRewind()
+{
+  RingCursor ring(1024);
+  ring.BeginFrame(0);
+  CHECK(ring.Allocate(600) == 0);
+  ring.Retire(0);
+  CHECK(ring.Used() == 0);
+
+  for(uint64_t frame = 1; frame < 8; ++frame)
+  {
+    ring.BeginFrame(frame);
+    CHECK(ring.Allocate(600) == 0);
+    CHECK(ring.Used() == 600);
+    ring.Retire(frame);
+  }
+}
+
+void TestDeletionQueueOrder()
+{
+  DeletionQueue    queue;
+  std::vector<int> destroyed;
+  queue.Defer(1, [&destroyed] { destroyed.push_back(1); });
+  queue.Defer(2, [&destroyed] { destroyed.push_back(2); });
+  queue.Defer(2, [&destroyed] { destroyed.push_back(3); });
+  queue.Defer(4, [&destroyed] { destroyed.push_back(4); });
+
+  CHECK(queue.Collect(0) == 0);
+  CHECK(queue.Collect(2) == 3);
+  CHECK((destroyed == std::vector<int>{1, 2, 3}));
+  CHECK(queue.Pending() == 1);
+  CHECK(queue.Collect(3) == 0);
+
+  queue.Flush();
+  CHECK((destroyed == std::vector<int>{1, 2, 3, 4}));
+  CHECK(queue.Pending() == 0);
+  CHECK(queue.Stats().batches == 2);
+}
+
+uint32_t ReadBigEndian(const std::vector<uint8_t>& data, size_t offset)
+{
+  return (uint32_t(data[offset]) << 24) | (uint32_t(data[offset + 1]) << 16) | (uint32_t(data[offset + 2]) << 8) |
+         uint32_t(data[offset + 3]);
+}
+
+void TestEncodePng()
+{
+  const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  CHECK(Crc32(check, sizeof(check)) == 0xcbf43926u);
+
+  const uint8_t        rgba[2 * 2 * 4] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+  std::vector<uint8_t> png;
+  EncodePng(rgba, 2, 2, png);
+
+  const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  CHECK(png.size() > 8 && std::equal(signature, signature + 8, png.begin()));
+
+  // Every chunk's CRC covers its type and data; the last one is IEND.
+  size_t      offset = 8;
+  std::string last_type;
+  while(offset + 12 <= png.size())
+  {
+    const auto length = ReadBigEndian(png, offset);
+    if(offset + 12 + length > png.size())
+    {
+      CHECK(!"chunk runs past the end of the file");
+      break;
+    }
+    last_type.assign(png.begin() + offset + 4, png.begin() + offset + 8);
+    CHECK(Crc32(png.data() + offset + 4, length + 4) == ReadBigEndian(png, offset + 8 + length));
+    if(last_type == "IHDR")
+    {
+      CHECK(ReadBigEndian(png, offset + 8) == 2 && ReadBigEndian(png, offset + 12) == 2);
+    }
+    offset += 12 + length;
+  }
+  CHECK(offset == png.size());
+  CHECK(last_type == "IEND");
+}
+} // namespace
+
+int main()
+{
+  TestBlockCoalesce();
+  TestBlockGranularity();
+  TestRingWrap();
+  TestRingRewind();
+  TestDeletionQueueOrder();
+  TestEncodePng();
+
+  if(failures > 0)
+  {
+    std::cerr << failures << " check(s) failed." << std::endl;
+    return 1;
+  }
+  std::cout << "All checks passed." << std::endl;
+  return 0;
+}